@@ -347,9 +347,37 @@ class TextFramePerformanceVC : UIViewController, UIPopoverPresentationController
     let zh:   [NSAttributedString.Key: AnyObject] = [.font: zhFont,   .paragraphStyle: ltrParaStyle]
     let ar:   [NSAttributedString.Key: AnyObject] = [.font: arFont,   .paragraphStyle: rtlParaStyle]
 
+    func enWithLineBreakMode(_ mode: NSLineBreakMode) -> [NSAttributedString.Key: AnyObject] {
+      let style = paragraphStyle({ b in
+                    b.baseWritingDirection = .leftToRight
+                    b.lineBreakMode = mode
+                  })
+      return en.updated(with: style, forKey: .paragraphStyle)
+    }
+    let enHeadTruncated   = enWithLineBreakMode(.byTruncatingHead)
+    let enMiddleTruncated = enWithLineBreakMode(.byTruncatingMiddle)
+    let enTailTruncated   = enWithLineBreakMode(.byTruncatingTail)
+
+    let url = "https://www.example.com/documentation/text-layout/truncation/line-truncation-and-hyphenation?language=swift&platform=ios&changes=latest_minor#truncation-tokens"
+    let path = "/private/var/mobile/Containers/Data/Application/5C6F2D3B-8A3E-4F41-9D51-3F5E0C2F7A11/Library/Caches/Downloads/Reports/2018/Quarterly Summary (Final Revision).pdf"
+
     let enUnderlined = en.updated(with: NSUnderlineStyle.single.rawValue as NSNumber,
                                   forKey: .underlineStyle)
 
+    // A list of underlined words with many descender gaps, similar to a list of links.
+    let enLinkList: NSAttributedString = {
+      let string = NSMutableAttributedString()
+      for (i, word) in ["Apple", "typography", "gyroscope", "jump", "quality", "pygmy", "yoga",
+                        "kerning", "glyph"].enumerated()
+      {
+        if i > 0 {
+          string.append(NSAttributedString(" · ", en))
+        }
+        string.append(NSAttributedString(word, enUnderlined))
+      }
+      return string
+    }()
+
     let zhUnderlined = zh.updated(with: NSUnderlineStyle.single.rawValue as NSNumber,
                                   forKey: .underlineStyle)
 
@@ -375,10 +403,28 @@ class TextFramePerformanceVC : UIViewController, UIPopoverPresentationController
                                   en15),
                width: 258, height: ceil(en15LineHeight*2) + 2, needsTruncation: true),
 
+      TestCase(title: "Start-truncated URL",
+               NSAttributedString(url, enHeadTruncated),
+               width: 250, height: ceil(enLineHeight) + 1, needsTruncation: true),
+
+      TestCase(title: "Middle-truncated URL",
+               NSAttributedString(url, enMiddleTruncated),
+               width: 250, height: ceil(enLineHeight) + 1, needsTruncation: true),
+
+      TestCase(title: "End-truncated URL",
+               NSAttributedString(url, enTailTruncated),
+               width: 250, height: ceil(enLineHeight) + 1, needsTruncation: true),
+
+      TestCase(title: "Middle-truncated file path",
+               NSAttributedString(path, enMiddleTruncated),
+               width: 250, height: ceil(enLineHeight) + 1, needsTruncation: true),
 
       TestCase(title: "Short underlined English text",
                NSAttributedString("John Appleseed", enUnderlined)),
 
+      TestCase(title: "Densely underlined English text",
+               enLinkList, width: 250),
+
       TestCase(title: "Short Chinese text",
                NSAttributedString("简短的中文文本", zh)),
 
@@ -12,6 +12,10 @@ class DrawingContext;
 
 struct StyledGlyphSpan;
 
+/// The properties of a decoration line except for its x-range. The decoration lines of a text
+/// line are stored in a structure-of-arrays layout, with the x-ranges in a separate array, so
+/// that the clip, merge and gap subtraction passes can sweep over the x-ranges without loading the
+/// other line properties.
 struct DecorationLine {
   struct OffsetAndThickness {
     /// The LLO Y-offset from the baseline to the center of the line.
@@ -28,7 +32,9 @@ struct DecorationLine {
                                                LocalFontInfoCache&);
   };
 
-  Rect<CGFloat> rectLLO() const { return {x, {offsetLLO + Range{-thickness/2, thickness/2}}}; }
+  Rect<CGFloat> rectLLO(Range<CGFloat> x) const {
+    return {x, {offsetLLO + Range{-thickness/2, thickness/2}}};
+  }
 
   OffsetAndThickness offsetAndThickness() const {
     return {.offsetLLO = offsetLLO,
@@ -36,7 +42,6 @@ struct DecorationLine {
             .unroundedThickness = unroundedThickness};
   }
 
-  Range<CGFloat> x;
   CGFloat fullLineXStart;
   /// The offset rounded for the drawing context display scale.
   CGFloat offsetLLO;
@@ -56,9 +61,57 @@ struct DecorationLine {
   const TextStyle::ShadowInfo * __nullable shadowInfo;
 };
 
+struct OnlyDoubleLines : Parameter<OnlyDoubleLines> { using Parameter::Parameter; };
+
+/// The parts of a sequence of decoration lines that remain after the descender gaps have been
+/// subtracted, in a structure-of-arrays layout.
+struct DecorationLineSegments {
+  /// The x-ranges of the segments, in the order of the decoration lines.
+  TempArray<Range<CGFloat>> xs;
+  /// The index of the decoration line that each segment belongs to.
+  TempArray<Int> lineIndices;
+
+  /// Subtracts the gaps from the lines in a single linear sweep over both arrays.
+  ///
+  /// @pre The lines must be sorted by x and must not overlap, and the gaps must be sorted and
+  ///      disjoint (like the intervals of a SortedIntervalBuffer).
+  ///
+  /// @pre lineXs.count() == lines.count()
+  static DecorationLineSegments subtractGaps(ArrayRef<const Range<CGFloat>> lineXs,
+                                             ArrayRef<const DecorationLine> lines,
+                                             ArrayRef<const Range<CGFloat>> gaps,
+                                             OnlyDoubleLines onlyDoubleLines);
+};
+
+/// A filled rect of a solid decoration line, relative to the line origin.
+struct DecorationRect {
+  Rect<CGFloat> rectLLO;
+  ColorIndex colorIndex;
+  const TextStyle::ShadowInfo* __nullable shadowInfo;
+};
+
+/// Draws the shadows of the rects and then the rects, filling adjacent rects with the same color
+/// with a single CGContextFillRects call.
+void drawDecorationRectsLLO(ArrayRef<const DecorationRect>, DrawingContext&);
+
 struct TextFrameLine;
 
+/// Removes the lines that don't intersect the clip rect (taking into account their shadows) and
+/// merges continued underlines with the same color and shadow into the preceding line.
+///
+/// The clip test is first done for the bounds of all lines, which usually are fully contained in
+/// the clip rect, so that the per-line test is only needed when some lines are clipped. The lines
+/// are then compacted in a single sweep over both arrays.
+///
+/// @pre xs.count() == lines.count()
+/// @pre boundsLLO contains the rects and shadow bounds of all lines.
+void removeLinePartsNotIntersectingClipRectAndMergeIdenticallyStyledAdjacentUnderlines(
+       TempVector<Range<CGFloat>>& xs, TempVector<DecorationLine>& lines,
+       const Rect<CGFloat>& boundsLLO, const Rect<CGFloat>& clipRect);
+
 struct Underlines {
+  /// The x-ranges of the lines.
+  TempArray<Range<CGFloat>> xs;
   TempArray<DecorationLine> lines;
   TempArray<Range<CGFloat>> lowerLinesGaps;
   TempArray<Range<CGFloat>> upperLinesGaps;
@@ -73,15 +126,29 @@ struct Underlines {
                                       const Optional<DisplayScale>&, LocalFontInfoCache&);
 
   void drawLLO(DrawingContext&) const;
+
+  /// Appends the rects that drawLLO would fill, in the same order. Returns false if any of the
+  /// lines is patterned, i.e. has to be stroked.
+  ///
+  /// @pre The underlines were found with a drawing context that has a display scale.
+  bool appendRectsLLO(TempVector<DecorationRect>&) const;
 };
 
 struct Strikethroughs {
+  /// The x-ranges of the lines.
+  TempArray<Range<CGFloat>> xs;
   TempArray<DecorationLine> lines;
   bool hasShadow;
 
   static Strikethroughs find(const TextFrameLine& line, DrawingContext& context);
 
   void drawLLO(DrawingContext&) const;
+
+  /// Appends the rects that drawLLO would fill, in the same order. Returns false if any of the
+  /// lines is patterned, i.e. has to be stroked.
+  ///
+  /// @pre The strikethroughs were found with a drawing context that has a display scale.
+  bool appendRectsLLO(TempVector<DecorationRect>&) const;
 };
 
 } // stu_label
@@ -109,7 +109,7 @@ OffsetAndThickness
 
 /// Assumes an LLO coordinate system, with the baseline at y = 0.
 static void findXBoundsOfIntersectionsOfGlyphsWithHorizontalLine(
-              CGFloat runXOffset, GlyphSpan span,
+              const TextFrameLine& line, CGFloat runXOffset, TextLinePart part, GlyphSpan span,
               CGFloat minY, CGFloat maxY, CGFloat dilation,
               OptionalDisplayScaleRef displayScale,
               LocalGlyphBoundsCache& localGlyphBoundsCache,
@@ -131,7 +131,10 @@ static void findXBoundsOfIntersectionsOfGlyphsWithHorizontalLine(
   const CGAffineTransform textMatrix = span.run().textMatrix();
   const bool hasNonIdentityMatrix = span.run().status() & kCTRunStatusHasNonIdentityMatrix;
   const FontFaceGlyphBoundsCache::Ref boundsCache = localGlyphBoundsCache.glyphBoundsCache(font);
-  const GlyphsWithPositions gwp = span.getGlyphsWithPositions();
+  const GlyphsWithPositions gwp = line.glyphsWithPositions(part, span);
+  const GlyphPathIntersectionBounds pathBounds{font};
+  const Range<CGFloat> lowerLineY{minY - 0.25f, lowerStripeMaxY + 0.25f};
+  const Range<CGFloat> upperLineY{upperStripeMinY - 0.25f, maxY + 0.25f};
 
   const auto dilateAndRoundGap = [&](Range<CGFloat> xi) STU_INLINE_LAMBDA -> Range<CGFloat> {
     CGFloat start = xi.start - dilation;
@@ -156,81 +159,91 @@ static void findXBoundsOfIntersectionsOfGlyphsWithHorizontalLine(
       bounds = CGRectApplyAffineTransform(bounds, textMatrix);
     }
     if (!bounds.y.overlaps(Range{minY, maxY})) continue;
-    CGAffineTransform matrix = textMatrix;
-    matrix.tx = position.x;
-    matrix.ty = position.y;
-    const CGPathRef path = CTFontCreatePathForGlyph(font, gwp.glyphs()[i], &matrix);
-    if (!path) continue;
-    const LowerAndUpperInterval xis = findXBoundsOfPathIntersectionWithHorizontalLines(
-                                        path,
-                                        Range<CGFloat>{minY - 0.25f, lowerStripeMaxY + 0.25f},
-                                        Range<CGFloat>{upperStripeMinY - 0.25f, maxY + 0.25f},
-                                        0.25f);
+    LowerAndUpperInterval xis;
+    if (pathBounds.isCacheable() && !hasNonIdentityMatrix) {
+      xis = pathBounds.find(gwp.glyphs()[i], lowerLineY - position.y, upperLineY - position.y,
+                            0.25f);
+      xis.lower += position.x;
+      xis.upper += position.x;
+    } else {
+      CGAffineTransform matrix = textMatrix;
+      matrix.tx = position.x;
+      matrix.ty = position.y;
+      const CGPathRef path = CTFontCreatePathForGlyph(font, gwp.glyphs()[i], &matrix);
+      if (!path) continue;
+      xis = findXBoundsOfPathIntersectionWithHorizontalLines(path, lowerLineY, upperLineY, 0.25f);
+      CFRelease(path);
+    }
     if (xis.lower.start <= xis.lower.end) {
       buffer.add(dilateAndRoundGap(xis.lower));
     }
     if (upperStripeBuffer && xis.upper.start <= xis.upper.end) {
       upperStripeBuffer->add(dilateAndRoundGap(xis.upper));
     }
-    CFRelease(path);
   }
 }
 
-static void removeLinePartsNotIntersectingClipRectAndMergeIdenticallyStyledAdjacentUnderlines(
-              TempVector<DecorationLine>& buffer, const Rect<CGFloat>& clipRect)
+void removeLinePartsNotIntersectingClipRectAndMergeIdenticallyStyledAdjacentUnderlines(
+       TempVector<Range<CGFloat>>& xs, TempVector<DecorationLine>& lines,
+       const Rect<CGFloat>& boundsLLO, const Rect<CGFloat>& clipRect)
 {
-  DecorationLine* previous = nullptr;
-  DecorationLine* end = nullptr;
-  for (DecorationLine& u : buffer) {
-    const auto rect = u.rectLLO();
-    bool remove = !rect.overlaps(clipRect)
-               && !rectShadowOverlapsRectLLO(rect, u.shadowInfo, clipRect);
-    if (previous) {
-      if (!remove) {
-        if (u.isUnderlineContinuation
-            && previous->colorIndex == u.colorIndex
-            && (previous->shadowInfo == u.shadowInfo
-                || (previous->shadowInfo && u.shadowInfo
-                     && *previous->shadowInfo == *u.shadowInfo)))
-        {
-          previous->x.end = u.x.end;
-          remove = true;
-        }
-      } else { // remove
-        previous->hasUnderlineContinuation = false;
-        previous = nullptr;
-      }
-    } else { // The previous line part may have been removed.
-      u.isUnderlineContinuation = false;
+  STU_DEBUG_ASSERT(xs.count() == lines.count());
+  const Int n = lines.count();
+  if (n == 0) return;
+  // The clip pass. In the common case all lines are visible and we don't need the per-line test.
+  TempArray<bool> isVisible;
+  if (!clipRect.contains(boundsLLO)) {
+    isVisible = TempArray<bool>{uninitialized, Count{n}};
+    for (Int i = 0; i < n; ++i) {
+      const DecorationLine& u = lines[i];
+      const Rect<CGFloat> rect = u.rectLLO(xs[i]);
+      isVisible[i] = rect.overlaps(clipRect)
+                  || rectShadowOverlapsRectLLO(rect, u.shadowInfo, clipRect);
     }
-    if (!remove) {
-      if (!end) {
-        previous = &u;
-      } else {
-        *end = u;
-        previous = end;
-        ++end;
+  }
+  // The merge pass, which compacts both arrays in place.
+  Int k = 0;
+  for (Int i = 0; i < n; ++i) {
+    DecorationLine& u = lines[i];
+    if (!isVisible.isEmpty() && !isVisible[i]) {
+      if (k > 0) {
+        lines[k - 1].hasUnderlineContinuation = false;
       }
-    } else { // remove
-      if (!end) {
-        end = &u;
+      continue;
+    }
+    const bool previousIsKept = k > 0 && (isVisible.isEmpty() || isVisible[i - 1]);
+    if (!previousIsKept) {
+      u.isUnderlineContinuation = false;
+    } else {
+      DecorationLine& previous = lines[k - 1];
+      if (u.isUnderlineContinuation
+          && previous.colorIndex == u.colorIndex
+          && (previous.shadowInfo == u.shadowInfo
+              || (previous.shadowInfo && u.shadowInfo && *previous.shadowInfo == *u.shadowInfo)))
+      {
+        xs[k - 1].end = xs[i].end;
+        previous.hasUnderlineContinuation = u.hasUnderlineContinuation;
+        continue;
       }
     }
-  }
-  if (end) {
-    if (previous) {
-      previous->hasUnderlineContinuation = false;
+    if (k != i) {
+      xs[k] = xs[i];
+      lines[k] = u;
     }
-    buffer.removeLast(buffer.end() - end);
+    ++k;
   }
+  xs.removeLast(n - k);
+  lines.removeLast(n - k);
 }
 
 Underlines Underlines::find(const TextFrameLine& line, DrawingContext& context) {
   bool hasShadow = false;
   bool hasDoubleLine = false;
-  TempArray<DecorationLine> lines;
+  TempArray<Range<CGFloat>> xs;
+  TempArray<DecorationLine> lines{xs.allocator()};
   {
-    TempVector<DecorationLine> buffer{MaxInitialCapacity{128}, lines.allocator()};
+    TempVector<Range<CGFloat>> xsBuffer{MaxInitialCapacity{128}, xs.allocator()};
+    TempVector<DecorationLine> buffer{MaxInitialCapacity{128}, xs.allocator()};
     const TextStyle* previousTextStyle = nil;
     CTFont* previousFont = nil;
     line.forEachStyledGlyphSpan(TextFlags::hasUnderline, context.styleOverride(),
@@ -243,6 +256,7 @@ Underlines Underlines::find(const TextFrameLine& line, DrawingContext& context)
         const TextStyle::UnderlineInfo& info = *style.underlineInfo();
         const NSUnderlineStyle lineStyle = static_cast<NSUnderlineStyle>(info.style());
         DecorationLine* const previous = !buffer.isEmpty() ? &buffer[$ - 1] : nil;
+        const Range<CGFloat>* const previousX = previous ? &xsBuffer[$ - 1] : nil;
         // Note: During the first pass we store the minY in DecorationLine.offsetLLO.
         CGFloat minY;
         CGFloat thickness;
@@ -268,7 +282,7 @@ Underlines Underlines::find(const TextFrameLine& line, DrawingContext& context)
             thickness = max(thickness, fontInfo.underlineThickness);
           }
         }
-        const bool isContinuation = previous && previous->x.end == x.start
+        const bool isContinuation = previous && previousX->end == x.start
                                              && previous->style == lineStyle;
         CGFloat fullLineXStart = x.start;
         if (isContinuation) {
@@ -279,7 +293,8 @@ Underlines Underlines::find(const TextFrameLine& line, DrawingContext& context)
         }
         // Below we'll adjust the offset and thickness again when we iterate backwards over the
         // decoration lines.
-        buffer.append(DecorationLine{.x = x, .fullLineXStart = fullLineXStart,
+        xsBuffer.append(x);
+        buffer.append(DecorationLine{.fullLineXStart = fullLineXStart,
                                      .offsetLLO = minY, .thickness = thickness,
                                      .style = lineStyle,
                                      .colorIndex = info.colorIndex ? *info.colorIndex
@@ -291,17 +306,19 @@ Underlines Underlines::find(const TextFrameLine& line, DrawingContext& context)
       }
       return ShouldStop{context.isCancelled()};
     });
+    Rect<CGFloat> boundsLLO = Rect<CGFloat>::infinitelyEmpty();
     if (!context.isCancelled()) {
       // Adjust the offset and thickness, invert the offset sign, propagate the maximum offset and
-      // thickness back through continued underlines, and determine hasDoubleLine and hasShadow.
+      // thickness back through continued underlines, and determine hasDoubleLine, hasShadow and
+      // the bounds of the lines and their shadows.
       CGFloat offset = 0;
       CGFloat thickness = 0;
       CGFloat originalOffset = 0;
       CGFloat originalThickness = 0;
       CGFloat unroundedThickness = 0;
-      for (DecorationLine& u : buffer.reversed()) {
+      for (Int i = buffer.count() - 1; i >= 0; --i) {
+        DecorationLine& u = buffer[i];
         hasDoubleLine |= (u.style & NSUnderlineStyleDouble) == NSUnderlineStyleDouble;
-        hasShadow |= u.shadowInfo != nullptr;
         if (!u.hasUnderlineContinuation) {
           // This also inverts the sign off the offset.
           const auto ot = calculateUnderlineOffsetAndThickness(u.offsetLLO, u.thickness, u.style,
@@ -318,11 +335,21 @@ Underlines Underlines::find(const TextFrameLine& line, DrawingContext& context)
         u.originalOffsetLLO = originalOffset;
         u.originalThickness = originalThickness;
         u.unroundedThickness = unroundedThickness;
+        const Rect<CGFloat> rect = u.rectLLO(xsBuffer[i]);
+        boundsLLO = boundsLLO.convexHull(rect);
+        if (u.shadowInfo) {
+          hasShadow = true;
+          boundsLLO = boundsLLO.convexHull((rect + u.shadowInfo->offsetLLO())
+                                           .outset(u.shadowInfo->blurRadius));
+        }
       }
     }
     removeLinePartsNotIntersectingClipRectAndMergeIdenticallyStyledAdjacentUnderlines(
-      buffer, context.clipRect() - context.lineOrigin());
+      xsBuffer, buffer, boundsLLO, context.clipRect() - context.lineOrigin());
+    // The order of the following operations should be the reverse of the declaration order
+    // (to improve reuse of TempAllocator memory).
     lines = std::move(buffer);
+    xs = std::move(xsBuffer);
   }
 
   // Calculate descender gaps.
@@ -342,12 +369,12 @@ Underlines Underlines::find(const TextFrameLine& line, DrawingContext& context)
       if (!lines.isValidIndex(index)) return {};
       const Range<CGFloat> x = narrow_cast<Range<CGFloat>>(x_f64);
       if (x.isEmpty()) return {};
-      if (x.start >= lines[index].x.end) {
+      if (x.start >= xs[index].end) {
         ++index;
         if (!lines.isValidIndex(index)) return {};
       }
+      if (x.end <= xs[index].start) return {};
       const DecorationLine& u = lines[index];
-      if (x.end <= u.x.start) return {};
 
       CGFloat dilation = u.originalThickness;
       const bool isDoubleLine = (u.style & NSUnderlineStyleDouble) == NSUnderlineStyleDouble;
@@ -361,7 +388,7 @@ Underlines Underlines::find(const TextFrameLine& line, DrawingContext& context)
       // taking into account the dilation) beyond their horizontal typographic bounds.
       // Since underlines are usually word-aligned, this shouldn't be a problem in practice.
       findXBoundsOfIntersectionsOfGlyphsWithHorizontalLine(
-        span.ctLineXOffset, span.glyphSpan,
+        line, span.ctLineXOffset, span.part, span.glyphSpan,
         u.originalOffsetLLO - u.originalThickness/2, u.originalOffsetLLO + u.originalThickness/2,
         dilation, context.displayScale(), context.glyphBoundsCache(),
         buffer, isDoubleLine ? Optional<SortedIntervalBuffer<CGFloat>&>(buffer2) : none);
@@ -373,7 +400,8 @@ Underlines Underlines::find(const TextFrameLine& line, DrawingContext& context)
     upperLinesGaps = std::move(buffer2);
     lowerLinesGaps = std::move(buffer);
   }
-  return {.lines = std::move(lines),
+  return {.xs = std::move(xs),
+          .lines = std::move(lines),
           .lowerLinesGaps = std::move(lowerLinesGaps),
           .upperLinesGaps = std::move(upperLinesGaps),
           .hasShadow = hasShadow,
@@ -472,6 +500,7 @@ Rect<Float64> Underlines::imageBoundsLLO(const TextFrameLine& line,
 }
 
 Strikethroughs Strikethroughs::find(const TextFrameLine& line, DrawingContext& context) {
+  TempVector<Range<CGFloat>> xsBuffer{MaxInitialCapacity{64}};
   TempVector<DecorationLine> buffer{MaxInitialCapacity{64}};
   bool hasShadow = false;
   const TextStyle* previousTextStyle = nil;
@@ -484,11 +513,12 @@ Strikethroughs Strikethroughs::find(const TextFrameLine& line, DrawingContext& c
     CTFont* const font = span.glyphSpan.run().font();
     if (!font) return {};
     DecorationLine* previous = !buffer.isEmpty() ? &buffer[$ - 1] : nil;
-    if (previous && previous->x.end == x.start
+    Range<CGFloat>* const previousX = previous ? &xsBuffer[$ - 1] : nil;
+    if (previous && previousX->end == x.start
                  && &style == previousTextStyle && !style.isOverrideStyle()
                  && font == previousFont)
     {
-      previous->x.end = x.end;
+      previousX->end = x.end;
       return {};
     }
     const TextStyle::StrikethroughInfo& info = *style.strikethroughInfo();
@@ -499,16 +529,17 @@ Strikethroughs Strikethroughs::find(const TextFrameLine& line, DrawingContext& c
                                                          context.fontInfoCache());
     const ColorIndex colorIndex = info.colorIndex ? *info.colorIndex
                                 : context.textColorIndex(style);
-    if (previous && previous->x.end == x.start
+    if (previous && previousX->end == x.start
         && previous->offsetLLO == ot.offsetLLO
         && previous->unroundedThickness == ot.unroundedThickness
         && previous->style == lineStyle && previous->colorIndex == colorIndex
         && (previous->shadowInfo == shadowInfo
             || (previous->shadowInfo && shadowInfo && *previous->shadowInfo == *shadowInfo)))
     {
-      previous->x.end = x.end;
+      previousX->end = x.end;
     } else {
-      buffer.append(DecorationLine{.x = x, .fullLineXStart = x.start,
+      xsBuffer.append(x);
+      buffer.append(DecorationLine{.fullLineXStart = x.start,
                                    .offsetLLO = ot.offsetLLO, .thickness = ot.thickness,
                                    .unroundedThickness = ot.unroundedThickness,
                                    .style = static_cast<NSUnderlineStyle>(info.style),
@@ -518,7 +549,11 @@ Strikethroughs Strikethroughs::find(const TextFrameLine& line, DrawingContext& c
     previousTextStyle = &style;
     return ShouldStop{context.isCancelled()};
   });
-  return Strikethroughs{.lines = std::move(buffer), .hasShadow = hasShadow};
+  // The order of the following operations should be the reverse of the declaration order
+  // (to improve reuse of TempAllocator memory).
+  TempArray<DecorationLine> lines = std::move(buffer);
+  TempArray<Range<CGFloat>> xs = std::move(xsBuffer);
+  return Strikethroughs{.xs = std::move(xs), .lines = std::move(lines), .hasShadow = hasShadow};
 }
 
 enum class DoubleLineStripe {
@@ -618,37 +653,40 @@ static void drawDecorationLine(const DecorationLine& line, Range<CGFloat> x,
 }
 
 STU_INLINE
-void drawDecorationLines(ArrayRef<const DecorationLine> lines,
+void drawDecorationLines(ArrayRef<const Range<CGFloat>> xs, ArrayRef<const DecorationLine> lines,
                          DrawShadow drawShadow, DrawingContext& context)
 {
-  for (const DecorationLine& line : lines) {
+  for (Int i = 0; i < lines.count(); ++i) {
+    const DecorationLine& line = lines[i];
     if (drawShadow && !line.shadowInfo) continue;
-    drawDecorationLine(line, line.x, DoubleLineStripe::both, drawShadow, context);
+    drawDecorationLine(line, xs[i], DoubleLineStripe::both, drawShadow, context);
     if (context.isCancelled()) return;
   }
 }
 
-static void drawDecorationLinesWithGaps(ArrayRef<const DecorationLine> lines,
-                                        DoubleLineStripe stripe,
-                                        ArrayRef<const Range<CGFloat>> gaps,
-                                        DrawShadow drawShadow,
-                                        DrawingContext& context)
+DecorationLineSegments DecorationLineSegments::subtractGaps(
+                         ArrayRef<const Range<CGFloat>> lineXs,
+                         ArrayRef<const DecorationLine> lines,
+                         ArrayRef<const Range<CGFloat>> gaps,
+                         OnlyDoubleLines onlyDoubleLines)
 {
+  STU_DEBUG_ASSERT(lineXs.count() == lines.count());
+  // Usually each gap splits at most one line, so this is normally the final capacity.
+  const Int capacity = lines.count() + gaps.count();
+  TempVector<Range<CGFloat>> xs{Capacity{capacity}};
+  TempVector<Int> lineIndices{Capacity{capacity}};
   Range<CGFloat> gap = {minValue<CGFloat>, minValue<CGFloat>};
   Int j = -1;
-  for (const DecorationLine& line : lines) {
-    if (   (drawShadow && !line.shadowInfo)
-        || (stripe == DoubleLineStripe::upper
-            && (line.style & NSUnderlineStyleDouble) != NSUnderlineStyleDouble))
-    {
+  for (Int i = 0; i < lineXs.count(); ++i) {
+    if (onlyDoubleLines && (lines[i].style & NSUnderlineStyleDouble) != NSUnderlineStyleDouble) {
       continue;
     }
-    const CGFloat end = line.x.end;
-    CGFloat start = line.x.start;
+    const CGFloat end = lineXs[i].end;
+    CGFloat start = lineXs[i].start;
     for (;;) {
       if (start < gap.start) {
-        drawDecorationLine(line, {start, min(end, gap.start)}, stripe, drawShadow, context);
-        if (context.isCancelled()) return;
+        xs.append(Range{start, min(end, gap.start)});
+        lineIndices.append(i);
       }
       if (gap.end >= end) break;
       start = max(start, gap.end);
@@ -659,38 +697,203 @@ static void drawDecorationLinesWithGaps(ArrayRef<const DecorationLine> lines,
       }
     }
   }
+  // The order of the following operations should be the reverse of the declaration order
+  // (to improve reuse of TempAllocator memory).
+  TempArray<Int> lineIndicesArray = std::move(lineIndices);
+  TempArray<Range<CGFloat>> xsArray = std::move(xs);
+  return {.xs = std::move(xsArray), .lineIndices = std::move(lineIndicesArray)};
+}
+
+/// Returns the rect of the specified stripe of a solid decoration line relative to the line origin,
+/// or none if the part of the line is too short to be drawn.
+///
+/// @pre (line.style & 0x700) == 0 && stripe != DoubleLineStripe::both
+static Optional<Rect<CGFloat>> solidDecorationLineStripeRectLLO(const DecorationLine& line,
+                                                                 Range<CGFloat> x,
+                                                                 DoubleLineStripe stripe)
+{
+  CGFloat y = line.offsetLLO;
+  CGFloat thickness = line.thickness;
+  CGFloat originalThickness = line.originalThickness;
+  if ((line.style & NSUnderlineStyleDouble) == NSUnderlineStyleDouble) {
+    thickness /= 3;
+    originalThickness /= 3;
+    if (stripe != DoubleLineStripe::lower) {
+      y += thickness;
+    } else {
+      y -= thickness;
+    }
+  }
+  if (x.end - x.start < originalThickness) return none;
+  return Rect{x, y + Range{-thickness/2, thickness/2}};
+}
+
+/// Draws the decoration line segments. Consecutive rects of solid line segments with the same color
+/// are filled with a single CGContextFillRects call, even if they belong to different lines.
+static void drawDecorationLineSegments(ArrayRef<const DecorationLine> lines,
+                                       DoubleLineStripe stripe,
+                                       const DecorationLineSegments& segments,
+                                       DrawShadow drawShadow,
+                                       DrawingContext& context)
+{
+  STU_DEBUG_ASSERT(stripe != DoubleLineStripe::both);
+  TempVector<CGRect> rects{MaxInitialCapacity{64}};
+  ColorIndex rectsColorIndex{};
+  const auto fillRects = [&]() {
+    if (rects.isEmpty()) return;
+    context.setShadow(nil);
+    context.setFillColor(rectsColorIndex);
+    CGContextFillRects(context.cgContext(), rects.begin(), sign_cast(rects.count()));
+    rects.removeAll();
+  };
+  for (Int k = 0; k < segments.xs.count(); ++k) {
+    const DecorationLine& line = lines[segments.lineIndices[k]];
+    if (drawShadow && !line.shadowInfo) continue;
+    // We don't batch the shadow drawing, because a single fill operation would draw the shadow of
+    // the union of the rects instead of the union of the rect shadows.
+    if (drawShadow || (line.style & 0x700) != 0 || !context.displayScale()) {
+      fillRects();
+      drawDecorationLine(line, segments.xs[k], stripe, drawShadow, context);
+      if (context.isCancelled()) return;
+      continue;
+    }
+    if (line.colorIndex != rectsColorIndex) {
+      fillRects();
+      if (context.isCancelled()) return;
+      rectsColorIndex = line.colorIndex;
+    }
+    if (const Optional<Rect<CGFloat>> rect = solidDecorationLineStripeRectLLO(line,
+                                                                              segments.xs[k],
+                                                                              stripe))
+    {
+      rects.append(*rect + context.lineOrigin());
+    }
+  }
+  fillRects();
 }
 
 void Underlines::drawLLO(DrawingContext& context) const {
+  // The gaps are subtracted only once per stripe, not once per drawing pass.
+  const DecorationLineSegments upperSegments =
+    hasDoubleLine ? DecorationLineSegments::subtractGaps(xs, lines, upperLinesGaps,
+                                                         OnlyDoubleLines{true})
+                  : DecorationLineSegments{};
+  const DecorationLineSegments lowerSegments =
+    DecorationLineSegments::subtractGaps(xs, lines, lowerLinesGaps, OnlyDoubleLines{false});
   if (hasShadow) {
     DrawingContext::ShadowOnlyDrawingScope shadowOnlyScope{context};
     if (hasDoubleLine) {
-      drawDecorationLinesWithGaps(lines, DoubleLineStripe::upper, upperLinesGaps,
-                                  DrawShadow{true}, context);
+      drawDecorationLineSegments(lines, DoubleLineStripe::upper, upperSegments,
+                                 DrawShadow{true}, context);
       if (context.isCancelled()) return;
     }
-    drawDecorationLinesWithGaps(lines, DoubleLineStripe::lower, lowerLinesGaps,
-                                DrawShadow{true}, context);
+    drawDecorationLineSegments(lines, DoubleLineStripe::lower, lowerSegments,
+                               DrawShadow{true}, context);
     if (context.isCancelled()) return;
   }
   if (hasDoubleLine) {
-    drawDecorationLinesWithGaps(lines, DoubleLineStripe::upper, upperLinesGaps,
-                                DrawShadow{false}, context);
+    drawDecorationLineSegments(lines, DoubleLineStripe::upper, upperSegments,
+                               DrawShadow{false}, context);
+    if (context.isCancelled()) return;
+  }
+  drawDecorationLineSegments(lines, DoubleLineStripe::lower, lowerSegments,
+                             DrawShadow{false}, context);
+}
+
+/// @pre (line.style & 0x700) == 0
+static void appendSolidDecorationLineRectsLLO(const DecorationLine& line, Range<CGFloat> x,
+                                              DoubleLineStripe stripe,
+                                              TempVector<DecorationRect>& rects)
+{
+  const auto append = [&](DoubleLineStripe singleStripe) {
+    if (const Optional<Rect<CGFloat>> rect = solidDecorationLineStripeRectLLO(line, x,
+                                                                              singleStripe))
+    {
+      rects.append(DecorationRect{.rectLLO = *rect, .colorIndex = line.colorIndex,
+                                  .shadowInfo = line.shadowInfo});
+    }
+  };
+  if (stripe != DoubleLineStripe::both) {
+    append(stripe);
+  } else {
+    append(DoubleLineStripe::upper);
+    if ((line.style & NSUnderlineStyleDouble) == NSUnderlineStyleDouble) {
+      append(DoubleLineStripe::lower);
+    }
+  }
+}
+
+bool Underlines::appendRectsLLO(TempVector<DecorationRect>& rects) const {
+  for (const DecorationLine& line : lines) {
+    if ((line.style & 0x700) != 0) return false;
+  }
+  if (hasDoubleLine) {
+    const DecorationLineSegments upperSegments =
+      DecorationLineSegments::subtractGaps(xs, lines, upperLinesGaps, OnlyDoubleLines{true});
+    for (Int k = 0; k < upperSegments.xs.count(); ++k) {
+      appendSolidDecorationLineRectsLLO(lines[upperSegments.lineIndices[k]], upperSegments.xs[k],
+                                        DoubleLineStripe::upper, rects);
+    }
+  }
+  const DecorationLineSegments lowerSegments =
+    DecorationLineSegments::subtractGaps(xs, lines, lowerLinesGaps, OnlyDoubleLines{false});
+  for (Int k = 0; k < lowerSegments.xs.count(); ++k) {
+    appendSolidDecorationLineRectsLLO(lines[lowerSegments.lineIndices[k]], lowerSegments.xs[k],
+                                      DoubleLineStripe::lower, rects);
+  }
+  return true;
+}
+
+bool Strikethroughs::appendRectsLLO(TempVector<DecorationRect>& rects) const {
+  for (const DecorationLine& line : lines) {
+    if ((line.style & 0x700) != 0) return false;
+  }
+  for (Int i = 0; i < lines.count(); ++i) {
+    appendSolidDecorationLineRectsLLO(lines[i], xs[i], DoubleLineStripe::both, rects);
+  }
+  return true;
+}
+
+void drawDecorationRectsLLO(ArrayRef<const DecorationRect> rects, DrawingContext& context) {
+  const CGPoint lineOrigin = context.lineOrigin();
+  const CGContextRef cgContext = context.cgContext();
+  bool hasShadow = false;
+  for (const DecorationRect& rect : rects) {
+    hasShadow |= rect.shadowInfo != nullptr;
+  }
+  if (hasShadow) {
+    // As in drawDecorationLineSegments, the shadows are drawn one rect at a time.
+    DrawingContext::ShadowOnlyDrawingScope shadowOnlyScope{context};
+    for (const DecorationRect& rect : rects) {
+      if (!rect.shadowInfo) continue;
+      context.setShadow(rect.shadowInfo);
+      context.setFillColor(rect.colorIndex);
+      CGContextFillRect(cgContext, rect.rectLLO + lineOrigin);
+    }
     if (context.isCancelled()) return;
   }
-  drawDecorationLinesWithGaps(lines, DoubleLineStripe::lower, lowerLinesGaps,
-                              DrawShadow{false}, context);
+  context.setShadow(nil);
+  TempVector<CGRect> cgRects{MaxInitialCapacity{64}};
+  for (Int i = 0; i < rects.count();) {
+    const ColorIndex colorIndex = rects[i].colorIndex;
+    do {
+      cgRects.append(rects[i].rectLLO + lineOrigin);
+    } while (++i < rects.count() && rects[i].colorIndex == colorIndex);
+    context.setFillColor(colorIndex);
+    CGContextFillRects(cgContext, cgRects.begin(), sign_cast(cgRects.count()));
+    cgRects.removeAll();
+  }
 }
 
 void Strikethroughs::drawLLO(DrawingContext& context) const {
   if (hasShadow) {
     {
       DrawingContext::ShadowOnlyDrawingScope shadowOnlyScope{context};
-      drawDecorationLines(lines, DrawShadow{true}, context);
+      drawDecorationLines(xs, lines, DrawShadow{true}, context);
     }
     if (context.isCancelled()) return;
   }
-  drawDecorationLines(lines, DrawShadow{false}, context);
+  drawDecorationLines(xs, lines, DrawShadow{false}, context);
 }
 
 } // namespace stu_label
@@ -110,6 +110,27 @@ public:
     }
   };
 
+  /// Temporarily replaces the clip rect with an infinite rect, so that e.g. the decoration lines
+  /// of a whole line can be found for recording.
+  class UnclippedScope {
+    DrawingContext& context_;
+    const Rect<CGFloat> clipRect_;
+  public:
+    explicit STU_INLINE
+    UnclippedScope(DrawingContext& context)
+    : context_(context), clipRect_(context.clipRect_)
+    {
+      context_.clipRect_ = Rect<CGFloat>{Range{-infinity<CGFloat>, infinity<CGFloat>},
+                                         Range{-infinity<CGFloat>, infinity<CGFloat>}};
+    }
+
+    UnclippedScope(const UnclippedScope&) = delete;
+    UnclippedScope& operator=(const UnclippedScope&) = delete;
+
+    STU_INLINE
+    ~UnclippedScope() { context_.clipRect_ = clipRect_; }
+  };
+
   void setShadow(const TextStyle::ShadowInfo* __nullable shadowInfo) {
     if (shadowInfo_ == shadowInfo) return;
     setShadow_slowPath(shadowInfo);
@@ -209,6 +230,14 @@ public:
     return overrideTextColorIndices_[style.isOverride_isLink().index].value_or(style.colorIndex());
   }
 
+  /// Returns the text color index that the style override would give the (non-override) style
+  /// if the style's text was in the override range. The style override must have a text color.
+  ColorIndex overriddenTextColorIndex(const TextStyle& style) const {
+    STU_DEBUG_ASSERT(!style.isOverrideStyle() && styleOverride_ && styleOverride_->textColorIndex);
+    return overrideTextColorIndices_[style.isOverride_isLink().index | 1]
+           .value_or(*styleOverride_->textColorIndex);
+  }
+
   STU_INLINE
   DrawingContext(Optional<const STUCancellationFlag&> cancellationFlag,
                  CGContext* cgContext, ContextBaseCTM_d contextBaseCTM_d,
@@ -205,33 +205,68 @@ private:
   CachedFontInfo(FontRef);
 };
 
+#ifndef STU_LOCAL_FONT_INFO_CACHE_SIZE
+  #define STU_LOCAL_FONT_INFO_CACHE_SIZE 8
+#endif
+
+/// A small LRU cache in front of CachedFontInfo::get, which has to lock a global mutex.
 class LocalFontInfoCache {
 public:
+  static constexpr Int entryCount = STU_LOCAL_FONT_INFO_CACHE_SIZE;
+  static_assert(2 <= entryCount && entryCount <= 256);
+
+  LocalFontInfoCache() {
+    for (Int i = 0; i < entryCount; ++i) {
+      entries_[i].infoIndex = narrow_cast<UInt8>(i);
+    }
+  }
+
+  /// Adds the lookup counts to the totals reported by stu_fontCacheStatistics.
+  ~LocalFontInfoCache() {
+    if (lookupCount_ != 0) {
+      addLookupCountsToGlobalStatistics();
+    }
+  }
+
   STU_INLINE
   const CachedFontInfo& operator[](FontRef font) {
     return (*this)[font.ctFont()];
   }
   STU_INLINE
   const CachedFontInfo& operator[](CTFont* __nonnull font) {
-    // TODO: Replace this with a simple LRU cache like in LocalGlyphBoundsCache::glyphBoundsCache.
-    UInt index = (  (font == fonts_[0] ? 1 : 0)
-                  | (font == fonts_[1] ? 2 : 0))
-               | (  (font == fonts_[2] ? 3 : 0)
-                  | (font == fonts_[3] ? 4 : 0));
-    if (STU_LIKELY(index != 0)) {
-      return infos_[index - 1];
+    lookupCount_ += 1;
+    if (STU_LIKELY(font == entries_[0].font)) {
+      return infos_[entries_[0].infoIndex].info;
     }
-    index = counter_%4;
-    counter_ += 1;
-    fonts_[index] = font;
-    infos_[index] = CachedFontInfo::get(font);
-    return infos_[index];
+    return get_slowPath(font);
   }
 
+  /// The number of lookups performed with this cache.
+  Int lookupCount() const { return lookupCount_; }
+  /// The number of lookups that had to fall back to CachedFontInfo::get.
+  Int globalLookupCount() const { return globalLookupCount_; }
+
 private:
-  CTFont* fonts_[4] = {};
-  UInt counter_{};
-  CachedFontInfo infos_[4] = {uninitialized, uninitialized, uninitialized, uninitialized};
+  STU_NO_INLINE
+  const CachedFontInfo& get_slowPath(CTFont*);
+
+  STU_NO_INLINE
+  void addLookupCountsToGlobalStatistics() const;
+
+  struct Entry {
+    CTFont* font;
+    UInt8 infoIndex;
+  };
+
+  struct InfoStorage {
+    CachedFontInfo info{uninitialized};
+  };
+
+  /// Ordered from most to least recently used.
+  Entry entries_[entryCount] = {};
+  InfoStorage infos_[entryCount];
+  Int lookupCount_{};
+  Int globalLookupCount_{};
 };
 
 class GlyphsWithPositions {
@@ -242,6 +277,7 @@ public:
 
 private:
   friend class GlyphSpan;
+  friend class TextFrameGlyphStore;
 
   STU_INLINE_T
   GlyphsWithPositions()
@@ -261,6 +297,9 @@ private:
 
 class FontFaceGlyphBoundsCache {
 public:
+  /// The number of glyphs per page of cached bounds.
+  static constexpr Int pageSize = 64;
+
   struct FontFace {
     // The glyph bounds of Core Text fonts with the same graphics font scale linearly with the font
     // size, except for the AppleColorEmoji and .AppleColorEmojiUI fonts (or all color bitmap
@@ -327,29 +366,42 @@ public:
 private:
   static void returnToGlobalPool(FontFaceGlyphBoundsCache* __nonnull) noexcept;
 public:
+  /// Owns one reference to a cache shared by all threads.
   using UniquePtr = stu::UniquePtr<FontFaceGlyphBoundsCache, returnToGlobalPool>;
 
   /// Transfers ownership. Don't dereference the pointers after returning them to the pool!
   ///
-  /// Thread-safe (for nonoverlapping array arguments).
+  /// Thread-safe.
   static void returnToGlobalPool(ArrayRef<FontFaceGlyphBoundsCache* __nullable const>);
 
-  /// Exchanges the cache with one that holds glyph bounds for the specified font.
-  /// The caller relinquishes the ownership of the nullable old cache and assumes ownership for the
-  /// nonnull new one (via the @c UniquePtr).
+  /// Exchanges the cache with the one that holds glyph bounds for the specified font.
+  /// The caller relinquishes the ownership of the nullable old cache reference and assumes
+  /// ownership for the nonnull new one (via the @c UniquePtr).
+  ///
+  /// There is only a single cache per font face, which is shared by all threads.
   ///
   /// @pre `fontFace == FontFace(font)`
   ///
-  /// Thread-safe (for different cache and fontface arguments).
+  /// Thread-safe.
   static void exchange(InOut<UniquePtr> cache, FontRef font, FontFace&& fontFace);
 
-  const FontFace& fontFace() const;
+  const FontFace& fontFace() const { return fontFace_; }
 
+  /// Thread-safe. Looking up already cached glyph bounds doesn't require a lock. The bounds of
+  /// glyphs that aren't cached yet are fetched without holding a lock and are then inserted in a
+  /// single batch.
   Rect<CGFloat> boundingRect(CGFloat fontSize, ArrayRef<const CGGlyph> glyphs,
                              const CGPoint* positions);
 
-  /// For testing purposes.
-  bool usesIntBounds() const { return usesIntBounds_; }
+  /// Loads the bounds of the glyphs for the printable ASCII and Latin-1 characters into the global
+  /// cache for the font's face.
+  ///
+  /// @pre The current thread must have a ThreadLocalArenaAllocator.
+  static void preloadLatin1GlyphBounds(FontRef font);
+
+  /// For testing purposes. Indicates whether all glyph bounds cached so far are stored as 16-bit
+  /// integers.
+  bool usesIntBounds() const;
 
 #if STU_DEBUG
   void setMaxIntBoundsCountToTestFallbacktToFloatBounds(Int maxCount) {
@@ -357,6 +409,8 @@ public:
   }
 #endif
 
+  /// Removes all font faces from the global cache that aren't currently in use.
+  ///
   /// Thread-safe.
   static void clearGlobalCache();
 
@@ -364,64 +418,76 @@ private:
   friend Malloced<FontFaceGlyphBoundsCache>;
 
   friend class GlyphBoundsCache;
-  struct Pool;
+
+  struct Page;
+  struct FloatPage;
 
   FontFaceGlyphBoundsCache(const FontFaceGlyphBoundsCache&) = delete;
   FontFaceGlyphBoundsCache& operator==(const FontFaceGlyphBoundsCache&) = delete;
 
   ~FontFaceGlyphBoundsCache();
 
-  /// @pre usesIntBounds_
-  void switchToFloatBounds();
-
-  struct GlyphHasher {
-    STU_INLINE static HashCode<UInt32> hash(CGGlyph glyph) {
-      UInt32 value = glyph;
-      // This is the hash function used by Skia, see SkChecksum::CheapMix.
-      value *= 0x85ebca6b;
-      value ^= value >> 16;
-      return HashCode{value};
-    }
-  };
-
   struct InitData {
-    Pool& pool;
-    FontRef font;
     CGFloat unitsPerEM;
     CGFloat pointsPerUnit;
     CGPoint offset;
-    bool isAppleColorEmoji;
-    bool useIntBounds;
+    Int pageCount;
 
-    InitData(Pool&);
+    InitData(FontRef, const FontFace&);
   };
 
-  explicit FontFaceGlyphBoundsCache(Pool& pool)
-  : FontFaceGlyphBoundsCache{InitData{pool}} {}
+  explicit FontFaceGlyphBoundsCache(FontRef font, FontFace&& fontFace)
+  : FontFaceGlyphBoundsCache{InitData{font, fontFace}, font, std::move(fontFace)} {}
 
-  explicit FontFaceGlyphBoundsCache(InitData data);
-  
-  Pool& pool_;
-  const FontRef font_;
+  explicit FontFaceGlyphBoundsCache(InitData data, FontRef font, FontFace&& fontFace);
+
+  /// Returns null if no bounds have been cached yet for any glyph in the glyph's page.
+  /// @pre `glyph < pageCount_*pageSize`
+  const Page* page(CGGlyph glyph) const;
+
+  /// @pre The insertion mutex for this cache must be locked by the current thread.
+  Page& pageForInsertion(CGGlyph glyph);
+
+  /// @pre The insertion mutex for this cache must be locked by the current thread.
+  void insert(CGGlyph glyph, CGRect bounds);
+
+  /// The number of bytes allocated for this cache, including the allocated pages.
+  Int byteSize() const {
+    return atomic_load_explicit(&byteSize_, memory_order_relaxed);
+  }
+
+  /// Adds the size of a newly allocated page to byteSize_ and to the global footprint counter.
+  void addAllocatedByteSize(Int size);
+
+  const FontFace fontFace_;
+  const RC<CTFont> font_;
   const CGFloat unitsPerEM_;
-  /// effectiveFontSize/unitsPerEM_ if usesIntBounds_ || !isAppleColorEmoji_ else 1
-  CGFloat pointsPerUnit_;
+  /// effectiveFontSize/unitsPerEM_ if !isAppleColorEmoji_ || fontFace_.fontMatrixIsIdentity else 1
+  const CGFloat pointsPerUnit_;
   /// 1/pointPerUnit_
-  CGFloat inversePointsPerUnit_;
-  /// Is zero if !isAppleColorEmoji_ || !usesIntBounds_
-  Point<CGFloat> scaledIntBoundsOffset_;
+  const CGFloat inversePointsPerUnit_;
+  /// Is zero if !isAppleColorEmoji_ || !fontFace_.fontMatrixIsIdentity
+  const Point<CGFloat> scaledIntBoundsOffset_;
   const bool isAppleColorEmoji_;
-  bool usesIntBounds_;
+  /// The number of elements of the pages_ array. Glyphs outside the page range have no bounds.
+  const Int pageCount_;
+  /// The pages are allocated on demand and are only freed when the cache is destroyed.
+  _Atomic(Page*)* const pages_;
+  /// Updated while holding the insertion mutex, but also read by the global cache eviction.
+  _Atomic(Int) byteSize_;
+  /// Only accessed while holding the insertion mutex.
+  Int intBoundsCount_{};
+  /// Only accessed while holding the insertion mutex.
+  Int floatBoundsCount_{};
+  /// Only accessed while holding the global cache mutex.
+  Int referenceCount_{};
+  /// The value of the global cache's use counter when the cache was last acquired or released.
+  /// Only accessed while holding the global cache mutex.
+  UInt64 lastUseTime_{};
 #if STU_DEBUG
   /// Only used for testing the fallback to float bounds.
   Int maxIntBoundsCount_{maxValue<Int>};
 #endif
-
-  union {
-    HashTable<CGGlyph, Rect<Int16>, Malloc, GlyphHasher> intBoundsByGlyphIndex_;
-    HashTable<CGGlyph, Rect<Float32>, Malloc, GlyphHasher> floatBoundsByGlyphIndex_;
-    Int uninitialized_{};
-  };
 };
 
 class LocalGlyphBoundsCache {
@@ -461,6 +527,13 @@ private:
   FontFaceGlyphBoundsCache* caches_[entryCount] = {};
 };
 
+/// Evicts the least recently used entries from the global font info and glyph bounds caches until
+/// their footprints don't exceed 1/4 of their byte budgets. This is what happens when the app
+/// receives a memory warning.
+///
+/// Thread-safe.
+void trimGlobalFontCachesToLowWatermarks();
+
 } // namespace stu_label
 
 #include "UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
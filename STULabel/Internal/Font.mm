@@ -2,17 +2,23 @@
 
 #import "Font.hpp"
 
+#import "STULabel/STUFontCaches.h"
 #import "STULabel/stu_mutex.h"
 
 #import "Hash.hpp"
 #import "HashTable.hpp"
 #import "Once.hpp"
+#import "PersistentFontCache.hpp"
 #import "Rect.hpp"
 
 #import "stu/ScopeGuard.hpp"
 #import "stu/UniquePtr.hpp"
 #import "stu/Vector.hpp"
 
+#import <algorithm>
+#import <simd/simd.h>
+#import <stdatomic.h>
+
 #include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
 
 namespace stu_label {
@@ -24,17 +30,70 @@ CTFont* defaultCoreTextFont() {
   return (__bridge CTFont*)value;
 }
 
+#ifndef STU_FONT_INFO_CACHE_BYTE_BUDGET
+  #define STU_FONT_INFO_CACHE_BYTE_BUDGET (256*1024)
+#endif
+
+#ifndef STU_GLYPH_BOUNDS_CACHE_BYTE_BUDGET
+  #define STU_GLYPH_BOUNDS_CACHE_BYTE_BUDGET (4*1024*1024)
+#endif
+
+/// When a global font cache exceeds its byte budget, it evicts the least recently used entries
+/// until its footprint is no greater than 3/4 of the budget, so that not every subsequent insertion
+/// has to evict an entry.
+static Int evictionTargetByteSize(Int byteBudget) { return byteBudget - byteBudget/4; }
+
+/// The footprint a global font cache is trimmed to when the app receives a memory warning or
+/// enters the background.
+static Int lowWatermarkByteSize(Int byteBudget) { return byteBudget/4; }
+
 struct FontInfoCache {
   struct Entry {
     FontRef font;
     HashCode<UInt> hashCode; // hash(CFHash(font.ctFont()))
+    /// The value of useCounter when the entry was last looked up.
+    UInt64 lastUseTime;
     CachedFontInfo info;
   };
 
+  using IndexSet = HashSet<UInt16, Malloc>;
+
   Vector<Entry> entries;
-  HashSet<UInt16, Malloc> indicesByFontPointer{uninitialized};
-  HashSet<UInt16, Malloc> indicesByHashIdentity{uninitialized};
+  IndexSet indicesByFontPointer{uninitialized};
+  IndexSet indicesByHashIdentity{uninitialized};
+  UInt64 useCounter{};
+  Int evictionCount{};
+
+  static constexpr Int minBucketCount = 16;
+
+  static Int bucketCount(Int entryCount) {
+    return max(minBucketCount,
+               sign_cast(roundUpToPowerOfTwo(sign_cast(entryCount + entryCount/2 + 1))));
+  }
 
+  static Int byteSize(Int entryCapacity, Int bucketCount) {
+    return sign_cast(sizeof(FontInfoCache) + sign_cast(entryCapacity)*sizeof(Entry)
+                     + 2*sign_cast(bucketCount)*sizeof(IndexSet::Bucket));
+  }
+
+  Int byteSize() const {
+    STU_DEBUG_ASSERT(indicesByFontPointer.buckets().count()
+                     == indicesByHashIdentity.buckets().count());
+    return byteSize(entries.capacity(), indicesByFontPointer.buckets().count());
+  }
+
+  void initialize() {
+    indicesByFontPointer.initializeWithBucketCount(minBucketCount);
+    indicesByHashIdentity.initializeWithBucketCount(minBucketCount);
+    entries.ensureFreeCapacity(8);
+  }
+
+  void insertIndices(UInt16 index) {
+    const Entry& entry = entries[index];
+    indicesByFontPointer.insertNew(narrow_cast<HashCode<UInt>>(hashPointer(entry.font.ctFont())),
+                                   index);
+    indicesByHashIdentity.insertNew(entry.hashCode, index);
+  }
 
   STU_NO_INLINE
   void clear() {
@@ -46,12 +105,58 @@ struct FontInfoCache {
     indicesByHashIdentity.removeAll();
   }
 
+  /// Removes the least recently used entries until the footprint is no greater than the specified
+  /// size. The remaining entries are reindexed.
+  STU_NO_INLINE
+  void evictLeastRecentlyUsed(Int maxByteSize) {
+    if (byteSize() <= maxByteSize) return;
+    const Int oldCount = entries.count();
+    Int newCount = oldCount;
+    while (newCount > 0 && byteSize(newCount, bucketCount(newCount)) > maxByteSize) {
+      --newCount;
+    }
+    // The use times are unique, so exactly the newCount most recently used entries have a use time
+    // no less than minRetainedUseTime.
+    UInt64 minRetainedUseTime = maxValue<UInt64>;
+    if (newCount != 0) {
+      Vector<UInt64> useTimes{Capacity{oldCount}};
+      for (const Entry& entry : entries) {
+        useTimes.append(entry.lastUseTime);
+      }
+      const Int k = oldCount - newCount;
+      std::nth_element(useTimes.begin(), useTimes.begin() + k, useTimes.end());
+      minRetainedUseTime = useTimes[k];
+    }
+    Int n = 0;
+    for (Int i = 0; i < oldCount; ++i) {
+      if (entries[i].lastUseTime >= minRetainedUseTime) {
+        entries[n++] = entries[i];
+      } else {
+        decrementRefCount((__bridge UIFont*)entries[i].font.ctFont());
+      }
+    }
+    STU_DEBUG_ASSERT(n == newCount);
+    entries.removeLast(oldCount - n);
+    entries.trimFreeCapacity();
+    evictionCount += oldCount - n;
+    indicesByFontPointer = IndexSet{uninitialized};
+    indicesByHashIdentity = IndexSet{uninitialized};
+    indicesByFontPointer.initializeWithBucketCount(bucketCount(n));
+    indicesByHashIdentity.initializeWithBucketCount(bucketCount(n));
+    for (Int i = 0; i < n; ++i) {
+      insertIndices(narrow_cast<UInt16>(i));
+    }
+  }
 };
 
 stu_mutex fontInfoCacheMutex = STU_MUTEX_INIT;
 bool fontInfoCacheIsInitialized = false;
 alignas(FontInfoCache)
 Byte fontInfoCacheStorage[sizeof(FontInfoCache)];
+/// Only accessed while holding fontInfoCacheMutex.
+Int fontInfoCacheByteBudget = STU_FONT_INFO_CACHE_BYTE_BUDGET;
+
+static void registerDidEnterBackgroundObserver();
 
 CachedFontInfo::CachedFontInfo(FontRef font)
 : metrics{uninitialized}
@@ -147,21 +252,17 @@ CachedFontInfo CachedFontInfo::get(FontRef font) {
   if (STU_UNLIKELY(!fontInfoCacheIsInitialized)) {
     fontInfoCacheIsInitialized = true;
     FontInfoCache& cache = *new (fontInfoCacheStorage) FontInfoCache{};
-    cache.indicesByFontPointer.initializeWithBucketCount(16);
-    cache.indicesByHashIdentity.initializeWithBucketCount(16);
-    cache.entries.ensureFreeCapacity(8);
-
-    NSNotificationCenter* const notificationCenter = NSNotificationCenter.defaultCenter;
-    NSOperationQueue* const mainQueue = NSOperationQueue.mainQueue;
-    const auto clearCacheBlock = ^(NSNotification*) {
-      stu_mutex_lock(&fontInfoCacheMutex);
-      cache.clear();
-      stu_mutex_unlock(&fontInfoCacheMutex);
-    };
-    [notificationCenter addObserverForName:UIApplicationDidEnterBackgroundNotification
-                                    object:nil queue:mainQueue usingBlock:clearCacheBlock];
-    [notificationCenter addObserverForName:UIApplicationDidReceiveMemoryWarningNotification
-                                    object:nil queue:mainQueue usingBlock:clearCacheBlock];
+    cache.initialize();
+
+    [NSNotificationCenter.defaultCenter
+       addObserverForName:UIApplicationDidReceiveMemoryWarningNotification
+                   object:nil queue:NSOperationQueue.mainQueue
+               usingBlock:^(NSNotification*) {
+                 stu_mutex_lock(&fontInfoCacheMutex);
+                 cache.evictLeastRecentlyUsed(lowWatermarkByteSize(fontInfoCacheByteBudget));
+                 stu_mutex_unlock(&fontInfoCacheMutex);
+               }];
+    registerDidEnterBackgroundObserver();
   }
   FontInfoCache& cache = reinterpret_cast<FontInfoCache&>(fontInfoCacheStorage);
 
@@ -170,7 +271,9 @@ CachedFontInfo CachedFontInfo::get(FontRef font) {
   };
   CachedFontInfo info{uninitialized};
   if (const auto optIndex = cache.indicesByFontPointer.find(pointerHashCode, isEqualFontPointer)) {
-    info = cache.entries[*optIndex].info;
+    FontInfoCache::Entry& entry = cache.entries[*optIndex];
+    entry.lastUseTime = ++cache.useCounter;
+    info = entry.info;
     stu_mutex_unlock(&fontInfoCacheMutex);
     return info;
   }
@@ -181,12 +284,20 @@ CachedFontInfo CachedFontInfo::get(FontRef font) {
     return hashCode == entry.hashCode && CFEqual(font.ctFont(), entry.font.ctFont());
   };
   if (const auto optIndex = cache.indicesByHashIdentity.find(hashCode, isEqualFont)) {
-    info = cache.entries[*optIndex].info;
+    FontInfoCache::Entry& entry = cache.entries[*optIndex];
+    entry.lastUseTime = ++cache.useCounter;
+    info = entry.info;
     stu_mutex_unlock(&fontInfoCacheMutex);
     return info;
   }
   stu_mutex_unlock(&fontInfoCacheMutex);
+#if STU_USE_PERSISTENT_FONT_CACHE
+  const Optional<CachedFontInfo> persistedInfo =
+    PersistentFontCache::findFontInfoInGlobalCache(font);
+  info = persistedInfo ? *persistedInfo : CachedFontInfo{font};
+#else
   info = CachedFontInfo{font};
+#endif
   incrementRefCount((__bridge UIFont*)font.ctFont());
   stu_mutex_lock(&fontInfoCacheMutex);
   UInt16 index = narrow_cast<UInt16>(cache.entries.count());
@@ -197,7 +308,10 @@ CachedFontInfo CachedFontInfo::get(FontRef font) {
   const bool inserted = cache.indicesByHashIdentity.insert(hashCode, index, isEqualFont).inserted;
   if (inserted) {
     cache.indicesByFontPointer.insertNew(pointerHashCode, index);
-    cache.entries.append(FontInfoCache::Entry{font, hashCode, info});
+    cache.entries.append(FontInfoCache::Entry{font, hashCode, ++cache.useCounter, info});
+    if (cache.byteSize() > fontInfoCacheByteBudget) {
+      cache.evictLeastRecentlyUsed(evictionTargetByteSize(fontInfoCacheByteBudget));
+    }
   }
   stu_mutex_unlock(&fontInfoCacheMutex);
   if (!inserted) {
@@ -206,28 +320,67 @@ CachedFontInfo CachedFontInfo::get(FontRef font) {
   return info;
 };
 
-struct FontFaceGlyphBoundsCache::Pool {
-  FontFace fontFace;
-  RC<CTFont> ctFont;
-  Int cacheCount{};
-  Vector<Malloced<FontFaceGlyphBoundsCache>> unusedCaches{};
-};
+const CachedFontInfo& LocalFontInfoCache::get_slowPath(CTFont* font) {
+  Int i = 1;
+  while (i < entryCount && entries_[i].font != font) {
+    ++i;
+  }
+  Entry entry;
+  if (i < entryCount) {
+    entry = entries_[i];
+  } else {
+    // Reuse the info slot of the least recently used entry.
+    i = entryCount - 1;
+    entry = Entry{font, entries_[i].infoIndex};
+    infos_[entry.infoIndex].info = CachedFontInfo::get(font);
+    globalLookupCount_ += 1;
+  }
+  for (; i > 0; --i) {
+    entries_[i] = entries_[i - 1];
+  }
+  entries_[0] = entry;
+  return infos_[entry.infoIndex].info;
+}
+
+/// The lookup counts of the destroyed LocalFontInfoCache instances.
+_Atomic(UInt64) localFontInfoCacheLookupCount;
+_Atomic(UInt64) localFontInfoCacheGlobalLookupCount;
 
+void LocalFontInfoCache::addLookupCountsToGlobalStatistics() const {
+  atomic_fetch_add_explicit(&localFontInfoCacheLookupCount, sign_cast(lookupCount_),
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&localFontInfoCacheGlobalLookupCount, sign_cast(globalLookupCount_),
+                            memory_order_relaxed);
+}
 
 class GlyphBoundsCache {
-  using Pool = FontFaceGlyphBoundsCache::Pool;
 public:
-  HashSet<Malloced<Pool>, Malloc> poolsByFontFace{uninitialized};
+  HashSet<Malloced<FontFaceGlyphBoundsCache>, Malloc> cachesByFontFace{uninitialized};
+  UInt64 useCounter{};
+  Int evictionCount{};
+  /// The footprint after the last call of evictLeastRecentlyUsed. If the caches that are in use
+  /// alone exceed the byte budget, the budget enforcement waits until the footprint has grown past
+  /// this value before it scans the caches again.
+  Int byteSizeAfterLastEviction{};
+
+#if STU_USE_PERSISTENT_FONT_CACHE
+  void appendPersistableGlyphBounds(Vector<PersistentFontCache::GlyphBoundsEntry>&) const;
+#endif
+
+  Int byteSize() const;
 
   STU_NO_INLINE
   void clear() {
-    poolsByFontFace.filterAndRehash(MinBucketCount{8}, [](const Malloced<Pool>& poolPtr) {
-      Pool& pool = *poolPtr;
-      pool.cacheCount -= pool.unusedCaches.count();
-      pool.unusedCaches.removeAll();
-      return pool.cacheCount != 0;
+    cachesByFontFace.filterAndRehash(MinBucketCount{8},
+                                     [](const Malloced<FontFaceGlyphBoundsCache>& cache) {
+      return cache->referenceCount_ != 0;
     });
+    byteSizeAfterLastEviction = 0;
   }
+
+  /// Removes the least recently used caches that aren't currently in use until the footprint is no
+  /// greater than the specified size (or no unused cache is left).
+  void evictLeastRecentlyUsed(Int maxByteSize);
 };
 
 stu_mutex glyphBoundsCacheMutex = STU_MUTEX_INIT;
@@ -237,22 +390,100 @@ Byte glyphBoundsCacheStorage[sizeof(GlyphBoundsCache)];
 // To inspect the glyph bounds cache in the debugger add the following watch expression:
 // (stu_label::GlyphBoundsCache&)stu_label::glyphBoundsCacheStorage
 
+/// Only accessed while holding glyphBoundsCacheMutex.
+Int glyphBoundsCacheByteBudget = STU_GLYPH_BOUNDS_CACHE_BYTE_BUDGET;
+
+/// The sum of the byte sizes of all font face caches. Since pages are allocated while only holding
+/// an insertion mutex, this counter is updated atomically.
+_Atomic(Int) glyphBoundsCacheFontFacesByteSize;
+
+Int GlyphBoundsCache::byteSize() const {
+  return sign_cast(sizeof(GlyphBoundsCache)
+                   + sign_cast(cachesByFontFace.buckets().count())
+                     *sizeof(decltype(cachesByFontFace)::Bucket))
+       + atomic_load_explicit(&glyphBoundsCacheFontFacesByteSize, memory_order_relaxed);
+}
+
+STU_NO_INLINE
+void GlyphBoundsCache::evictLeastRecentlyUsed(Int maxByteSize) {
+  Int size = byteSize();
+  byteSizeAfterLastEviction = size;
+  if (size <= maxByteSize) return;
+  struct Candidate {
+    UInt64 lastUseTime;
+    Int byteSize;
+  };
+  Vector<Candidate> candidates;
+  for (const auto& bucket : cachesByFontFace.buckets()) {
+    if (bucket.isEmpty()) continue;
+    const FontFaceGlyphBoundsCache& cache = *bucket.key();
+    if (cache.referenceCount_ != 0) continue;
+    candidates.append(Candidate{cache.lastUseTime_, cache.byteSize()});
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate& lhs, const Candidate& rhs) {
+              return lhs.lastUseTime < rhs.lastUseTime;
+            });
+  // The use times are unique, so exactly the first n candidates have a use time no greater than
+  // maxEvictedUseTime.
+  Int n = 0;
+  UInt64 maxEvictedUseTime = 0;
+  for (const Candidate& candidate : candidates) {
+    if (size <= maxByteSize) break;
+    size -= candidate.byteSize;
+    maxEvictedUseTime = candidate.lastUseTime;
+    ++n;
+  }
+  if (n == 0) return;
+  cachesByFontFace.filterAndRehash(MinBucketCount{8},
+                                   [&](const Malloced<FontFaceGlyphBoundsCache>& cache) {
+    return cache->referenceCount_ != 0 || cache->lastUseTime_ > maxEvictedUseTime;
+  });
+  evictionCount += n;
+  byteSizeAfterLastEviction = byteSize();
+}
+
+/// The mutexes used for serializing the insertions into the font face caches. A cache uses the
+/// mutex selected by the hash of its address, so that insertions into the caches of different
+/// font faces usually don't contend for the same mutex.
+stu_mutex glyphBoundsInsertionMutexes[8] = {STU_MUTEX_INIT, STU_MUTEX_INIT,
+                                            STU_MUTEX_INIT, STU_MUTEX_INIT,
+                                            STU_MUTEX_INIT, STU_MUTEX_INIT,
+                                            STU_MUTEX_INIT, STU_MUTEX_INIT};
+
+static stu_mutex& glyphBoundsInsertionMutex(const FontFaceGlyphBoundsCache& cache) {
+  return glyphBoundsInsertionMutexes[hashPointer(&cache).value
+                                     % arrayLength(glyphBoundsInsertionMutexes)];
+}
+
 /// @pre glyphBoundsCacheMutex must be locked by the current thread.
 static void initGlyphBoundsCache() {
   STU_ASSERT(!glyphBoundsCacheIsInitialized);
   glyphBoundsCacheIsInitialized = true;
   GlyphBoundsCache& glyphBoundsCache = *new (glyphBoundsCacheStorage) GlyphBoundsCache{};
-  glyphBoundsCache.poolsByFontFace.initializeWithBucketCount(8);
+  glyphBoundsCache.cachesByFontFace.initializeWithBucketCount(8);
 
-  NSNotificationCenter* const notificationCenter = NSNotificationCenter.defaultCenter;
-  NSOperationQueue* const mainQueue = NSOperationQueue.mainQueue;
-  const auto clearCacheBlock = ^(NSNotification*) {
-    FontFaceGlyphBoundsCache::clearGlobalCache();
-  };
-  [notificationCenter addObserverForName:UIApplicationDidEnterBackgroundNotification
-                                  object:nil queue:mainQueue usingBlock:clearCacheBlock];
-  [notificationCenter addObserverForName:UIApplicationDidReceiveMemoryWarningNotification
-                                  object:nil queue:mainQueue usingBlock:clearCacheBlock];
+  [NSNotificationCenter.defaultCenter
+     addObserverForName:UIApplicationDidReceiveMemoryWarningNotification
+                 object:nil queue:NSOperationQueue.mainQueue
+             usingBlock:^(NSNotification*) {
+               stu_mutex_lock(&glyphBoundsCacheMutex);
+               glyphBoundsCache.evictLeastRecentlyUsed(
+                                  lowWatermarkByteSize(glyphBoundsCacheByteBudget));
+               stu_mutex_unlock(&glyphBoundsCacheMutex);
+             }];
+  registerDidEnterBackgroundObserver();
+}
+
+/// @pre glyphBoundsCacheMutex must be locked by the current thread.
+STU_INLINE
+static void enforceGlyphBoundsCacheByteBudget(GlyphBoundsCache& cache) {
+  const Int size = cache.byteSize();
+  if (STU_UNLIKELY(size > glyphBoundsCacheByteBudget)
+      && size > cache.byteSizeAfterLastEviction)
+  {
+    cache.evictLeastRecentlyUsed(evictionTargetByteSize(glyphBoundsCacheByteBudget));
+  }
 }
 
 void FontFaceGlyphBoundsCache::clearGlobalCache() {
@@ -278,44 +509,60 @@ void FontFaceGlyphBoundsCache::exchange(InOut<UniquePtr> inOutArg, FontRef font,
   UniquePtr& inOutCache = inOutArg;
   STU_PRECONDITION(fontFace.cgFont);
   const HashCode<UInt> hashCode = fontFace.hash();
+  FontFaceGlyphBoundsCache* const oldCache = std::move(inOutCache).toRawPointer();
   stu_mutex_lock(&glyphBoundsCacheMutex);
   if (STU_UNLIKELY(!glyphBoundsCacheIsInitialized)) {
     initGlyphBoundsCache();
   }
   GlyphBoundsCache& glyphBoundsCache = reinterpret_cast<GlyphBoundsCache&>(glyphBoundsCacheStorage);
-  if (inOutCache) { // Return the cache to its pool.
-    inOutCache->pool_.unusedCaches.append(Malloced{std::move(inOutCache).toRawPointer()});
+  if (oldCache) { // Release the reference to the old cache.
+    oldCache->referenceCount_ -= 1;
+    oldCache->lastUseTime_ = ++glyphBoundsCache.useCounter;
   }
-  const auto isEqualFontFace = [&](const Malloced<Pool>& entry) {
-    return fontFace == entry->fontFace;
-  };
-  // Get the reference to the existing pool for the font face,
-  // or insert a new pool and return the reference.
-  const auto result = glyphBoundsCache.poolsByFontFace.insert(
-                        hashCode, isEqualFontFace,
-                        [&] { return mallocNew<Pool>(std::move(fontFace), font.ctFont()); }
-                      );
-  Pool& pool = *result.value;
-  Malloced<FontFaceGlyphBoundsCache> cache = nullptr;
-  if (pool.unusedCaches.isEmpty()) { // We'll create the cache after unlocking the mutex.
-    pool.cacheCount += 1;
-  } else {
-    cache = result.value->unusedCaches.popLast();
+  FontFaceGlyphBoundsCache* cache = nullptr;
+  if (const auto optCache = glyphBoundsCache.cachesByFontFace.find(hashCode,
+                              [&](const Malloced<FontFaceGlyphBoundsCache>& entry) {
+                                return fontFace == entry->fontFace_;
+                              }))
+  {
+    cache = optCache->get();
   }
-  stu_mutex_unlock(&glyphBoundsCacheMutex);
-
+  Malloced<FontFaceGlyphBoundsCache> newCache;
   if (!cache) {
-    cache = mallocNew<FontFaceGlyphBoundsCache>(pool);
+    // Creating a new cache involves loading the persisted glyph bounds pages, which may require
+    // file system access, so we construct the cache without holding the global mutex. If another
+    // thread inserts a cache for the same font face in the meantime, we use that one instead and
+    // destroy the new cache after unlocking the mutex.
+    stu_mutex_unlock(&glyphBoundsCacheMutex);
+    newCache = mallocNew<FontFaceGlyphBoundsCache>(font, std::move(fontFace));
+    stu_mutex_lock(&glyphBoundsCacheMutex);
+    const auto result = glyphBoundsCache.cachesByFontFace.insert(
+                          hashCode,
+                          [&](const Malloced<FontFaceGlyphBoundsCache>& entry) {
+                            return newCache->fontFace_ == entry->fontFace_;
+                          },
+                          [&] { return std::move(newCache); }
+                        );
+    cache = result.value.get();
   }
+  cache->referenceCount_ += 1;
+  cache->lastUseTime_ = ++glyphBoundsCache.useCounter;
+  enforceGlyphBoundsCacheByteBudget(glyphBoundsCache);
+  stu_mutex_unlock(&glyphBoundsCacheMutex);
+  // If newCache is still non-null here, another thread won the race and newCache is destroyed
+  // outside the mutex.
 
   STU_DEBUG_ASSERT(!inOutCache);
   inOutCache.assumeIsNull();
-  inOutCache = UniquePtr{std::move(cache).toRawPointer()};
+  inOutCache = UniquePtr{cache};
 }
 
 void FontFaceGlyphBoundsCache::returnToGlobalPool(FontFaceGlyphBoundsCache* __nonnull cache) noexcept {
   stu_mutex_lock(&glyphBoundsCacheMutex);
-  cache->pool_.unusedCaches.append(Malloced{cache});
+  GlyphBoundsCache& glyphBoundsCache = reinterpret_cast<GlyphBoundsCache&>(glyphBoundsCacheStorage);
+  cache->referenceCount_ -= 1;
+  cache->lastUseTime_ = ++glyphBoundsCache.useCounter;
+  enforceGlyphBoundsCacheByteBudget(glyphBoundsCache);
   stu_mutex_unlock(&glyphBoundsCacheMutex);
 }
 
@@ -324,11 +571,14 @@ void FontFaceGlyphBoundsCache
      ::returnToGlobalPool(ArrayRef<FontFaceGlyphBoundsCache* __nullable const> caches)
 {
   stu_mutex_lock(&glyphBoundsCacheMutex);
+  GlyphBoundsCache& glyphBoundsCache = reinterpret_cast<GlyphBoundsCache&>(glyphBoundsCacheStorage);
   for (const auto cache : caches) {
     if (cache) {
-      cache->pool_.unusedCaches.append(Malloced{cache});
+      cache->referenceCount_ -= 1;
+      cache->lastUseTime_ = ++glyphBoundsCache.useCounter;
     }
   }
+  enforceGlyphBoundsCacheByteBudget(glyphBoundsCache);
   stu_mutex_unlock(&glyphBoundsCacheMutex);
 }
 
@@ -416,92 +666,132 @@ static CGPoint scaledAppleColorEmojiOffset(bool isAppleColorEmojiUI, CGFloat fon
   return {x, y};
 }
 
-FontFaceGlyphBoundsCache::InitData::InitData(Pool& pool)
-: pool{pool},
-  font{pool.ctFont.get()},
-  unitsPerEM{static_cast<CGFloat>(CTFontGetUnitsPerEm(font.ctFont()))},
+FontFaceGlyphBoundsCache::InitData::InitData(FontRef font, const FontFace& fontFace)
+: unitsPerEM{static_cast<CGFloat>(CTFontGetUnitsPerEm(font.ctFont()))},
   offset{},
-  isAppleColorEmoji{pool.fontFace.isAppleColorEmoji},
-  useIntBounds{pool.fontFace.fontMatrixIsIdentity}
+  pageCount{(CTFontGetGlyphCount(font.ctFont()) + (pageSize - 1))/pageSize}
 {
-  if (!isAppleColorEmoji) {
+  if (!fontFace.isAppleColorEmoji) {
     pointsPerUnit = font.size()/unitsPerEM;
-  } else if (!useIntBounds) {
+  } else if (!fontFace.fontMatrixIsIdentity) {
     pointsPerUnit = 1;
   } else {
-    const CGFloat fontSize = pool.fontFace.appleColorEmojiSize;
+    const CGFloat fontSize = fontFace.appleColorEmojiSize;
     pointsPerUnit = effectiveAppleColorEmojiFontSize(fontSize)/unitsPerEM;
-    offset = scaledAppleColorEmojiOffset(pool.fontFace.isAppleColorEmojiUI, fontSize,
-                                         pointsPerUnit);
+    offset = scaledAppleColorEmojiOffset(fontFace.isAppleColorEmojiUI, fontSize, pointsPerUnit);
   }
 }
 
-FontFaceGlyphBoundsCache::FontFaceGlyphBoundsCache(InitData data)
-: pool_{data.pool},
-  font_{pool_.ctFont.get()},
+#if CGFLOAT_IS_DOUBLE
+  using CGFloat4 = simd_double4;
+#else
+  using CGFloat4 = simd_float4;
+#endif
+
+struct FontFaceGlyphBoundsCache::Page {
+  /// The bit patterns of the Rect<Int16> glyph bounds, or of one of the two special values
+  /// notYetCachedIntBounds and floatBoundsMarker.
+  _Atomic(UInt64) intBounds[pageSize];
+  /// Is null until the bounds of a glyph in this page have to be stored as floats.
+  _Atomic(FloatPage*) floatPage;
+};
+
+struct FontFaceGlyphBoundsCache::FloatPage {
+  Rect<Float32> bounds[pageSize];
+};
+
+// Since minValue<Int16> is never used as the coordinate of an Int16 glyph bounds rect, the
+// following values can't be confused with actual bounds.
+
+/// The placeholder for glyphs whose bounds haven't been cached yet.
+static constexpr Rect<Int16> notYetCachedIntBounds = {Range{minValue<Int16>, minValue<Int16>},
+                                                      Range{minValue<Int16>, minValue<Int16>}};
+/// Indicates that the glyph's bounds are stored in the float page.
+static constexpr Rect<Int16> floatBoundsMarker = {Range{minValue<Int16>, maxValue<Int16>},
+                                                  Range{minValue<Int16>, maxValue<Int16>}};
+
+FontFaceGlyphBoundsCache::FontFaceGlyphBoundsCache(InitData data, FontRef font,
+                                                   FontFace&& fontFace)
+: fontFace_{std::move(fontFace)},
+  font_{font.ctFont()},
   unitsPerEM_{data.unitsPerEM},
   pointsPerUnit_{data.pointsPerUnit},
   inversePointsPerUnit_{1/pointsPerUnit_},
   scaledIntBoundsOffset_{data.offset},
-  isAppleColorEmoji_{data.isAppleColorEmoji},
-  usesIntBounds_{data.useIntBounds}
+  isAppleColorEmoji_{fontFace_.isAppleColorEmoji},
+  pageCount_{data.pageCount},
+  pages_{Malloc{}.allocate<_Atomic(Page*)>(data.pageCount)}
 {
-  if (usesIntBounds_) {
-    new (&intBoundsByGlyphIndex_) decltype(intBoundsByGlyphIndex_){uninitialized};
-    intBoundsByGlyphIndex_.initializeWithBucketCount(64);
-  } else {
-    new (&floatBoundsByGlyphIndex_) decltype(floatBoundsByGlyphIndex_){uninitialized};
-    floatBoundsByGlyphIndex_.initializeWithBucketCount(64);
+  for (Int i = 0; i < pageCount_; ++i) {
+    atomic_init(&pages_[i], nullptr);
   }
+  atomic_init(&byteSize_, Int{0});
+  addAllocatedByteSize(sign_cast(sizeof(FontFaceGlyphBoundsCache)
+                                 + sign_cast(pageCount_)*sizeof(_Atomic(Page*))));
+#if STU_USE_PERSISTENT_FONT_CACHE
+  // Only Int16 bounds are persisted, which we only use for fonts with an identity matrix.
+  if (!fontFace_.fontMatrixIsIdentity) return;
+  // The new cache isn't yet visible to other threads, so we don't need to lock the insertion mutex.
+  PersistentFontCache::forEachGlyphBoundsPageInGlobalCache(font, fontFace_.appleColorEmojiSize,
+    [&](const PersistentFontCache::GlyphBoundsPage& persistedPage)
+  {
+    if (Int{persistedPage.index} >= pageCount_) return;
+    Page& page = pageForInsertion(narrow_cast<CGGlyph>(Int{persistedPage.index}*pageSize));
+    for (Int i = 0; i < pageSize; ++i) {
+      const UInt64 bits = persistedPage.intBounds[i];
+      if (bits == bit_cast<UInt64>(notYetCachedIntBounds)
+          || bits == bit_cast<UInt64>(floatBoundsMarker))
+      {
+        continue;
+      }
+      atomic_store_explicit(&page.intBounds[i], bits, memory_order_relaxed);
+      ++intBoundsCount_;
+    }
+  });
+#endif
 }
 
 FontFaceGlyphBoundsCache::~FontFaceGlyphBoundsCache() {
-  if (usesIntBounds_) {
-    intBoundsByGlyphIndex_.~HashTable();
-  } else {
-    floatBoundsByGlyphIndex_.~HashTable();
+  atomic_fetch_sub_explicit(&glyphBoundsCacheFontFacesByteSize, byteSize(), memory_order_relaxed);
+  for (Int i = 0; i < pageCount_; ++i) {
+    Page* const page = atomic_load_explicit(&pages_[i], memory_order_relaxed);
+    if (!page) continue;
+    if (FloatPage* const floatPage = atomic_load_explicit(&page->floatPage, memory_order_relaxed)) {
+      Malloc{}.deallocate(floatPage);
+    }
+    Malloc{}.deallocate(page);
   }
+  Malloc{}.deallocate(pages_, pageCount_);
 }
 
-void FontFaceGlyphBoundsCache::switchToFloatBounds() {
-  STU_ASSERT(usesIntBounds_);
-
-  const auto oldTable = std::move(intBoundsByGlyphIndex_);
+void FontFaceGlyphBoundsCache::addAllocatedByteSize(Int size) {
+  atomic_fetch_add_explicit(&byteSize_, size, memory_order_relaxed);
+  atomic_fetch_add_explicit(&glyphBoundsCacheFontFacesByteSize, size, memory_order_relaxed);
+}
 
-  // Change the active member of the union.
-  intBoundsByGlyphIndex_.~HashTable();
-  new (&floatBoundsByGlyphIndex_) decltype(floatBoundsByGlyphIndex_){uninitialized};
-  floatBoundsByGlyphIndex_.initializeWithBucketCount(oldTable.buckets().count());
+STU_INLINE
+auto FontFaceGlyphBoundsCache::page(CGGlyph glyph) const -> const Page* {
+  STU_DEBUG_ASSERT(glyph < pageCount_*pageSize);
+  return atomic_load_explicit(&pages_[glyph/pageSize], memory_order_acquire);
+}
 
-  // If isAppleColorEmoji_, we only use the cache for a single font size. So, when storing the
-  // bounds as floats, it's preferable not to apply any transformation to the values returned
-  // CTFontGetBoundingRectsForGlyphs. Hence, if isAppleColorEmoji_, we undo the transformation for
-  // any previously stored bounds and then set pointsPerUnit_ to 1 and scaledIntBoundsOffset_ to 0.
-
-  if (oldTable.count()) {
-    for (auto& bucket : oldTable.buckets()) {
-      if (!bucket.isEmpty()) {
-        Rect<Float32> r;
-        if (!isAppleColorEmoji_) {
-          r = bucket.value;
-        } else {
-          r = narrow_cast<Rect<Float32>>(pointsPerUnit_*bucket.value + scaledIntBoundsOffset_);
-        }
-        floatBoundsByGlyphIndex_.insertNew(bucket.key(), r);
-      }
+auto FontFaceGlyphBoundsCache::pageForInsertion(CGGlyph glyph) -> Page& {
+  STU_DEBUG_ASSERT(glyph < pageCount_*pageSize);
+  _Atomic(Page*)& pagePointer = pages_[glyph/pageSize];
+  Page* page = atomic_load_explicit(&pagePointer, memory_order_relaxed);
+  if (!page) {
+    page = Malloc{}.allocate<Page>(1);
+    for (auto& intBounds : page->intBounds) {
+      atomic_init(&intBounds, bit_cast<UInt64>(notYetCachedIntBounds));
     }
+    atomic_init(&page->floatPage, nullptr);
+    // The release store publishes the initialized page to the lock-free readers.
+    atomic_store_explicit(&pagePointer, page, memory_order_release);
+    addAllocatedByteSize(Int{sizeof(Page)});
   }
-
-  usesIntBounds_ = false;
-  if (isAppleColorEmoji_) {
-    pointsPerUnit_ = 1;
-    inversePointsPerUnit_ = 1;
-    scaledIntBoundsOffset_ = Point<CGFloat>{};
-  }
+  return *page;
 }
 
-auto FontFaceGlyphBoundsCache::fontFace() const -> const FontFace& { return pool_.fontFace; }
-
 /// Indicates whether r1 is equal to the reference rect r2 with close to maximum accuracy.
 STU_INLINE
 static bool isBoundsRectEqualToRectWithHighAccuracy(Rect<CGFloat> r1, Rect<CGFloat> r2) {
@@ -512,151 +802,287 @@ static bool isBoundsRectEqualToRectWithHighAccuracy(Rect<CGFloat> r1, Rect<CGFlo
       && abs(r2.y.end   - r1.y.end)   <= eps*max(abs(r2.y.end), r2.height());
 }
 
+void FontFaceGlyphBoundsCache::insert(CGGlyph glyph, CGRect glyphBounds) {
+  Page& page = pageForInsertion(glyph);
+  _Atomic(UInt64)& intBounds = page.intBounds[glyph%pageSize];
+  if (atomic_load_explicit(&intBounds, memory_order_relaxed)
+      != bit_cast<UInt64>(notYetCachedIntBounds))
+  {
+    return; // Another thread inserted the bounds after our lookup.
+  }
+  const Rect<CGFloat> bounds = Rect{glyphBounds.origin - scaledIntBoundsOffset_, glyphBounds.size}
+                             * inversePointsPerUnit_;
+  if (STU_LIKELY(fontFace_.fontMatrixIsIdentity)) {
+    // Before storing the bounds as Int16 values check that the bounds were derived from the integer
+    // font space coordinates as expected.
+    const Rect<CGFloat> r = bounds.roundedToNearbyInt();
+    if (STU_LIKELY(
+        // Can the rounded coordinates be represented with 16-bit signed integers?
+        // (minValue<Int16> is reserved for the special values.)
+           min(min(r.x.start, r.x.end), min(r.y.start, r.y.end)) > minValue<Int16>
+        && max(max(r.x.start, r.x.end), max(r.y.start, r.y.end)) <= maxValue<Int16>
+        // Do we get back the original bounds when applying the inverse transform to r?
+        && isBoundsRectEqualToRectWithHighAccuracy(pointsPerUnit_*r + scaledIntBoundsOffset_,
+                                                   glyphBounds)
+      #if STU_DEBUG
+        && intBoundsCount_ < maxIntBoundsCount_
+      #endif
+        ))
+    {
+      atomic_store_explicit(&intBounds, bit_cast<UInt64>(narrow_cast<Rect<Int16>>(r)),
+                            memory_order_release);
+      ++intBoundsCount_;
+      return;
+    }
+  }
+  FloatPage* floatPage = atomic_load_explicit(&page.floatPage, memory_order_relaxed);
+  if (!floatPage) {
+    floatPage = Malloc{}.allocate<FloatPage>(1);
+    atomic_store_explicit(&page.floatPage, floatPage, memory_order_relaxed);
+    addAllocatedByteSize(Int{sizeof(FloatPage)});
+  }
+  // If isAppleColorEmoji_, we only use the cache for a single font size. So, when storing the
+  // bounds as floats, it's preferable not to apply any transformation to the values returned by
+  // CTFontGetBoundingRectsForGlyphs.
+  floatPage->bounds[glyph%pageSize] = narrow_cast<Rect<Float32>>(
+                                        isAppleColorEmoji_ ? Rect<CGFloat>{glyphBounds} : bounds);
+  // The release store publishes the float bounds to the lock-free readers.
+  atomic_store_explicit(&intBounds, bit_cast<UInt64>(floatBoundsMarker), memory_order_release);
+  ++floatBoundsCount_;
+}
+
+#if STU_USE_PERSISTENT_FONT_CACHE
+
+void GlyphBoundsCache::appendPersistableGlyphBounds(
+                         Vector<PersistentFontCache::GlyphBoundsEntry>& entries) const
+{
+  for (const auto& bucket : cachesByFontFace.buckets()) {
+    if (bucket.isEmpty()) continue;
+    const FontFaceGlyphBoundsCache& cache = *bucket.key();
+    if (!cache.fontFace_.fontMatrixIsIdentity) continue;
+    PersistentFontCache::GlyphBoundsEntry entry{cache.font_, cache.fontFace_.appleColorEmojiSize,
+                                                {}};
+    for (Int i = 0; i < cache.pageCount_; ++i) {
+      const FontFaceGlyphBoundsCache::Page* const page =
+        atomic_load_explicit(&cache.pages_[i], memory_order_acquire);
+      if (!page) continue;
+      PersistentFontCache::GlyphBoundsPage& persistedPage = entry.pages.append(uninitialized);
+      persistedPage.index = narrow_cast<UInt32>(i);
+      persistedPage.reserved = 0;
+      for (Int j = 0; j < FontFaceGlyphBoundsCache::pageSize; ++j) {
+        const UInt64 bits = atomic_load_explicit(&page->intBounds[j], memory_order_acquire);
+        // Float bounds aren't persisted.
+        persistedPage.intBounds[j] = bits != bit_cast<UInt64>(floatBoundsMarker) ? bits
+                                   : bit_cast<UInt64>(notYetCachedIntBounds);
+      }
+    }
+    if (entry.pages.isEmpty()) continue;
+    entries.append(std::move(entry));
+  }
+}
+
+#endif
+
+/// Passes the contents of the global font info and glyph bounds caches to the persistent font
+/// cache and then trims the caches to their low watermarks.
+static void saveAndTrimGlobalFontCaches() {
+#if STU_USE_PERSISTENT_FONT_CACHE
+  Vector<PersistentFontCache::FontInfoEntry> fontInfos;
+  Vector<PersistentFontCache::GlyphBoundsEntry> glyphBounds;
+#endif
+  stu_mutex_lock(&fontInfoCacheMutex);
+  if (fontInfoCacheIsInitialized) {
+    FontInfoCache& cache = reinterpret_cast<FontInfoCache&>(fontInfoCacheStorage);
+  #if STU_USE_PERSISTENT_FONT_CACHE
+    for (const FontInfoCache::Entry& entry : cache.entries) {
+      fontInfos.append(PersistentFontCache::FontInfoEntry{RC<CTFont>{entry.font.ctFont()},
+                                                          entry.info});
+    }
+  #endif
+    cache.evictLeastRecentlyUsed(lowWatermarkByteSize(fontInfoCacheByteBudget));
+  }
+  stu_mutex_unlock(&fontInfoCacheMutex);
+  stu_mutex_lock(&glyphBoundsCacheMutex);
+  if (glyphBoundsCacheIsInitialized) {
+    GlyphBoundsCache& cache = reinterpret_cast<GlyphBoundsCache&>(glyphBoundsCacheStorage);
+  #if STU_USE_PERSISTENT_FONT_CACHE
+    cache.appendPersistableGlyphBounds(glyphBounds);
+  #endif
+    cache.evictLeastRecentlyUsed(lowWatermarkByteSize(glyphBoundsCacheByteBudget));
+  }
+  stu_mutex_unlock(&glyphBoundsCacheMutex);
+#if STU_USE_PERSISTENT_FONT_CACHE
+  PersistentFontCache::updateGlobalCacheInBackground(std::move(fontInfos), std::move(glyphBounds));
+#endif
+}
+
+/// Registers a single observer for both global font caches, so that the persistent font cache
+/// receives the contents of both caches before they are trimmed.
+static void registerDidEnterBackgroundObserver() {
+  static Once once;
+  once.initialize(nullptr, [](void*) {
+    [NSNotificationCenter.defaultCenter
+       addObserverForName:UIApplicationDidEnterBackgroundNotification
+                   object:nil queue:NSOperationQueue.mainQueue
+               usingBlock:^(NSNotification*) {
+                 saveAndTrimGlobalFontCaches();
+               }];
+  });
+}
+
+/// @param fontInfoCacheBudget The new budget, or none to keep the current one.
+/// @param glyphBoundsCacheBudget The new budget, or none to keep the current one.
+static void trimGlobalFontCaches(Optional<Int> fontInfoCacheBudget,
+                                 Optional<Int> glyphBoundsCacheBudget,
+                                 Int (* __nonnull targetByteSize)(Int byteBudget))
+{
+  stu_mutex_lock(&fontInfoCacheMutex);
+  if (fontInfoCacheBudget) {
+    fontInfoCacheByteBudget = *fontInfoCacheBudget;
+  }
+  if (fontInfoCacheIsInitialized) {
+    reinterpret_cast<FontInfoCache&>(fontInfoCacheStorage)
+      .evictLeastRecentlyUsed(targetByteSize(fontInfoCacheByteBudget));
+  }
+  stu_mutex_unlock(&fontInfoCacheMutex);
+  stu_mutex_lock(&glyphBoundsCacheMutex);
+  if (glyphBoundsCacheBudget) {
+    glyphBoundsCacheByteBudget = *glyphBoundsCacheBudget;
+  }
+  if (glyphBoundsCacheIsInitialized) {
+    reinterpret_cast<GlyphBoundsCache&>(glyphBoundsCacheStorage)
+      .evictLeastRecentlyUsed(targetByteSize(glyphBoundsCacheByteBudget));
+  }
+  stu_mutex_unlock(&glyphBoundsCacheMutex);
+}
+
+void trimGlobalFontCachesToLowWatermarks() {
+  trimGlobalFontCaches(none, none, lowWatermarkByteSize);
+}
+
+bool FontFaceGlyphBoundsCache::usesIntBounds() const {
+  stu_mutex& mutex = glyphBoundsInsertionMutex(*this);
+  stu_mutex_lock(&mutex);
+  const bool result = fontFace_.fontMatrixIsIdentity && floatBoundsCount_ == 0;
+  stu_mutex_unlock(&mutex);
+  return result;
+}
+
+void FontFaceGlyphBoundsCache::preloadLatin1GlyphBounds(FontRef font) {
+  // The printable ASCII and Latin-1 Supplement characters.
+  UniChar characters[(0x7F - 0x20) + (0x100 - 0xA0)];
+  Int n = 0;
+  for (UniChar c = 0x20; c < 0x7F; ++c) {
+    characters[n++] = c;
+  }
+  for (UniChar c = 0xA0; c < 0x100; ++c) {
+    characters[n++] = c;
+  }
+  STU_DEBUG_ASSERT(n == arrayLength(characters));
+  // Characters not supported by the font are mapped to glyph 0.
+  CGGlyph glyphs[arrayLength(characters)];
+  CTFontGetGlyphsForCharacters(font.ctFont(), characters, glyphs, n);
+  const CGPoint positions[arrayLength(characters)] = {};
+  const CGFloat fontSize = font.size();
+  UniquePtr cache;
+  exchange(InOut{cache}, font, FontFace{font, fontSize});
+  cache->boundingRect(fontSize, ArrayRef{glyphs}, positions);
+}
+
 Rect<CGFloat> FontFaceGlyphBoundsCache::boundingRect(const CGFloat fontSize,
                                                      const ArrayRef<const CGGlyph> glyphs,
                                                      const CGPoint* const positions)
 {
-  /// The scanGlyphs function fills this vector with the glyph array indices of the glyphs
-  /// whose bounds haven't yet been cached. If the same glyph occurs more than once, the index for
-  /// every occurance other than the first is inverted, i.e. multiplied by -1.
+  /// The glyph array indices of the glyphs whose bounds haven't yet been cached.
   TempVector<Int32> remaining{freeCapacityInCurrentThreadLocalAllocatorBuffer};
 
-  /// The number of different remaining glyphs, which may be less than remaining.count().
-  Int newGlyphCount = 0;
-
-  STU_DEBUG_ASSERT(!isAppleColorEmoji_ || fontSize == pool_.fontFace.appleColorEmojiSize);
-  CGFloat pointsPerUnit = isAppleColorEmoji_ ? pointsPerUnit_ : fontSize/unitsPerEM_;
+  STU_DEBUG_ASSERT(!isAppleColorEmoji_ || fontSize == fontFace_.appleColorEmojiSize);
+  const CGFloat intPointsPerUnit = isAppleColorEmoji_ ? pointsPerUnit_ : fontSize/unitsPerEM_;
+  // The float bounds of emoji glyphs are stored untransformed, see insert.
+  const CGFloat floatPointsPerUnit = isAppleColorEmoji_ ? 1 : intPointsPerUnit;
 
   Rect<CGFloat> rect = Rect<CGFloat>::infinitelyEmpty();
 
-  enum class BoundsAreInt : bool {}; // A "strong typedef" used in lieue of a named argument.
+  // The union of the positioned Int16 glyph bounds is accumulated in the vector
+  // {minX, minY, -maxX, -maxY}, so that it can be updated with a single vector min operation.
+  CGFloat4 intRect = infinity<CGFloat>;
+  const CGFloat4 intScale = {intPointsPerUnit, intPointsPerUnit,
+                             -intPointsPerUnit, -intPointsPerUnit};
 
-  const auto extendRect = [&](/* Rect */ auto glyphBounds, BoundsAreInt boundsAreInt,
-                              Int positionIndex) STU_INLINE_LAMBDA
-  {
-    if (glyphBounds.isEmpty()) return;
+  /// Returns false if the bounds of the glyph haven't been cached yet.
+  const auto extendRect = [&](CGGlyph glyph, Int positionIndex) STU_INLINE_LAMBDA -> bool {
+    const Page* const page = this->page(glyph);
+    if (!page) return false;
+    const UInt64 bits = atomic_load_explicit(&page->intBounds[glyph%pageSize],
+                                             memory_order_acquire);
     Point<CGFloat> offset = positions[positionIndex];
-    if (boundsAreInt == BoundsAreInt{true}) {
+    if (STU_LIKELY(bits != bit_cast<UInt64>(floatBoundsMarker))) {
+      if (bits == bit_cast<UInt64>(notYetCachedIntBounds)) return false;
+      if (bit_cast<Rect<Int16>>(bits).isEmpty()) return true;
       offset += scaledIntBoundsOffset_;
+      // {x.start, x.end, y.start, y.end} -> {x.start, y.start, x.end, y.end}
+      const CGFloat4 glyphBounds = __builtin_convertvector(bit_cast<simd_short4>(bits),
+                                                           CGFloat4).xzyw;
+      // We don't fuse the multiplication and addition, so that the result is exactly the same as
+      // with scalar code.
+      const CGFloat4 scaledBounds = intScale*glyphBounds;
+      const CGFloat4 positionedBounds = scaledBounds + CGFloat4{offset.x, offset.y,
+                                                                -offset.x, -offset.y};
+      intRect = simd_min(intRect, positionedBounds);
+    } else {
+      const FloatPage* const floatPage = atomic_load_explicit(&page->floatPage,
+                                                              memory_order_relaxed);
+      const Rect<Float32> glyphBounds = floatPage->bounds[glyph%pageSize];
+      if (glyphBounds.isEmpty()) return true;
+      rect = rect.convexHull(floatPointsPerUnit*glyphBounds + offset);
     }
-    rect = rect.convexHull(pointsPerUnit*glyphBounds + offset);
+    return true;
   };
 
   if (fontSize > 0) {
-    static constexpr Rect<Int16> intPlaceholder = {Range{minValue<Int16>, minValue<Int16>},
-                                                   Range{minValue<Int16>, minValue<Int16>}};
-    static constexpr Rect<Float32> floatPlaceholder = Rect<Float32>::infinitelyEmpty();
-    const auto scanGlyphs = [&](auto& boundsByGlyph, const auto& placeholder) STU_INLINE_LAMBDA {
-      for (Int i = 0; i < glyphs.count(); ++i) {
-        // Look up the glyph in the hash table
-        // and if it doesn't yet have an entry, insert a placeholder value.
-        const CGGlyph glyph = glyphs[i];
-        if (glyph == maxValue<CGGlyph>) {
-          static_assert(maxValue<CGGlyph> == kCGFontIndexInvalid);
-          // CTRunGetGlyphs sometimes returns an invalid glyph (with code kCGFontIndexInvalid) with
-          // a zero width. Since this value is used as a reserved value in the boundsByGlyph
-          // HashTable, we have to filter it out here if we don't want to run into an assertion
-          // error in the insert, see https://github.com/stephan-tolksdorf/STULabel/issues/20
-          // Chromium also contains code handling CTRunGetGlyphs returning invalid glyphs, see
-          // https://chromium.googlesource.com/chromium/src/+/59fe54df8c0de55f03c8fb5e1860279d2993b473/ui/gfx/render_text_mac.mm#389
-          continue;
-        }
-          
-        const auto result = boundsByGlyph.insert(glyph, isEqualTo(glyph),
-                                                 [&] { return placeholder; });
-        if (!result.inserted && result.value.x.end != placeholder.x.end) {
-          // If there was already a non-placeholder entry for the glyph, extend the bounding rect
-          // for the positioned glyph.
-          extendRect(result.value, BoundsAreInt{isInteger<decltype(placeholder.x.start)>}, i);
-        } else {
-          // We don't yet have cached bounds for this glyph.
-          newGlyphCount += result.inserted;
-          remaining.append(result.inserted ? narrow_cast<Int32>(i) : -narrow_cast<Int32>(i));
-        }
+    const Int glyphLimit = pageCount_*pageSize;
+    for (Int i = 0; i < glyphs.count(); ++i) {
+      const CGGlyph glyph = glyphs[i];
+      if (glyph >= glyphLimit) {
+        // Glyphs outside the font's glyph range have no bounds. This includes the invalid glyph
+        // (with code kCGFontIndexInvalid) with a zero width that CTRunGetGlyphs sometimes returns,
+        // see https://github.com/stephan-tolksdorf/STULabel/issues/20
+        // Chromium also contains code handling CTRunGetGlyphs returning invalid glyphs, see
+        // https://chromium.googlesource.com/chromium/src/+/59fe54df8c0de55f03c8fb5e1860279d2993b473/ui/gfx/render_text_mac.mm#389
+        static_assert(maxValue<CGGlyph> == kCGFontIndexInvalid);
+        continue;
+      }
+      if (!extendRect(glyph, i)) {
+        remaining.append(narrow_cast<Int32>(i));
       }
-    };
-    if (STU_LIKELY(usesIntBounds_)) {
-      scanGlyphs(intBoundsByGlyphIndex_, intPlaceholder);
-    } else {
-      scanGlyphs(floatBoundsByGlyphIndex_, floatPlaceholder);
     }
   }
   remaining.trimFreeCapacity();
   if (STU_UNLIKELY(!remaining.isEmpty())) {
-    // Fetch the bounds for the non-duplicate new glyphs.
-    TempArray<CGRect> newBounds{uninitialized, Count{newGlyphCount}, remaining.allocator()};
-    TempArray<CGGlyph> newGlyphs{uninitialized, Count{newGlyphCount}, remaining.allocator()};
-    TempArray<Int32> newGlyphIndices{uninitialized, Count{newGlyphCount}, remaining.allocator()};
-    {
-      Int k = 0;
-      for (auto i : remaining) {
-        if (i >= 0) { // A negative index indicates a duplicate occurence of a new glyph.
-          newGlyphs[k] = glyphs[i];
-          newGlyphIndices[k] = i;
-          ++k;
-        }
-      }
-      STU_ASSERT(k == newGlyphCount);
+    // Fetch the bounds for the distinct new glyphs without holding a lock.
+    TempArray<CGGlyph> newGlyphs{uninitialized, Count{remaining.count()}, remaining.allocator()};
+    for (Int k = 0; k < remaining.count(); ++k) {
+      newGlyphs[k] = glyphs[remaining[k]];
     }
-    CTFontGetBoundingRectsForGlyphs(font_.ctFont(), kCTFontOrientationHorizontal,
+    std::sort(newGlyphs.begin(), newGlyphs.end());
+    const Int newGlyphCount = std::unique(newGlyphs.begin(), newGlyphs.end()) - newGlyphs.begin();
+    TempArray<CGRect> newBounds{uninitialized, Count{newGlyphCount}, remaining.allocator()};
+    CTFontGetBoundingRectsForGlyphs(font_.get(), kCTFontOrientationHorizontal,
                                     newGlyphs.begin(), newBounds.begin(), newGlyphCount);
-    for (Int k = 0; k < newGlyphs.count(); ++k) {
-      const CGGlyph glyph = newGlyphs[k];
-      Rect<CGFloat> bounds = Rect{newBounds[k].origin - scaledIntBoundsOffset_,
-                                  newBounds[k].size}
-                             * inversePointsPerUnit_;
-      if (STU_LIKELY(usesIntBounds_)) {
-        // Before inserting the bounds into intBoundsByGlyphIndex_ check that the bounds were
-        // derived from the integer font space coordinates as expected.
-        const Rect<CGFloat> r = bounds.roundedToNearbyInt();
-        if (STU_LIKELY(
-            // Can the rounded coordinates be represented with 16-bit signed integers?
-               min(min(r.x.start, r.x.end), min(r.y.start, r.y.end)) >= minValue<Int16>
-            && max(max(r.x.start, r.x.end), max(r.y.start, r.y.end)) <= maxValue<Int16>
-            // Do we get back the original bounds when applying the inverse transform to r?
-            && isBoundsRectEqualToRectWithHighAccuracy(pointsPerUnit_*r + scaledIntBoundsOffset_,
-                                                       newBounds[k])
-          #if STU_DEBUG
-            && intBoundsByGlyphIndex_.count() < maxIntBoundsCount_
-          #endif
-            ))
-        {
-          *intBoundsByGlyphIndex_.find(glyph, isEqualTo(glyph)) = narrow_cast<Rect<Int16>>(r);
-          extendRect(r, BoundsAreInt{true}, newGlyphIndices[k]);
-          continue;
-        }
-        switchToFloatBounds();
-        if (isAppleColorEmoji_) {
-          STU_DEBUG_ASSERT(pointsPerUnit_ == 1 && scaledIntBoundsOffset_ == Point<CGFloat>{});
-          pointsPerUnit = 1;
-          bounds = newBounds[k];
-        } else {
-          STU_DEBUG_ASSERT(pointsPerUnit == pointsPerUnit_);
-        }
-      }
-      // !usesIntBounds_
-      const Rect<Float32> bounds_f32 = narrow_cast<Rect<Float32>>(bounds);
-      *floatBoundsByGlyphIndex_.find(glyph, isEqualTo(glyph)) = bounds_f32;
-      extendRect(bounds_f32, BoundsAreInt{false}, newGlyphIndices[k]);
+    // Insert the new bounds in a single batch.
+    stu_mutex& mutex = glyphBoundsInsertionMutex(*this);
+    stu_mutex_lock(&mutex);
+    for (Int k = 0; k < newGlyphCount; ++k) {
+      insert(newGlyphs[k], newBounds[k]);
     }
-    if (newGlyphCount < remaining.count()) {
-      const auto extendRectForRemainingGlyphs = [&](auto& boundsByGlyph) STU_INLINE_LAMBDA {
-        for (auto i : remaining) {
-          // We already adjusted the bounding rect for the non-duplicate new glyphs.
-          if (i >= 0) continue; // Indices of duplicate glyph occurences are multiplied by -1.
-          i = -i;
-          const CGGlyph glyph = glyphs[i];
-          const auto bounds = *boundsByGlyph.find(glyph, isEqualTo(glyph));
-          extendRect(bounds, BoundsAreInt{isInteger<decltype(bounds.x.start)>}, i);
-        }
-      };
-      if (STU_LIKELY(usesIntBounds_)) {
-        extendRectForRemainingGlyphs(intBoundsByGlyphIndex_);
-      } else {
-        extendRectForRemainingGlyphs(floatBoundsByGlyphIndex_);
-      }
+    stu_mutex_unlock(&mutex);
+    for (const Int32 i : remaining) {
+      const bool isCached = extendRect(glyphs[i], i);
+      STU_DEBUG_ASSERT(isCached);
+      discard(isCached);
     }
   }
+  rect = rect.convexHull(Rect{Range{intRect.x, -intRect.z}, Range{intRect.y, -intRect.w}});
   if (rect.x.start == Range<CGFloat>::infinitelyEmpty().start) {
     rect = Rect<CGFloat>{};
   }
@@ -744,3 +1170,43 @@ void LocalGlyphBoundsCache::glyphBoundsCacheFor_slowPath(FontRef font) {
 
 } // namespace stu_label
 
+using namespace stu_label;
+
+STU_EXPORT
+void stu_setFontCacheByteBudgets(size_t fontInfoCacheBudget, size_t glyphBoundsCacheBudget) {
+  const auto clampedBudget = [](size_t budget) -> Int {
+    return sign_cast(min(budget, sign_cast(maxValue<Int>)));
+  };
+  trimGlobalFontCaches(clampedBudget(fontInfoCacheBudget), clampedBudget(glyphBoundsCacheBudget),
+                       [](Int byteBudget) { return byteBudget; });
+}
+
+STU_EXPORT
+STUFontCacheStatistics stu_fontCacheStatistics(void) {
+  STUFontCacheStatistics stats = {};
+  const UInt64 localLookupCount = atomic_load_explicit(&localFontInfoCacheLookupCount,
+                                                       memory_order_relaxed);
+  const UInt64 localMissCount = atomic_load_explicit(&localFontInfoCacheGlobalLookupCount,
+                                                     memory_order_relaxed);
+  // The two counters are updated separately, so the miss count may briefly be ahead.
+  stats.localFontInfoCacheMissCount = localMissCount;
+  stats.localFontInfoCacheHitCount = localLookupCount - min(localMissCount, localLookupCount);
+  stu_mutex_lock(&fontInfoCacheMutex);
+  if (fontInfoCacheIsInitialized) {
+    const FontInfoCache& cache = reinterpret_cast<const FontInfoCache&>(fontInfoCacheStorage);
+    stats.fontInfoCount = sign_cast(cache.entries.count());
+    stats.fontInfoByteSize = sign_cast(cache.byteSize());
+    stats.fontInfoEvictionCount = sign_cast(cache.evictionCount);
+  }
+  stu_mutex_unlock(&fontInfoCacheMutex);
+  stu_mutex_lock(&glyphBoundsCacheMutex);
+  if (glyphBoundsCacheIsInitialized) {
+    const GlyphBoundsCache& cache =
+      reinterpret_cast<const GlyphBoundsCache&>(glyphBoundsCacheStorage);
+    stats.glyphBoundsFontFaceCount = sign_cast(cache.cachesByFontFace.count());
+    stats.glyphBoundsByteSize = sign_cast(cache.byteSize());
+    stats.glyphBoundsEvictionCount = sign_cast(cache.evictionCount);
+  }
+  stu_mutex_unlock(&glyphBoundsCacheMutex);
+  return stats;
+}
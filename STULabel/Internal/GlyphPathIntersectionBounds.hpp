@@ -29,4 +29,45 @@ LowerAndUpperInterval findXBoundsOfPathIntersectionWithHorizontalLines(
                         Range<CGFloat> lowerLineY, Range<CGFloat> upperLineY,
                         CGFloat maxError);
 
+/// @brief Finds the x-axis bounds of the intersection of glyph paths with one or two horizontal
+///        lines, using a global cache.
+///
+/// The cache stores the intersection bounds in font units. The keys consist of the graphics font,
+/// the glyph and the y-intervals and maximum error quantized to 1/4 font unit. Since the underline
+/// position and thickness scale with the font size, the cached bounds of a glyph can usually be
+/// reused for all occurrences of the glyph in underlined text with the same font face and size.
+///
+/// The cache is cleared when it grows too large, when the app enters the background and when the
+/// app receives a memory warning.
+class GlyphPathIntersectionBounds {
+public:
+  /// Fonts with a non-identity font matrix are not supported by the cache, see `isCacheable`.
+  explicit GlyphPathIntersectionBounds(CTFont* font);
+
+  ~GlyphPathIntersectionBounds();
+
+  GlyphPathIntersectionBounds(const GlyphPathIntersectionBounds&) = delete;
+  GlyphPathIntersectionBounds& operator=(const GlyphPathIntersectionBounds&) = delete;
+
+  STU_INLINE_T
+  bool isCacheable() const { return cgFont_ != nullptr; }
+
+  /// Equivalent to calling `findXBoundsOfPathIntersectionWithHorizontalLines` with the glyph's
+  /// path, except that the y-intervals and the returned x-intervals are relative to the glyph
+  /// origin (in an LLO coordinate system) and that the y-intervals are quantized.
+  ///
+  /// @pre `isCacheable()`
+  LowerAndUpperInterval find(CGGlyph glyph,
+                             Range<CGFloat> lowerLineY, Range<CGFloat> upperLineY,
+                             CGFloat maxError) const;
+
+  static void clearGlobalCache();
+
+private:
+  CTFont* font_;
+  CGFont* cgFont_{};
+  CGFloat pointsPerUnit_;
+  CGFloat quantizationStepsPerPoint_;
+};
+
 } // namespace stu_label
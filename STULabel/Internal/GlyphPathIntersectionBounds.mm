@@ -2,7 +2,14 @@
 
 #import "GlyphPathIntersectionBounds.hpp"
 
+#import "STULabel/stu_mutex.h"
+
 #import "CoreGraphicsUtils.hpp"
+#import "Equal.hpp"
+#import "Hash.hpp"
+#import "HashTable.hpp"
+
+#import "stu/Vector.hpp"
 
 namespace stu_label {
 
@@ -175,4 +182,201 @@ LowerAndUpperInterval findXBoundsOfPathIntersectionWithHorizontalLines(
   return {.lower = state.xis.lower, .upper = state.xis.upper};
 }
 
+/// The quantization step for the cache keys in font units.
+static constexpr CGFloat glyphPathIntersectionBoundsQuantizationStep = 0.25f;
+
+struct GlyphPathIntersectionBoundsKey {
+  CGFont* cgFont;
+  CGGlyph glyph;
+  Int32 maxError;
+  Range<Int32> lowerLineY;
+  Range<Int32> upperLineY;
+
+  HashCode<UInt64> hash() const {
+    return stu_label::hash(reinterpret_cast<UInt64>(cgFont), glyph, maxError,
+                           lowerLineY.start, lowerLineY.end, upperLineY.start, upperLineY.end);
+  }
+
+  friend bool operator==(const GlyphPathIntersectionBoundsKey& lhs,
+                         const GlyphPathIntersectionBoundsKey& rhs)
+  {
+    return lhs.cgFont == rhs.cgFont
+        && lhs.glyph == rhs.glyph
+        && lhs.maxError == rhs.maxError
+        && lhs.lowerLineY == rhs.lowerLineY
+        && lhs.upperLineY == rhs.upperLineY;
+  }
+};
+
+struct GlyphPathIntersectionBoundsCache {
+  struct Entry {
+    GlyphPathIntersectionBoundsKey key;
+    HashCode<UInt64> hashCode;
+    /// In font units.
+    Range<Float32> lower;
+    /// In font units.
+    Range<Float32> upper;
+  };
+
+  static constexpr Int maxEntryCount = 1 << 14;
+
+  Vector<Entry> entries;
+  HashSet<UInt32, Malloc> indices{uninitialized};
+
+  STU_NO_INLINE
+  void clear() {
+    for (auto& entry : entries.reversed()) {
+      CFRelease(entry.key.cgFont);
+    }
+    entries.removeAll();
+    indices.removeAll();
+  }
+};
+
+stu_mutex glyphPathIntersectionBoundsCacheMutex = STU_MUTEX_INIT;
+bool glyphPathIntersectionBoundsCacheIsInitialized = false;
+alignas(GlyphPathIntersectionBoundsCache)
+Byte glyphPathIntersectionBoundsCacheStorage[sizeof(GlyphPathIntersectionBoundsCache)];
+
+/// @pre glyphPathIntersectionBoundsCacheMutex must be locked by the current thread.
+static GlyphPathIntersectionBoundsCache& glyphPathIntersectionBoundsCache() {
+  if (STU_UNLIKELY(!glyphPathIntersectionBoundsCacheIsInitialized)) {
+    glyphPathIntersectionBoundsCacheIsInitialized = true;
+    GlyphPathIntersectionBoundsCache& cache =
+      *new (glyphPathIntersectionBoundsCacheStorage) GlyphPathIntersectionBoundsCache{};
+    cache.indices.initializeWithBucketCount(64);
+    cache.entries.ensureFreeCapacity(32);
+
+    NSNotificationCenter* const notificationCenter = NSNotificationCenter.defaultCenter;
+    NSOperationQueue* const mainQueue = NSOperationQueue.mainQueue;
+    const auto clearCacheBlock = ^(NSNotification*) {
+      GlyphPathIntersectionBounds::clearGlobalCache();
+    };
+    [notificationCenter addObserverForName:UIApplicationDidEnterBackgroundNotification
+                                    object:nil queue:mainQueue usingBlock:clearCacheBlock];
+    [notificationCenter addObserverForName:UIApplicationDidReceiveMemoryWarningNotification
+                                    object:nil queue:mainQueue usingBlock:clearCacheBlock];
+  }
+  return reinterpret_cast<GlyphPathIntersectionBoundsCache&>(
+           glyphPathIntersectionBoundsCacheStorage);
+}
+
+void GlyphPathIntersectionBounds::clearGlobalCache() {
+  stu_mutex_lock(&glyphPathIntersectionBoundsCacheMutex);
+  if (glyphPathIntersectionBoundsCacheIsInitialized) {
+    reinterpret_cast<GlyphPathIntersectionBoundsCache&>(glyphPathIntersectionBoundsCacheStorage)
+    .clear();
+  }
+  stu_mutex_unlock(&glyphPathIntersectionBoundsCacheMutex);
+}
+
+GlyphPathIntersectionBounds::GlyphPathIntersectionBounds(CTFont* font)
+: font_{font}
+{
+  const CGFloat fontSize = CTFontGetSize(font);
+  const unsigned unitsPerEm = CTFontGetUnitsPerEm(font);
+  if (!(fontSize > 0 && unitsPerEm > 0)) return;
+  pointsPerUnit_ = fontSize/unitsPerEm;
+  quantizationStepsPerPoint_ = 1/(pointsPerUnit_*glyphPathIntersectionBoundsQuantizationStep);
+  if (CTFontGetMatrix(font) != CGAffineTransformIdentity) return;
+  cgFont_ = CTFontCopyGraphicsFont(font, nullptr);
+}
+
+GlyphPathIntersectionBounds::~GlyphPathIntersectionBounds() {
+  if (cgFont_) {
+    CFRelease(cgFont_);
+  }
+}
+
+static LowerAndUpperInterval findXBoundsOfGlyphPathIntersectionWithHorizontalLines(
+                               CTFont* font, CGGlyph glyph, const CGAffineTransform* matrix,
+                               Range<CGFloat> lowerLineY, Range<CGFloat> upperLineY,
+                               CGFloat maxError)
+{
+  const CGPathRef path = CTFontCreatePathForGlyph(font, glyph, matrix);
+  if (!path) {
+    return {Range<CGFloat>::infinitelyEmpty(), Range<CGFloat>::infinitelyEmpty()};
+  }
+  const LowerAndUpperInterval xis = findXBoundsOfPathIntersectionWithHorizontalLines(
+                                      path, lowerLineY, upperLineY, maxError);
+  CFRelease(path);
+  return xis;
+}
+
+LowerAndUpperInterval GlyphPathIntersectionBounds::find(
+                        CGGlyph glyph, Range<CGFloat> lowerLineY, Range<CGFloat> upperLineY,
+                        CGFloat maxError) const
+{
+  STU_DEBUG_ASSERT(isCacheable());
+  const CGFloat q = quantizationStepsPerPoint_;
+  if (STU_UNLIKELY(!(max(abs(lowerLineY.start), abs(upperLineY.end), maxError)*q < (1 << 30)))) {
+    return findXBoundsOfGlyphPathIntersectionWithHorizontalLines(font_, glyph, nullptr,
+                                                                  lowerLineY, upperLineY, maxError);
+  }
+  const auto quantize = [q](CGFloat value) -> Int32 { return narrow_cast<Int32>(lrint(value*q)); };
+  const GlyphPathIntersectionBoundsKey key = {
+    .cgFont = cgFont_,
+    .glyph = glyph,
+    .maxError = max(1, quantize(maxError)),
+    .lowerLineY = {quantize(lowerLineY.start), quantize(lowerLineY.end)},
+    .upperLineY = {quantize(upperLineY.start), quantize(upperLineY.end)}
+  };
+  const HashCode<UInt64> hashCode = key.hash();
+
+  Range<Float32> lower;
+  Range<Float32> upper;
+  {
+    stu_mutex_lock(&glyphPathIntersectionBoundsCacheMutex);
+    GlyphPathIntersectionBoundsCache& cache = glyphPathIntersectionBoundsCache();
+    const auto isEqualKey = [&](const UInt32 index) {
+      const auto& entry = cache.entries[index];
+      return hashCode == entry.hashCode && key == entry.key;
+    };
+    if (const auto optIndex = cache.indices.find(hashCode, isEqualKey)) {
+      const auto& entry = cache.entries[*optIndex];
+      lower = entry.lower;
+      upper = entry.upper;
+      stu_mutex_unlock(&glyphPathIntersectionBoundsCacheMutex);
+      return {.lower = Range<CGFloat>{lower}*pointsPerUnit_,
+              .upper = Range<CGFloat>{upper}*pointsPerUnit_};
+    }
+    stu_mutex_unlock(&glyphPathIntersectionBoundsCacheMutex);
+  }
+
+  // We compute the intersection bounds for the quantized lines in font units, so that the cached
+  // value doesn't depend on which of the lines mapping to the same key is computed first.
+  const CGFloat step = glyphPathIntersectionBoundsQuantizationStep;
+  const CGAffineTransform unitsMatrix = CGAffineTransformMakeScale(1/pointsPerUnit_,
+                                                                   1/pointsPerUnit_);
+  const LowerAndUpperInterval xis = findXBoundsOfGlyphPathIntersectionWithHorizontalLines(
+                                      font_, glyph, &unitsMatrix,
+                                      step*Range<CGFloat>{key.lowerLineY},
+                                      step*Range<CGFloat>{key.upperLineY},
+                                      step*key.maxError);
+  lower = Range<Float32>{xis.lower};
+  upper = Range<Float32>{xis.upper};
+
+  CFRetain(cgFont_);
+  stu_mutex_lock(&glyphPathIntersectionBoundsCacheMutex);
+  GlyphPathIntersectionBoundsCache& cache = glyphPathIntersectionBoundsCache();
+  if (STU_UNLIKELY(cache.entries.count() == GlyphPathIntersectionBoundsCache::maxEntryCount)) {
+    cache.clear();
+  }
+  const UInt32 index = narrow_cast<UInt32>(cache.entries.count());
+  const auto isEqualKey = [&](const UInt32 index) {
+    const auto& entry = cache.entries[index];
+    return hashCode == entry.hashCode && key == entry.key;
+  };
+  const bool inserted = cache.indices.insert(hashCode, index, isEqualKey).inserted;
+  if (inserted) {
+    cache.entries.append(GlyphPathIntersectionBoundsCache::Entry{key, hashCode, lower, upper});
+  }
+  stu_mutex_unlock(&glyphPathIntersectionBoundsCacheMutex);
+  if (!inserted) {
+    CFRelease(cgFont_);
+  }
+  return {.lower = Range<CGFloat>{lower}*pointsPerUnit_,
+          .upper = Range<CGFloat>{upper}*pointsPerUnit_};
+}
+
 } // namespace stu_label
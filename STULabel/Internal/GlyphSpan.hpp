@@ -396,6 +396,18 @@ public:
     return stringIndicesArray_slowPath(run_, Range{startIndex_, Count{count()}});
   }
 
+  STU_INLINE
+  AdvancesArray advancesArray() const {
+    const Int count = this->count();
+    if (STU_UNLIKELY(count == 0)) {
+      return AdvancesArray{{}, none};
+    }
+    if (const CGSize* const p = run_.advancesPointer()) {
+      return {{p + startIndex_, count}, none};
+    }
+    return advancesArray_slowPath(run_, Range{startIndex_, Count{count}});
+  }
+
   // Note: Don't use advances for determining the typographic width. Use typographicWidth() instead.
   // An advance 'width' can be negative and a negative advance width that is less than minus the
   // typographic offset of the glyph within the run may increase the typographic width of the run to
@@ -0,0 +1,142 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "NSAttributedStringRef.hpp"
+
+#include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+@class STUHyphenationPatterns;
+
+namespace stu_label {
+
+using CFLocale = RemovePointer<CFLocaleRef>;
+
+/// A view of the compact trie encoding of Liang hyphenation patterns that is stored in the compiled
+/// data of a `STUHyphenationPatterns` instance.
+///
+/// The data consists of a header followed by the arrays
+///   UInt32 nodeEdgeStarts[nodeCount + 1];
+///   UInt32 nodeValueStarts[nodeCount + 1];
+///   UInt32 edgeTargets[edgeCount];
+///   Char16 edgeChars[edgeCount];
+///   UInt8  values[valueCount];
+/// The root node has index 0. The outgoing edges of a node are sorted by their UTF-16 char and the
+/// target of an edge always has a greater index than its source, since the nodes are stored in
+/// breadth-first order. The values of the node reached with the pattern letters p[0..<k] are the
+/// pattern's digits for the k + 1 positions before, between and after the letters, with trailing
+/// zeros omitted.
+class HyphenationPatterns {
+public:
+  struct Header {
+    UInt32 magic;
+    UInt16 version;
+    UInt8 leftHyphenMin;
+    UInt8 rightHyphenMin;
+    UInt32 nodeCount;
+    UInt32 edgeCount;
+    UInt32 valueCount;
+  };
+  static constexpr UInt32 magic = 0x48555453; // "STUH" in little-endian byte order
+  static constexpr UInt16 version = 1;
+
+  /// Creates an invalid instance that must not be used.
+  HyphenationPatterns() = default;
+
+  /// Returns none if the data is not a valid encoding.
+  /// @pre The data must be 4-byte aligned and must outlive the returned instance.
+  static Optional<HyphenationPatterns> create(ArrayRef<const Byte> data);
+
+  /// Compiles TeX-formatted patterns and exceptions (as described in STUHyphenationPatterns.h).
+  /// Returns nil if a pattern or exception is malformed.
+  static NSData* __nullable compile(NSString* patterns, NSString* __nullable exceptions,
+                                    Int leftHyphenMin, Int rightHyphenMin);
+
+  STU_INLINE Int leftHyphenMin() const { return header_->leftHyphenMin; }
+  STU_INLINE Int rightHyphenMin() const { return header_->rightHyphenMin; }
+
+  /// Lowercases the word in place and then appends the offsets of the hyphenation locations in
+  /// the word in increasing order. Doesn't return locations before a low surrogate or a char that
+  /// extends a grapheme cluster.
+  void findHyphenationLocations(ArrayRef<Char16> word, CFLocale* __nullable locale,
+                                TempVector<Int32>& offsets) const;
+
+private:
+  /// Returns the target node of the edge with the specified char, or -1.
+  STU_INLINE Int32 child(Int32 node, Char16 c) const;
+
+  const Header* header_{};
+  const UInt32* nodeEdgeStarts_{};
+  const UInt32* nodeValueStarts_{};
+  const UInt32* edgeTargets_{};
+  const Char16* edgeChars_{};
+  const UInt8* values_{};
+};
+
+/// Caches the CFLocale instance and the registered `STUHyphenationPatterns` for the most recently
+/// used hyphenation locale identifier.
+class HyphenationLocaleCache {
+  RC<CFString> localeId_;
+  RC<CFLocale> locale_;
+  STUHyphenationPatterns* patternsObject_; // arc
+  const HyphenationPatterns* patterns_{};
+public:
+  struct Language {
+    /// Null if the locale identifier couldn't be parsed, or if no patterns are registered for it
+    /// and `CFStringGetHyphenationLocationBeforeIndex` doesn't support it.
+    CFLocale* __nullable locale;
+    /// The patterns registered for the locale identifier, if any.
+    const HyphenationPatterns* __nullable patterns;
+
+    STU_INLINE bool isAvailable() const { return locale || patterns; }
+  };
+
+  /// Returns a language that isn't available if the identifier is empty or if hyphenation is not
+  /// available for the locale.
+  Language languageForId(CFString* localeId);
+};
+
+struct HyphenationLocation {
+  Int32 index;
+  Char32 hyphen;
+};
+
+/// The hyphenation locations of a paragraph, as determined by the registered
+/// `STUHyphenationPatterns` or by `CFStringGetHyphenationLocationBeforeIndex` for the locales
+/// specified with the `STUHyphenationLocaleIdentifierAttributeName` attribute.
+///
+/// Computing all locations of a paragraph at once is considerably cheaper than repeatedly asking
+/// Core Foundation for the last location in a line, since Core Foundation has to re-tokenize the
+/// word for every query and the text layout of a paragraph may be calculated multiple times with
+/// different widths.
+class HyphenationLocations {
+  Int32 count_;
+  HyphenationLocation locations_[];
+
+  explicit HyphenationLocations(Int32 count) : count_{count} {}
+
+public:
+  HyphenationLocations(const HyphenationLocations&) = delete;
+  HyphenationLocations& operator=(const HyphenationLocations&) = delete;
+
+  /// Returns a shared instance with no hyphenation locations, which must not be destroyed.
+  static const HyphenationLocations& empty();
+
+  /// @pre paragraphRange ⊆ [0, attributedString.string.count())
+  static const HyphenationLocations& create(const NSAttributedStringRef& attributedString,
+                                            Range<Int> paragraphRange,
+                                            HyphenationLocaleCache& localeCache);
+
+  static void destroy(const HyphenationLocations& locations);
+
+  /// The locations in increasing index order.
+  STU_INLINE
+  ArrayRef<const HyphenationLocation> locations() const {
+    return {locations_, count_, unchecked};
+  }
+
+  /// Returns the locations l with range.start < l.index < range.end, in increasing index order.
+  ArrayRef<const HyphenationLocation> locationsStrictlyInside(Range<Int> range) const;
+};
+
+} // namespace stu_label
+
+#include "UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
@@ -0,0 +1,504 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "Hyphenation.hpp"
+
+#import "STULabel/STUHyphenationPatterns-Internal.hpp"
+#import "STULabel/STUTextAttributes.h"
+
+#import "Kerning.hpp"
+#import "ThreadLocalAllocator.hpp"
+
+#import "stu/BinarySearch.hpp"
+
+#include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+namespace stu_label {
+
+Optional<HyphenationPatterns> HyphenationPatterns::create(ArrayRef<const Byte> data) {
+  STU_ASSERT(reinterpret_cast<UInt>(data.begin())%alignof(UInt32) == 0);
+  if (sign_cast(data.count()) < sizeof(Header)) return none;
+  const Header& header = *reinterpret_cast<const Header*>(data.begin());
+  if (header.magic != magic || header.version != version) return none;
+  const UInt64 nodeCount = header.nodeCount;
+  const UInt64 edgeCount = header.edgeCount;
+  if (nodeCount == 0) return none;
+  const UInt64 size = sizeof(Header) + 2*sizeof(UInt32)*(nodeCount + 1)
+                    + (sizeof(UInt32) + sizeof(Char16))*edgeCount + header.valueCount;
+  if (size != sign_cast(data.count())) return none;
+
+  HyphenationPatterns patterns;
+  patterns.header_ = &header;
+  patterns.nodeEdgeStarts_ = reinterpret_cast<const UInt32*>(&header + 1);
+  patterns.nodeValueStarts_ = patterns.nodeEdgeStarts_ + (nodeCount + 1);
+  patterns.edgeTargets_ = patterns.nodeValueStarts_ + (nodeCount + 1);
+  patterns.edgeChars_ = reinterpret_cast<const Char16*>(patterns.edgeTargets_ + edgeCount);
+  patterns.values_ = reinterpret_cast<const UInt8*>(patterns.edgeChars_ + edgeCount);
+
+  if (patterns.nodeEdgeStarts_[0] != 0 || patterns.nodeEdgeStarts_[nodeCount] != edgeCount
+      || patterns.nodeValueStarts_[0] != 0
+      || patterns.nodeValueStarts_[nodeCount] != header.valueCount)
+  {
+    return none;
+  }
+  for (UInt32 node = 0; node < nodeCount; ++node) {
+    const UInt32 edgeStart = patterns.nodeEdgeStarts_[node];
+    const UInt32 edgeEnd = patterns.nodeEdgeStarts_[node + 1];
+    if (edgeStart > edgeEnd || edgeEnd > edgeCount) return none;
+    if (patterns.nodeValueStarts_[node] > patterns.nodeValueStarts_[node + 1]) return none;
+    for (UInt32 e = edgeStart; e < edgeEnd; ++e) {
+      const UInt32 target = patterns.edgeTargets_[e];
+      if (target <= node || target >= nodeCount) return none;
+      if (e > edgeStart && patterns.edgeChars_[e - 1] >= patterns.edgeChars_[e]) return none;
+    }
+  }
+  for (UInt32 i = 0; i < header.valueCount; ++i) {
+    if (patterns.values_[i] > 9) return none;
+  }
+  return patterns;
+}
+
+STU_INLINE
+Int32 HyphenationPatterns::child(Int32 node, Char16 c) const {
+  const Int32 start = narrow_cast<Int32>(nodeEdgeStarts_[node]);
+  const Int32 end = narrow_cast<Int32>(nodeEdgeStarts_[node + 1]);
+  if (end - start <= 8) {
+    for (Int32 e = start; e < end; ++e) {
+      if (edgeChars_[e] == c) return narrow_cast<Int32>(edgeTargets_[e]);
+      if (edgeChars_[e] > c) break;
+    }
+    return -1;
+  }
+  const ArrayRef<const Char16> chars{edgeChars_ + start, end - start, unchecked};
+  const Int i = binarySearchFirstIndexWhere(chars, [&](Char16 ec) { return ec >= c; })
+                .indexOrArrayCount;
+  if (i == chars.count() || chars[i] != c) return -1;
+  return narrow_cast<Int32>(edgeTargets_[start + i]);
+}
+
+/// Lowercases the word in place. Returns false if the lowercase string has a different length.
+static bool lowercase(ArrayRef<Char16> word, CFLocale* __nullable locale) {
+  bool isASCII = true;
+  for (Char16& c : word) {
+    if (c >= 0x80) {
+      isASCII = false;
+      break;
+    }
+    if ('A' <= c && c <= 'Z') {
+      c = static_cast<Char16>(c + ('a' - 'A'));
+    }
+  }
+  if (isASCII) return true;
+  const RC<RemovePointer<CFMutableStringRef>> string{CFStringCreateMutable(nil, 0),
+                                                     ShouldIncrementRefCount{false}};
+  CFStringAppendCharacters(string.get(), reinterpret_cast<const UniChar*>(word.begin()),
+                           word.count());
+  CFStringLowercase(string.get(), locale);
+  if (CFStringGetLength(string.get()) != word.count()) return false;
+  CFStringGetCharacters(string.get(), CFRange{0, word.count()},
+                        reinterpret_cast<UniChar*>(word.begin()));
+  return true;
+}
+
+void HyphenationPatterns::findHyphenationLocations(ArrayRef<Char16> word,
+                                                   CFLocale* __nullable locale,
+                                                   TempVector<Int32>& offsets) const
+{
+  const Int32 n = narrow_cast<Int32>(word.count());
+  const Int32 leftMin = max(1, header_->leftHyphenMin);
+  const Int32 rightMin = max(1, header_->rightHyphenMin);
+  if (n < leftMin + rightMin) return;
+  if (!lowercase(word, locale)) return;
+  // The patterns are matched against the word with a '.' before and after it. values[k] is the
+  // maximum pattern digit for the position before the k-th char of the padded word.
+  const Int32 m = n + 2;
+  const auto paddedChar = [&](Int32 k) -> Char16 {
+    return k == 0 || k == m - 1 ? u'.' : word[k - 1];
+  };
+  TempArray<UInt8> values{zeroInitialized, Count{m + 1}};
+  for (Int32 i = 0; i < m; ++i) {
+    Int32 node = 0;
+    for (Int32 j = i; j < m; ++j) {
+      node = child(node, paddedChar(j));
+      if (node < 0) break;
+      const Int32 valueStart = narrow_cast<Int32>(nodeValueStarts_[node]);
+      const Int32 valueCount = min(narrow_cast<Int32>(nodeValueStarts_[node + 1]) - valueStart,
+                                   j - i + 2);
+      for (Int32 k = 0; k < valueCount; ++k) {
+        values[i + k] = max(values[i + k], values_[valueStart + k]);
+      }
+    }
+  }
+  for (Int32 offset = leftMin; offset <= n - rightMin; ++offset) {
+    if (!(values[offset + 1] & 1)) continue;
+    const Char16 c = word[offset];
+    if (c >= 0x80) {
+      if (isLowSurrogate(c)) continue;
+      switch (graphemeClusterCategory(c)) {
+      case GraphemeClusterCategory::extend:
+      case GraphemeClusterCategory::spacingMark:
+      case GraphemeClusterCategory::zwj:
+        continue;
+      default:
+        break;
+      }
+    }
+    offsets.append(offset);
+  }
+}
+
+namespace {
+  struct Pattern {
+    Int32 lettersStart;
+    Int32 letterCount;
+    /// The index of the first of the letterCount + 1 values.
+    Int32 valuesStart;
+  };
+
+  struct PatternBuffer {
+    Vector<Char16> letters;
+    Vector<UInt8> values;
+    Vector<Pattern> patterns;
+
+    ArrayRef<const Char16> lettersOf(const Pattern& p) const {
+      return letters[{p.lettersStart, p.lettersStart + p.letterCount}];
+    }
+  };
+}
+
+STU_INLINE
+static bool isPatternSeparator(Char16 c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+/// Calls parseToken for every whitespace-separated token, skipping comments.
+/// Returns false if parseToken returns false.
+template <typename ParseToken>
+static bool forEachPatternToken(NSString* string, ParseToken&& parseToken) {
+  NSString* const lowercaseString = [string lowercaseString];
+  const NSStringRef str{(__bridge CFStringRef)lowercaseString};
+  const Int n = str.count();
+  for (Int i = 0; i < n;) {
+    const Char16 c = str[i];
+    if (isPatternSeparator(c)) {
+      ++i;
+      continue;
+    }
+    if (c == '%') {
+      while (i < n && !isLineTerminator(str[i])) ++i;
+      continue;
+    }
+    const Int start = i;
+    while (i < n && !isPatternSeparator(str[i]) && str[i] != '%') ++i;
+    TempArray<Char16> token{uninitialized, Count{i - start}};
+    str.copyUTF16Chars({start, i}, token);
+    if (!parseToken(ArrayRef<const Char16>{token})) return false;
+  }
+  return true;
+}
+
+static bool appendPattern(ArrayRef<const Char16> token, PatternBuffer& buffer) {
+  Pattern p{.lettersStart = narrow_cast<Int32>(buffer.letters.count()), .letterCount = 0,
+            .valuesStart = narrow_cast<Int32>(buffer.values.count())};
+  buffer.values.append(0);
+  bool previousWasDigit = false;
+  for (const Char16 c : token) {
+    if ('0' <= c && c <= '9') {
+      if (previousWasDigit) return false;
+      buffer.values[$ - 1] = narrow_cast<UInt8>(c - '0');
+      previousWasDigit = true;
+    } else {
+      buffer.letters.append(c);
+      buffer.values.append(0);
+      ++p.letterCount;
+      previousWasDigit = false;
+    }
+  }
+  if (p.letterCount == 0) return false;
+  buffer.patterns.append(p);
+  return true;
+}
+
+/// Encodes the exception "hy-phen" as the pattern ".h8y9p8h8e8n.".
+static bool appendException(ArrayRef<const Char16> token, PatternBuffer& buffer) {
+  if (token[0] == '-' || token[$ - 1] == '-') return false;
+  Pattern p{.lettersStart = narrow_cast<Int32>(buffer.letters.count()), .letterCount = 2,
+            .valuesStart = narrow_cast<Int32>(buffer.values.count())};
+  buffer.letters.append(u'.');
+  buffer.values.append(0);
+  buffer.values.append(0);
+  bool previousWasHyphen = false;
+  for (const Char16 c : token) {
+    if (c == '-') {
+      if (previousWasHyphen) return false;
+      buffer.values[$ - 1] = 9;
+      previousWasHyphen = true;
+    } else {
+      if (p.letterCount > 2 && !previousWasHyphen) {
+        buffer.values[$ - 1] = 8;
+      }
+      buffer.letters.append(c);
+      buffer.values.append(0);
+      ++p.letterCount;
+      previousWasHyphen = false;
+    }
+  }
+  buffer.letters.append(u'.');
+  buffer.values.append(0);
+  buffer.patterns.append(p);
+  return true;
+}
+
+NSData* HyphenationPatterns::compile(NSString* patternString, NSString* __nullable exceptions,
+                                     Int leftHyphenMin, Int rightHyphenMin)
+{
+  PatternBuffer buffer;
+  if (!forEachPatternToken(patternString, [&](ArrayRef<const Char16> token) {
+                             return appendPattern(token, buffer);
+                           }))
+  {
+    return nil;
+  }
+  if (exceptions
+      && !forEachPatternToken(exceptions, [&](ArrayRef<const Char16> token) {
+                                return appendException(token, buffer);
+                              }))
+  {
+    return nil;
+  }
+
+  // Sort the patterns by their letters, so that the patterns with a common prefix are adjacent
+  // and a pattern precedes all patterns it is a proper prefix of.
+  Vector<Pattern>& patterns = buffer.patterns;
+  std::sort(patterns.begin(), patterns.end(), [&](const Pattern& p1, const Pattern& p2) {
+    const ArrayRef<const Char16> letters1 = buffer.lettersOf(p1);
+    const ArrayRef<const Char16> letters2 = buffer.lettersOf(p2);
+    return std::lexicographical_compare(letters1.begin(), letters1.end(),
+                                        letters2.begin(), letters2.end());
+  });
+
+  // Build the trie in breadth-first order. Each node corresponds to the range of patterns that
+  // start with the node's prefix.
+  struct PendingNode {
+    Int32 patternsStart;
+    Int32 patternsEnd;
+    Int32 depth;
+  };
+  Vector<PendingNode> nodes;
+  Vector<UInt32> nodeEdgeStarts;
+  Vector<UInt32> nodeValueStarts;
+  Vector<UInt32> edgeTargets;
+  Vector<Char16> edgeChars;
+  Vector<UInt8> values;
+  nodes.append(PendingNode{0, narrow_cast<Int32>(patterns.count()), 0});
+  nodeEdgeStarts.append(0);
+  nodeValueStarts.append(0);
+  Vector<UInt8> nodeValues;
+  for (Int nodeIndex = 0; nodeIndex < nodes.count(); ++nodeIndex) {
+    const PendingNode node = nodes[nodeIndex];
+    Int32 i = node.patternsStart;
+    // Duplicate patterns are merged.
+    Int32 valueCount = 0;
+    for (; i < node.patternsEnd && patterns[i].letterCount == node.depth; ++i) {
+      if (valueCount == 0) {
+        valueCount = node.depth + 1;
+        nodeValues.removeAll();
+        nodeValues.append(repeat(UInt8{0}, valueCount));
+      }
+      for (Int32 k = 0; k < valueCount; ++k) {
+        nodeValues[k] = max(nodeValues[k], buffer.values[patterns[i].valuesStart + k]);
+      }
+    }
+    while (valueCount > 0 && nodeValues[valueCount - 1] == 0) {
+      --valueCount;
+    }
+    values.append(nodeValues[{0, valueCount}]);
+    nodeValueStarts.append(narrow_cast<UInt32>(values.count()));
+    while (i < node.patternsEnd) {
+      const Char16 c = buffer.lettersOf(patterns[i])[node.depth];
+      const Int32 start = i;
+      do ++i;
+      while (i < node.patternsEnd && buffer.lettersOf(patterns[i])[node.depth] == c);
+      edgeChars.append(c);
+      edgeTargets.append(narrow_cast<UInt32>(nodes.count()));
+      nodes.append(PendingNode{start, i, node.depth + 1});
+    }
+    nodeEdgeStarts.append(narrow_cast<UInt32>(edgeChars.count()));
+  }
+
+  const Header header = {
+    .magic = magic,
+    .version = version,
+    .leftHyphenMin = narrow_cast<UInt8>(clamp(0, leftHyphenMin, UINT8_MAX)),
+    .rightHyphenMin = narrow_cast<UInt8>(clamp(0, rightHyphenMin, UINT8_MAX)),
+    .nodeCount = narrow_cast<UInt32>(nodes.count()),
+    .edgeCount = narrow_cast<UInt32>(edgeChars.count()),
+    .valueCount = narrow_cast<UInt32>(values.count())
+  };
+  NSMutableData* const data = [[NSMutableData alloc]
+                                 initWithLength:sizeof(Header)
+                                                + nodeEdgeStarts.arraySizeInBytes()
+                                                + nodeValueStarts.arraySizeInBytes()
+                                                + edgeTargets.arraySizeInBytes()
+                                                + edgeChars.arraySizeInBytes()
+                                                + values.arraySizeInBytes()];
+  Byte* p = static_cast<Byte*>(data.mutableBytes);
+  memcpy(p, &header, sizeof(header));
+  p += sizeof(header);
+  memcpy(p, nodeEdgeStarts.begin(), nodeEdgeStarts.arraySizeInBytes());
+  p += nodeEdgeStarts.arraySizeInBytes();
+  memcpy(p, nodeValueStarts.begin(), nodeValueStarts.arraySizeInBytes());
+  p += nodeValueStarts.arraySizeInBytes();
+  memcpy(p, edgeTargets.begin(), edgeTargets.arraySizeInBytes());
+  p += edgeTargets.arraySizeInBytes();
+  memcpy(p, edgeChars.begin(), edgeChars.arraySizeInBytes());
+  p += edgeChars.arraySizeInBytes();
+  memcpy(p, values.begin(), values.arraySizeInBytes());
+  p += values.arraySizeInBytes();
+  STU_DEBUG_ASSERT(p == static_cast<Byte*>(data.mutableBytes) + data.length);
+  return data;
+}
+
+HyphenationLocaleCache::Language HyphenationLocaleCache::languageForId(CFString* const localeId) {
+  if (localeId == localeId_.get() || (localeId_ && CFEqual(localeId, localeId_.get()))) {
+    return {locale_.get(), patterns_};
+  }
+  localeId_ = localeId;
+  locale_ = nullptr;
+  patternsObject_ = nil;
+  patterns_ = nullptr;
+  if (CFStringGetLength(localeId) == 0) return {};
+  locale_ = RC<CFLocale>{CFLocaleCreate(nil, localeId), ShouldIncrementRefCount{false}};
+  patternsObject_ = registeredHyphenationPatterns(localeId);
+  if (patternsObject_) {
+    patterns_ = &hyphenationPatterns(patternsObject_);
+  } else if (locale_ && !CFStringIsHyphenationAvailableForLocale(locale_.get())) {
+    locale_ = nullptr;
+  }
+  return {locale_.get(), patterns_};
+}
+
+STU_INLINE
+static Int sizeInBytes(Int32 count) {
+  return sizeof(HyphenationLocations) + sizeof(HyphenationLocation)*sign_cast(count);
+}
+
+const HyphenationLocations& HyphenationLocations::empty() {
+  alignas(HyphenationLocations) static const Byte storage[sizeof(HyphenationLocations)] = {};
+  return *reinterpret_cast<const HyphenationLocations*>(storage);
+}
+
+/// Appends the hyphenation locations in the range in increasing index order.
+static void appendHyphenationLocations(const NSStringRef& string, Range<Int> range,
+                                       CFLocale* locale,
+                                       TempVector<HyphenationLocation>& locations)
+{
+  // CFStringGetHyphenationLocationBeforeIndex only considers the word containing the specified
+  // index, so we iterate over the words with a tokenizer that uses the same word boundaries.
+  const RC<RemovePointer<CFStringTokenizerRef>> tokenizer{
+    CFStringTokenizerCreate(nil, string, range, kCFStringTokenizerUnitWord, locale),
+    ShouldIncrementRefCount{false}};
+  if (!tokenizer) return;
+  while (CFStringTokenizerAdvanceToNextToken(tokenizer.get()) != kCFStringTokenizerTokenNone) {
+    const Range<Int> word = Range<Int>(CFStringTokenizerGetCurrentTokenRange(tokenizer.get()));
+    const Int wordLocationsStart = locations.count();
+    // A hyphenation location before the last char would never be a valid one anyway.
+    for (Int i = word.end - 1; i > word.start + 1;) {
+      UTF32Char hyphen;
+      const Int index = CFStringGetHyphenationLocationBeforeIndex(string, i, range, 0, locale,
+                                                                  &hyphen);
+      if (index <= word.start || index >= i) break;
+      if (hyphen == 0x2D) { // We prefer a proper hyphen, not a hyphen-minus.
+        hyphen = hyphenCodePoint;
+      }
+      locations.append(HyphenationLocation{narrow_cast<Int32>(index), hyphen});
+      i = index;
+    }
+    for (Int i = wordLocationsStart, j = locations.count() - 1; i < j; ++i, --j) {
+      std::swap(locations[i], locations[j]);
+    }
+  }
+}
+
+/// Appends the hyphenation locations in the range in increasing index order.
+static void appendHyphenationLocations(const NSStringRef& string, Range<Int> range,
+                                       CFLocale* __nullable locale,
+                                       const HyphenationPatterns& patterns,
+                                       TempVector<HyphenationLocation>& locations)
+{
+  // We use the same word boundaries as the Core Foundation implementation.
+  const RC<RemovePointer<CFStringTokenizerRef>> tokenizer{
+    CFStringTokenizerCreate(nil, string, range, kCFStringTokenizerUnitWord, locale),
+    ShouldIncrementRefCount{false}};
+  if (!tokenizer) return;
+  const Int minWordLength = max(1, patterns.leftHyphenMin()) + max(1, patterns.rightHyphenMin());
+  TempVector<Char16> word{Capacity{64}};
+  TempVector<Int32> offsets{Capacity{16}};
+  while (CFStringTokenizerAdvanceToNextToken(tokenizer.get()) != kCFStringTokenizerTokenNone) {
+    const Range<Int> wordRange = Range<Int>(CFStringTokenizerGetCurrentTokenRange(tokenizer.get()));
+    if (wordRange.count() < minWordLength) continue;
+    word.removeAll();
+    word.append(repeat(uninitialized, wordRange.count()));
+    string.copyUTF16Chars(wordRange, word);
+    offsets.removeAll();
+    patterns.findHyphenationLocations(word, locale, offsets);
+    for (const Int32 offset : offsets) {
+      locations.append(HyphenationLocation{narrow_cast<Int32>(wordRange.start + offset),
+                                           hyphenCodePoint});
+    }
+  }
+}
+
+const HyphenationLocations& HyphenationLocations::create(
+                              const NSAttributedStringRef& attributedString,
+                              Range<Int> paragraphRange, HyphenationLocaleCache& localeCache)
+{
+  TempVector<HyphenationLocation> locations{Capacity{32}};
+  TempVector<HyphenationLocation>* const pLocations = &locations;
+  HyphenationLocaleCache* const pLocaleCache = &localeCache;
+  const NSStringRef* const pString = &attributedString.string;
+  [attributedString.attributedString
+     enumerateAttribute:STUHyphenationLocaleIdentifierAttributeName
+                inRange:NSRange(paragraphRange)
+                options:0
+             usingBlock:^(__unsafe_unretained id value, NSRange nsRange, BOOL* __unused shouldStop)
+  {
+    CFString* const localeId = (__bridge CFStringRef)value;
+    if (!localeId) return;
+    const HyphenationLocaleCache::Language language = pLocaleCache->languageForId(localeId);
+    if (language.patterns) {
+      appendHyphenationLocations(*pString, Range<Int>(nsRange), language.locale,
+                                 *language.patterns, *pLocations);
+    } else if (language.locale) {
+      appendHyphenationLocations(*pString, Range<Int>(nsRange), language.locale, *pLocations);
+    }
+  }];
+  if (locations.isEmpty()) return empty();
+  const Int32 count = narrow_cast<Int32>(locations.count());
+  Byte* const p = Malloc{}.allocate(sizeInBytes(count));
+  HyphenationLocations* const result = new (p) HyphenationLocations{count};
+  array_utils::copyConstructArray(locations, result->locations_);
+  return *result;
+}
+
+void HyphenationLocations::destroy(const HyphenationLocations& locations) {
+  if (&locations == &empty()) return;
+  Malloc{}.deallocate(reinterpret_cast<Byte*>(const_cast<HyphenationLocations*>(&locations)),
+                      sizeInBytes(locations.count_));
+}
+
+ArrayRef<const HyphenationLocation>
+  HyphenationLocations::locationsStrictlyInside(Range<Int> range) const
+{
+  const ArrayRef<const HyphenationLocation> array = locations();
+  const Int start = binarySearchFirstIndexWhere(array,
+                      [&](const HyphenationLocation& l) { return l.index > range.start; }
+                    ).indexOrArrayCount;
+  const Int end = binarySearchFirstIndexWhere(array,
+                    [&](const HyphenationLocation& l) { return l.index >= range.end; }
+                  ).indexOrArrayCount;
+  return array[{start, max(start, end)}];
+}
+
+} // namespace stu_label
+
+#include "UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
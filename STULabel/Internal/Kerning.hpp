@@ -33,20 +33,38 @@ struct GlyphForKerningPurposes {
   static GlyphForKerningPurposes find(GlyphSpan, const NSAttributedStringRef&, GlyphPositionInSpan);
 };
 
+/// Determines whether the truncation code adjusts the position of the truncation token for the
+/// kerning between the token and the adjacent glyph. (The static library targets used by the tests
+/// are built with this flag enabled.)
 #ifndef STU_TRUNCATION_TOKEN_KERNING
   #define STU_TRUNCATION_TOKEN_KERNING 0
 #endif
 
 #if STU_TRUNCATION_TOKEN_KERNING
 
-// This function is currently too slow to be really useful.
-// (Because Core Text doesn't make the relevant CTFont API functions public.)
+// Determining the kerning between two glyphs requires typesetting a temporary line, because
+// Core Text doesn't make the relevant CTFont API functions public. The kerned advances are
+// therefore cached in a global cache keyed by the two fonts, glyphs and attribute dictionaries and
+// the writing direction, so that only the first truncated line with a certain glyph pair pays for
+// the typesetting.
 Optional<Float64> kerningAdjustment(const GlyphForKerningPurposes& glyph,
                                     const NSStringRef& string,
                                     const GlyphForKerningPurposes& nextGlyph,
                                     const NSStringRef& nextGlyphString);
 
-#endif
+struct KerningAdjustmentCacheStatistics {
+  Int entryCount;
+  Int hitCount;
+  Int missCount;
+};
+
+/// Thread-safe.
+KerningAdjustmentCacheStatistics kerningAdjustmentCacheStatistics();
+
+/// Thread-safe.
+void clearKerningAdjustmentCache();
+
+#endif // STU_TRUNCATION_TOKEN_KERNING
 
 constexpr Char32 hyphenCodePoint = 0x2010;
 
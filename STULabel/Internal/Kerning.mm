@@ -2,7 +2,14 @@
 
 #import "Kerning.hpp"
 
+#import "STULabel/stu_mutex.h"
+
+#import "Hash.hpp"
+#import "HashTable.hpp"
 #import "Once.hpp"
+#import "TokenLineCache.hpp"
+
+#import "stu/Vector.hpp"
 
 namespace stu_label {
 
@@ -149,19 +156,15 @@ static CFDictionaryRef typesetterOptions(bool rightToLeft) {
 
 #if STU_TRUNCATION_TOKEN_KERNING
 
-Optional<Float64> kerningAdjustment(const GlyphForKerningPurposes& glyph0,
-                                    const NSStringRef& string0,
-                                    const GlyphForKerningPurposes& glyph1,
-                                    const NSStringRef& string1)
+/// Returns the advance of the first glyph when it is followed by the second glyph in a line
+/// typeset with the specified writing direction, or none if the line doesn't consist of exactly
+/// these two glyphs with positive advances.
+static Optional<Float64> typesetKernedAdvance(const GlyphForKerningPurposes& glyph0,
+                                              const NSStringRef& string0,
+                                              const GlyphForKerningPurposes& glyph1,
+                                              const NSStringRef& string1,
+                                              const bool isRightToLeft)
 {
-  if (!glyph0.glyph || !glyph1.glyph) return none;
-
-  const BidiStrongType b0 = bidiStrongType(string0.codePointAtUTF16Index(glyph0.stringRange.start));
-  const BidiStrongType b1 = bidiStrongType(string1.codePointAtUTF16Index(glyph1.stringRange.start));
-
-  const bool isRightToLeft = (b0 == BidiStrongType::rtl && b1 != BidiStrongType::ltr)
-                          || (b0 != BidiStrongType::ltr && b1 == BidiStrongType::rtl);
-
   const Int glyph0StringLength = glyph0.stringRange.count();
   const Int glyph1StringLength = glyph1.stringRange.count();
   const Int bufferLength = glyph0StringLength + glyph1StringLength;
@@ -241,7 +244,7 @@ Optional<Float64> kerningAdjustment(const GlyphForKerningPurposes& glyph0,
     if (glyphs[1] != glyph1.glyph) break;
     if (!(advances[0].width > 0)) break;
     if (!(advances[1].width > 0)) break;
-    result = advances[0].width - glyph0.width;
+    result = advances[0].width;
   } while (false);
 
   CFRelease(line);
@@ -258,7 +261,261 @@ Optional<Float64> kerningAdjustment(const GlyphForKerningPurposes& glyph0,
   return result;
 }
 
-#endif
+struct KerningAdjustmentCacheEntry {
+  /// Retained.
+  CTFont* font0;
+  /// Retained.
+  CTFont* font1;
+  /// Retained.
+  CFDictionaryRef __nullable attributes0;
+  /// Retained.
+  CFDictionaryRef __nullable attributes1;
+  CGGlyph glyph0;
+  CGGlyph glyph1;
+  bool isRightToLeft;
+  bool hasKernedAdvance;
+  HashCode<UInt> hashCode;
+  Float64 kernedAdvance;
+};
+
+struct GlobalKerningAdjustmentCache {
+  static constexpr Int maxEntryCount = 1024;
+
+  Vector<KerningAdjustmentCacheEntry> entries;
+  HashSet<UInt16, Malloc> indices{uninitialized};
+  Int hitCount{};
+  Int missCount{};
+
+  STU_NO_INLINE
+  void clear() {
+    for (auto& entry : entries.reversed()) {
+      if (entry.attributes1) {
+        CFRelease(entry.attributes1);
+      }
+      if (entry.attributes0) {
+        CFRelease(entry.attributes0);
+      }
+      CFRelease(entry.font1);
+      CFRelease(entry.font0);
+    }
+    entries.removeAll();
+    indices.removeAll();
+  }
+};
+
+stu_mutex kerningAdjustmentCacheMutex = STU_MUTEX_INIT;
+bool kerningAdjustmentCacheIsInitialized = false;
+alignas(GlobalKerningAdjustmentCache)
+Byte kerningAdjustmentCacheStorage[sizeof(GlobalKerningAdjustmentCache)];
+
+/// @pre kerningAdjustmentCacheMutex must be locked by the current thread.
+static GlobalKerningAdjustmentCache& kerningAdjustmentCache() {
+  if (STU_UNLIKELY(!kerningAdjustmentCacheIsInitialized)) {
+    kerningAdjustmentCacheIsInitialized = true;
+    GlobalKerningAdjustmentCache& cache =
+      *new (kerningAdjustmentCacheStorage) GlobalKerningAdjustmentCache{};
+    cache.indices.initializeWithBucketCount(64);
+    cache.entries.ensureFreeCapacity(16);
+
+    NSNotificationCenter* const notificationCenter = NSNotificationCenter.defaultCenter;
+    NSOperationQueue* const mainQueue = NSOperationQueue.mainQueue;
+    const auto clearCacheBlock = ^(NSNotification*) {
+      clearKerningAdjustmentCache();
+    };
+    [notificationCenter addObserverForName:UIApplicationDidEnterBackgroundNotification
+                                    object:nil queue:mainQueue usingBlock:clearCacheBlock];
+    [notificationCenter addObserverForName:UIApplicationDidReceiveMemoryWarningNotification
+                                    object:nil queue:mainQueue usingBlock:clearCacheBlock];
+  }
+  return reinterpret_cast<GlobalKerningAdjustmentCache&>(kerningAdjustmentCacheStorage);
+}
+
+void clearKerningAdjustmentCache() {
+  stu_mutex_lock(&kerningAdjustmentCacheMutex);
+  if (kerningAdjustmentCacheIsInitialized) {
+    reinterpret_cast<GlobalKerningAdjustmentCache&>(kerningAdjustmentCacheStorage).clear();
+  }
+  stu_mutex_unlock(&kerningAdjustmentCacheMutex);
+}
+
+KerningAdjustmentCacheStatistics kerningAdjustmentCacheStatistics() {
+  stu_mutex_lock(&kerningAdjustmentCacheMutex);
+  const GlobalKerningAdjustmentCache& cache = kerningAdjustmentCache();
+  const KerningAdjustmentCacheStatistics statistics = {.entryCount = cache.entries.count(),
+                                                       .hitCount = cache.hitCount,
+                                                       .missCount = cache.missCount};
+  stu_mutex_unlock(&kerningAdjustmentCacheMutex);
+  return statistics;
+}
+
+static bool isEqualFont(CTFont* font, CTFont* otherFont) {
+  return font == otherFont || CFEqual(font, otherFont);
+}
+
+static bool isEqualAttributes(NSDictionary* __unsafe_unretained attributes,
+                              CFDictionaryRef __nullable otherAttributes)
+{
+  NSDictionary* const other = (__bridge NSDictionary*)otherAttributes;
+  return attributes == other || (attributes && other && [attributes isEqualToDictionary:other]);
+}
+
+Optional<Float64> kerningAdjustment(const GlyphForKerningPurposes& glyph0,
+                                    const NSStringRef& string0,
+                                    const GlyphForKerningPurposes& glyph1,
+                                    const NSStringRef& string1)
+{
+  if (!glyph0.glyph || !glyph1.glyph) return none;
+
+  const BidiStrongType b0 = bidiStrongType(string0.codePointAtUTF16Index(glyph0.stringRange.start));
+  const BidiStrongType b1 = bidiStrongType(string1.codePointAtUTF16Index(glyph1.stringRange.start));
+
+  const bool isRightToLeft = (b0 == BidiStrongType::rtl && b1 != BidiStrongType::ltr)
+                          || (b0 != BidiStrongType::ltr && b1 == BidiStrongType::rtl);
+
+  // The typeset advance of the first glyph only depends on the fonts, glyphs and attributes of the
+  // two glyphs and the writing direction, so we can cache it independently of glyph0.width.
+  const HashCode<UInt> hashCode = narrow_cast<HashCode<UInt>>(
+                                    hash(UInt64{CFHash(glyph0.font)}, UInt64{CFHash(glyph1.font)},
+                                         UInt64{*glyph0.glyph} | (UInt64{*glyph1.glyph} << 16)
+                                         | (UInt64{isRightToLeft} << 32)));
+  const auto isEqualKeyExceptAttributes = [&](const KerningAdjustmentCacheEntry& entry) -> bool {
+    return hashCode == entry.hashCode
+        && *glyph0.glyph == entry.glyph0 && *glyph1.glyph == entry.glyph1
+        && isRightToLeft == entry.isRightToLeft
+        && isEqualFont(glyph0.font, entry.font0) && isEqualFont(glyph1.font, entry.font1);
+  };
+  // While holding the mutex we only compare the attribute dictionaries by identity, since
+  // -isEqualToDictionary: may have to compare arbitrary attribute values.
+  const auto isIdenticalKey = [&](const GlobalKerningAdjustmentCache& cache, UInt16 index) -> bool {
+    const KerningAdjustmentCacheEntry& entry = cache.entries[index];
+    return isEqualKeyExceptAttributes(entry)
+        && (__bridge CFDictionaryRef)glyph0.attributes == entry.attributes0
+        && (__bridge CFDictionaryRef)glyph1.attributes == entry.attributes1;
+  };
+
+  Optional<Float64> kernedAdvance;
+  {
+    // The entries that only differ in the identity of the attribute dictionaries. There may be
+    // several such entries with different attributes (e.g. different colors), so we have to
+    // compare the attributes of all of them in order to avoid inserting duplicate keys.
+    struct Candidate {
+      CFDictionaryRef __nullable attributes0;
+      CFDictionaryRef __nullable attributes1;
+      bool hasKernedAdvance;
+      Float64 kernedAdvance;
+    };
+    TempVector<Candidate> candidates;
+
+    stu_mutex_lock(&kerningAdjustmentCacheMutex);
+    GlobalKerningAdjustmentCache& cache = kerningAdjustmentCache();
+    if (const auto optIndex = cache.indices.find(hashCode, [&](const UInt16 index) {
+                                if (isIdenticalKey(cache, index)) return true;
+                                const KerningAdjustmentCacheEntry& entry = cache.entries[index];
+                                if (isEqualKeyExceptAttributes(entry)) {
+                                  candidates.append(Candidate{entry.attributes0,
+                                                              entry.attributes1,
+                                                              entry.hasKernedAdvance,
+                                                              entry.kernedAdvance});
+                                }
+                                return false;
+                              }))
+    {
+      const KerningAdjustmentCacheEntry& entry = cache.entries[*optIndex];
+      if (entry.hasKernedAdvance) {
+        kernedAdvance = entry.kernedAdvance;
+      }
+      cache.hitCount += 1;
+      stu_mutex_unlock(&kerningAdjustmentCacheMutex);
+      if (!kernedAdvance) return none;
+      return *kernedAdvance - glyph0.width;
+    }
+    if (candidates.isEmpty()) {
+      cache.missCount += 1;
+    }
+    // Keep the dictionaries alive in case the cache is cleared by another thread.
+    for (const Candidate& candidate : candidates) {
+      if (candidate.attributes0) {
+        CFRetain(candidate.attributes0);
+      }
+      if (candidate.attributes1) {
+        CFRetain(candidate.attributes1);
+      }
+    }
+    stu_mutex_unlock(&kerningAdjustmentCacheMutex);
+
+    if (!candidates.isEmpty()) {
+      const Candidate* equalCandidate = nullptr;
+      for (const Candidate& candidate : candidates) {
+        if (isEqualAttributes(glyph0.attributes, candidate.attributes0)
+            && isEqualAttributes(glyph1.attributes, candidate.attributes1))
+        {
+          equalCandidate = &candidate;
+          break;
+        }
+      }
+      for (const Candidate& candidate : candidates.reversed()) {
+        if (candidate.attributes1) {
+          CFRelease(candidate.attributes1);
+        }
+        if (candidate.attributes0) {
+          CFRelease(candidate.attributes0);
+        }
+      }
+      stu_mutex_lock(&kerningAdjustmentCacheMutex);
+      if (equalCandidate) {
+        cache.hitCount += 1;
+      } else {
+        cache.missCount += 1;
+      }
+      stu_mutex_unlock(&kerningAdjustmentCacheMutex);
+      if (equalCandidate) {
+        if (!equalCandidate->hasKernedAdvance) return none;
+        return equalCandidate->kernedAdvance - glyph0.width;
+      }
+    }
+  }
+
+  kernedAdvance = typesetKernedAdvance(glyph0, string0, glyph1, string1, isRightToLeft);
+
+  const KerningAdjustmentCacheEntry newEntry = {
+    .font0 = glyph0.font,
+    .font1 = glyph1.font,
+    .attributes0 = (__bridge CFDictionaryRef)glyph0.attributes,
+    .attributes1 = (__bridge CFDictionaryRef)glyph1.attributes,
+    .glyph0 = *glyph0.glyph,
+    .glyph1 = *glyph1.glyph,
+    .isRightToLeft = isRightToLeft,
+    .hasKernedAdvance = kernedAdvance != none,
+    .hashCode = hashCode,
+    .kernedAdvance = kernedAdvance ? *kernedAdvance : 0
+  };
+  stu_mutex_lock(&kerningAdjustmentCacheMutex);
+  GlobalKerningAdjustmentCache& cache = kerningAdjustmentCache();
+  if (STU_UNLIKELY(cache.entries.count() == GlobalKerningAdjustmentCache::maxEntryCount)) {
+    cache.clear();
+  }
+  const UInt16 index = narrow_cast<UInt16>(cache.entries.count());
+  if (cache.indices.insert(hashCode, index, [&](const UInt16 index) {
+                             return isIdenticalKey(cache, index);
+                           }).inserted)
+  {
+    CFRetain(newEntry.font0);
+    CFRetain(newEntry.font1);
+    if (newEntry.attributes0) {
+      CFRetain(newEntry.attributes0);
+    }
+    if (newEntry.attributes1) {
+      CFRetain(newEntry.attributes1);
+    }
+    cache.entries.append(newEntry);
+  }
+  stu_mutex_unlock(&kerningAdjustmentCacheMutex);
+
+  if (!kernedAdvance) return none;
+  return *kernedAdvance - glyph0.width;
+}
+
+#endif // STU_TRUNCATION_TOKEN_KERNING
 
 static CFStringRef const hyphenCodePointString = (__bridge CFStringRef)@"\u2010";
 
@@ -296,13 +553,13 @@ HyphenLine createHyphenLine(const NSAttributedStringRef& originalAttributedStrin
     if (hyphen != hyphenCodePoint) {
       CFRelease(hyphenString);
     }
-    result.line = CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)
-                                                     hyphenAttributedString);
+    const TokenLineCache::Line hyphenLine = TokenLineCache::createLine(hyphenAttributedString);
+    result.line = hyphenLine.line;
     result.runIndex = 0;
     result.glyphIndex = -1;
     result.trailingGlyphAdvanceCorrection = 0;
     result.xOffset = 0;
-    result.width = typographicWidth(result.line);
+    result.width = hyphenLine.width;
     STU_ASSERT(result.width >= 0);
     return result;
   }
@@ -325,15 +582,6 @@ HyphenLine createHyphenLine(const NSAttributedStringRef& originalAttributedStrin
                                       initWithString:(__bridge NSString*)bufferString
                                            attributes:tg.attributes];
     CFRelease(bufferString);
-    const auto glyphString = CFStringCreateWithCharacters(nullptr,
-                               reinterpret_cast<const UTF16Char*>(buffer.begin()),
-                               glyphStringLength);
-    const auto glyphInfo = CTGlyphInfoCreateWithGlyph(trailingGlyph, tg.font, glyphString);
-    CFRelease(glyphString);
-    [attributedString addAttribute:(__bridge NSString*)kCTGlyphInfoAttributeName
-                             value:(__bridge id)glyphInfo
-                              range:NSRange{0, sign_cast(glyphStringLength)}];
-    CFRelease(glyphInfo);
 
     CGGlyph hyphenGlyphs[2];
     const bool fontHasHyphen = CTFontGetGlyphsForCharacters(tg.font, hyphenChars, hyphenGlyphs,
@@ -345,11 +593,39 @@ HyphenLine createHyphenLine(const NSAttributedStringRef& originalAttributedStrin
                                range:NSRange(Range{glyphStringLength, Count{hyphenCharsCount}})];
     }
 
-    const CTTypesetterRef ts = CTTypesetterCreateWithAttributedStringAndOptions(
-                                (__bridge CFAttributedStringRef)attributedString,
-                                typesetterOptions(tg.isRightToLeftRun));
-    result.line = CTTypesetterCreateLine(ts, CFRange{});
-    CFRelease(ts);
+    // The line only depends on the attributed string, the trailing glyph and its font and the
+    // writing direction, so we can use the global token line cache. The glyph info attribute isn't
+    // part of the cache key, since it is a function of the key.
+    NSAttributedString* const keyString = [attributedString copy];
+    const TokenLineCache::Key cacheKey = {
+      .attributedString = keyString,
+      .font = tg.font,
+      .value = UInt32{trailingGlyph}
+             | (UInt32{tg.isRightToLeftRun} << 16)
+             | (UInt32{hyphenCharsCount == 2} << 17)
+    };
+    result.line = TokenLineCache::createLine(cacheKey,
+                                             [&](const TokenLineCache::Key& key) -> CTLine*
+    {
+      NSMutableAttributedString* const attributedStringWithGlyphInfo =
+        [key.attributedString mutableCopy];
+      const auto glyphString = CFStringCreateWithCharacters(nullptr,
+                                 reinterpret_cast<const UTF16Char*>(buffer.begin()),
+                                 glyphStringLength);
+      const auto glyphInfo = CTGlyphInfoCreateWithGlyph(trailingGlyph, tg.font, glyphString);
+      CFRelease(glyphString);
+      [attributedStringWithGlyphInfo addAttribute:(__bridge NSString*)kCTGlyphInfoAttributeName
+                                            value:(__bridge id)glyphInfo
+                                            range:NSRange{0, sign_cast(glyphStringLength)}];
+      CFRelease(glyphInfo);
+
+      const CTTypesetterRef ts = CTTypesetterCreateWithAttributedStringAndOptions(
+                                  (__bridge CFAttributedStringRef)attributedStringWithGlyphInfo,
+                                  typesetterOptions(tg.isRightToLeftRun));
+      CTLine* const line = CTTypesetterCreateLine(ts, CFRange{});
+      CFRelease(ts);
+      return line;
+    }).line;
   }
   auto guard = ScopeGuard{[&]{ CFRelease(result.line); }};
 
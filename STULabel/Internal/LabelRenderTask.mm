@@ -2,6 +2,7 @@
 
 #include "LabelRenderTask.hpp"
 #include "LabelPrerenderer.hpp"
+#include "PhaseTracing.hpp"
 
 namespace stu_label {
 
@@ -81,6 +82,7 @@ void LabelRenderTask::renderImage(const STUCancellationFlag* __nullable cancella
 
 void LabelTextShapingAndLayoutAndRenderTask::run(void* taskPointer) {
   auto& task = *down_cast<LabelTextShapingAndLayoutAndRenderTask*>(taskPointer);
+  STU_TRACE_RENDER_TASK();
   if (!task.isCancelled_) {
     task.createShapedString(&task.isCancelled_);
     LabelLayoutAndRenderTask::run(&task);
@@ -90,6 +92,7 @@ void LabelTextShapingAndLayoutAndRenderTask::run(void* taskPointer) {
 }
 void LabelLayoutAndRenderTask::run(void* taskPointer) {
   auto& task = *down_cast<LabelLayoutAndRenderTask*>(taskPointer);
+  STU_TRACE_RENDER_TASK();
   if (!task.isCancelled_) {
     task.createTextFrame();
     task.completedLayout_.store(true, std::memory_order_release);
@@ -100,6 +103,7 @@ void LabelLayoutAndRenderTask::run(void* taskPointer) {
 }
 void LabelRenderTask::run(void* taskPointer) {
   auto& task = *down_cast<LabelRenderTask*>(taskPointer);
+  STU_TRACE_RENDER_TASK();
   if (!task.renderingIsCancelled_) {
     task.renderImage(&task.renderingIsCancelled_);
     if (!task.renderingIsCancelled_) {
@@ -48,6 +48,18 @@ PurgeableImage createLabelTextFrameImage(const STUTextFrame*,
                                          const LabelParameters&,
                                          const STUCancellationFlag* __nullable);
 
+/// Returns a copy of the image in which the lines whose highlighting differs between the
+/// previous drawing options and `params.drawingOptions` have been redrawn, or an empty image if
+/// the original image was purged. The pixels of the returned image are identical to those of an
+/// image newly created with `createLabelTextFrameImage`.
+///
+/// The original image must have been created by `createLabelTextFrameImage` for the same text
+/// frame and render info, with the previous drawing options and without a drawing block.
+PurgeableImage updateLabelTextFrameImageHighlighting(
+                 PurgeableImage& image, const STUTextFrame*, const LabelTextFrameRenderInfo&,
+                 const LabelParameters&,
+                 const STUTextFrameDrawingOptions* __nullable previousDrawingOptions);
+
 } // namespace stu_label
 
 
@@ -7,6 +7,7 @@
 #import "STULabel/STUTextHighlightStyle-Internal.hpp"
 
 #import "LabelParameters.hpp"
+#import "PhaseTracing.hpp"
 
 namespace stu_label {
 
@@ -124,9 +125,13 @@ LabelTextFrameRenderInfo labelTextFrameRenderInfo(const STUTextFrame* __unsafe_u
   Rect<CGFloat> imageBounds{uninitialized};
   bool mayBeClipped = true;
   if (useImageBounds) {
-    imageBounds = STUTextFrameGetImageBoundsForRange(textFrame, STUTextFrameGetRange(textFrame),
-                                                     CGPoint{}, params.displayScale(),
-                                                     params.drawingOptions, cancellationFlag);
+    {
+      STU_TRACE_PHASE(ImageBounds);
+      STU_TRACE_PHASE_COUNT(textFrameRef(textFrame).lineCount);
+      imageBounds = STUTextFrameGetImageBoundsForRange(textFrame, STUTextFrameGetRange(textFrame),
+                                                       CGPoint{}, params.displayScale(),
+                                                       params.drawingOptions, cancellationFlag);
+    }
     const CGFloat tolerance = params.displayScale().inverseValue()/4;
     bounds = renderBoundsForTextFrameImageBounds(imageBounds, info, params.size(),
                                                  params.edgeInsets(), tolerance,
@@ -262,16 +267,114 @@ PurgeableImage createLabelTextFrameImage(const STUTextFrame* __unsafe_unretained
                                          const LabelParameters& params,
                                          const STUCancellationFlag* __nullable cancellationFlag)
 {
-  return {renderInfo.bounds.size, params.displayScale(),
-          renderInfo.shouldDrawBackgroundColor ? params.backgroundColor() : nil,
-          renderInfo.imageFormat,
-          renderInfo.isOpaque ? STUCGImageFormatWithoutAlphaChannel : STUCGImageFormatOptionsNone,
-          [&](CGContext* context) {
-            drawLabelTextFrame(textFrame, STUTextFrameGetRange(textFrame),
-                               -renderInfo.bounds.origin, context, ContextBaseCTM_d{1},
-                               PixelAlignBaselines{true}, params.drawingOptions,
-                               params.drawingBlock, cancellationFlag);
-          }};
+  STU_TRACE_PHASE(Drawing);
+  PurgeableImage image{
+    renderInfo.bounds.size, params.displayScale(),
+    renderInfo.shouldDrawBackgroundColor ? params.backgroundColor() : nil,
+    renderInfo.imageFormat,
+    renderInfo.isOpaque ? STUCGImageFormatWithoutAlphaChannel : STUCGImageFormatOptionsNone,
+    [&](CGContext* context) {
+      drawLabelTextFrame(textFrame, STUTextFrameGetRange(textFrame),
+                         -renderInfo.bounds.origin, context, ContextBaseCTM_d{1},
+                         PixelAlignBaselines{true}, params.drawingOptions,
+                         params.drawingBlock, cancellationFlag);
+    }};
+  STU_TRACE_PHASE_BYTE_SIZE(image.sizeInBytes());
+  return image;
+}
+
+/// Returns the index range of the lines overlapping the text range to which the highlight style of
+/// the drawing options applies.
+static Range<Int32> highlightedLineRange(
+                      const TextFrame& textFrame,
+                      const STUTextFrameDrawingOptions* __unsafe_unretained __nullable options)
+{
+  if (!options || !options->impl.highlightStyle()) return {};
+  const TextStyleOverride styleOverride{textFrame, textFrame.range(), options->impl};
+  const Range<TextFrameCompactIndex> highlightRange = styleOverride.overrideRange;
+  if (highlightRange.isEmpty()) return {};
+  Range<Int32> lineRange = {maxValue<Int32>, 0};
+  for (const TextFrameLine& line : textFrame.lines()[styleOverride.drawnLineRange]) {
+    const Range<TextFrameCompactIndex> range = line.range();
+    if (range.start < highlightRange.end && highlightRange.start < range.end) {
+      lineRange.start = min(lineRange.start, line.lineIndex);
+      lineRange.end = line.lineIndex + 1;
+    }
+  }
+  return lineRange;
+}
+
+PurgeableImage updateLabelTextFrameImageHighlighting(
+                 PurgeableImage& image,
+                 const STUTextFrame* __unsafe_unretained textFrame,
+                 const LabelTextFrameRenderInfo& renderInfo,
+                 const LabelParameters& params,
+                 const STUTextFrameDrawingOptions* __unsafe_unretained __nullable
+                   previousDrawingOptions)
+{
+  STU_TRACE_PHASE(Drawing);
+  STU_DEBUG_ASSERT(!params.drawingBlock);
+  const TextFrame& tf = textFrameRef(textFrame);
+  const CGFloat scale = params.displayScale();
+  const CGPoint textFrameOrigin = -renderInfo.bounds.origin;
+  const SizeInPixels<UInt32> sizeInPixels = image.sizeInPixels();
+  const Range<CGFloat> imageY = {0, sizeInPixels.height/scale};
+
+  // The horizontal image bands that need to be redrawn, in the coordinate system of the image.
+  Range<CGFloat> bands[2];
+  Int bandCount = 0;
+  const Range<Int32> lineRanges[2] = {highlightedLineRange(tf, previousDrawingOptions),
+                                      highlightedLineRange(tf, params.drawingOptions)};
+  for (const Range<Int32>& lineRange : lineRanges) {
+    if (lineRange.isEmpty()) continue;
+    const ArrayRef<const TextFrameLine> lines = tf.lines()[lineRange];
+    const STUTextFrameRange range = Range{lines[0].range().start, lines[$ - 1].range().end};
+    // The highlighting may grow or shrink the image bounds of the lines, so we need the union of
+    // the bounds for the previous and the current drawing options.
+    Rect<CGFloat> bounds = STUTextFrameGetImageBoundsForRange(textFrame, range, textFrameOrigin,
+                                                              scale, previousDrawingOptions,
+                                                              nullptr);
+    bounds = bounds.convexHull(STUTextFrameGetImageBoundsForRange(textFrame, range,
+                                                                  textFrameOrigin, scale,
+                                                                  params.drawingOptions,
+                                                                  nullptr));
+    Range<CGFloat> y = bounds.y;
+    for (const TextFrameLine& line : lines) {
+      const Range<Float64> lineY = line.originY + Range<Float64>{line.fastBounds().y};
+      y = y.convexHull(textFrameOrigin.y + tf.textScaleFactor*lineY);
+    }
+    // Round outwards to pixel boundaries, with an extra pixel on each side to account for the
+    // baseline pixel alignment.
+    y = Range{(floor(y.start*scale) - 1)/scale, (ceil(y.end*scale) + 1)/scale};
+    y.intersect(imageY);
+    if (y.isEmpty()) continue;
+    if (bandCount == 1 && bands[0].overlaps(y)) {
+      bands[0] = bands[0].convexHull(y);
+    } else {
+      bands[bandCount++] = y;
+    }
+  }
+
+  const CGFloat width = sizeInPixels.width/scale;
+  PurgeableImage result{image, scale, [&](CGContext* context) {
+    for (const Range<CGFloat>& band : ArrayRef{bands, bandCount}) {
+      const CGRect rect = {{0, band.start}, {width, band.diameter()}};
+      CGContextSaveGState(context);
+      CGContextClipToRect(context, rect);
+      CGContextClearRect(context, rect);
+      if (renderInfo.shouldDrawBackgroundColor) {
+        CGContextSetFillColorWithColor(context, params.backgroundColor());
+        CGContextFillRect(context, rect);
+      }
+      drawLabelTextFrame(textFrame, STUTextFrameGetRange(textFrame), textFrameOrigin, context,
+                         ContextBaseCTM_d{1}, PixelAlignBaselines{true}, params.drawingOptions,
+                         nil, nullptr);
+      CGContextRestoreGState(context);
+    }
+  }};
+  STU_TRACE_PHASE_COUNT(bandCount);
+  STU_TRACE_PHASE_BYTE_SIZE(result.sizeInBytes());
+  return result;
 }
 
 } // namespace stu_label
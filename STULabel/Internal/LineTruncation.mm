@@ -4,6 +4,8 @@
 
 #import "Kerning.hpp"
 
+#import "stu/BinarySearch.hpp"
+
 #include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
 
 namespace stu_label {
@@ -15,6 +17,79 @@ struct StartAtEndOfLineString : Parameter<StartAtEndOfLineString> { using Parame
 struct IsRightToLeftLine : Parameter<IsRightToLeftLine> { using Parameter::Parameter; };
 struct MinInitialOffset : Parameter<MinInitialOffset, Float64> { using Parameter::Parameter; };
 
+/// Lazily computed prefix sums of the glyph advance widths of the runs in a line.
+///
+/// With the sums the width of a glyph range within a run can be determined with two array lookups
+/// instead of a CTRunGetTypographicBounds call, and the glyph at a certain offset can be found with
+/// a binary search. The sums are computed at most once per run, even if multiple iterators (or a
+/// truncation range adjuster) repeatedly iterate over the same part of the line.
+///
+/// The sums are stored in glyph order, i.e. in visual order. An iterator that moves through a run
+/// from right to left uses the same array, since the width of a glyph range is just the difference
+/// of two sums.
+///
+/// If a run contains a glyph with a negative advance width, the typographic width of a glyph range
+/// can differ from the sum of the advance widths (see the note in GlyphSpan.hpp), so for such runs
+/// no sums are computed.
+class LineAdvanceSums {
+  NSArrayRef<CTRun*> runs_;
+  /// The index range of the run's sums in sums_. Range{-1, -1} if the sums haven't been computed
+  /// yet, an empty range if the run contains a negative advance width.
+  TempArray<Range<Int>> runSumRanges_;
+  /// Has the capacity for the sums of all runs, so that appending never reallocates the storage
+  /// (which would invalidate the arrays returned by sumsForRun).
+  TempVector<Float64> sums_;
+
+public:
+  explicit STU_INLINE
+  LineAdvanceSums(NSArrayRef<CTRun*> runs)
+  : runs_{runs},
+    runSumRanges_{repeat(Range<Int>{-1, -1}, runs.count())},
+    sums_{Capacity{runs.count() + glyphCount(runs)}}
+  {}
+
+  /// Returns an array with run.count() + 1 elements where the element at index i is the sum of the
+  /// advance widths of the first i glyphs in the run, or an empty array if the run contains a
+  /// negative advance width.
+  STU_INLINE
+  ArrayRef<const Float64> sumsForRun(Int runIndex) {
+    const Range<Int> range = runSumRanges_[runIndex];
+    if (STU_LIKELY(range.start >= 0)) {
+      return sums_[range];
+    }
+    return computeSumsForRun(runIndex);
+  }
+
+private:
+  static Int glyphCount(NSArrayRef<CTRun*> runs) {
+    Int count = 0;
+    for (CTRun* const run : runs) {
+      count += GlyphRunRef{run}.count();
+    }
+    return count;
+  }
+
+  STU_NO_INLINE
+  ArrayRef<const Float64> computeSumsForRun(Int runIndex) {
+    const AdvancesArray advances = GlyphSpan{runs_[runIndex]}.advancesArray();
+    const Int start = sums_.count();
+    Float64 sum = 0;
+    sums_.append(sum);
+    for (const CGSize& advance : advances) {
+      if (STU_UNLIKELY(advance.width < 0)) {
+        sums_.removeLast(sums_.count() - start);
+        runSumRanges_[runIndex] = Range{start, start};
+        return {};
+      }
+      sum += advance.width;
+      sums_.append(sum);
+    }
+    const Range<Int> range{start, sums_.count()};
+    runSumRanges_[runIndex] = range;
+    return sums_[range];
+  }
+};
+
 /// An iterator for iterating over the grapheme clusters in a line such that both the skipped
 /// string range and the corresponding glyph range are continuous, i.e. do not have gaps.
 struct Iterator {
@@ -22,6 +97,7 @@ struct Iterator {
   const NSStringRef string_;
   const Range<Int> lineStringRange_;
   const NSArrayRef<CTRun*> runs_;
+  LineAdvanceSums& advanceSums_;
 
   const bool isRightToLeftLine_;
   bool isStringForwardIterator_;
@@ -53,16 +129,21 @@ struct Iterator {
   /// Is only set if skipRun.
   Range<Int> runStringRange_;
 
+  /// Is only set if !skipRun. Empty if the advance sums can't be used for the run.
+  ArrayRef<const Float64> runAdvanceSums_;
+
   ArrayRef<const Int> stringIndices_;
   TempVector<Int> stringIndexBuffer_;
 
   STU_INLINE
-  Iterator(const TruncatableTextLine& line, const StartAtEndOfLineString startAtEndOfLineString,
+  Iterator(const TruncatableTextLine& line, LineAdvanceSums& advanceSums,
+           const StartAtEndOfLineString startAtEndOfLineString,
            const MinInitialOffset minOffset = {})
   : attributedString_{line.attributedString},
     string_{attributedString_.string},
     lineStringRange_{line.stringRange},
     runs_{line.runs},
+    advanceSums_{advanceSums},
     isRightToLeftLine_{line.isRightToLeftLine},
     isStringForwardIterator_{!startAtEndOfLineString},
     isRightToLeftIterator_{isStringForwardIterator_ == isRightToLeftLine_},
@@ -178,6 +259,18 @@ private:
 
   bool loadNextRun();
 
+  /// Returns the typographic width of the glyph range in the current run.
+  STU_INLINE
+  Float64 glyphRangeWidth(Range<Int> glyphRange) const {
+    STU_DEBUG_ASSERT(!skipRun_);
+    if (STU_LIKELY(!runAdvanceSums_.isEmpty())) {
+      return runAdvanceSums_[glyphRange.end] - runAdvanceSums_[glyphRange.start];
+    }
+    return CTRunGetTypographicBounds(run_->ctRun(), glyphRange, nullptr, nullptr, nullptr);
+  }
+
+  void skipGlyphsBeforeMinOffset(Float64 minOffset);
+
   STU_INLINE
   Int glyphStringIndex() {
     if (STU_LIKELY(stringIndices_.isValidIndex(glyphIndex_))) {
@@ -244,11 +337,47 @@ void Iterator::advanceToInitialMinOffset(const Float64 minOffset) {
     stringIndex_ = string_.startIndexOfGraphemeClusterAt(stringIndex);
   }
   loadNextRun();
+  if (offset_ < minOffset && !skipRun_ && !isNonMonotonicRun_ && !runAdvanceSums_.isEmpty()) {
+    skipGlyphsBeforeMinOffset(minOffset);
+  }
   while (offset_ < minOffset) {
     advance();
   }
 }
 
+/// Uses a binary search over the advance sums of the current run to skip the glyphs that end
+/// before the min offset, so that the iterator doesn't have to advance cluster by cluster through
+/// a potentially long run. The iterator may afterwards be positioned in the middle of a grapheme
+/// cluster, which is fine, because the next advance() call will skip the remainder of the cluster.
+///
+/// @pre offset_ < minOffset && !skipRun_ && !isNonMonotonicRun_ && !runAdvanceSums_.isEmpty()
+/// @post offset_ < minOffset
+void Iterator::skipGlyphsBeforeMinOffset(const Float64 minOffset) {
+  const ArrayRef<const Float64> sums = runAdvanceSums_;
+  const Int n = runGlyphCount();
+  STU_DEBUG_ASSERT(sums.count() == n + 1);
+  const Float64 offset = offset_;
+  if (!isRightToLeftIterator_) {
+    // The glyphs [0, glyphIndex) are skipped. Since sums[0] == 0, i >= 1.
+    const Int i = binarySearchFirstIndexWhere(sums, [&](Float64 sum) {
+                    return offset + sum >= minOffset;
+                  }).indexOrArrayCount;
+    const Int glyphIndex = min(i, n) - 1;
+    glyphIndex_ = glyphIndex;
+    offset_ = offset + sums[glyphIndex];
+  } else {
+    // The glyphs [glyphIndex + 1, n) are skipped.
+    const Float64 runWidth = sums[n];
+    const Int j = binarySearchFirstIndexWhere(sums, [&](Float64 sum) {
+                    return offset + (runWidth - sum) < minOffset;
+                  }).indexOrArrayCount;
+    const Int glyphIndex = max(j, 1) - 1;
+    glyphIndex_ = glyphIndex;
+    offset_ = offset + (runWidth - sums[glyphIndex + 1]);
+  }
+  STU_DEBUG_ASSERT(offset_ < minOffset);
+}
+
 STU_NO_INLINE
 bool Iterator::loadNextRun() {
   // Note that this method may be called from the constructor
@@ -265,6 +394,7 @@ bool Iterator::loadNextRun() {
     if (skipRun_) {
       runStringRange_ = run_->stringRange();
     } else {
+      runAdvanceSums_ = advanceSums_.sumsForRun(runIndex_);
       stringIndices_ = ArrayRef<const Int>();
       if (!isNonMonotonicRun_) {
         if (const Int* const stringIndices = CTRunGetStringIndicesPtr(run_->ctRun())) {
@@ -314,8 +444,7 @@ bool Iterator::advanceImpl() {
         Int lastGlyphIndex = glyphIndex_ - minusOneIfRightToLeftIter;
         const Range<Int> glyphRange = {min(glyphStartIndex, lastGlyphIndex),
                                        max(glyphStartIndex, lastGlyphIndex) + 1};
-        offset_ += minusOneIfReversed*CTRunGetTypographicBounds(run_->ctRun(), glyphRange,
-                                                                nullptr, nullptr, nullptr);
+        offset_ += minusOneIfReversed*glyphRangeWidth(glyphRange);
         if (!(0 <= glyphIndex_ && glyphIndex_ < runGlyphCount())) break;
         if (STU_LIKELY(hasAdvanced())) return true;
         STU_DISABLE_CLANG_WARNING("-Wconditional-uninitialized")
@@ -444,6 +573,7 @@ static void truncationRangeAdjusterReturnedInvalidRange(
 
 static ExcisedGlyphRange findRangeToExciseForStartOrEndTruncation(
                            const TruncatableTextLine& line,
+                           LineAdvanceSums& advanceSums,
                            const CTLineTruncationType truncationType,
                            const Float64 maxWidth,
                            const __nullable __unsafe_unretained
@@ -455,7 +585,7 @@ static ExcisedGlyphRange findRangeToExciseForStartOrEndTruncation(
 {
   const bool startAtTruncatedEnd = line.width < 2*maxWidth;
   const Float64 minTruncationWidth = line.width - maxWidth;
-  Iterator iter{line,
+  Iterator iter{line, advanceSums,
                 StartAtEndOfLineString{startAtTruncatedEnd
                                        == (truncationType == kCTLineTruncationEnd)},
                 MinInitialOffset{startAtTruncatedEnd ? minTruncationWidth : maxWidth}};
@@ -543,6 +673,7 @@ static ExcisedGlyphRange findRangeToExciseForStartOrEndTruncation(
 static
 ExcisedGlyphRange findRangeToExciseForMiddleTruncation(
                     const TruncatableTextLine& line,
+                    LineAdvanceSums& advanceSums,
                     const CTLineTruncationType truncationType,
                     const Float64 maxWidth,
                     const __nullable __unsafe_unretained
@@ -555,8 +686,8 @@ ExcisedGlyphRange findRangeToExciseForMiddleTruncation(
   // We iteratively determine the two spans at the ends of the lines that will remain after
   // truncation. We alternate between both sides to keep the widths balanced when possible.
 
-  Iterator iterS{line, StartAtEndOfLineString{false}};
-  Iterator iterE{line, StartAtEndOfLineString{true}};
+  Iterator iterS{line, advanceSums, StartAtEndOfLineString{false}};
+  Iterator iterE{line, advanceSums, StartAtEndOfLineString{true}};
 
   auto& iterL = line.isRightToLeftLine ? iterE : iterS;
   auto& iterR = line.isRightToLeftLine ? iterS : iterE;
@@ -719,9 +850,10 @@ ExcisedGlyphRange findRangeToExciseForTruncation(
                   )
 {
   STU_ASSERT(line.width > maxWidth);
+  LineAdvanceSums advanceSums{line.runs};
   const bool isMiddleStartOrEndTruncation = line.truncatableStringRange != line.stringRange;
   if (!isMiddleStartOrEndTruncation && truncationType != kCTLineTruncationMiddle) {
-    return findRangeToExciseForStartOrEndTruncation(line, truncationType, maxWidth,
+    return findRangeToExciseForStartOrEndTruncation(line, advanceSums, truncationType, maxWidth,
                                                     truncationRangeAdjuster
                                                   #if STU_TRUNCATION_TOKEN_KERNING
                                                     , token
@@ -732,7 +864,7 @@ ExcisedGlyphRange findRangeToExciseForTruncation(
       STU_ASSERT(truncationType != kCTLineTruncationMiddle);
       STU_ASSERT(line.stringRange.contains(line.truncatableStringRange));
     }
-    return findRangeToExciseForMiddleTruncation(line, truncationType, maxWidth,
+    return findRangeToExciseForMiddleTruncation(line, advanceSums, truncationType, maxWidth,
                                                 truncationRangeAdjuster
                                               #if STU_TRUNCATION_TOKEN_KERNING
                                                 , token
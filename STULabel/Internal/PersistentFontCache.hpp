@@ -0,0 +1,133 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#pragma once
+
+#import "Font.hpp"
+
+#import "stu/FunctionRef.hpp"
+#import "stu/Vector.hpp"
+
+#ifndef STU_USE_PERSISTENT_FONT_CACHE
+  #define STU_USE_PERSISTENT_FONT_CACHE 1
+#endif
+
+#include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+namespace stu_label {
+
+/// @brief An on-disk cache for CachedFontInfo values and Int16 glyph bounds, which serves as a
+///        second-level store behind the in-memory font caches.
+///
+/// Without this cache, the font metrics and glyph bounds have to be recomputed with Core Text after
+/// every launch of the app and after every return from the background (since the in-memory caches
+/// are cleared when the app enters the background).
+///
+/// The cache file is memory-mapped and only contains fixed-size records, which are sorted by the
+/// hash of their keys. The keys consist of the font's PostScript name and a hash of the identity
+/// of the font file (path, inode, size and modification time), the glyph count, the units per em
+/// and the variation of the font. Font info keys additionally contain the font size and matrix.
+/// Glyph bounds are only stored for fonts with an identity font matrix, and, since the bounds are
+/// stored in font units, independently of the font size (except for the Apple color emoji fonts).
+///
+/// A cache file is ignored if it was written by a different OS build or file format version or if
+/// its size doesn't match the record counts in the header. These checks only need to read the
+/// file header.
+///
+/// When the app enters the background, the contents of the in-memory caches are merged with the
+/// current file and written to a new file on a background queue. The new file atomically replaces
+/// the old one.
+class PersistentFontCache {
+public:
+  struct GlyphBoundsPage {
+    /// glyph/FontFaceGlyphBoundsCache::pageSize for the first glyph in the page.
+    UInt32 index;
+    UInt32 reserved;
+    /// The bit patterns of the Rect<Int16> glyph bounds in font units. The bounds of glyphs that
+    /// aren't cached have all coordinates set to minValue<Int16>.
+    UInt64 intBounds[FontFaceGlyphBoundsCache::pageSize];
+  };
+
+  struct FontInfoEntry {
+    RC<CTFont> font;
+    CachedFontInfo info;
+  };
+
+  struct GlyphBoundsEntry {
+    RC<CTFont> font;
+    /// FontFaceGlyphBoundsCache::FontFace::appleColorEmojiSize
+    CGFloat appleColorEmojiSize;
+    Vector<GlyphBoundsPage> pages;
+  };
+
+  /// Memory-maps the cache file at the specified path. The cache is empty if the file doesn't
+  /// exist or isn't valid.
+  explicit PersistentFontCache(const char* __nonnull path);
+
+  ~PersistentFontCache();
+
+  PersistentFontCache(const PersistentFontCache&) = delete;
+  PersistentFontCache& operator=(const PersistentFontCache&) = delete;
+
+  bool isEmpty() const { return fontInfoCount_ == 0 && glyphBoundsFontCount_ == 0; }
+
+  Optional<CachedFontInfo> findFontInfo(FontRef) const;
+
+  /// The returned pages are sorted by index and are valid for the lifetime of this object.
+  ArrayRef<const GlyphBoundsPage> findGlyphBounds(FontRef, CGFloat appleColorEmojiSize) const;
+
+  /// Writes a new cache file to the specified path that contains the specified entries and, as far
+  /// as the size limits of the cache file permit, the entries of this cache that aren't
+  /// superseded by the specified entries. Entries for fonts that aren't backed by a font file are
+  /// ignored.
+  ///
+  /// The file is first written to a temporary file and then renamed, so that any existing file at
+  /// the path (including the file mapped by this object) is replaced atomically.
+  ///
+  /// Returns false if the file couldn't be written.
+  bool writeFile(const char* __nonnull path,
+                 ArrayRef<const FontInfoEntry>, ArrayRef<const GlyphBoundsEntry>) const;
+
+  // The global cache, which uses a file in the app's caches directory. The static functions are
+  // thread-safe.
+
+  static Optional<CachedFontInfo> findFontInfoInGlobalCache(FontRef);
+
+  /// Calls the function for each glyph bounds page stored for the font in the global cache.
+  ///
+  /// @note The function is called while a global mutex is locked.
+  static void forEachGlyphBoundsPageInGlobalCache(
+                FontRef, CGFloat appleColorEmojiSize,
+                FunctionRef<void(const GlyphBoundsPage&)>);
+
+  /// Asynchronously updates the global cache file with the specified entries on a serial
+  /// background queue.
+  static void updateGlobalCacheInBackground(Vector<FontInfoEntry>&&, Vector<GlyphBoundsEntry>&&);
+
+private:
+  struct FontKey;
+  struct FileHeader;
+  struct FontInfoRecord;
+  struct GlyphBoundsFontRecord;
+
+  const FontInfoRecord* __nullable findFontInfo(const FontKey&, FontRef) const;
+  const GlyphBoundsFontRecord* __nullable findGlyphBounds(const FontKey&,
+                                                          CGFloat appleColorEmojiSize) const;
+
+  const Byte* __nullable data_{};
+  UInt byteSize_{};
+  const FontInfoRecord* __nullable fontInfos_{};
+  const GlyphBoundsFontRecord* __nullable glyphBoundsFonts_{};
+  const GlyphBoundsPage* __nullable glyphBoundsPages_{};
+  Int fontInfoCount_{};
+  Int glyphBoundsFontCount_{};
+  Int glyphBoundsPageCount_{};
+};
+
+} // namespace stu_label
+
+template <>
+struct stu::IsBitwiseMovable<stu_label::PersistentFontCache::FontInfoEntry> : stu::True {};
+template <>
+struct stu::IsBitwiseMovable<stu_label::PersistentFontCache::GlyphBoundsEntry> : stu::True {};
+
+#include "UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
@@ -0,0 +1,600 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "PersistentFontCache.hpp"
+
+#import "STULabel/stu_mutex.h"
+
+#import "Hash.hpp"
+#import "HashTable.hpp"
+#import "Once.hpp"
+#import "PhaseTracing.hpp"
+
+#import "stu/BinarySearch.hpp"
+#import "stu/UniquePtr.hpp"
+
+#import <algorithm>
+#import <fcntl.h>
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <unistd.h>
+
+#include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+namespace stu_label {
+
+using CFDictionary = RemovePointer<CFDictionaryRef>;
+using CFURL = RemovePointer<CFURLRef>;
+
+/// "STUF" in little-endian byte order.
+static constexpr UInt32 fileMagic = 0x46555453;
+static constexpr UInt32 fileFormatVersion = 1;
+
+// These limits bound the size of the cache file to about 2.3 MB.
+static constexpr Int maxFontInfoCount = 1024;
+static constexpr Int maxGlyphBoundsFontCount = 256;
+static constexpr Int maxGlyphBoundsPageCount = 4096;
+
+struct PersistentFontCache::FontKey {
+  /// A hash of the PostScript name, the identity of the font file, the glyph count, the units per
+  /// em and the variation of the font.
+  UInt64 hash;
+  /// The zero-padded PostScript name. (PostScript names are limited to 63 characters.)
+  char postScriptName[64];
+
+  /// Returns none if the font isn't backed by a font file or if its PostScript name is too long.
+  ///
+  /// The keys are memoized per graphics font for the lifetime of the process, since computing a
+  /// key involves several Core Text calls and a stat call.
+  static Optional<FontKey> create(FontRef);
+
+  friend bool operator==(const FontKey& lhs, const FontKey& rhs) {
+    return lhs.hash == rhs.hash
+        && memcmp(lhs.postScriptName, rhs.postScriptName, sizeof(postScriptName)) == 0;
+  }
+
+private:
+  struct Cache;
+
+  static Optional<FontKey> createUncached(FontRef);
+};
+
+struct PersistentFontCache::FileHeader {
+  UInt32 magic;
+  UInt32 formatVersion;
+  /// A hash of the OS version and build, the Core Text version and the size of CachedFontInfo.
+  UInt64 environmentHash;
+  UInt64 byteSize;
+  UInt32 fontInfoCount;
+  UInt32 glyphBoundsFontCount;
+  UInt32 glyphBoundsPageCount;
+  UInt32 reserved;
+};
+
+struct PersistentFontCache::FontInfoRecord {
+  /// fontInfoRecordHash(fontKey, fontSize, matrix)
+  UInt64 hash;
+  FontKey fontKey;
+  CGFloat fontSize;
+  CGAffineTransform matrix;
+  CachedFontInfo info;
+};
+
+struct PersistentFontCache::GlyphBoundsFontRecord {
+  /// glyphBoundsFontRecordHash(fontKey, appleColorEmojiSize)
+  UInt64 hash;
+  FontKey fontKey;
+  CGFloat appleColorEmojiSize;
+  UInt32 pageStartIndex;
+  UInt32 pageCount;
+};
+
+// The file consists of the header, followed by the font info records sorted by hash, the glyph
+// bounds font records sorted by hash and the glyph bounds pages.
+static_assert(std::is_trivially_copyable<CachedFontInfo>::value);
+static_assert(sizeof(PersistentFontCache::GlyphBoundsPage)%8 == 0);
+
+static UInt64 hashBytes(const char* bytes, Int count) {
+  UInt64 h = hash(static_cast<UInt64>(count)).value;
+  for (Int i = 0; i < count; i += 8) {
+    UInt64 word = 0;
+    memcpy(&word, bytes + i, sign_cast(min(count - i, Int{8})));
+    h = hash(h, word).value;
+  }
+  return h;
+}
+
+static UInt64 computeEnvironmentHash() {
+  // The version string contains the OS build number.
+  const char* const osVersion = NSProcessInfo.processInfo.operatingSystemVersionString.UTF8String;
+  return hash(hashBytes(osVersion, sign_cast(strlen(osVersion))),
+              UInt64{CTGetCoreTextVersion()}, UInt64{sizeof(CachedFontInfo)}).value;
+}
+
+static UInt64 environmentHash() {
+  STU_STATIC_CONST_ONCE(UInt64, value, computeEnvironmentHash());
+  return value;
+}
+
+auto PersistentFontCache::FontKey::createUncached(FontRef font) -> Optional<FontKey> {
+  FontKey key{};
+  const RC<CFString> name{CTFontCopyPostScriptName(font.ctFont()), ShouldIncrementRefCount{false}};
+  if (!name || !CFStringGetCString(name.get(), key.postScriptName, sizeof(key.postScriptName),
+                                   kCFStringEncodingUTF8))
+  {
+    return none;
+  }
+  const RC<CFURL> url{static_cast<CFURLRef>(CTFontCopyAttribute(font.ctFont(),
+                                                                kCTFontURLAttribute)),
+                      ShouldIncrementRefCount{false}};
+  char path[PATH_MAX];
+  if (!url || CFGetTypeID(url.get()) != CFURLGetTypeID()
+      || !CFURLGetFileSystemRepresentation(url.get(), true, reinterpret_cast<UInt8*>(path),
+                                           sizeof(path)))
+  {
+    return none;
+  }
+  struct stat status;
+  if (stat(path, &status) != 0) return none;
+  UInt64 variationHash = 0;
+  const RC<CFDictionary> variation{CTFontCopyVariation(font.ctFont()),
+                                   ShouldIncrementRefCount{false}};
+  if (variation) {
+    CFDictionaryApplyFunction(variation.get(), [](const void* axis, const void* value,
+                                                  void* context)
+    {
+      Float64 axisID = 0;
+      Float64 axisValue = 0;
+      if (CFGetTypeID(axis) == CFNumberGetTypeID()) {
+        CFNumberGetValue(static_cast<CFNumberRef>(axis), kCFNumberFloat64Type, &axisID);
+      }
+      if (CFGetTypeID(value) == CFNumberGetTypeID()) {
+        CFNumberGetValue(static_cast<CFNumberRef>(value), kCFNumberFloat64Type, &axisValue);
+      }
+      // The combination must not depend on the iteration order.
+      *static_cast<UInt64*>(context) ^= stu_label::hash(axisID, axisValue).value;
+    }, &variationHash);
+  }
+  key.hash = stu_label::hash(hashBytes(key.postScriptName, sign_cast(strlen(key.postScriptName))),
+                             hashBytes(path, sign_cast(strlen(path))),
+                             static_cast<UInt64>(status.st_dev),
+                             static_cast<UInt64>(status.st_ino),
+                             static_cast<UInt64>(status.st_size),
+                             static_cast<UInt64>(status.st_mtimespec.tv_sec),
+                             static_cast<UInt64>(status.st_mtimespec.tv_nsec),
+                             static_cast<UInt64>(CTFontGetGlyphCount(font.ctFont())),
+                             UInt64{CTFontGetUnitsPerEm(font.ctFont())},
+                             variationHash).value;
+  return key;
+}
+
+struct PersistentFontCache::FontKey::Cache {
+  // The number of graphics fonts used by an app is usually small. If an app uses more fonts than
+  // this, the keys for the additional fonts aren't memoized.
+  static constexpr Int maxEntryCount = 256;
+
+  struct Entry {
+    /// Retained, so that the pointer can't be reused for a different font.
+    CGFont* cgFont;
+    Optional<FontKey> key;
+  };
+
+  Vector<Entry> entries;
+  HashSet<UInt16, Malloc> indices{uninitialized};
+
+  static stu_mutex mutex;
+  static bool isInitialized;
+  static Byte storage[];
+
+  /// @pre `mutex` must be locked by the current thread.
+  static Cache& get() {
+    if (STU_UNLIKELY(!isInitialized)) {
+      isInitialized = true;
+      Cache& cache = *new (storage) Cache{};
+      cache.indices.initializeWithBucketCount(64);
+      cache.entries.ensureFreeCapacity(16);
+    }
+    return reinterpret_cast<Cache&>(storage);
+  }
+};
+
+stu_mutex PersistentFontCache::FontKey::Cache::mutex = STU_MUTEX_INIT;
+bool PersistentFontCache::FontKey::Cache::isInitialized = false;
+alignas(PersistentFontCache::FontKey::Cache)
+Byte PersistentFontCache::FontKey::Cache::storage[sizeof(PersistentFontCache::FontKey::Cache)];
+
+auto PersistentFontCache::FontKey::create(FontRef font) -> Optional<FontKey> {
+  RC<CGFont> cgFont{CTFontCopyGraphicsFont(font.ctFont(), nullptr), ShouldIncrementRefCount{false}};
+  if (!cgFont) return createUncached(font);
+  const HashCode<UInt64> hashCode = hashPointer(cgFont.get());
+  const auto isEqual = [&](const Cache& cache, UInt16 index) -> bool {
+    return cache.entries[index].cgFont == cgFont.get();
+  };
+  stu_mutex_lock(&Cache::mutex);
+  {
+    Cache& cache = Cache::get();
+    if (const auto optIndex = cache.indices.find(hashCode, [&](UInt16 index) {
+                                return isEqual(cache, index);
+                              }))
+    {
+      const Optional<FontKey> key = cache.entries[*optIndex].key;
+      stu_mutex_unlock(&Cache::mutex);
+      return key;
+    }
+  }
+  stu_mutex_unlock(&Cache::mutex);
+  // The key is created without holding the lock, since this involves a stat call.
+  const Optional<FontKey> key = createUncached(font);
+  stu_mutex_lock(&Cache::mutex);
+  Cache& cache = Cache::get();
+  // If another thread inserted an entry for the same font in the meantime, its key is the same.
+  if (cache.entries.count() < Cache::maxEntryCount
+      && cache.indices.insert(hashCode, narrow_cast<UInt16>(cache.entries.count()),
+                              [&](UInt16 index) { return isEqual(cache, index); }).inserted)
+  {
+    cache.entries.append(Cache::Entry{std::move(cgFont).toRawPointer(), key});
+  }
+  stu_mutex_unlock(&Cache::mutex);
+  return key;
+}
+
+static UInt64 fontInfoRecordHash(UInt64 fontKeyHash, CGFloat fontSize,
+                                 const CGAffineTransform& m)
+{
+  return hash(fontKeyHash, fontSize, m.a, m.b, m.c, m.d, m.tx, m.ty).value;
+}
+
+static UInt64 glyphBoundsFontRecordHash(UInt64 fontKeyHash, CGFloat appleColorEmojiSize) {
+  return hash(fontKeyHash, appleColorEmojiSize).value;
+}
+
+/// Returns the index of the first record with the specified hash, or the index of the first
+/// record with a greater hash, or the record count.
+template <typename Record>
+static Int firstIndexWithHash(ArrayRef<const Record> records, UInt64 hash) {
+  return binarySearchFirstIndexWhere(records, [hash](const Record& record) {
+           return record.hash >= hash;
+         }).indexOrArrayCount;
+}
+
+PersistentFontCache::PersistentFontCache(const char* path) {
+  STU_TRACE_PHASE(PersistentFontCacheLoading);
+  constexpr UInt maxFileSize = sizeof(FileHeader)
+                             + sign_cast(maxFontInfoCount)*sizeof(FontInfoRecord)
+                             + sign_cast(maxGlyphBoundsFontCount)*sizeof(GlyphBoundsFontRecord)
+                             + sign_cast(maxGlyphBoundsPageCount)*sizeof(GlyphBoundsPage);
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return;
+  struct stat status;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &status) == 0
+      && sizeof(FileHeader) <= sign_cast(status.st_size)
+      && sign_cast(status.st_size) <= maxFileSize)
+  {
+    data = mmap(nullptr, sign_cast(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) return;
+  data_ = static_cast<const Byte*>(data);
+  byteSize_ = sign_cast(status.st_size);
+  STU_TRACE_PHASE_BYTE_SIZE(sign_cast(byteSize_));
+
+  const FileHeader& header = *reinterpret_cast<const FileHeader*>(data_);
+  const UInt fontInfosOffset = sizeof(FileHeader);
+  const UInt glyphBoundsFontsOffset = fontInfosOffset
+                                    + UInt{header.fontInfoCount}*sizeof(FontInfoRecord);
+  const UInt glyphBoundsPagesOffset = glyphBoundsFontsOffset
+                                    + UInt{header.glyphBoundsFontCount}
+                                      *sizeof(GlyphBoundsFontRecord);
+  const UInt size = glyphBoundsPagesOffset
+                  + UInt{header.glyphBoundsPageCount}*sizeof(GlyphBoundsPage);
+  if (header.magic != fileMagic
+      || header.formatVersion != fileFormatVersion
+      || header.environmentHash != environmentHash()
+      || header.byteSize != byteSize_
+      || size != byteSize_)
+  {
+    munmap(const_cast<Byte*>(data_), byteSize_);
+    data_ = nullptr;
+    byteSize_ = 0;
+    return;
+  }
+  fontInfos_ = reinterpret_cast<const FontInfoRecord*>(data_ + fontInfosOffset);
+  glyphBoundsFonts_ = reinterpret_cast<const GlyphBoundsFontRecord*>(data_
+                                                                     + glyphBoundsFontsOffset);
+  glyphBoundsPages_ = reinterpret_cast<const GlyphBoundsPage*>(data_ + glyphBoundsPagesOffset);
+  fontInfoCount_ = header.fontInfoCount;
+  glyphBoundsFontCount_ = header.glyphBoundsFontCount;
+  glyphBoundsPageCount_ = header.glyphBoundsPageCount;
+  STU_TRACE_PHASE_COUNT(fontInfoCount_ + glyphBoundsFontCount_);
+}
+
+PersistentFontCache::~PersistentFontCache() {
+  if (data_) {
+    munmap(const_cast<Byte*>(data_), byteSize_);
+  }
+}
+
+auto PersistentFontCache::findFontInfo(const FontKey& key, FontRef font) const
+  -> const FontInfoRecord*
+{
+  const CGFloat fontSize = font.size();
+  const CGAffineTransform matrix = CTFontGetMatrix(font.ctFont());
+  const UInt64 hash = fontInfoRecordHash(key.hash, fontSize, matrix);
+  const ArrayRef<const FontInfoRecord> records{fontInfos_, fontInfoCount_};
+  for (Int i = firstIndexWithHash(records, hash); i < records.count(); ++i) {
+    const FontInfoRecord& record = records[i];
+    if (record.hash != hash) break;
+    if (record.fontKey == key && record.fontSize == fontSize && record.matrix == matrix) {
+      return &record;
+    }
+  }
+  return nullptr;
+}
+
+auto PersistentFontCache::findGlyphBounds(const FontKey& key, CGFloat appleColorEmojiSize) const
+  -> const GlyphBoundsFontRecord*
+{
+  const UInt64 hash = glyphBoundsFontRecordHash(key.hash, appleColorEmojiSize);
+  const ArrayRef<const GlyphBoundsFontRecord> records{glyphBoundsFonts_, glyphBoundsFontCount_};
+  for (Int i = firstIndexWithHash(records, hash); i < records.count(); ++i) {
+    const GlyphBoundsFontRecord& record = records[i];
+    if (record.hash != hash) break;
+    if (record.fontKey == key && record.appleColorEmojiSize == appleColorEmojiSize) {
+      if (UInt{record.pageStartIndex} + record.pageCount > sign_cast(glyphBoundsPageCount_)) break;
+      return &record;
+    }
+  }
+  return nullptr;
+}
+
+Optional<CachedFontInfo> PersistentFontCache::findFontInfo(FontRef font) const {
+  if (fontInfoCount_ == 0) return none;
+  const Optional<FontKey> key = FontKey::create(font);
+  if (!key) return none;
+  if (const FontInfoRecord* const record = findFontInfo(*key, font)) {
+    return record->info;
+  }
+  return none;
+}
+
+auto PersistentFontCache::findGlyphBounds(FontRef font, CGFloat appleColorEmojiSize) const
+  -> ArrayRef<const GlyphBoundsPage>
+{
+  if (glyphBoundsFontCount_ == 0) return {};
+  const Optional<FontKey> key = FontKey::create(font);
+  if (!key) return {};
+  if (const GlyphBoundsFontRecord* const record = findGlyphBounds(*key, appleColorEmojiSize)) {
+    return {glyphBoundsPages_ + record->pageStartIndex, record->pageCount};
+  }
+  return {};
+}
+
+static bool writeAll(int fd, const void* bytes, UInt count) {
+  const Byte* p = static_cast<const Byte*>(bytes);
+  while (count != 0) {
+    const ssize_t n = write(fd, p, count);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += n;
+    count -= sign_cast(n);
+  }
+  return true;
+}
+
+bool PersistentFontCache::writeFile(const char* path,
+                                    ArrayRef<const FontInfoEntry> fontInfoEntries,
+                                    ArrayRef<const GlyphBoundsEntry> glyphBoundsEntries) const
+{
+  Vector<FontInfoRecord> fontInfos;
+  for (const FontInfoEntry& entry : fontInfoEntries) {
+    if (fontInfos.count() == maxFontInfoCount) break;
+    const Optional<FontKey> key = FontKey::create(entry.font.get());
+    if (!key) continue;
+    const CGFloat fontSize = CTFontGetSize(entry.font.get());
+    const CGAffineTransform matrix = CTFontGetMatrix(entry.font.get());
+    fontInfos.append(FontInfoRecord{fontInfoRecordHash(key->hash, fontSize, matrix),
+                                    *key, fontSize, matrix, entry.info});
+  }
+  const Int newFontInfoCount = fontInfos.count();
+  for (const FontInfoRecord& record : ArrayRef{fontInfos_, fontInfoCount_}) {
+    if (fontInfos.count() == maxFontInfoCount) break;
+    const bool isSuperseded = std::any_of(fontInfos.begin(), fontInfos.begin() + newFontInfoCount,
+                                          [&](const FontInfoRecord& newRecord) {
+                                            return newRecord.hash == record.hash
+                                                && newRecord.fontKey == record.fontKey
+                                                && newRecord.fontSize == record.fontSize
+                                                && newRecord.matrix == record.matrix;
+                                          });
+    if (isSuperseded) continue;
+    fontInfos.append(record);
+  }
+
+  Vector<GlyphBoundsFontRecord> glyphBoundsFonts;
+  Vector<GlyphBoundsPage> glyphBoundsPages;
+  const auto isStored = [&](const GlyphBoundsFontRecord& record) {
+    return std::any_of(glyphBoundsFonts.begin(), glyphBoundsFonts.end(),
+                       [&](const GlyphBoundsFontRecord& other) {
+                         return other.hash == record.hash
+                             && other.fontKey == record.fontKey
+                             && other.appleColorEmojiSize == record.appleColorEmojiSize;
+                       });
+  };
+  const auto append = [&](const GlyphBoundsFontRecord& record,
+                          ArrayRef<const GlyphBoundsPage> pages)
+  {
+    if (glyphBoundsFonts.count() == maxGlyphBoundsFontCount
+        || glyphBoundsPages.count() + pages.count() > maxGlyphBoundsPageCount
+        || isStored(record))
+    {
+      return;
+    }
+    glyphBoundsFonts.append(GlyphBoundsFontRecord{
+                              record.hash, record.fontKey, record.appleColorEmojiSize,
+                              narrow_cast<UInt32>(glyphBoundsPages.count()),
+                              narrow_cast<UInt32>(pages.count())});
+    glyphBoundsPages.append(pages);
+  };
+  for (const GlyphBoundsEntry& entry : glyphBoundsEntries) {
+    if (entry.pages.isEmpty()) continue;
+    const Optional<FontKey> key = FontKey::create(entry.font.get());
+    if (!key) continue;
+    append(GlyphBoundsFontRecord{glyphBoundsFontRecordHash(key->hash, entry.appleColorEmojiSize),
+                                 *key, entry.appleColorEmojiSize, 0, 0},
+           entry.pages);
+  }
+  for (const GlyphBoundsFontRecord& record : ArrayRef{glyphBoundsFonts_, glyphBoundsFontCount_}) {
+    if (UInt{record.pageStartIndex} + record.pageCount > sign_cast(glyphBoundsPageCount_)) continue;
+    append(record, ArrayRef{glyphBoundsPages_ + record.pageStartIndex, record.pageCount});
+  }
+
+  std::sort(fontInfos.begin(), fontInfos.end(),
+            [](const FontInfoRecord& r1, const FontInfoRecord& r2) { return r1.hash < r2.hash; });
+  // The page ranges of the font records are unaffected by the sorting.
+  std::sort(glyphBoundsFonts.begin(), glyphBoundsFonts.end(),
+            [](const GlyphBoundsFontRecord& r1, const GlyphBoundsFontRecord& r2) {
+              return r1.hash < r2.hash;
+            });
+
+  const UInt fontInfosSize = sign_cast(fontInfos.count())*sizeof(FontInfoRecord);
+  const UInt glyphBoundsFontsSize = sign_cast(glyphBoundsFonts.count())
+                                   *sizeof(GlyphBoundsFontRecord);
+  const UInt glyphBoundsPagesSize = sign_cast(glyphBoundsPages.count())*sizeof(GlyphBoundsPage);
+  const FileHeader header = {
+    .magic = fileMagic,
+    .formatVersion = fileFormatVersion,
+    .environmentHash = environmentHash(),
+    .byteSize = sizeof(FileHeader) + fontInfosSize + glyphBoundsFontsSize + glyphBoundsPagesSize,
+    .fontInfoCount = narrow_cast<UInt32>(fontInfos.count()),
+    .glyphBoundsFontCount = narrow_cast<UInt32>(glyphBoundsFonts.count()),
+    .glyphBoundsPageCount = narrow_cast<UInt32>(glyphBoundsPages.count())
+  };
+
+  char tempPath[PATH_MAX];
+  const int n = snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+  if (n < 0 || sign_cast(n) >= sizeof(tempPath)) return false;
+  const int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  bool success = writeAll(fd, &header, sizeof(header))
+              && writeAll(fd, fontInfos.begin(), fontInfosSize)
+              && writeAll(fd, glyphBoundsFonts.begin(), glyphBoundsFontsSize)
+              && writeAll(fd, glyphBoundsPages.begin(), glyphBoundsPagesSize);
+  success = close(fd) == 0 && success;
+  success = success && rename(tempPath, path) == 0;
+  if (!success) {
+    unlink(tempPath);
+  }
+  return success;
+}
+
+static stu_mutex globalCacheMutex = STU_MUTEX_INIT;
+static bool globalCacheIsInitialized = false;
+/// Is null if the caches directory couldn't be determined. Is only replaced on the update queue.
+static PersistentFontCache* globalCache;
+static NSString* globalCachePath;
+
+/// @pre globalCacheMutex must be locked by the current thread.
+static PersistentFontCache* __nullable globalCache_locked() {
+  if (STU_UNLIKELY(!globalCacheIsInitialized)) {
+    globalCacheIsInitialized = true;
+    NSURL* const directory = [NSFileManager.defaultManager URLsForDirectory:NSCachesDirectory
+                                                                  inDomains:NSUserDomainMask]
+                             .firstObject;
+    if (directory) {
+      globalCachePath = [directory URLByAppendingPathComponent:@"STULabelFontCache"].path;
+      globalCache = mallocNew<PersistentFontCache>(globalCachePath.fileSystemRepresentation)
+                    .toRawPointer();
+    }
+  }
+  return globalCache;
+}
+
+/// Returns null if the global cache is empty.
+static PersistentFontCache* __nullable nonEmptyGlobalCache() {
+  stu_mutex_lock(&globalCacheMutex);
+  PersistentFontCache* const cache = globalCache_locked();
+  const bool isEmpty = !cache || cache->isEmpty();
+  stu_mutex_unlock(&globalCacheMutex);
+  return isEmpty ? nullptr : cache;
+}
+
+Optional<CachedFontInfo> PersistentFontCache::findFontInfoInGlobalCache(FontRef font) {
+  if (!nonEmptyGlobalCache()) return none;
+  // The key is created without holding the lock, since this involves a stat call.
+  const Optional<FontKey> key = FontKey::create(font);
+  if (!key) return none;
+  Optional<CachedFontInfo> result;
+  stu_mutex_lock(&globalCacheMutex);
+  if (const FontInfoRecord* const record = globalCache->findFontInfo(*key, font)) {
+    result = record->info;
+  }
+  stu_mutex_unlock(&globalCacheMutex);
+  return result;
+}
+
+void PersistentFontCache::forEachGlyphBoundsPageInGlobalCache(
+                            FontRef font, CGFloat appleColorEmojiSize,
+                            FunctionRef<void(const GlyphBoundsPage&)> body)
+{
+  if (!nonEmptyGlobalCache()) return;
+  const Optional<FontKey> key = FontKey::create(font);
+  if (!key) return;
+  stu_mutex_lock(&globalCacheMutex);
+  const PersistentFontCache& cache = *globalCache;
+  if (const GlyphBoundsFontRecord* const record = cache.findGlyphBounds(*key,
+                                                                        appleColorEmojiSize))
+  {
+    for (const GlyphBoundsPage& page : ArrayRef{cache.glyphBoundsPages_ + record->pageStartIndex,
+                                                record->pageCount})
+    {
+      body(page);
+    }
+  }
+  stu_mutex_unlock(&globalCacheMutex);
+}
+
+/// Must only be called on the update queue.
+static void updateGlobalCache(ArrayRef<const PersistentFontCache::FontInfoEntry> fontInfos,
+                              ArrayRef<const PersistentFontCache::GlyphBoundsEntry> glyphBounds)
+{
+  stu_mutex_lock(&globalCacheMutex);
+  PersistentFontCache* const oldCache = globalCache_locked();
+  NSString* const path = globalCachePath;
+  stu_mutex_unlock(&globalCacheMutex);
+  if (!oldCache) return;
+  // Since the global cache is only replaced on this serial queue, we can read the old cache
+  // without holding the lock.
+  if (!oldCache->writeFile(path.fileSystemRepresentation, fontInfos, glyphBounds)) return;
+  PersistentFontCache* const newCache = mallocNew<PersistentFontCache>(
+                                          path.fileSystemRepresentation).toRawPointer();
+  stu_mutex_lock(&globalCacheMutex);
+  globalCache = newCache;
+  stu_mutex_unlock(&globalCacheMutex);
+  // Readers only access the global cache while holding the lock, so we can now destroy the old one.
+  const Malloced<PersistentFontCache> destroyedCache{oldCache};
+}
+
+void PersistentFontCache::updateGlobalCacheInBackground(Vector<FontInfoEntry>&& fontInfos,
+                                                        Vector<GlyphBoundsEntry>&& glyphBounds)
+{
+  if (fontInfos.isEmpty() && glyphBounds.isEmpty()) return;
+  struct Update {
+    Vector<FontInfoEntry> fontInfos;
+    Vector<GlyphBoundsEntry> glyphBounds;
+  };
+  STU_STATIC_CONST_ONCE(dispatch_queue_t, queue,
+                        dispatch_queue_create("STULabel.PersistentFontCache",
+                                              dispatch_queue_attr_make_with_qos_class(
+                                                DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0)));
+  Update* const update = mallocNew<Update>(std::move(fontInfos), std::move(glyphBounds))
+                         .toRawPointer();
+  dispatch_async_f(queue, update, [](void* context) {
+    const Malloced<Update> update{static_cast<Update*>(context)};
+    updateGlobalCache(update->fontInfos, update->glyphBounds);
+  });
+}
+
+} // namespace stu_label
+
+#include "UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
@@ -0,0 +1,79 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "STULabel/STUPhaseTracing.h"
+
+#import "Common.hpp"
+
+#ifndef STU_PHASE_TRACING
+  #define STU_PHASE_TRACING 0
+#endif
+
+#if STU_PHASE_TRACING
+  /// Records the duration of the remainder of the enclosing scope as a trace event for the
+  /// specified STUTracePhase (without the prefix).
+  #define STU_TRACE_PHASE(phase) \
+    ::stu_label::PhaseTraceScope stu_phaseTraceScope{STUTracePhase##phase}
+  #define STU_TRACE_PHASE_COUNT(value) (stu_phaseTraceScope.count = (value))
+  #define STU_TRACE_PHASE_BYTE_SIZE(value) (stu_phaseTraceScope.byteSize = (value))
+  /// Associates the trace events recorded on the current thread in the remainder of the enclosing
+  /// scope with a new render task ID, unless a render task ID is already set.
+  #define STU_TRACE_RENDER_TASK() \
+    ::stu_label::RenderTaskTraceScope stu_renderTaskTraceScope
+#else
+  #define STU_TRACE_PHASE(phase)
+  #define STU_TRACE_PHASE_COUNT(value) ((void)0)
+  #define STU_TRACE_PHASE_BYTE_SIZE(value) ((void)0)
+  #define STU_TRACE_RENDER_TASK()
+#endif
+
+#if STU_PHASE_TRACING
+
+#include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+namespace stu_label {
+
+UInt64 traceTime();
+
+void recordTraceEvent(const STUTraceEvent& event);
+
+/// Begins an os_signpost interval for the phase if signposts are enabled.
+/// Returns the signpost ID, or 0 if no interval was begun.
+UInt64 beginPhaseSignpostInterval(STUTracePhase phase);
+
+class PhaseTraceScope {
+public:
+  Int64 count{};
+  Int64 byteSize{};
+
+  explicit PhaseTraceScope(STUTracePhase phase)
+  : phase_{phase}, signpostID_{beginPhaseSignpostInterval(phase)}, startTime_{traceTime()}
+  {}
+
+  ~PhaseTraceScope();
+
+  PhaseTraceScope(const PhaseTraceScope&) = delete;
+  PhaseTraceScope& operator=(const PhaseTraceScope&) = delete;
+
+private:
+  STUTracePhase phase_;
+  UInt64 signpostID_;
+  UInt64 startTime_;
+};
+
+class RenderTaskTraceScope {
+public:
+  RenderTaskTraceScope();
+  ~RenderTaskTraceScope();
+
+  RenderTaskTraceScope(const RenderTaskTraceScope&) = delete;
+  RenderTaskTraceScope& operator=(const RenderTaskTraceScope&) = delete;
+
+private:
+  bool isOutermostScope_;
+};
+
+} // namespace stu_label
+
+#include "UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+#endif // STU_PHASE_TRACING
@@ -0,0 +1,266 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "PhaseTracing.hpp"
+
+#import "STULabel/stu_mutex.h"
+
+#if STU_PHASE_TRACING
+
+#import "Once.hpp"
+#import "ThreadLocalAllocator.hpp"
+
+#import <mach/mach_time.h>
+#import <os/signpost.h>
+#import <pthread.h>
+
+#include <atomic>
+
+#endif
+
+#include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+using namespace stu;
+using namespace stu_label;
+
+#if STU_PHASE_TRACING
+
+namespace stu_label {
+
+UInt64 traceTime() {
+  STU_STATIC_CONST_ONCE(mach_timebase_info_data_t, timebase, ({
+    mach_timebase_info_data_t info;
+    mach_timebase_info(&info);
+    info;
+  }));
+  const UInt64 t = mach_absolute_time();
+  if (timebase.numer == timebase.denom) return t;
+  return static_cast<UInt64>(static_cast<Float64>(t)*timebase.numer/timebase.denom);
+}
+
+namespace {
+
+struct TraceEventRingBuffer {
+  STUTraceEvent* events;
+  UInt capacity;
+  UInt start;
+  UInt count;
+};
+
+} // namespace
+
+static stu_mutex traceMutex = STU_MUTEX_INIT;
+static STUTraceEventHandler traceEventHandler; // Guarded by traceMutex.
+static TraceEventRingBuffer traceEventRingBuffer; // Guarded by traceMutex.
+// Allows recordTraceEvent to skip the locking when there's no handler and no ring buffer.
+static std::atomic<bool> traceEventsAreRecorded;
+static std::atomic<bool> traceSignpostsAreEnabled;
+
+static std::atomic<UInt64> renderTaskIDCounter;
+#if STU_HAS_THREAD_LOCAL
+static thread_local UInt64 currentRenderTaskID;
+#else
+static const UInt64 currentRenderTaskID = 0;
+#endif
+
+static void updateTraceEventsAreRecorded() {
+  traceEventsAreRecorded.store(traceEventHandler != nil || traceEventRingBuffer.capacity != 0,
+                               std::memory_order_relaxed);
+}
+
+STU_DISABLE_CLANG_WARNING("-Wunguarded-availability")
+static os_log_t traceLog() {
+  STU_STATIC_CONST_ONCE(os_log_t, log, os_log_create("STULabel", "Phases"));
+  return log;
+}
+STU_REENABLE_CLANG_WARNING
+
+static const char* phaseName(STUTracePhase phase) {
+  switch (phase) {
+  case STUTracePhaseTextShaping:                return "TextShaping";
+  case STUTracePhaseLayout:                     return "Layout";
+  case STUTracePhaseTruncation:                 return "Truncation";
+  case STUTracePhaseJustification:              return "Justification";
+  case STUTracePhaseImageBounds:                return "ImageBounds";
+  case STUTracePhaseDrawing:                    return "Drawing";
+  case STUTracePhaseTextFrameCreation:          return "TextFrameCreation";
+  case STUTracePhaseLineRecreation:             return "LineRecreation";
+  case STUTracePhaseTextRects:                  return "TextRects";
+  case STUTracePhaseTextRectsPath:              return "TextRectsPath";
+  case STUTracePhaseDisplayListRecording:       return "DisplayListRecording";
+  case STUTracePhasePersistentFontCacheLoading: return "PersistentFontCacheLoading";
+  }
+  return "Unknown";
+}
+
+UInt64 beginPhaseSignpostInterval(STUTracePhase phase) {
+  if (STU_LIKELY(!traceSignpostsAreEnabled.load(std::memory_order_relaxed))) return 0;
+  if (@available(iOS 12.0, tvOS 12.0, macOS 10.14, *)) {
+    const os_log_t log = traceLog();
+    const os_signpost_id_t signpostID = os_signpost_id_generate(log);
+    os_signpost_interval_begin(log, signpostID, "Phase", "%{public}s", phaseName(phase));
+    return signpostID;
+  }
+  return 0;
+}
+
+/// @pre signpostID was returned by beginPhaseSignpostInterval and isn't 0.
+static void endPhaseSignpostInterval(UInt64 signpostID, const STUTraceEvent& event) {
+  if (@available(iOS 12.0, tvOS 12.0, macOS 10.14, *)) {
+    os_signpost_interval_end(traceLog(), signpostID, "Phase",
+                             "%{public}s count: %lld, bytes: %lld, task: %llu",
+                             phaseName(event.phase), event.count, event.byteSize,
+                             event.renderTaskID);
+  }
+}
+
+void recordTraceEvent(const STUTraceEvent& event) {
+  if (!traceEventsAreRecorded.load(std::memory_order_relaxed)) return;
+  stu_mutex_lock(&traceMutex);
+  const STUTraceEventHandler handler = traceEventHandler;
+  TraceEventRingBuffer& buffer = traceEventRingBuffer;
+  if (buffer.capacity != 0) {
+    buffer.events[(buffer.start + buffer.count)%buffer.capacity] = event;
+    if (buffer.count < buffer.capacity) {
+      buffer.count += 1;
+    } else {
+      buffer.start = (buffer.start + 1)%buffer.capacity;
+    }
+  }
+  stu_mutex_unlock(&traceMutex);
+  if (handler) {
+    handler(&event);
+  }
+}
+
+PhaseTraceScope::~PhaseTraceScope() {
+  const UInt64 endTime = traceTime();
+  const STUTraceEvent event{.startTime = startTime_, .duration = endTime - startTime_,
+                            .renderTaskID = currentRenderTaskID,
+                            .count = count, .byteSize = byteSize,
+                            .threadID = pthread_mach_thread_np(pthread_self()),
+                            .phase = phase_};
+  // An interval that was begun is always ended, even if signposts were disabled in the meantime.
+  if (STU_UNLIKELY(signpostID_ != 0)) {
+    endPhaseSignpostInterval(signpostID_, event);
+  }
+  recordTraceEvent(event);
+}
+
+RenderTaskTraceScope::RenderTaskTraceScope()
+: isOutermostScope_{currentRenderTaskID == 0}
+{
+#if STU_HAS_THREAD_LOCAL
+  if (isOutermostScope_) {
+    currentRenderTaskID = renderTaskIDCounter.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+#endif
+}
+
+RenderTaskTraceScope::~RenderTaskTraceScope() {
+#if STU_HAS_THREAD_LOCAL
+  if (isOutermostScope_) {
+    currentRenderTaskID = 0;
+  }
+#endif
+}
+
+} // namespace stu_label
+
+#endif // STU_PHASE_TRACING
+
+STU_EXPORT
+bool stu_phaseTracingIsAvailable(void) {
+  return STU_PHASE_TRACING;
+}
+
+STU_EXPORT
+void stu_setTraceEventHandler(STUTraceEventHandler __nullable handler) {
+#if STU_PHASE_TRACING
+  handler = [handler copy];
+  stu_mutex_lock(&traceMutex);
+  STUTraceEventHandler const oldHandler = traceEventHandler;
+  traceEventHandler = handler;
+  updateTraceEventsAreRecorded();
+  stu_mutex_unlock(&traceMutex);
+  discard(oldHandler); // Released outside the lock.
+#else
+  discard(handler);
+#endif
+}
+
+STU_EXPORT
+void stu_setTraceRingBufferCapacity(size_t capacity) {
+#if STU_PHASE_TRACING
+  STUTraceEvent* const events =
+    capacity == 0 ? nullptr : static_cast<STUTraceEvent*>(malloc(capacity*sizeof(STUTraceEvent)));
+  if (capacity != 0 && !events) return;
+  stu_mutex_lock(&traceMutex);
+  STUTraceEvent* const oldEvents = traceEventRingBuffer.events;
+  traceEventRingBuffer = TraceEventRingBuffer{.events = events, .capacity = capacity};
+  updateTraceEventsAreRecorded();
+  stu_mutex_unlock(&traceMutex);
+  free(oldEvents);
+#else
+  discard(capacity);
+#endif
+}
+
+STU_EXPORT
+size_t stu_takeTraceEvents(STUTraceEvent* __nonnull events, size_t capacity) {
+#if STU_PHASE_TRACING
+  stu_mutex_lock(&traceMutex);
+  TraceEventRingBuffer& buffer = traceEventRingBuffer;
+  const UInt n = min(capacity, buffer.count);
+  for (UInt i = 0; i < n; ++i) {
+    events[i] = buffer.events[(buffer.start + i)%buffer.capacity];
+  }
+  if (n != 0) {
+    buffer.start = (buffer.start + n)%buffer.capacity;
+    buffer.count -= n;
+  }
+  stu_mutex_unlock(&traceMutex);
+  return n;
+#else
+  discard(events, capacity);
+  return 0;
+#endif
+}
+
+STU_EXPORT
+void stu_setTraceSignpostsEnabled(bool enabled) {
+#if STU_PHASE_TRACING
+  traceSignpostsAreEnabled.store(enabled, std::memory_order_relaxed);
+#else
+  discard(enabled);
+#endif
+}
+
+STU_EXPORT
+NSData* __nonnull stu_chromeTraceJSONForTraceEvents(const STUTraceEvent* __nullable events,
+                                                    size_t count)
+{
+  NSMutableData* const data = [[NSMutableData alloc] init];
+  [data appendBytes:"[" length:1];
+#if STU_PHASE_TRACING
+  char buffer[256];
+  for (size_t i = 0; i < count; ++i) {
+    const STUTraceEvent& event = events[i];
+    // Complete events ("ph": "X") with the timestamp and duration in microseconds.
+    const int n = snprintf(buffer, sizeof(buffer),
+                           "%s\n{\"name\":\"%s\",\"cat\":\"STULabel\",\"ph\":\"X\","
+                           "\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%u,"
+                           "\"args\":{\"renderTask\":%llu,\"count\":%lld,\"bytes\":%lld}}",
+                           i == 0 ? "" : ",", phaseName(event.phase),
+                           event.startTime/1000.0, event.duration/1000.0, event.threadID,
+                           event.renderTaskID, event.count, event.byteSize);
+    if (n <= 0) continue;
+    [data appendBytes:buffer length:min(sign_cast(n), sizeof(buffer) - 1)];
+  }
+#else
+  discard(events, count);
+#endif
+  [data appendBytes:"\n]\n" length:3];
+  return data;
+}
+
+#include "UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
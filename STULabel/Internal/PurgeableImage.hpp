@@ -63,6 +63,8 @@ public:
 
   SizeInPixels<UInt32> sizeInPixels() const { return size_; }
 
+  UInt sizeInBytes() const { return UInt{bytesPerRowDiv32_}*32*size_.height; }
+
   STU_INLINE
   PurgeableImage()
   : data_{}, size_{}, bytesPerRowDiv32_{}, formatOptions_{}, format_{},
@@ -79,6 +81,13 @@ public:
                  STUPredefinedCGImageFormat, STUCGImageFormatOptions,
                  FunctionRef<void(CGContext*)> drawingFunction);
 
+  /// Creates a copy of the original image and then calls the drawing function with a bitmap
+  /// context for the copied pixels, so that parts of the image can be redrawn. (The original data
+  /// can't be modified in place, since it may still be referenced by CGImages that are on screen.)
+  /// The created image is empty if the original image was purged.
+  PurgeableImage(PurgeableImage& original, CGFloat scale,
+                 FunctionRef<void(CGContext*)> drawingFunction);
+
   STU_INLINE
   PurgeableImage(const PurgeableImage& other)
   : data_{}
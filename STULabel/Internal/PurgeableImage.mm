@@ -65,6 +65,40 @@ Failure:
   return;
 }
 
+PurgeableImage::PurgeableImage(PurgeableImage& original, CGFloat scale,
+                               FunctionRef<void(CGContext*)> drawingFunction)
+: PurgeableImage{}
+{
+  const bool originalWasNonPurgeable = original.hasUnconsumedContentAccessBegin_;
+  if (!original.tryMakeNonPurgeableUntilNextCGImageIsCreated()) return;
+  NSPurgeableData* const data = [[NSPurgeableData alloc] initWithBytes:original.data_.bytes
+                                                                length:original.data_.length];
+  if (!originalWasNonPurgeable) {
+    original.makePurgeableOnceAllCGImagesAreDestroyed();
+  }
+  void* const bytes = [data mutableBytes];
+  if (!bytes) {
+#if STU_DEBUG
+    STU_CHECK_MSG(false, "Failed to allocate purgeable image bitmap buffer");
+#else
+    NSLog(@"Failed to allocate purgeable image bitmap buffer");
+#endif
+    return;
+  }
+  const UInt bytesPerRow = UInt{original.bytesPerRowDiv32_}*32;
+  const CGContextRef context = stu_createCGBitmapContext(
+                                 original.size_.width, original.size_.height, scale, nil,
+                                 stuCGImageFormat(original.format_, original.formatOptions_),
+                                 bytes, bytesPerRow);
+  if (!context) return; // stu_createCGBitmapContext already logs any error.
+  drawingFunction(context);
+  CGContextFlush(context);
+  CFRelease(context);
+
+  *this = PurgeableImage(data, original.size_, original.format_, original.formatOptions_,
+                         bytesPerRow);
+}
+
 void PurgeableImage::makePurgeableOnceAllCGImagesAreDestroyed() {
   if (!hasUnconsumedContentAccessBegin_) return;
   hasUnconsumedContentAccessBegin_ = false;
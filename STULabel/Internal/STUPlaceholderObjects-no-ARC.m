@@ -37,6 +37,12 @@ STUTextFrame * __nonnull
                                           const STUCancellationFlag*)
     NS_RETURNS_RETAINED;
 
+STUTextFrame * __nullable
+  STUTextFrameCreateWithSerializedData(__nullable Class cls,
+                                       NSData * __nonnull serializedData,
+                                       STUShapedString * __nonnull shapedString)
+    NS_RETURNS_RETAINED;
+
 STU_EXTERN_C_END
 
 STU_DISABLE_CLANG_WARNING("-Wobjc-designated-initializers")
@@ -96,6 +102,12 @@ STU_DISABLE_CLANG_WARNING("-Wobjc-missing-super-calls")
                                                      displayScale, options, cancellationFlag);
 }
 
+- (nullable STUTextFrame *)initWithSerializedData:(nonnull NSData *)serializedData
+                                     shapedString:(nonnull STUShapedString *)shapedString
+{
+  return (id)STUTextFrameCreateWithSerializedData(nil, serializedData, shapedString);
+}
+
 - (void)dealloc {}
 
 - (instancetype)retain { return self;  }
@@ -5,11 +5,14 @@
 
 #import "Font.hpp"
 #import "HashTable.hpp"
+#import "Hyphenation.hpp"
 #import "NSAttributedStringRef.hpp"
 #import "TextStyleBuffer.hpp"
 
 #import "stu/FunctionRef.hpp"
 
+#include <atomic>
+
 #include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
 
 namespace stu_label {
@@ -106,6 +109,8 @@ public:
   const bool defaultBaseWritingDirectionWasUsed;
   const Int textStylesSize;
 private:
+  /// Lazily allocated array with paragraphCount elements.
+  mutable std::atomic<std::atomic<const HyphenationLocations*>*> paragraphHyphenationLocations_{};
   Paragraph paragraphs_[];
 
 public:
@@ -157,6 +162,15 @@ public:
             TextStyleSpan{.firstStyle = firstStyle, .terminatorStyle = terminatorStyle}};
   };
 
+  /// Returns the lazily computed and cached hyphenation locations of the specified paragraph.
+  /// Thread-safe.
+  ///
+  /// @pre `attributedString` references `this->attributedString`.
+  /// @pre The current thread has a ThreadLocalArenaAllocator.
+  const HyphenationLocations& hyphenationLocations(Int32 paragraphIndex,
+                                                   const NSAttributedStringRef& attributedString,
+                                                   HyphenationLocaleCache& localeCache) const;
+
   static ShapedString* __nullable create(NSAttributedString*, STUWritingDirection,
                                          const STUCancellationFlag*,
                                          FunctionRef<void*(UInt)> alloc);
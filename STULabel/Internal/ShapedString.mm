@@ -10,6 +10,7 @@
 #import "InputClamping.hpp"
 #import "NSAttributedStringRef.hpp"
 #import "Once.hpp"
+#import "PhaseTracing.hpp"
 #import "TextFrameLayouter.hpp"
 #import "TextStyleBuffer.hpp"
 #import "ThreadLocalAllocator.hpp"
@@ -408,6 +409,7 @@ ShapedString* __nullable
                        const STUCancellationFlag* cancellationFlagPointer,
                        const FunctionRef<void*(UInt)> alloc)
 {
+  STU_TRACE_PHASE(TextShaping);
   // Make sure the string is immutable.
   NSAttributedString* attributedString = [originalAttributedString copy];
 
@@ -453,6 +455,9 @@ ShapedString* __nullable
                   + sizeof(ColorHashBucket)*sign_cast(colors.count()) + sanitizerGap
                   + sign_cast(textStyleBuffer.data().count()) + sanitizerGap;
 
+  STU_TRACE_PHASE_COUNT(paragraphs.count());
+  STU_TRACE_PHASE_BYTE_SIZE(sign_cast(size));
+
   return new (alloc(size))
              ShapedString{attributedString, status.stringLength,
                           defaultBaseWritingDirection, status.defaultBaseWritingDirectionWasUsed,
@@ -554,7 +559,52 @@ ShapedString::ShapedString(NSAttributedString* const attributedString, const Int
                                     tas.fontMetrics);
 }
 
+const HyphenationLocations& ShapedString::hyphenationLocations(
+                                             Int32 paragraphIndex,
+                                             const NSAttributedStringRef& attributedString,
+                                             HyphenationLocaleCache& localeCache) const
+{
+  STU_DEBUG_ASSERT(0 <= paragraphIndex && paragraphIndex < paragraphCount);
+  STU_DEBUG_ASSERT(attributedString.attributedString == this->attributedString);
+  std::atomic<const HyphenationLocations*>* array =
+    paragraphHyphenationLocations_.load(std::memory_order_acquire);
+  if (STU_UNLIKELY(!array)) {
+    std::atomic<const HyphenationLocations*>* const newArray =
+      new std::atomic<const HyphenationLocations*>[sign_cast(paragraphCount)]();
+    if (paragraphHyphenationLocations_.compare_exchange_strong(array, newArray,
+                                                               std::memory_order_acq_rel))
+    {
+      array = newArray;
+    } else {
+      delete[] newArray;
+    }
+  }
+  std::atomic<const HyphenationLocations*>& entry = array[paragraphIndex];
+  if (const HyphenationLocations* const locations = entry.load(std::memory_order_acquire)) {
+    return *locations;
+  }
+  const Range<Int32> stringRange = arrays().paragraphs[paragraphIndex].stringRange;
+  const HyphenationLocations* locations =
+    &HyphenationLocations::create(attributedString, stringRange, localeCache);
+  const HyphenationLocations* expected = nullptr;
+  if (!entry.compare_exchange_strong(expected, locations, std::memory_order_acq_rel)) {
+    HyphenationLocations::destroy(*locations);
+    locations = expected;
+  }
+  return *locations;
+}
+
 ShapedString::~ShapedString() {
+  if (std::atomic<const HyphenationLocations*>* const array =
+        paragraphHyphenationLocations_.load(std::memory_order_relaxed))
+  {
+    for (Int i = 0; i < paragraphCount; ++i) {
+      if (const HyphenationLocations* const locations = array[i].load(std::memory_order_relaxed)) {
+        HyphenationLocations::destroy(*locations);
+      }
+    }
+    delete[] array;
+  }
   const ArraysRef tas = arrays();
   for (ColorRef color : tas.colors.reversed()) {
     decrementRefCount(color.cgColor());
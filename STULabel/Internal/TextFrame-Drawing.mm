@@ -4,6 +4,7 @@
 
 #import "DrawingContext.hpp"
 #import "TextFrame.hpp"
+#import "TextFrameDisplayList.hpp"
 
 
 namespace stu_label {
@@ -98,6 +99,10 @@ void TextFrame::draw(CGPoint origin,
 
   const Point<Float64> textFrameOrigin = origin;
 
+#if STU_USE_TEXT_FRAME_DISPLAY_LIST
+  const TextFrameDisplayList& displayList = TextFrameDisplayList::get(*this);
+#endif
+
   for (const TextFrameLine& line : this->lines()[clipLineRange]) {
     if (context.isCancelled()) break;
 
@@ -111,6 +116,11 @@ void TextFrame::draw(CGPoint origin,
 
     if (const auto scope = context.enterLineDrawingScope(line)) {
       context.setLineOrigin({cgLineOrigin.x, -cgLineOrigin.y});
+    #if STU_USE_TEXT_FRAME_DISPLAY_LIST
+      // A replayed line doesn't need the CTLine.
+      if (displayList.drawLLO(line, context)) continue;
+    #endif
+      const TextFrameLine::RecreatedCTLineScope ctLineScope{line};
       line.drawLLO(context);
     }
   }
@@ -4,10 +4,139 @@
 
 #import "stu/BinarySearch.hpp"
 
+#import <stdatomic.h>
+
 #include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
 
+struct STUTextFrameLineIndexTable {};
+
 namespace stu_label {
 
+/// Block-sampled lookup tables for mapping indices in the original or the truncated string to the
+/// index of the line containing the string index.
+///
+/// For every block of `1 << shift` UTF-16 code units the table stores the index of the line that
+/// contains the first code unit of the block. The block size is chosen such that it isn't larger
+/// than the average line length, so that the lookup only has to look at a few lines after the
+/// sampled line. The table is only created for text frames with at least `minLineCount` lines,
+/// since for smaller frames a binary search over the line string indices is just as fast.
+class LineIndexTable : public STUTextFrameLineIndexTable {
+public:
+  static constexpr Int32 minLineCount = 128;
+
+  /// Returns null if the text frame has less than `minLineCount` lines. Thread-safe.
+  static const LineIndexTable* __nullable get(const TextFrame&);
+
+  template <Int32 StringStartIndices::* startIndex>
+  STU_INLINE
+  Int32 lineIndex(ArrayRef<const StringStartIndices> lineStringIndices, Int32 stringIndex) const {
+    const Samples& samples = startIndex == &StringStartIndices::startIndexInOriginalString
+                           ? originalString_ : truncatedString_;
+    const StringStartIndices* const indices = lineStringIndices.begin();
+    const Int32 offset = stringIndex - indices[0].*startIndex;
+    const Int32 k = clamp(0, offset >> samples.shift, samples.count - 1);
+    Int32 lineIndex = samples.lineIndices[k];
+    const Int32 nextLineIndex = k + 1 < samples.count ? samples.lineIndices[k + 1]
+                              : narrow_cast<Int32>(lineStringIndices.count() - 2);
+    if (nextLineIndex - lineIndex <= 8) {
+      while (lineIndex < nextLineIndex && indices[lineIndex + 1].*startIndex <= stringIndex) {
+        ++lineIndex;
+      }
+    } else {
+      lineIndex += narrow_cast<Int32>(
+                     binarySearchFirstIndexWhere(
+                       ArrayRef{indices + lineIndex + 1, nextLineIndex - lineIndex},
+                       [&](const StringStartIndices& si) { return si.*startIndex > stringIndex; }
+                     ).indexOrArrayCount);
+    }
+    return lineIndex;
+  }
+
+private:
+  struct Samples {
+    Int32 shift;
+    Int32 count;
+    const Int32* lineIndices;
+  };
+
+  template <Int32 StringStartIndices::* startIndex>
+  static Samples sampleCountAndShift(ArrayRef<const StringStartIndices> lineStringIndices) {
+    const Int32 lineCount = narrow_cast<Int32>(lineStringIndices.count() - 1);
+    const Int32 length = lineStringIndices[lineCount].*startIndex
+                       - lineStringIndices[0].*startIndex;
+    const Int32 averageLineLength = length/lineCount;
+    const Int32 shift = averageLineLength <= 1 ? 0
+                      : 31 - countLeadingZeroBits(sign_cast(averageLineLength));
+    return {.shift = shift, .count = (length >> shift) + 1, .lineIndices = nullptr};
+  }
+
+  template <Int32 StringStartIndices::* startIndex>
+  static void writeSamples(ArrayRef<const StringStartIndices> lineStringIndices,
+                           Samples& samples, Int32* lineIndices)
+  {
+    const Int32 lineCount = narrow_cast<Int32>(lineStringIndices.count() - 1);
+    const Int32 stringStart = lineStringIndices[0].*startIndex;
+    Int32 lineIndex = 0;
+    for (Int32 k = 0; k < samples.count; ++k) {
+      const Int32 stringIndex = stringStart + (k << samples.shift);
+      while (lineIndex + 1 < lineCount
+             && lineStringIndices[lineIndex + 1].*startIndex <= stringIndex)
+      {
+        ++lineIndex;
+      }
+      lineIndices[k] = lineIndex;
+    }
+    samples.lineIndices = lineIndices;
+  }
+
+  static const LineIndexTable* create(const TextFrame&);
+
+  Samples originalString_;
+  Samples truncatedString_;
+};
+
+STU_NO_INLINE
+const LineIndexTable* LineIndexTable::create(const TextFrame& textFrame) {
+  const ArrayRef<const StringStartIndices> indices = textFrame.lineStringIndices();
+  Samples originalString = sampleCountAndShift<&StringStartIndices::startIndexInOriginalString>(
+                             indices);
+  Samples truncatedString = sampleCountAndShift<&StringStartIndices::startIndexInTruncatedString>(
+                              indices);
+  static_assert(sizeof(LineIndexTable)%alignof(Int32) == 0);
+  const UInt size = sizeof(LineIndexTable)
+                  + sign_cast(originalString.count + truncatedString.count)*sizeof(Int32);
+  Byte* const p = Malloc{}.allocate(sign_cast(size));
+  Int32* const lineIndices = reinterpret_cast<Int32*>(p + sizeof(LineIndexTable));
+  writeSamples<&StringStartIndices::startIndexInOriginalString>(
+    indices, originalString, lineIndices);
+  writeSamples<&StringStartIndices::startIndexInTruncatedString>(
+    indices, truncatedString, lineIndices + originalString.count);
+  LineIndexTable* const table = new (p) LineIndexTable{};
+  table->originalString_ = originalString;
+  table->truncatedString_ = truncatedString;
+  return table;
+}
+
+const LineIndexTable* __nullable LineIndexTable::get(const TextFrame& textFrame) {
+  if (textFrame.lineCount < minLineCount) return nullptr;
+  _Atomic(const STUTextFrameLineIndexTable*)* const frameTable =
+    const_cast<_Atomic(const STUTextFrameLineIndexTable*)*>(&textFrame._lineIndexTable);
+  const STUTextFrameLineIndexTable* table = atomic_load_explicit(frameTable, memory_order_relaxed);
+  if (STU_LIKELY(table)) {
+    table = atomic_load_explicit(frameTable, memory_order_acquire);
+  } else {
+    table = create(textFrame);
+    const STUTextFrameLineIndexTable* expected = nullptr;
+    if (!atomic_compare_exchange_strong_explicit(frameTable, &expected, table,
+                                                 memory_order_release, memory_order_acquire))
+    {
+      free(const_cast<STUTextFrameLineIndexTable*>(table));
+      table = expected;
+    }
+  }
+  return static_cast<const LineIndexTable*>(table);
+}
+
 TextFrameIndex TextFrame::index(IndexInOriginalString unsignedIndexInOriginalString,
                                 IndexInTruncationToken indexInTruncationToken) const
 {
@@ -22,11 +151,17 @@ TextFrameIndex TextFrame::index(IndexInOriginalString unsignedIndexInOriginalStr
     unsignedIndexInOriginalString.value = fullRangeInOriginalString.start;
   }
   const Int32 indexInOriginalString = static_cast<Int32>(unsignedIndexInOriginalString.value);
-  const Int32 lineIndex = narrow_cast<Int32>(
-                            binarySearchFirstIndexWhere(lineStringIndices(),
-                              [&](const StringStartIndices& si)
-                              { return si.startIndexInOriginalString > indexInOriginalString; }
-                            ).indexOrArrayCount - 1);
+  Int32 lineIndex;
+  if (const LineIndexTable* const table = LineIndexTable::get(*this)) {
+    lineIndex = table->lineIndex<&StringStartIndices::startIndexInOriginalString>(
+                  lineStringIndices(), indexInOriginalString);
+  } else {
+    lineIndex = narrow_cast<Int32>(
+                  binarySearchFirstIndexWhere(lineStringIndices(),
+                    [&](const StringStartIndices& si)
+                    { return si.startIndexInOriginalString > indexInOriginalString; }
+                  ).indexOrArrayCount - 1);
+  }
   const Int32 paraIndex = lines()[lineIndex].paragraphIndex;
   const TextFrameParagraph& para = paragraphs()[paraIndex];
   Int32 index;
@@ -70,11 +205,17 @@ TextFrameIndex TextFrame::index(IndexInTruncatedString unsignedIndexInTruncatedS
     return TextFrameIndex{};
   }
   const Int32 indexInTruncatedString = static_cast<Int32>(unsignedIndexInTruncatedString.value);
-  const Int32 lineIndex = narrow_cast<Int32>(
-                            binarySearchFirstIndexWhere(lineStringIndices(),
-                              [&](const StringStartIndices& si)
-                              { return si.startIndexInTruncatedString > indexInTruncatedString; }
-                            ).indexOrArrayCount - 1);
+  Int32 lineIndex;
+  if (const LineIndexTable* const table = LineIndexTable::get(*this)) {
+    lineIndex = table->lineIndex<&StringStartIndices::startIndexInTruncatedString>(
+                  lineStringIndices(), indexInTruncatedString);
+  } else {
+    lineIndex = narrow_cast<Int32>(
+                  binarySearchFirstIndexWhere(lineStringIndices(),
+                    [&](const StringStartIndices& si)
+                    { return si.startIndexInTruncatedString > indexInTruncatedString; }
+                  ).indexOrArrayCount - 1);
+  }
   STU_DEBUG_ASSERT(0 <= lineIndex && lineIndex < lineCount);
   return STUTextFrameIndex{.indexInTruncatedString = sign_cast(indexInTruncatedString),
                            .lineIndex = sign_cast(lineIndex)};
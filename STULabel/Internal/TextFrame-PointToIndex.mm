@@ -2,8 +2,205 @@
 
 #import "TextFrame.hpp"
 
+#import "TextFrameGlyphStore.hpp"
+
+#import "stu/BinarySearch.hpp"
+
+#import <stdatomic.h>
+
+struct STUTextFrameHitTestIndex {};
+
 namespace stu_label {
 
+/// The cumulative typographic glyph widths of the CTRuns in the lines of a text frame.
+///
+/// The index allows rangeOfGraphemeClusterAtXOffset to find the glyph at an X offset with a
+/// binary search instead of measuring one glyph after another, which matters for long lines
+/// that are hit-tested on every touch move during a selection or drag. Like the background
+/// segments, the index is created lazily and owned by the text frame. The glyph widths of a line
+/// are only measured when the line is hit-tested for the first time.
+class TextFrameHitTestIndex : public STUTextFrameHitTestIndex {
+public:
+  struct Run {
+    /// See TextFrameGlyphStore::runKey.
+    Int32 key;
+    Int32 glyphStartIndex;
+    Int32 glyphCount;
+  };
+
+  class Line {
+  public:
+    /// Returns null if the run is neither a run of the line's CTLine nor of its token CTLine.
+    STU_INLINE
+    const Run* __nullable find(TextLinePart part, GlyphRunRef run) const {
+      const ArrayRef<const Run> runs{runs_, runCount_, unchecked};
+      const Int32 key = TextFrameGlyphStore::runKey(part, run);
+      const Int i = binarySearchFirstIndexWhere(runs, [&](const Run& r) { return key <= r.key; })
+                    .indexOrArrayCount;
+      if (i == runs.count()) return nullptr;
+      const Run& r = runs[i];
+      if (r.key != key || r.glyphCount != run.count()) return nullptr;
+      return &r;
+    }
+
+    struct GlyphIndexAndXOffset {
+      Int glyphIndex;
+      Float64 xOffset;
+    };
+
+    /// Returns the index (relative to `glyphRange.start`) and the X offset of the first glyph in
+    /// the range whose right edge lies right of `xOffset`, or of the last glyph in the range if
+    /// there is no such glyph. The X offsets are relative to the left edge of the glyph range.
+    STU_INLINE
+    GlyphIndexAndXOffset findGlyph(const Run& run, Range<Int> glyphRange, Float64 xOffset) const {
+      STU_DEBUG_ASSERT(Range<Int>(0, run.glyphCount).contains(glyphRange)
+                       && !glyphRange.isEmpty());
+      const Float64* const ends = glyphEndXOffsets_ + run.glyphStartIndex + glyphRange.start;
+      const Float64 base = glyphRange.start == 0 ? 0 : ends[-1];
+      const Float64 x = base + xOffset;
+      const Int index = binarySearchFirstIndexWhere(ArrayRef{ends, glyphRange.count() - 1},
+                                                    [&](Float64 end) { return x < end; })
+                        .indexOrArrayCount;
+      return {index, index == 0 ? 0 : ends[index - 1] - base};
+    }
+
+  private:
+    friend TextFrameHitTestIndex;
+
+    Int32 runCount_;
+    /// Sorted by key.
+    const Run* runs_;
+    /// `glyphEndXOffsets_[run.glyphStartIndex + i]` is the typographic width of the first `i + 1`
+    /// glyphs of the run.
+    const Float64* glyphEndXOffsets_;
+  };
+
+  /// Returns the hit-test index of the text frame, creating an empty one if necessary.
+  /// Thread-safe.
+  static const TextFrameHitTestIndex& get(const TextFrame&);
+
+  static void destroy(const STUTextFrameHitTestIndex* __nonnull);
+
+  /// Returns the index for the line, creating it if necessary. Thread-safe.
+  /// If the line's CTLine was discarded, the caller should create a RecreatedCTLineScope for the
+  /// line before calling this function.
+  const Line& line(const TextFrameLine&) const;
+
+private:
+  static const Line* createLine(const TextFrameLine&);
+
+  Int32 lineCount_;
+  /// Null for lines that haven't been hit-tested yet.
+  _Atomic(const Line*)* lines_;
+};
+
+STU_NO_INLINE
+auto TextFrameHitTestIndex::createLine(const TextFrameLine& line) -> const Line* {
+  TempVector<Run> runs{Capacity{8}};
+  TempVector<Float64> glyphEndXOffsets{Capacity{64}};
+  RC<CTLine> recreatedCTLine;
+  for (const TextLinePart part : {TextLinePart::originalString, TextLinePart::truncationToken}) {
+    CTLine* const ctLine = part == TextLinePart::originalString
+                         ? line.ctLineForIteration(Out{recreatedCTLine})
+                         : line._tokenCTLine;
+    if (!ctLine) continue;
+    for (CTRun* const ctRun : glyphRuns(ctLine)) {
+      const GlyphRunRef run{ctRun};
+      const Int count = run.count();
+      runs.append(Run{.key = TextFrameGlyphStore::runKey(part, run),
+                      .glyphStartIndex = narrow_cast<Int32>(glyphEndXOffsets.count()),
+                      .glyphCount = narrow_cast<Int32>(count)});
+      Float64 x = 0;
+      for (Int i = 0; i < count; ++i) {
+        // This must match the width computation in GlyphSpan::typographicWidth.
+        x += CTRunGetTypographicBounds(ctRun, CFRange{i, 1}, nullptr, nullptr, nullptr);
+        glyphEndXOffsets.append(x);
+      }
+    }
+  }
+
+  std::sort(runs.begin(), runs.end(),
+            [](const Run& lhs, const Run& rhs) { return lhs.key < rhs.key; });
+
+  static_assert(sizeof(Line)%alignof(Float64) == 0);
+  static_assert(sizeof(Float64)%alignof(Run) == 0);
+  const UInt glyphEndXOffsetsOffset = sizeof(Line);
+  const UInt runsOffset = glyphEndXOffsetsOffset
+                        + sign_cast(glyphEndXOffsets.count())*sizeof(Float64);
+  const UInt size = runsOffset + sign_cast(runs.count())*sizeof(Run);
+
+  Byte* const p = Malloc{}.allocate(sign_cast(size));
+  Float64* const glyphEndXOffsetsArray = reinterpret_cast<Float64*>(p + glyphEndXOffsetsOffset);
+  Run* const runsArray = reinterpret_cast<Run*>(p + runsOffset);
+  std::copy(glyphEndXOffsets.begin(), glyphEndXOffsets.end(), glyphEndXOffsetsArray);
+  std::copy(runs.begin(), runs.end(), runsArray);
+
+  Line* const index = new (p) Line{};
+  index->runCount_ = narrow_cast<Int32>(runs.count());
+  index->runs_ = runsArray;
+  index->glyphEndXOffsets_ = glyphEndXOffsetsArray;
+  return index;
+}
+
+auto TextFrameHitTestIndex::line(const TextFrameLine& line) const -> const Line& {
+  _Atomic(const Line*)* const slot = &lines_[line.lineIndex];
+  const Line* index = atomic_load_explicit(slot, memory_order_acquire);
+  if (STU_UNLIKELY(!index)) {
+    index = createLine(line);
+    const Line* expected = nullptr;
+    if (!atomic_compare_exchange_strong_explicit(slot, &expected, index,
+                                                 memory_order_release, memory_order_acquire))
+    {
+      free(const_cast<Line*>(index));
+      index = expected;
+    }
+  }
+  return *index;
+}
+
+void TextFrameHitTestIndex::destroy(const STUTextFrameHitTestIndex* hitTestIndex) {
+  const TextFrameHitTestIndex& self = static_cast<const TextFrameHitTestIndex&>(*hitTestIndex);
+  for (Int32 i = 0; i < self.lineCount_; ++i) {
+    if (const Line* const line = atomic_load_explicit(&self.lines_[i], memory_order_relaxed)) {
+      free(const_cast<Line*>(line));
+    }
+  }
+  free(const_cast<STUTextFrameHitTestIndex*>(hitTestIndex));
+}
+
+void TextFrame::destroyHitTestIndex(const STUTextFrameHitTestIndex* hitTestIndex) {
+  TextFrameHitTestIndex::destroy(hitTestIndex);
+}
+
+const TextFrameHitTestIndex& TextFrameHitTestIndex::get(const TextFrame& textFrame) {
+  _Atomic(const STUTextFrameHitTestIndex*)* const frameHitTestIndex =
+    const_cast<_Atomic(const STUTextFrameHitTestIndex*)*>(&textFrame._hitTestIndex);
+  const STUTextFrameHitTestIndex* index = atomic_load_explicit(frameHitTestIndex,
+                                                               memory_order_relaxed);
+  if (STU_LIKELY(index)) {
+    index = atomic_load_explicit(frameHitTestIndex, memory_order_acquire);
+  } else {
+    static_assert(sizeof(TextFrameHitTestIndex)%alignof(_Atomic(const Line*)) == 0);
+    const UInt size = sizeof(TextFrameHitTestIndex)
+                    + sign_cast(textFrame.lineCount)*sizeof(_Atomic(const Line*));
+    // The zeroed memory initializes all line pointers to null.
+    Byte* const p = static_cast<Byte*>(calloc(1, size));
+    if (!p) __builtin_trap();
+    TextFrameHitTestIndex* const newIndex = new (p) TextFrameHitTestIndex{};
+    newIndex->lineCount_ = textFrame.lineCount;
+    newIndex->lines_ = reinterpret_cast<_Atomic(const Line*)*>(p + sizeof(TextFrameHitTestIndex));
+    index = newIndex;
+    const STUTextFrameHitTestIndex* expected = nullptr;
+    if (!atomic_compare_exchange_strong_explicit(frameHitTestIndex, &expected, index,
+                                                 memory_order_release, memory_order_acquire))
+    {
+      free(const_cast<STUTextFrameHitTestIndex*>(index));
+      index = expected;
+    }
+  }
+  return static_cast<const TextFrameHitTestIndex&>(*index);
+}
+
 auto TextFrame::rangeOfGraphemeClusterClosestTo(Point<Float64> point,
                                                 TextFrameOrigin unscaledTextFrameOrigin,
                                                 CGFloat displayScaleValue) const
@@ -114,6 +311,8 @@ auto TextFrameLine::rangeOfGraphemeClusterAtXOffset(Float64 xOffset) const
   xOffset = clamp(0, xOffset, width);
   const TextFrame& tf = this->textFrame();
   const TextFrameParagraph& para = tf.paragraphs()[this->paragraphIndex];
+  const RecreatedCTLineScope ctLineScope{*this};
+  const TextFrameHitTestIndex::Line& hitTestIndex = TextFrameHitTestIndex::get(tf).line(*this);
 
   Range<Int32> rangeInOriginalString = this->rangeInOriginalString;
   Range<TextFrameCompactIndex> range{};
@@ -141,7 +340,13 @@ auto TextFrameLine::rangeOfGraphemeClusterAtXOffset(Float64 xOffset) const
 
     Int glyphIndex = 0;
     Float64 glyphXOffset = spanXOffset.start;
+    if (const TextFrameHitTestIndex::Run* const run = hitTestIndex.find(span.part, glyphSpan.run()))
     {
+      const auto result = hitTestIndex.findGlyph(*run, glyphSpan.glyphRange(),
+                                                 xOffset - spanXOffset.start);
+      glyphIndex = result.glyphIndex;
+      glyphXOffset += result.xOffset;
+    } else {
       const Int lastGlyphIndex = glyphSpan.count() - 1;
       for (Float64 nextGlyphXOffset; glyphIndex < lastGlyphIndex;
            ++glyphIndex, glyphXOffset = nextGlyphXOffset)
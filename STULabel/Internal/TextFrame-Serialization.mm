@@ -0,0 +1,464 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "TextFrame.hpp"
+
+#import "Hash.hpp"
+#import "PhaseTracing.hpp"
+#import "ShapedString.hpp"
+#import "TextFrameLayouter.hpp"
+
+#import "STULabel/STUParagraphStyle.h"
+
+#import "STULabel/STUObjCRuntimeWrappers.h"
+
+#include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+namespace stu_label {
+
+// A serialized text frame consists of a SerializedTextFrameHeader followed by the vertical search
+// table, the line string indices, the paragraphs and the lines, i.e. the embedded arrays of the
+// TextFrame that don't reference the original attributed string. Pointers into the original
+// string's text style data are stored as offsets in the TextFrame data anyway. All other pointer
+// fields are cleared, so that the serialized data is position-independent. When a serialized text
+// frame is loaded, the colors and text styles are copied from the shaped string, and the CTLines
+// are lazily recreated from the shaped string's typesetter, as with the
+// STUTextFrameOptions.usesCompactLineStorage option.
+//
+// The format stores the raw bytes of the TextFrame data structures, so it can only be read by a
+// build of the library with the same format version and the same data structure sizes. Since
+// serialized text frames are meant to be used as a cache, that is an acceptable restriction.
+
+struct SerializedTextFrameHeader {
+  static constexpr UInt32 expectedMagic = 0x46555453; // "STUF"
+  static constexpr UInt32 expectedVersion = 3;
+
+  UInt32 magic;
+  UInt32 version;
+  UInt16 textFrameDataSize;
+  UInt16 paragraphSize;
+  UInt16 lineSize;
+  UInt16 pointerSize;
+  Int32 stringLength;
+  UInt32 originalStringTextStyleDataSize;
+  UInt64 contentHash;
+  /// A copy of the text frame's STUTextFrameData with all pointer fields cleared.
+  STUTextFrameData data;
+
+  UInt arraysSize() const {
+    const UInt lineCount = sign_cast(data.lineCount);
+    return IntervalSearchTable::sizeInBytesForCount(data.lineCount)
+         + sizeof(StringStartIndices)*(lineCount + 1)
+         + sizeof(TextFrameParagraph)*sign_cast(data.paragraphCount)
+         + sizeof(TextFrameLine)*lineCount;
+  }
+};
+
+namespace {
+
+struct ContentHasher {
+  UInt64 value{0};
+
+  void add(UInt64 bits) { value = hash(value, bits).value; }
+  void add(Float64 x) { add(UInt64{hashableBits(x)}); }
+};
+
+} // namespace
+
+/// A hash of an attribute value that, unlike -[NSObject hash] for many Foundation and UIKit
+/// classes, depends on all the properties that affect the layout. (-[NSParagraphStyle hash], for
+/// example, doesn't hash the paragraph spacing or the indentations.)
+static UInt64 attributeValueHash(id __unsafe_unretained value) {
+  ContentHasher h;
+  if ([value isKindOfClass:UIFont.class]) {
+    // The font name and size don't capture the font features of e.g. a monospaced digit system
+    // font or a font created with a kCTFontFeatureSettingsAttribute, or the font variation.
+    CTFont* const font = (__bridge CTFont*)value;
+    h.add(UInt64{((__bridge_transfer NSString*)CTFontCopyPostScriptName(font)).hash});
+    h.add(Float64{CTFontGetSize(font)});
+    const CGAffineTransform m = CTFontGetMatrix(font);
+    h.add(Float64{m.a}); h.add(Float64{m.b}); h.add(Float64{m.c});
+    h.add(Float64{m.d}); h.add(Float64{m.tx}); h.add(Float64{m.ty});
+    if (NSArray* const features = (__bridge_transfer NSArray*)CTFontCopyFeatureSettings(font)) {
+      h.add(attributeValueHash(features));
+    }
+    if (NSDictionary* const variation = (__bridge_transfer NSDictionary*)
+                                          CTFontCopyVariation(font))
+    {
+      h.add(attributeValueHash(variation));
+    }
+  } else if ([value isKindOfClass:STUParagraphStyle.class]) {
+    // -[STUParagraphStyle hash] doesn't hash all properties.
+    STUParagraphStyle* const style = value;
+    h.add(UInt64(style.firstLineOffsetType));
+    h.add(Float64{style.firstLineOffset});
+    h.add(Float64{style.minimumBaselineDistance});
+    h.add(UInt64(style.numberOfInitialLines));
+    h.add(Float64{style.initialLinesHeadIndent});
+    h.add(Float64{style.initialLinesTailIndent});
+  } else if ([value isKindOfClass:NSArray.class]) {
+    for (id element in (NSArray*)value) {
+      h.add(attributeValueHash(element));
+    }
+  } else if ([value isKindOfClass:NSDictionary.class]) {
+    __block UInt64 entriesHash = 0;
+    [(NSDictionary*)value enumerateKeysAndObjectsUsingBlock:^(id key, id object, BOOL*) {
+      entriesHash += hash(attributeValueHash(key), attributeValueHash(object)).value;
+    }];
+    h.add(entriesHash);
+  } else if ([value isKindOfClass:NSParagraphStyle.class]) {
+    NSParagraphStyle* const style = value;
+    h.add(UInt64(style.alignment));
+    h.add(UInt64(style.lineBreakMode));
+    h.add(UInt64(style.baseWritingDirection));
+    h.add(Float64{style.lineSpacing});
+    h.add(Float64{style.paragraphSpacing});
+    h.add(Float64{style.paragraphSpacingBefore});
+    h.add(Float64{style.headIndent});
+    h.add(Float64{style.tailIndent});
+    h.add(Float64{style.firstLineHeadIndent});
+    h.add(Float64{style.minimumLineHeight});
+    h.add(Float64{style.maximumLineHeight});
+    h.add(Float64{style.lineHeightMultiple});
+    h.add(Float64{style.hyphenationFactor});
+    h.add(Float64{style.defaultTabInterval});
+    for (NSTextTab* tab in style.tabStops) {
+      h.add(UInt64(tab.alignment));
+      h.add(Float64{tab.location});
+    }
+  } else if ([value isKindOfClass:UIColor.class]) {
+    CGColor* const color = ((UIColor*)value).CGColor;
+    const size_t n = CGColorGetNumberOfComponents(color);
+    const CGFloat* const components = CGColorGetComponents(color);
+    for (size_t i = 0; i < n; ++i) {
+      h.add(Float64{components[i]});
+    }
+  } else if ([value isKindOfClass:NSShadow.class]) {
+    NSShadow* const shadow = value;
+    h.add(Float64{shadow.shadowOffset.width});
+    h.add(Float64{shadow.shadowOffset.height});
+    h.add(Float64{shadow.shadowBlurRadius});
+    h.add(shadow.shadowColor ? attributeValueHash(shadow.shadowColor) : 0);
+  } else {
+    h.add(UInt64{NSStringFromClass([value class]).hash});
+    h.add(UInt64{[value hash]});
+  }
+  return h.value;
+}
+
+/// Hashes the full UTF-16 contents and the attribute runs of the string, so that a serialized text
+/// frame isn't loaded for a string with the same text but e.g. a different font or paragraph
+/// style. (-[NSString hash] only samples a few characters and ignores the attributes.)
+static UInt64 contentHash(NSAttributedString* attributedString) {
+  __block ContentHasher h;
+  NSString* const string = attributedString.string;
+  const Int length = sign_cast(string.length);
+  h.add(UInt64(length));
+  UniChar buffer[256];
+  for (Int i = 0; i < length;) {
+    const Int n = min(length - i, Int{arrayLength(buffer)});
+    CFStringGetCharacters((__bridge CFStringRef)string, CFRange{i, n}, buffer);
+    Int j = 0;
+    for (; j + 4 <= n; j += 4) {
+      h.add(  UInt64{buffer[j]}           | (UInt64{buffer[j + 1]} << 16)
+            | (UInt64{buffer[j + 2]} << 32) | (UInt64{buffer[j + 3]} << 48));
+    }
+    for (; j < n; ++j) {
+      h.add(UInt64{buffer[j]});
+    }
+    i += n;
+  }
+  [attributedString enumerateAttributesInRange:NSRange{0, sign_cast(length)} options:0
+                                    usingBlock:^(NSDictionary<NSAttributedStringKey, id>* attributes,
+                                                 NSRange range, BOOL*)
+  {
+    h.add(UInt64{range.location});
+    h.add(UInt64{range.length});
+    // The enumeration order of the dictionary isn't defined, so we combine the attribute hashes
+    // with a commutative operation.
+    __block UInt64 attributesHash = 0;
+    [attributes enumerateKeysAndObjectsUsingBlock:^(NSAttributedStringKey key, id value, BOOL*) {
+      attributesHash += hash(UInt64{key.hash}, attributeValueHash(value)).value;
+    }];
+    h.add(attributesHash);
+  }];
+  return h.value;
+}
+
+NSData* __nullable TextFrame::serializedData() const {
+  if (lineCount == 0 || (flags & STUTextFrameIsTruncated)) return nil;
+  for (const TextFrameLine& line : lines()) {
+    if (!line.hasRecreatableCTLine(paragraphs()[line.paragraphIndex])
+        && (line._ctLine || line._tokenCTLine))
+    {
+      return nil;
+    }
+  }
+
+  SerializedTextFrameHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = SerializedTextFrameHeader::expectedMagic;
+  header.version = SerializedTextFrameHeader::expectedVersion;
+  header.textFrameDataSize = sizeof(STUTextFrameData);
+  header.paragraphSize = sizeof(TextFrameParagraph);
+  header.lineSize = sizeof(TextFrameLine);
+  header.pointerSize = sizeof(void*);
+  header.stringLength = narrow_cast<Int32>(originalAttributedString.length);
+  header.originalStringTextStyleDataSize =
+    narrow_cast<UInt32>(reinterpret_cast<const Byte*>(this) + _dataSize - sanitizerGap
+                        - _textStylesData);
+  header.contentHash = contentHash(originalAttributedString);
+  // The struct contains atomic fields, so we copy it byte-wise and then clear the pointers.
+  memcpy(&header.data, static_cast<const STUTextFrameData*>(this), sizeof(STUTextFrameData));
+  header.data._textStylesData = nullptr;
+  header.data.originalAttributedString = nil;
+  header.data._typesetter = nullptr;
+  atomic_store_explicit(&header.data._truncatedAttributedString, nullptr, memory_order_relaxed);
+  atomic_store_explicit(&header.data._backgroundSegments, nullptr, memory_order_relaxed);
+  atomic_store_explicit(&header.data._hitTestIndex, nullptr, memory_order_relaxed);
+  atomic_store_explicit(&header.data._lineIndexTable, nullptr, memory_order_relaxed);
+  atomic_store_explicit(&header.data._rectsCache, nullptr, memory_order_relaxed);
+  atomic_store_explicit(&header.data._imageBoundsCache, nullptr, memory_order_relaxed);
+  atomic_store_explicit(&header.data._glyphStore, nullptr, memory_order_relaxed);
+  atomic_store_explicit(&header.data._displayList, nullptr, memory_order_relaxed);
+
+  const UInt arraysSize = header.arraysSize();
+  NSMutableData* const data = [[NSMutableData alloc]
+                                 initWithLength:sizeof(SerializedTextFrameHeader) + arraysSize];
+  Byte* p = static_cast<Byte*>(data.mutableBytes);
+  memcpy(p, &header, sizeof(header));
+  p += sizeof(header);
+
+  const IntervalSearchTable searchTable = verticalSearchTable();
+  memcpy(p, searchTable.startValues().begin(), searchTable.startValues().arraySizeInBytes());
+  p += searchTable.startValues().arraySizeInBytes();
+  memcpy(p, searchTable.endValues().begin(), searchTable.endValues().arraySizeInBytes());
+  p += searchTable.endValues().arraySizeInBytes();
+
+  memcpy(p, lineStringIndices().begin(), lineStringIndices().arraySizeInBytes());
+  p += lineStringIndices().arraySizeInBytes();
+
+  memcpy(p, paragraphs().begin(), paragraphs().arraySizeInBytes());
+  p += paragraphs().arraySizeInBytes();
+
+  for (const TextFrameLine& line : lines()) {
+    STUTextFrameLine serializedLine;
+    memcpy(&serializedLine, &line, sizeof(STUTextFrameLine));
+    serializedLine._ctLineWasDiscarded = line._ctLine || line._ctLineWasDiscarded;
+    serializedLine._ctLine = nullptr;
+    serializedLine._tokenCTLine = nullptr;
+    memcpy(p, &serializedLine, sizeof(STUTextFrameLine));
+    p += sizeof(STUTextFrameLine);
+  }
+  STU_DEBUG_ASSERT(p == static_cast<Byte*>(data.mutableBytes) + data.length);
+
+  return data;
+}
+
+/// Checks the consistency of the serialized data with the shaped string and the layouter
+/// constructed for the text frame's string range, so that a stale or corrupted cache entry can't
+/// lead to out-of-bounds memory accesses.
+static bool isValid(const SerializedTextFrameHeader& header, const Byte* arrays,
+                    const TextFrameLayouter& layouter)
+{
+  const STUTextFrameData& data = header.data;
+  if (layouter.paragraphs().count() != data.paragraphCount) return false;
+  if (layouter.colors().count() != data._colorCount) return false;
+  const Int originalStylesTerminatorSize =
+    TextStyle::sizeOfTerminatorWithStringIndex(data.rangeInOriginalString.end);
+  if (sign_cast(layouter.originalStringStyles().dataExcludingTerminator().count()
+                + originalStylesTerminatorSize)
+      != header.originalStringTextStyleDataSize)
+  {
+    return false;
+  }
+  if (data.truncatedStringLength < 0) return false;
+  const UInt lineCount = sign_cast(data.lineCount);
+
+  // The vertical search table must be monotonically increasing (and not contain NaNs), since it is
+  // binary-searched.
+  const Byte* p = arrays;
+  for (int k = 0; k < 2; ++k) {
+    Float32 previous = minValue<Float32>;
+    for (UInt i = 0; i < lineCount; ++i, p += sizeof(Float32)) {
+      Float32 value;
+      memcpy(&value, p, sizeof(value));
+      if (!(previous <= value)) return false;
+      previous = value;
+    }
+  }
+
+  const Byte* const indicesBegin = p;
+  const auto lineStringIndices = [&](UInt i) -> StringStartIndices {
+    StringStartIndices indices;
+    memcpy(&indices, indicesBegin + sizeof(StringStartIndices)*i, sizeof(indices));
+    return indices;
+  };
+  {
+    const StringStartIndices end = lineStringIndices(lineCount);
+    if (end.startIndexInOriginalString != data.rangeInOriginalString.end
+        || end.startIndexInTruncatedString != data.truncatedStringLength)
+    {
+      return false;
+    }
+  }
+
+  const Byte* const parasBegin = indicesBegin + sizeof(StringStartIndices)*(lineCount + 1);
+  Int32 paraIndex = 0;
+  Int32 paraLineIndexEnd = 0;
+  for (const STUTextFrameParagraph& expectedPara : layouter.paragraphs()) {
+    STUTextFrameParagraph para;
+    memcpy(&para, parasBegin + sizeof(STUTextFrameParagraph)*sign_cast(paraIndex), sizeof(para));
+    if (para.paragraphIndex != paraIndex
+        || para.rangeInOriginalString.start != expectedPara.rangeInOriginalString.start
+        || para.rangeInOriginalString.end != expectedPara.rangeInOriginalString.end
+        || para.truncationToken
+        || para.lineIndexRange.start != paraLineIndexEnd
+        || para.lineIndexRange.start > para.lineIndexRange.end
+        || para.lineIndexRange.end > data.lineCount
+        || para.initialLinesEndIndex < para.lineIndexRange.start
+        || para.initialLinesEndIndex > para.lineIndexRange.end
+        // Truncated text frames aren't serialized, so the excised ranges must be empty.
+        || para.excisedRangeInOriginalString.start != para.rangeInOriginalString.end
+        || para.excisedRangeInOriginalString.end != para.rangeInOriginalString.end
+        || para.excisedStringRangeIsContinuedInNextParagraph
+        || para.excisedStringRangeIsContinuationFromLastParagraph
+        || para.truncationTokenLength != 0
+        || para.rangeInTruncatedString.start < 0
+        || para.rangeInTruncatedString.end > data.truncatedStringLength
+        || para.rangeInTruncatedString.start > para.rangeInTruncatedString.end
+        || para.paragraphTerminatorInOriginalStringLength
+           > para.rangeInOriginalString.end - para.rangeInOriginalString.start)
+    {
+      return false;
+    }
+    paraLineIndexEnd = para.lineIndexRange.end;
+    ++paraIndex;
+  }
+  if (paraLineIndexEnd != data.lineCount) return false;
+
+  const Byte* const linesBegin = parasBegin
+                               + sizeof(STUTextFrameParagraph)*sign_cast(data.paragraphCount);
+  const TextStyle& firstStyle = *layouter.originalStringStyles().firstStyle;
+  for (UInt i = 0; i < lineCount; ++i) {
+    STUTextFrameLine line;
+    memcpy(&line, linesBegin + sizeof(STUTextFrameLine)*i, sizeof(line));
+    if (line.lineIndex != sign_cast(i)
+        || line.paragraphIndex < 0 || line.paragraphIndex >= data.paragraphCount
+        || line._ctLine || line._tokenCTLine || line.hasTruncationToken || line.hasInsertedHyphen
+        || line.rangeInOriginalString.start < data.rangeInOriginalString.start
+        || line.rangeInOriginalString.end > data.rangeInOriginalString.end
+        || line.rangeInOriginalString.start > line.rangeInOriginalString.end
+        || line.rangeInTruncatedString.start < 0
+        || line.rangeInTruncatedString.end > data.truncatedStringLength
+        || line.rangeInTruncatedString.start > line.rangeInTruncatedString.end)
+    {
+      return false;
+    }
+    STUTextFrameParagraph para;
+    memcpy(&para, parasBegin + sizeof(STUTextFrameParagraph)*sign_cast(line.paragraphIndex),
+           sizeof(para));
+    if (!(para.lineIndexRange.start <= line.lineIndex && line.lineIndex < para.lineIndexRange.end)
+        || line.rangeInOriginalString.start < para.rangeInOriginalString.start
+        || line.rangeInOriginalString.end > para.rangeInOriginalString.end)
+    {
+      return false;
+    }
+    const StringStartIndices indices = lineStringIndices(i);
+    if (indices.startIndexInOriginalString != line.rangeInOriginalString.start
+        || indices.startIndexInTruncatedString != line.rangeInTruncatedString.start)
+    {
+      return false;
+    }
+    // The text styles offset must point to the style of the line's first character.
+    const TextStyle& style = firstStyle.styleForStringIndex(line.rangeInOriginalString.start);
+    if (line._textStylesOffset != reinterpret_cast<const Byte*>(&style)
+                                  - reinterpret_cast<const Byte*>(&firstStyle))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+STUTextFrame* __nullable createSTUTextFrame(Class cls, const ShapedString& shapedString,
+                                            ArrayRef<const Byte> serializedData)
+  NS_RETURNS_RETAINED
+{
+  if (sign_cast(serializedData.count()) < sizeof(SerializedTextFrameHeader)) return nil;
+  SerializedTextFrameHeader header;
+  memcpy(&header, serializedData.begin(), sizeof(header));
+  if (header.magic != SerializedTextFrameHeader::expectedMagic
+      || header.version != SerializedTextFrameHeader::expectedVersion
+      || header.textFrameDataSize != sizeof(STUTextFrameData)
+      || header.paragraphSize != sizeof(TextFrameParagraph)
+      || header.lineSize != sizeof(TextFrameLine)
+      || header.pointerSize != sizeof(void*)
+      || header.stringLength != shapedString.stringLength
+      || header.contentHash != contentHash(shapedString.attributedString))
+  {
+    return nil;
+  }
+  const STUTextFrameData& data = header.data;
+  const Range<Int32> stringRange = data.rangeInOriginalString;
+  if (data.lineCount <= 0 || data.paragraphCount <= 0
+      || stringRange.start < 0 || stringRange.end > shapedString.stringLength
+      || stringRange.start > stringRange.end
+      || sign_cast(serializedData.count()) != sizeof(header) + header.arraysSize())
+  {
+    return nil;
+  }
+
+  STU_TRACE_PHASE(TextFrameCreation);
+  STU_TRACE_PHASE_COUNT(data.lineCount);
+
+  ThreadLocalArenaAllocator::InitialBuffer<4096> buffer;
+  ThreadLocalArenaAllocator alloc{Ref{buffer}};
+
+  // We only need the layouter for the paragraph, color and style data of the string range.
+  // The default text alignment doesn't matter, since the paragraphs are copied from the data.
+  TextFrameLayouter layouter{shapedString, stringRange, STUDefaultTextAlignmentLeft, nullptr};
+  // The layouter doesn't own any lines, since we never call layout.
+  layouter.relinquishOwnershipOfCTLinesAndParagraphTruncationTokens();
+  const Byte* const arrays = serializedData.begin() + sizeof(header);
+  if (!isValid(header, arrays, layouter)) return nil;
+
+  const UInt instanceSize = roundUpToMultipleOf<alignof(TextFrame)>(class_getInstanceSize(cls));
+  const auto oso = TextFrame::objectSizeAndThisOffset(layouter, data.paragraphCount,
+                                                      data.lineCount);
+  STU_TRACE_PHASE_BYTE_SIZE(sign_cast(instanceSize + oso.size));
+  Byte* const p = static_cast<Byte*>(malloc(instanceSize + oso.size));
+  memset(p, 0, instanceSize);
+  STUTextFrame* const instance = stu_constructClassInstance(cls, p);
+  const_cast<STUTextFrameData*&>(instance->data) =
+    new (p + instanceSize + oso.offset) TextFrame(std::move(layouter), header, arrays,
+                                                  oso.size - oso.offset);
+  return instance;
+}
+
+TextFrame::TextFrame(TextFrameLayouter&& layouter, const SerializedTextFrameHeader& header,
+                     const Byte* serializedArrays, UInt dataSize)
+: STUTextFrameData{}
+{
+  memcpy(static_cast<STUTextFrameData*>(this), &header.data, sizeof(STUTextFrameData));
+  _dataSize = dataSize;
+  originalAttributedString = layouter.attributedString().attributedString;
+  incrementRefCount(originalAttributedString);
+  _typesetter = layouter.typesetter();
+  incrementRefCount(_typesetter);
+  copyColorsAndTextStyles(layouter);
+
+  const Byte* p = serializedArrays;
+  const auto copy = [&](auto array) {
+    memcpy(const_array_cast(array).begin(), p, array.arraySizeInBytes());
+    p += array.arraySizeInBytes();
+  };
+  copy(verticalSearchTable().startValues());
+  copy(verticalSearchTable().endValues());
+  copy(lineStringIndices());
+  copy(paragraphs());
+  copy(lines());
+}
+
+} // namespace stu_label
+
+#include "UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
@@ -2,6 +2,9 @@
 
 #import "TextFrame.hpp"
 
+#import "stu/BinarySearch.hpp"
+#import "stu/Vector.hpp"
+
 namespace stu_label {
 
 NSDictionary<NSString*, id>* __nullable TextFrame::attributesAt(TextFrameIndex index) const {
@@ -17,9 +20,72 @@ NSDictionary<NSString*, id>* __nullable TextFrame::attributesAt(TextFrameIndex i
   }
 }
 
-static
-NSAttributedString* __nonnull creatTextFrameTruncatedAttributedString(const TextFrame& textFrame)
-                                NS_RETURNS_RETAINED
+struct TruncatedStringSegment {
+  /// The start index of the segment in the truncated string. The segment ends where the next
+  /// segment starts.
+  Int32 startIndex;
+  /// The index in the source string corresponding to `startIndex`.
+  Int32 sourceStartIndex;
+  /// The original attributed string of the text frame or a truncation token.
+  NSAttributedString* attributedString;
+  NSString* string;
+};
+
+} // namespace stu_label
+
+template <> struct stu::IsBitwiseMovable<stu_label::TruncatedStringSegment> : stu::True {};
+
+using namespace stu_label;
+
+/// An immutable view of the string of a truncated text frame that forwards all character lookups
+/// to the original string or the truncation tokens.
+@interface STUTextFrameTruncatedString : NSString {
+@package
+  Vector<TruncatedStringSegment> _segments;
+  Int _length;
+}
+@end
+
+/// An immutable view of the truncated attributed string of a text frame that forwards all lookups
+/// to the original attributed string or the truncation tokens, so that the text doesn't need to be
+/// copied.
+@interface STUTextFrameTruncatedAttributedString : NSAttributedString {
+  STUTextFrameTruncatedString* _string;
+}
+- (instancetype)initWithString:(STUTextFrameTruncatedString*)string NS_DESIGNATED_INITIALIZER;
+@end
+
+namespace stu_label {
+
+/// Returns the index of the segment containing the index in the truncated string.
+static Int segmentIndex(ArrayRef<const TruncatedStringSegment> segments, Int index) {
+  // The first segment starts at index 0.
+  return binarySearchFirstIndexWhere(segments, [&](const TruncatedStringSegment& segment) {
+           return segment.startIndex > index;
+         }).indexOrArrayCount - 1;
+}
+
+static Range<Int32> segmentRange(STUTextFrameTruncatedString* __unsafe_unretained string,
+                                 Int segmentIndex)
+{
+  const ArrayRef<const TruncatedStringSegment> segments = string->_segments;
+  return {segments[segmentIndex].startIndex,
+          segmentIndex + 1 < segments.count() ? segments[segmentIndex + 1].startIndex
+                                              : narrow_cast<Int32>(string->_length)};
+}
+
+static void setOutRange(NSRangePointer __nullable outRange, NSRange rangeInSegmentSource,
+                        const TruncatedStringSegment& segment, Range<Int32> segmentRange)
+{
+  if (!outRange) return;
+  const Int32 offset = segment.startIndex - segment.sourceStartIndex;
+  const Range<Int32> range = (offset + Range<Int32>(rangeInSegmentSource))
+                             .intersection(segmentRange);
+  *outRange = NSRange(range);
+}
+
+static NSAttributedString* __nonnull createTruncatedAttributedString(const TextFrame& textFrame)
+                                       NS_RETURNS_RETAINED
 {
   Range<Int32> rangeInOriginalString = textFrame.rangeInOriginalString();
   ArrayRef<const TextFrameParagraph> paras = textFrame.paragraphs();
@@ -31,43 +97,152 @@ NSAttributedString* __nonnull creatTextFrameTruncatedAttributedString(const Text
       break;
     }
   }
-  NSMutableAttributedString* mutableString;
-  if (textFrame.rangeInOriginalStringIsFullString
-      && rangeInOriginalString == textFrame.rangeInOriginalString())
+  NSAttributedString* __unsafe_unretained const original = textFrame.originalAttributedString;
+  NSString* const originalString = original.string;
+
+  STUTextFrameTruncatedString* const string = [[STUTextFrameTruncatedString alloc] init];
+  Vector<TruncatedStringSegment>& segments = string->_segments;
+  segments.setCapacity(2*paras.count() + 1);
+  Int32 length = 0;
+  const auto appendSegment = [&](NSAttributedString* __unsafe_unretained attributedString,
+                                 NSString* __unsafe_unretained sourceString,
+                                 Range<Int32> sourceRange)
   {
-    mutableString = [textFrame.originalAttributedString mutableCopy];
-  } else {
-    NSAttributedString* const substring = [textFrame.originalAttributedString
-                                            attributedSubstringFromRange:
-                                              NSRange(rangeInOriginalString)];
-    if (!(textFrame.flags & STUTextFrameIsTruncated)) {
-      return substring;
-    }
-    mutableString = [substring mutableCopy];
-  }
-  for (auto para = paras.begin(), end = paras.end(); para < end; ++para) {
-    NSAttributedString* __unsafe_unretained const token = para->truncationToken;
-    const Int32 index = para->rangeOfTruncationTokenInTruncatedString().start;
-    const Int32 excisionStartInOriginalString = para->excisedRangeInOriginalString().start;
-    while (para->excisedStringRangeIsContinuedInNextParagraph && para + 1 < end) {
-      ++para;
-    }
-    const Int32 excisionEndInOriginalString = para->excisedRangeInOriginalString().end;
-    const Int32 excisionLength = excisionEndInOriginalString - excisionStartInOriginalString;
-    if (excisionLength) {
-      const NSRange range{sign_cast(index), sign_cast(excisionLength)};
+    if (sourceRange.isEmpty()) return;
+    segments.append(TruncatedStringSegment{.startIndex = length,
+                                           .sourceStartIndex = sourceRange.start,
+                                           .attributedString = attributedString,
+                                           .string = sourceString});
+    length += sourceRange.end - sourceRange.start;
+  };
+  Int32 nextIndexInOriginalString = rangeInOriginalString.start;
+  if (textFrame.flags & STUTextFrameIsTruncated) {
+    for (auto para = paras.begin(), end = paras.end(); para < end; ++para) {
+      NSAttributedString* __unsafe_unretained const token = para->truncationToken;
+      const Int32 excisionStartInOriginalString = para->excisedRangeInOriginalString().start;
+      while (para->excisedStringRangeIsContinuedInNextParagraph && para + 1 < end) {
+        ++para;
+      }
+      const Int32 excisionEndInOriginalString = para->excisedRangeInOriginalString().end;
+      if (!token && excisionStartInOriginalString == excisionEndInOriginalString) continue;
+      appendSegment(original, originalString,
+                    {nextIndexInOriginalString, excisionStartInOriginalString});
       if (token) {
-        [mutableString replaceCharactersInRange:range withAttributedString:token];
-      } else {
-        [mutableString deleteCharactersInRange:range];
+        appendSegment(token, token.string, {0, narrow_cast<Int32>(token.length)});
       }
-    } else if (token) {
-      [mutableString insertAttributedString:token atIndex:sign_cast(index)];
+      nextIndexInOriginalString = excisionEndInOriginalString;
     }
   }
-  return [mutableString copy];
+  appendSegment(original, originalString,
+                {nextIndexInOriginalString, rangeInOriginalString.end});
+  STU_DEBUG_ASSERT(length == textFrame.truncatedStringLength);
+  segments.trimFreeCapacity();
+  string->_length = length;
+  return [[STUTextFrameTruncatedAttributedString alloc] initWithString:string];
+}
+
+} // namespace stu_label
+
+@implementation STUTextFrameTruncatedString
+
+- (id)copyWithZone:(NSZone* __unused)zone {
+  return self;
+}
+
+// The class is private, so archives should contain a plain string.
+- (Class)classForCoder {
+  return NSString.class;
+}
+
+- (NSUInteger)length {
+  return sign_cast(_length);
+}
+
+- (unichar)characterAtIndex:(NSUInteger)index {
+  STU_CHECK_MSG(index < sign_cast(_length), "Index out of bounds");
+  const TruncatedStringSegment& segment = _segments[segmentIndex(_segments, sign_cast(index))];
+  return [segment.string characterAtIndex:index - sign_cast(segment.startIndex)
+                                                + sign_cast(segment.sourceStartIndex)];
+}
+
+- (void)getCharacters:(unichar*)buffer range:(NSRange)nsRange {
+  const Range<Int> range = Range<Int>(nsRange);
+  STU_CHECK_MSG(0 <= range.start && range.start <= range.end && range.end <= _length,
+                "Range out of bounds");
+  if (range.isEmpty()) return;
+  Int index = range.start;
+  for (Int i = segmentIndex(_segments, index); index < range.end; ++i) {
+    const TruncatedStringSegment& segment = _segments[i];
+    const Int end = min(range.end, Int{segmentRange(self, i).end});
+    const Int offset = segment.sourceStartIndex - segment.startIndex;
+    [segment.string getCharacters:buffer + (index - range.start)
+                            range:NSRange(Range{index + offset, end + offset})];
+    index = end;
+  }
+}
+
+@end
+
+@implementation STUTextFrameTruncatedAttributedString
+
+- (instancetype)init {
+  return [self initWithString:[[STUTextFrameTruncatedString alloc] init]];
+}
+
+- (instancetype)initWithString:(STUTextFrameTruncatedString*)string {
+  if ((self = [super init])) {
+    _string = string;
+  }
+  return self;
 }
 
+- (id)copyWithZone:(NSZone* __unused)zone {
+  return self;
+}
+
+// The class is private, so archives should contain a plain attributed string.
+- (Class)classForCoder {
+  return NSAttributedString.class;
+}
+
+- (NSString*)string {
+  return _string;
+}
+
+- (NSDictionary<NSAttributedStringKey, id>*)attributesAtIndex:(NSUInteger)index
+                                               effectiveRange:(NSRangePointer)outRange
+{
+  STU_CHECK_MSG(index < _string.length, "Index out of bounds");
+  const Int i = segmentIndex(_string->_segments, sign_cast(index));
+  const TruncatedStringSegment& segment = _string->_segments[i];
+  NSRange range;
+  NSDictionary<NSAttributedStringKey, id>* const attributes =
+    [segment.attributedString attributesAtIndex:index - sign_cast(segment.startIndex)
+                                                + sign_cast(segment.sourceStartIndex)
+                                 effectiveRange:outRange ? &range : nil];
+  setOutRange(outRange, range, segment, segmentRange(_string, i));
+  return attributes;
+}
+
+- (id)attribute:(NSAttributedStringKey)name atIndex:(NSUInteger)index
+ effectiveRange:(NSRangePointer)outRange
+{
+  STU_CHECK_MSG(index < _string.length, "Index out of bounds");
+  const Int i = segmentIndex(_string->_segments, sign_cast(index));
+  const TruncatedStringSegment& segment = _string->_segments[i];
+  NSRange range;
+  const id attribute = [segment.attributedString attribute:name
+                                                   atIndex:index - sign_cast(segment.startIndex)
+                                                           + sign_cast(segment.sourceStartIndex)
+                                            effectiveRange:outRange ? &range : nil];
+  setOutRange(outRange, range, segment, segmentRange(_string, i));
+  return attribute;
+}
+
+@end
+
+namespace stu_label {
+
 Unretained<NSAttributedString* __nonnull> TextFrame::truncatedAttributedString() const {
   if (!(flags & STUTextFrameIsTruncated) && rangeInOriginalStringIsFullString) {
     return originalAttributedString;
@@ -80,7 +255,7 @@ Unretained<NSAttributedString* __nonnull> TextFrame::truncatedAttributedString()
   }
   CFAttributedStringRef expected = nil;
   CFAttributedStringRef retained = (__bridge_retained CFAttributedStringRef)
-                                     creatTextFrameTruncatedAttributedString(*this);
+                                     createTruncatedAttributedString(*this);
   if (atomic_compare_exchange_strong_explicit(pAttributedString, &expected, retained,
                                               memory_order_release, memory_order_acquire))
   {
@@ -163,6 +163,8 @@ struct TextFrameOrigin : Parameter<TextFrameOrigin, Point<Float64>> {
 struct TextFrameLine;
 struct TextFrameParagraph;
 class TextFrameLayouter;
+class ShapedString;
+struct SerializedTextFrameHeader;
 
 struct StringStartIndices {
   Int32 startIndexInOriginalString;
@@ -300,13 +302,20 @@ struct TextFrame : STUTextFrameData {
 
   void drawBackground(Range<Int> clipLineRange, DrawingContext& context) const;
 
+  /// Returns null if the text frame can't be serialized.
+  /// (See the documentation of -[STUTextFrame serializedData].)
+  // Defined in TextFrame-Serialization.mm
+  NSData* __nullable serializedData() const;
+
   ~TextFrame();
 
 private:
-  friend STUTextFrame* ::STUTextFrameCreateWithShapedStringRange(Class, STUShapedString*, NSRange,
-                                                                 CGSize, CGFloat,
-                                                                 STUTextFrameOptions*,
-                                                                 const STUCancellationFlag*);
+  friend STUTextFrame* createSTUTextFrame(Class, TextFrameLayouter&&);
+  friend STUTextFrame* createSTUTextFrame(Class, const ShapedString&, ArrayRef<const Byte>);
+  friend STUTextFrameLayoutInfo layoutInfoOfTemporaryTextFrame(TextFrameLayouter&&);
+
+  // Defined in TextFrame-PointToIndex.mm
+  static void destroyHitTestIndex(const STUTextFrameHitTestIndex* __nonnull);
 
   static constexpr Int sanitizerGap = STU_USE_ADDRESS_SANITIZER ? 8 : 0;
 
@@ -315,8 +324,19 @@ private:
     UInt offset;
   };
   static SizeAndOffset objectSizeAndThisOffset(const TextFrameLayouter& layouter);
+  static SizeAndOffset objectSizeAndThisOffset(const TextFrameLayouter& layouter,
+                                               Int paragraphCount, Int lineCount);
 
   explicit TextFrame(TextFrameLayouter&& layouter, UInt dataSize);
+
+  // Defined in TextFrame-Serialization.mm
+  explicit TextFrame(TextFrameLayouter&& layouter, const SerializedTextFrameHeader& header,
+                     const Byte* serializedArrays, UInt dataSize);
+
+  /// Sets `_textStylesData` and copies the colors and text styles from the layouter into the
+  /// embedded arrays following the lines. Returns the size of the original string's text style
+  /// data, including the terminator.
+  UInt copyColorsAndTextStyles(const TextFrameLayouter& layouter);
 };
 
 
@@ -327,6 +347,12 @@ STU_INLINE const TextFrame& textFrameRef(const STUTextFrame* textFrame) {
   return textFrameRef(*textFrame->data);
 }
 
+/// Returns null if the data is not a valid serialized text frame for the shaped string.
+// Defined in TextFrame-Serialization.mm
+STUTextFrame* __nullable createSTUTextFrame(Class, const ShapedString&,
+                                            ArrayRef<const Byte> serializedData)
+  NS_RETURNS_RETAINED;
+
 struct TextFrameParagraph : STUTextFrameParagraph {
   using Base = STUTextFrameParagraph;
 
@@ -688,6 +714,65 @@ struct TextFrameLine : STUTextFrameLine {
     }
   }
 
+  /// Indicates whether the line's CTLine can be recreated with a single
+  /// CTTypesetterCreateLineWithOffset call, i.e. whether the line has a non-empty CTLine, no
+  /// truncation token or inserted hyphen, and wasn't justified.
+  STU_INLINE
+  bool hasRecreatableCTLine(const TextFrameParagraph& para) const {
+    if (!(_ctLine || _ctLineWasDiscarded) || _tokenCTLine) return false;
+    if (para.alignment != STUParagraphAlignmentJustifiedLeft
+        && para.alignment != STUParagraphAlignmentJustifiedRight)
+    {
+      return true;
+    }
+    // TextFrameLayouter::justifyLinesWhereNecessary doesn't justify the last line of a paragraph
+    // or lines that are followed by a line terminator.
+    return isFollowedByTerminatorInOriginalString || lineIndex + 1 == para.lineIndexRange().end;
+  }
+
+  /// Creates a new CTLine equivalent to the one that was released because
+  /// `_ctLineWasDiscarded`. Returns null if the recreated line is empty.
+  /// The returned line isn't cached, so callers should keep it for as long as they need it.
+  // Defined in TextFrame.mm
+  RC<CTLine> recreateCTLine() const;
+
+  /// While a scope for a line whose CTLine was discarded exists, the glyph span iteration
+  /// functions called for the line on the current thread share a single recreated CTLine, which
+  /// is created when it is needed for the first time. Scopes for other lines have no effect.
+  class RecreatedCTLineScope {
+  public:
+    // Defined in TextFrame.mm
+    explicit RecreatedCTLineScope(const TextFrameLine& line);
+    ~RecreatedCTLineScope();
+
+    RecreatedCTLineScope(const RecreatedCTLineScope&) = delete;
+    RecreatedCTLineScope& operator=(const RecreatedCTLineScope&) = delete;
+
+  private:
+    friend TextFrameLine;
+
+    const TextFrameLine* line_{};
+    RecreatedCTLineScope* outerScope_{};
+    bool hasRecreatedCTLine_{};
+    RC<CTLine> ctLine_;
+  };
+
+  /// Returns `_ctLine`, the CTLine recreated by an enclosing RecreatedCTLineScope, or a newly
+  /// recreated CTLine that is kept alive by `recreatedCTLine`.
+  // Defined in TextFrame.mm
+  CTLine* __nullable ctLineForIteration(Out<RC<CTLine>> recreatedCTLine) const;
+
+  /// Returns the glyphs and positions of a span of a run of this line's CTLine or token CTLine.
+  /// `part` must be the line part that the run was iterated for.
+  // Defined in TextFrameGlyphStore.mm
+  GlyphsWithPositions glyphsWithPositions(TextLinePart part, const GlyphSpan& span) const;
+
+  /// Returns the image bounds of a span of a run of this line's CTLine or token CTLine, relative
+  /// to the origin of the CTLine.
+  // Defined in TextFrameGlyphStore.mm
+  Rect<CGFloat> imageBounds(TextLinePart part, const GlyphSpan& span,
+                            LocalGlyphBoundsCache& glyphBoundsCache) const;
+
   /// Returns bounds relative to the line origin.
   Rect<CGFloat> calculateImageBoundsLLO(const ImageBoundsContext& context) const;
 
@@ -778,7 +863,8 @@ struct TextFrameLine : STUTextFrameLine {
     hasTruncationToken = false;
     isLastLine = false;
     _initStep = 1;
-    _textStylesOffset = p.textStylesOffset;
+    _ctLineWasDiscarded = false;
+    _textStylesOffset = narrow_cast<Int32>(p.textStylesOffset);
     _tokenStylesOffset = 0;
     _ctLine = nullptr;
     _tokenCTLine = nullptr;
@@ -809,7 +895,7 @@ struct TextFrameLine : STUTextFrameLine {
 
     width = narrow_cast<Float32>(p.width);
 
-    _tokenStylesOffset  = p.token.tokenStylesOffset;
+    _tokenStylesOffset  = narrow_cast<Int32>(p.token.tokenStylesOffset);
 
     _ctLine = p.ctLine;
     _tokenCTLine = p.token.tokenCTLine;
@@ -4,13 +4,117 @@
 
 #import "CancellationFlag.hpp"
 #import "CoreGraphicsUtils.hpp"
+#import "PhaseTracing.hpp"
+#import "TextFrameDisplayList.hpp"
+#import "TextFrameGlyphStore.hpp"
 #import "TextFrameLayouter.hpp"
+#import "ThreadLocalAllocator.hpp"
 
 #include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
 
+struct STUTextFrameImageBoundsCache {};
+
 namespace stu_label {
 
+/// Memoizes the line image bounds calculated by `TextFrame::calculateImageBounds` for up to
+/// `capacity` different combinations of drawing mode and display scale. Entries are immutable once
+/// published and are never evicted, so that lookups require no locking.
+class TextFrameImageBoundsCache : public STUTextFrameImageBoundsCache {
+public:
+  static constexpr Int capacity = 4;
+
+  struct Entry {
+    STUTextFrameDrawingMode drawingMode;
+    Int32 lineCount;
+    CGFloat displayScale; ///< 0 if the bounds were calculated without a display scale.
+
+    /// The image bounds of the individual lines, in the coordinate system of the line (with the
+    /// Y-axis pointing up).
+    ArrayRef<const Rect<CGFloat>> lineBounds() const {
+      static_assert(sizeof(Entry)%alignof(Rect<CGFloat>) == 0);
+      return {reinterpret_cast<const Rect<CGFloat>*>(this + 1), lineCount};
+    }
+  };
+
+  static TextFrameImageBoundsCache& get(const TextFrame& textFrame) {
+    _Atomic(STUTextFrameImageBoundsCache*)* const frameCache =
+      const_cast<_Atomic(STUTextFrameImageBoundsCache*)*>(&textFrame._imageBoundsCache);
+    STUTextFrameImageBoundsCache* cache = atomic_load_explicit(frameCache, memory_order_relaxed);
+    if (STU_LIKELY(cache)) {
+      cache = atomic_load_explicit(frameCache, memory_order_acquire);
+    } else {
+      cache = static_cast<TextFrameImageBoundsCache*>(calloc(1,
+                                                             sizeof(TextFrameImageBoundsCache)));
+      STUTextFrameImageBoundsCache* expected = nullptr;
+      if (!atomic_compare_exchange_strong_explicit(frameCache, &expected, cache,
+                                                   memory_order_release, memory_order_acquire))
+      {
+        free(cache);
+        cache = expected;
+      }
+    }
+    return static_cast<TextFrameImageBoundsCache&>(*cache);
+  }
+
+  static void destroy(STUTextFrameImageBoundsCache* cache) {
+    for (_Atomic(const Entry*)& entry : static_cast<TextFrameImageBoundsCache*>(cache)->entries_) {
+      if (const Entry* const e = atomic_load_explicit(&entry, memory_order_relaxed)) {
+        free(const_cast<Entry*>(e));
+      }
+    }
+    free(cache);
+  }
+
+  const Entry* __nullable find(STUTextFrameDrawingMode drawingMode,
+                               Optional<DisplayScale> displayScale)
+  {
+    const CGFloat scale = displayScale ? displayScale->value() : 0;
+    for (_Atomic(const Entry*)& entry : entries_) {
+      const Entry* const e = atomic_load_explicit(&entry, memory_order_acquire);
+      if (!e) break;
+      if (e->drawingMode == drawingMode && e->displayScale == scale) return e;
+    }
+    return nullptr;
+  }
+
+  /// Does nothing if the cache is full.
+  void add(STUTextFrameDrawingMode drawingMode, Optional<DisplayScale> displayScale,
+           ArrayRef<const Rect<CGFloat>> lineBounds)
+  {
+    const UInt size = sizeof(Entry) + sign_cast(lineBounds.count())*sizeof(Rect<CGFloat>);
+    Entry* const newEntry = reinterpret_cast<Entry*>(Malloc{}.allocate(sign_cast(size)));
+    newEntry->drawingMode = drawingMode;
+    newEntry->lineCount = narrow_cast<Int32>(lineBounds.count());
+    newEntry->displayScale = displayScale ? displayScale->value() : 0;
+    std::copy(lineBounds.begin(), lineBounds.end(),
+              const_cast<Rect<CGFloat>*>(newEntry->lineBounds().begin()));
+    for (_Atomic(const Entry*)& entry : entries_) {
+      const Entry* expected = nullptr;
+      if (atomic_compare_exchange_strong_explicit(&entry, &expected, newEntry,
+                                                  memory_order_release, memory_order_acquire))
+      {
+        return;
+      }
+      if (expected->drawingMode == drawingMode
+          && expected->displayScale == newEntry->displayScale)
+      {
+        break; // Another thread added an equivalent entry.
+      }
+    }
+    free(newEntry);
+  }
+
+private:
+  _Atomic(const Entry*) entries_[capacity];
+};
+
 TextFrame::SizeAndOffset TextFrame::objectSizeAndThisOffset(const TextFrameLayouter& layouter) {
+  return objectSizeAndThisOffset(layouter, layouter.paragraphs().count(), layouter.lines().count());
+}
+
+TextFrame::SizeAndOffset TextFrame::objectSizeAndThisOffset(const TextFrameLayouter& layouter,
+                                                            Int paragraphCount, Int lineCount)
+{
   // The data layout must be kept in-sync with
   //   TextFrame::verticalSearchTable
   //   TextFrame::lineStringIndices
@@ -27,8 +131,6 @@ TextFrame::SizeAndOffset TextFrame::objectSizeAndThisOffset(const TextFrameLayou
                 && alignof(STUTextFrameData) == alignof(ColorRef)
                 && alignof(STUTextFrameData) >= alignof(TextStyle));
 
-  const Int lineCount = layouter.lines().count();
-
   const UInt verticalSearchTableSize = IntervalSearchTable::sizeInBytesForCount(lineCount);
   const UInt lineStringIndicesTableSize = sizeof(StringStartIndices)*sign_cast(lineCount + 1);
   const Int stylesTerminatorSize = TextStyle::sizeOfTerminatorWithStringIndex(
@@ -42,8 +144,8 @@ TextFrame::SizeAndOffset TextFrame::objectSizeAndThisOffset(const TextFrameLayou
                 + lineStringIndicesTableSize
                 + sanitizerGap
                 + sizeof(STUTextFrameData)
-                + layouter.paragraphs().arraySizeInBytes()
-                + layouter.lines().arraySizeInBytes()
+                + sizeof(TextFrameParagraph)*sign_cast(paragraphCount)
+                + sizeof(TextFrameLine)*sign_cast(lineCount)
                 + sanitizerGap
                 + colors.arraySizeInBytes()
                 + sanitizerGap
@@ -53,24 +155,7 @@ TextFrame::SizeAndOffset TextFrame::objectSizeAndThisOffset(const TextFrameLayou
                 + sanitizerGap};
 }
 
-TextFrame::TextFrame(TextFrameLayouter&& layouter, UInt dataSize)
-: STUTextFrameData{
-    .paragraphCount = narrow_cast<Int32>(layouter.paragraphs().count()),
-    .lineCount = narrow_cast<Int32>(layouter.lines().count()),
-    ._colorCount = narrow_cast<UInt16>(layouter.colors().count()),
-    .layoutMode = layouter.layoutMode(),
-    .size = narrow_cast<CGSize>(layouter.scaleInfo().scale*layouter.inverselyScaledFrameSize()),
-    .textScaleFactor = layouter.scaleInfo().scale,
-    .displayScale = layouter.scaleInfo().originalDisplayScale,
-    .rangeInOriginalStringIsFullString = layouter.rangeInOriginalStringIsFullString(),
-    ._layoutIterationCount = narrow_cast<UInt8>(layouter.layoutCallCount()),
-    .rangeInOriginalString = layouter.rangeInOriginalString(),
-    .truncatedStringLength = layouter.truncatedStringLength(),
-    .originalAttributedString = layouter.attributedString().attributedString,
-    ._dataSize = dataSize
-  }
-{
-  incrementRefCount(originalAttributedString);
+UInt TextFrame::copyColorsAndTextStyles(const TextFrameLayouter& layouter) {
   const Range<Int32> stringRange = rangeInOriginalString();
   const Int originalStylesTerminatorSize = TextStyle
                                            ::sizeOfTerminatorWithStringIndex(stringRange.end);
@@ -78,7 +163,7 @@ TextFrame::TextFrame(TextFrameLayouter&& layouter, UInt dataSize)
                                                          .dataExcludingTerminator().count()
                                                          + originalStylesTerminatorSize);
   _textStylesData = reinterpret_cast<const uint8_t*>(this)
-                  + dataSize
+                  + _dataSize
                   - sanitizerGap
                   - layouter.truncationTokenTextStyleData().count()
                   - originalStringTextStyleDataSize;
@@ -90,7 +175,58 @@ TextFrame::TextFrame(TextFrameLayouter&& layouter, UInt dataSize)
   sanitizer::poison((Byte*)colors().end(), sanitizerGap);
   sanitizer::poison((Byte*)this + _dataSize - sanitizerGap, sanitizerGap);
 #endif
-  { // Write out the data into the embedded arrays.
+
+  Byte* p = reinterpret_cast<Byte*>(const_array_cast(lines()).end()) + sanitizerGap;
+  using array_utils::copyConstructArray;
+
+  const ArrayRef<const ColorRef> colors = layouter.colors();
+  for (auto& color : colors) {
+    CFRetain(color.cgColor());
+  }
+  copyConstructArray(colors, reinterpret_cast<ColorRef*>(p));
+  p += colors.arraySizeInBytes();
+  p += sanitizerGap;
+
+  STU_ASSERT(p == _textStylesData);
+  const TextStyleSpan originalStyles = layouter.originalStringStyles();
+  copyConstructArray(originalStyles.dataExcludingTerminator(), p);
+  if (stringRange.start > 0) {
+    TextStyle* const style = reinterpret_cast<TextStyle*>(p);
+    STU_ASSERT(style->stringIndex() <= stringRange.start);
+    style->setStringIndex(stringRange.start);
+  }
+  p += originalStyles.dataExcludingTerminator().count();
+  TextStyle::writeTerminatorWithStringIndex(stringRange.end,
+                                            p - originalStyles.lastStyleSizeInBytes(),
+                                            ArrayRef{p, originalStylesTerminatorSize});
+  p += originalStylesTerminatorSize;
+  STU_DEBUG_ASSERT(p + layouter.truncationTokenTextStyleData().count() + sanitizerGap
+                   == reinterpret_cast<Byte*>(this) + _dataSize);
+  copyConstructArray(layouter.truncationTokenTextStyleData(), p);
+
+  return originalStringTextStyleDataSize;
+}
+
+TextFrame::TextFrame(TextFrameLayouter&& layouter, UInt dataSize)
+: STUTextFrameData{
+    .paragraphCount = narrow_cast<Int32>(layouter.paragraphs().count()),
+    .lineCount = narrow_cast<Int32>(layouter.lines().count()),
+    ._colorCount = narrow_cast<UInt16>(layouter.colors().count()),
+    .layoutMode = layouter.layoutMode(),
+    .size = narrow_cast<CGSize>(layouter.scaleInfo().scale*layouter.inverselyScaledFrameSize()),
+    .textScaleFactor = layouter.scaleInfo().scale,
+    .displayScale = layouter.scaleInfo().originalDisplayScale,
+    .rangeInOriginalStringIsFullString = layouter.rangeInOriginalStringIsFullString(),
+    ._layoutIterationCount = narrow_cast<UInt8>(layouter.layoutCallCount()),
+    .rangeInOriginalString = layouter.rangeInOriginalString(),
+    .truncatedStringLength = layouter.truncatedStringLength(),
+    .originalAttributedString = layouter.attributedString().attributedString,
+    ._dataSize = dataSize
+  }
+{
+  incrementRefCount(originalAttributedString);
+  const UInt originalStringTextStyleDataSize = copyColorsAndTextStyles(layouter);
+  { // Write out the paragraphs and lines into the embedded arrays.
     Byte* p = reinterpret_cast<Byte*>(this + 1);
     using array_utils::copyConstructArray;
 
@@ -100,33 +236,6 @@ TextFrame::TextFrame(TextFrameLayouter&& layouter, UInt dataSize)
     p += layouter.paragraphs().arraySizeInBytes();
 
     copyConstructArray(layouter.lines(), reinterpret_cast<TextFrameLine*>(p));
-    p += layouter.lines().arraySizeInBytes();
-    p += sanitizerGap;
-
-    const ArrayRef<const ColorRef> colors = layouter.colors();
-    for (auto& color : colors) {
-      CFRetain(color.cgColor());
-    }
-    copyConstructArray(colors, reinterpret_cast<ColorRef*>(p));
-    p += colors.arraySizeInBytes();
-    p += sanitizerGap;
-
-    STU_ASSERT(p == _textStylesData);
-    const TextStyleSpan originalStyles = layouter.originalStringStyles();
-    copyConstructArray(originalStyles.dataExcludingTerminator(), p);
-    if (stringRange.start > 0) {
-      TextStyle* const style = reinterpret_cast<TextStyle*>(p);
-      STU_ASSERT(style->stringIndex() <= stringRange.start);
-      style->setStringIndex(stringRange.start);
-    }
-    p += originalStyles.dataExcludingTerminator().count();
-    TextStyle::writeTerminatorWithStringIndex(stringRange.end,
-                                              p - originalStyles.lastStyleSizeInBytes(),
-                                              ArrayRef{p, originalStylesTerminatorSize});
-    p += originalStylesTerminatorSize;
-    STU_DEBUG_ASSERT(p + layouter.truncationTokenTextStyleData().count() + sanitizerGap
-                     == reinterpret_cast<Byte*>(this) + dataSize);
-    copyConstructArray(layouter.truncationTokenTextStyleData(), p);
   }
 
   const ArrayRef<TextFrameParagraph> paragraphs = const_array_cast(this->paragraphs());
@@ -151,6 +260,9 @@ TextFrame::TextFrame(TextFrameLayouter&& layouter, UInt dataSize)
 
   const Float64 inverseScale = layouter.scaleInfo().inverseScale;
 
+  const bool usesCompactLineStorage = layouter.usesCompactLineStorage();
+  bool discardedCTLine = false;
+
   Int32 lineIndex = 0;
   for (TextFrameParagraph& para : paragraphs) {
     isTruncated |= !para.excisedRangeInOriginalString().isEmpty();
@@ -232,13 +344,20 @@ TextFrame::TextFrame(TextFrameLayouter&& layouter, UInt dataSize)
       }
 
       if (line.hasTruncationToken) {
-        line._tokenStylesOffset += originalStringTextStyleDataSize;
+        line._tokenStylesOffset += narrow_cast<Int32>(originalStringTextStyleDataSize);
       }
       if (line.textFlags() & (TextFlags::decorationFlags | TextFlags::hasAttachment)) {
         stu_label::detail::adjustFastTextFrameLineBoundsToAccountForDecorationsAndAttachments(
                              line, layouter.localFontInfoCache());
       }
 
+      if (usesCompactLineStorage && line.hasRecreatableCTLine(para)) {
+        CFRelease(line._ctLine);
+        line._ctLine = nullptr;
+        line._ctLineWasDiscarded = true;
+        discardedCTLine = true;
+      }
+
       // Note that the line's fast bounds currently always encompass the typographic bounds (see
       // TextFrameLayouter::initializeTypographicMetricsOfLine), so that we can use the vertical
       // search table for finding lines whose typographic *or* image bounds intersect vertically
@@ -252,6 +371,11 @@ TextFrame::TextFrame(TextFrameLayouter&& layouter, UInt dataSize)
     flags |= paraFlags;
   }
 
+  if (discardedCTLine) {
+    _typesetter = layouter.typesetter();
+    incrementRefCount(_typesetter);
+  }
+
   {
     Float32 minY = infinity<Float32>;
     STU_DISABLE_LOOP_UNROLL
@@ -330,12 +454,37 @@ TextFrame::~TextFrame() {
   if (const void* const bs = atomic_load_explicit(&_backgroundSegments, memory_order_relaxed)) {
     free(const_cast<void*>(bs));
   }
+  if (const STUTextFrameHitTestIndex* const hi = atomic_load_explicit(&_hitTestIndex,
+                                                                     memory_order_relaxed))
+  {
+    destroyHitTestIndex(hi);
+  }
+  if (const void* const li = atomic_load_explicit(&_lineIndexTable, memory_order_relaxed)) {
+    free(const_cast<void*>(li));
+  }
+  if (STUTextFrameImageBoundsCache* const ic = atomic_load_explicit(&_imageBoundsCache,
+                                                                     memory_order_relaxed))
+  {
+    TextFrameImageBoundsCache::destroy(ic);
+  }
+  if (const STUTextFrameGlyphStore* const gs = atomic_load_explicit(&_glyphStore,
+                                                                    memory_order_relaxed))
+  {
+    TextFrameGlyphStore::destroy(gs);
+  }
+  if (const STUTextFrameDisplayList* const dl = atomic_load_explicit(&_displayList,
+                                                                     memory_order_relaxed))
+  {
+    TextFrameDisplayList::destroy(dl);
+  }
+  // Frames that aren't truncated but don't contain the full original string also cache a
+  // truncated string.
+  if (const CFAttributedString* const ts = atomic_load_explicit(&_truncatedAttributedString,
+                                                                memory_order_relaxed))
+  {
+    discard((__bridge_transfer NSAttributedString*)ts); // Releases the string.
+  }
   if (flags & STUTextFrameIsTruncated) {
-    if (const CFAttributedString* const ts = atomic_load_explicit(&_truncatedAttributedString,
-                                                                  memory_order_relaxed))
-    {
-      discard((__bridge_transfer NSAttributedString*)ts); // Releases the string.
-    }
     for (const TextFrameParagraph& para : paragraphs().reversed()) {
       if (para.truncationToken) {
         decrementRefCount(para.truncationToken);
@@ -345,6 +494,9 @@ TextFrame::~TextFrame() {
   for (const TextFrameLine& line : lines().reversed()) {
     line.releaseCTLines();
   }
+  if (_typesetter) {
+    decrementRefCount(_typesetter);
+  }
   for (ColorRef color : colors()) {
     decrementRefCount(color.cgColor());
   }
@@ -359,6 +511,55 @@ TextFrame::~TextFrame() {
 #endif
 }
 
+/// Calculates the image bounds of the lines in the specified index range on the current thread.
+static void calculateLineImageBounds(ArrayRef<const TextFrameLine> lines, Range<Int> indexRange,
+                                     const ImageBoundsContext& originalContext,
+                                     ArrayRef<Rect<CGFloat>> output)
+{
+  if (!ThreadLocalArenaAllocator::instance()) {
+    ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
+    ThreadLocalArenaAllocator alloc{Ref{buffer}};
+    calculateLineImageBounds(lines, indexRange, originalContext, output);
+    return;
+  }
+  LocalFontInfoCache fontInfoCache;
+  LocalGlyphBoundsCache glyphBoundsCache;
+  const ImageBoundsContext context = {
+    .cancellationFlag = originalContext.cancellationFlag,
+    .drawingMode = originalContext.drawingMode,
+    .displayScale = originalContext.displayScale,
+    .fontInfoCache = fontInfoCache,
+    .glyphBoundsCache = glyphBoundsCache
+  };
+  for (Int i = indexRange.start; i < indexRange.end; ++i) {
+    if (context.isCancelled()) break;
+    output[i] = lines[i].calculateImageBoundsLLO(context);
+  }
+}
+
+/// Calculates the image bounds of all lines (ignoring any style override in the context).
+/// Large text frames are processed concurrently, with each worker using its own caches.
+static void calculateLineImageBounds(ArrayRef<const TextFrameLine> lines,
+                                     const ImageBoundsContext& context,
+                                     ArrayRef<Rect<CGFloat>> output)
+{
+  const Int count = lines.count();
+  const Int chunkSize = 16;
+  if (count < 4*chunkSize) {
+    for (Int i = 0; i < count; ++i) {
+      if (context.isCancelled()) break;
+      output[i] = lines[i].calculateImageBoundsLLO(context);
+    }
+    return;
+  }
+  const Int chunkCount = (count + (chunkSize - 1))/chunkSize;
+  const dispatch_queue_t queue = dispatch_get_global_queue(qos_class_self(), 0);
+  dispatch_apply(sign_cast(chunkCount), queue, ^(UInt chunkIndex) {
+    const Int start = sign_cast(chunkIndex)*chunkSize;
+    calculateLineImageBounds(lines, Range{start, min(start + chunkSize, count)}, context, output);
+  });
+}
+
 Rect<CGFloat> TextFrame::calculateImageBounds(TextFrameOrigin originalTextFrameOrigin,
                                               const ImageBoundsContext& originalContext) const
 {
@@ -370,21 +571,54 @@ Rect<CGFloat> TextFrame::calculateImageBounds(TextFrameOrigin originalTextFrameO
       context.displayScale = DisplayScale::create(textScaleFactor * *context.displayScale);
     }
   }
-  Rect<Float64> bounds = Rect<Float64>::infinitelyEmpty();
-  ArrayRef<const TextFrameLine> lines = this->lines();
+  const ArrayRef<const TextFrameLine> allLines = this->lines();
+  ArrayRef<const TextFrameLine> lines = allLines;
   if (context.styleOverride) {
     lines = lines[context.styleOverride->drawnLineRange];
   }
-  for (const TextFrameLine& line : lines) {
-    Rect<CGFloat> r = line.calculateImageBoundsLLO(context);
-    if (context.isCancelled()) break;
-    if (r.isEmpty()) continue;
-    r.y *= -1;
-    Point<Float64> lineOrigin = textFrameOrigin + line.origin();
-    if (context.displayScale) {
-      lineOrigin.y = ceilToScale(lineOrigin.y, *context.displayScale);
+  TextFrameImageBoundsCache& cache = TextFrameImageBoundsCache::get(*this);
+  const TextFrameImageBoundsCache::Entry* const entry = cache.find(context.drawingMode,
+                                                                   context.displayScale);
+  TempArray<Rect<CGFloat>> lineBounds{uninitialized, Count{lines.count()}};
+  if (!context.styleOverride) {
+    if (entry) {
+      std::copy(entry->lineBounds().begin(), entry->lineBounds().end(), lineBounds.begin());
+    } else {
+      calculateLineImageBounds(lines, context, lineBounds);
+      if (!context.isCancelled()) {
+        cache.add(context.drawingMode, context.displayScale, lineBounds);
+      }
+    }
+  } else {
+    // Lines that are drawn completely and aren't affected by the override have the same image
+    // bounds as without the style override. (The style override can't be used concurrently.)
+    const TextStyleOverride& styleOverride = *context.styleOverride;
+    const Int32 startLineIndex = styleOverride.drawnLineRange.start;
+    for (Int i = 0; i < lines.count(); ++i) {
+      if (context.isCancelled()) break;
+      const TextFrameLine& line = lines[i];
+      const Range<TextFrameCompactIndex> lineRange = line.range();
+      if (entry && styleOverride.drawnRange.contains(lineRange)
+          && !styleOverride.overrideRange.overlaps(lineRange))
+      {
+        lineBounds[i] = entry->lineBounds()[startLineIndex + i];
+      } else {
+        lineBounds[i] = line.calculateImageBoundsLLO(context);
+      }
+    }
+  }
+  Rect<Float64> bounds = Rect<Float64>::infinitelyEmpty();
+  if (!context.isCancelled()) {
+    for (Int i = 0; i < lines.count(); ++i) {
+      Rect<CGFloat> r = lineBounds[i];
+      if (r.isEmpty()) continue;
+      r.y *= -1;
+      Point<Float64> lineOrigin = textFrameOrigin + lines[i].origin();
+      if (context.displayScale) {
+        lineOrigin.y = ceilToScale(lineOrigin.y, *context.displayScale);
+      }
+      bounds = bounds.convexHull(lineOrigin + r);
     }
-    bounds = bounds.convexHull(lineOrigin + r);
   }
   if (bounds.x.start == Rect<Float64>::infinitelyEmpty().x.start) {
     return Rect<CGFloat>{narrow_cast<CGPoint>(originalTextFrameOrigin.value), {}};
@@ -392,5 +626,96 @@ Rect<CGFloat> TextFrame::calculateImageBounds(TextFrameOrigin originalTextFrameO
   return narrow_cast<Rect<CGFloat>>(textScaleFactor*bounds);
 }
 
+RC<CTLine> TextFrameLine::recreateCTLine() const {
+  STU_DEBUG_ASSERT(_ctLineWasDiscarded);
+  STU_TRACE_PHASE(LineRecreation);
+  STU_TRACE_PHASE_COUNT(rangeInOriginalString.end - rangeInOriginalString.start);
+  const TextFrame& textFrame = this->textFrame();
+  const TextFrameParagraph& para = textFrame.paragraphs()[paragraphIndex];
+  // This mirrors the head indent computation in TextFrameLayouter::Indentations.
+  Float64 headIndent = 0;
+  if (para.isIndented) {
+    const bool isInitialLine = lineIndex < para.initialLinesEndIndex;
+    if (para.baseWritingDirection == STUWritingDirectionLeftToRight) {
+      headIndent = isInitialLine ? para.initialLinesLeftIndent : para.nonInitialLinesLeftIndent;
+    } else {
+      headIndent = isInitialLine ? para.initialLinesRightIndent : para.nonInitialLinesRightIndent;
+    }
+    // The paragraph indents are stored in the scaled coordinate system of the text frame.
+    headIndent /= textFrame.textScaleFactor;
+  }
+  const Range<Int32> stringRange = rangeInOriginalString;
+  return {CTTypesetterCreateLineWithOffset(textFrame._typesetter, stringRange, headIndent),
+          ShouldIncrementRefCount{false}};
+}
+
+#if STU_HAS_THREAD_LOCAL
+
+static thread_local TextFrameLine::RecreatedCTLineScope* currentRecreatedCTLineScope_;
+
+STU_INLINE
+static TextFrameLine::RecreatedCTLineScope* currentRecreatedCTLineScope() {
+  return currentRecreatedCTLineScope_;
+}
+
+STU_INLINE
+static void setCurrentRecreatedCTLineScope(TextFrameLine::RecreatedCTLineScope* scope) {
+  currentRecreatedCTLineScope_ = scope;
+}
+
+#else
+
+static pthread_key_t createRecreatedCTLineScopePThreadKey() {
+  pthread_key_t key;
+  const int RC = pthread_key_create(&key, nullptr);
+  STU_CHECK(RC == 0);
+  return key;
+}
+
+static const pthread_key_t recreatedCTLineScopeKey = createRecreatedCTLineScopePThreadKey();
+
+static TextFrameLine::RecreatedCTLineScope* currentRecreatedCTLineScope() {
+  return static_cast<TextFrameLine::RecreatedCTLineScope*>(
+           pthread_getspecific(recreatedCTLineScopeKey));
+}
+
+static void setCurrentRecreatedCTLineScope(TextFrameLine::RecreatedCTLineScope* scope) {
+  pthread_setspecific(recreatedCTLineScopeKey, scope);
+}
+
+#endif
+
+TextFrameLine::RecreatedCTLineScope::RecreatedCTLineScope(const TextFrameLine& line) {
+  if (STU_LIKELY(!line._ctLineWasDiscarded)) return;
+  RecreatedCTLineScope* const currentScope = currentRecreatedCTLineScope();
+  for (auto* scope = currentScope; scope; scope = scope->outerScope_) {
+    if (scope->line_ == &line) return;
+  }
+  line_ = &line;
+  outerScope_ = currentScope;
+  setCurrentRecreatedCTLineScope(this);
+}
+
+TextFrameLine::RecreatedCTLineScope::~RecreatedCTLineScope() {
+  if (!line_) return;
+  STU_DEBUG_ASSERT(currentRecreatedCTLineScope() == this);
+  setCurrentRecreatedCTLineScope(outerScope_);
+}
+
+CTLine* TextFrameLine::ctLineForIteration(Out<RC<CTLine>> outRecreatedCTLine) const {
+  if (STU_LIKELY(!_ctLineWasDiscarded)) return _ctLine;
+  for (auto* scope = currentRecreatedCTLineScope(); scope; scope = scope->outerScope_) {
+    if (scope->line_ != this) continue;
+    if (!scope->hasRecreatedCTLine_) {
+      scope->hasRecreatedCTLine_ = true;
+      scope->ctLine_ = recreateCTLine();
+    }
+    return scope->ctLine_.get();
+  }
+  RC<CTLine>& recreatedCTLine = outRecreatedCTLine;
+  recreatedCTLine = recreateCTLine();
+  return recreatedCTLine.get();
+}
+
 
 } // namespace stu_label
@@ -0,0 +1,62 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#pragma once
+
+#import "TextFrame.hpp"
+
+#ifndef STU_USE_TEXT_FRAME_DISPLAY_LIST
+  #define STU_USE_TEXT_FRAME_DISPLAY_LIST 1
+#endif
+
+#include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+struct STUTextFrameDisplayList {};
+
+namespace stu_label {
+
+class DrawingContext;
+
+/// Recorded drawing commands for the lines of a text frame.
+///
+/// A line is recorded the second time it is drawn, so that frames and lines that are only drawn
+/// once, e.g. in the first tile of a tiled layer, don't pay for the recording. The recorded
+/// commands of a line contain copies of the glyphs and glyph positions of the line's runs, the
+/// attachments, and the rects of the line's underlines and strikethroughs, together with the text
+/// styles, which determine the shadows, strokes and (at replay time) fill colors. Subsequent draws
+/// of the line replay these commands instead of iterating over the CTLine runs and searching for
+/// the decoration lines again.
+///
+/// The decoration line rects are rounded for the display scale of the context that the line was
+/// recorded with, and their colors depend on the color override options. A line is therefore only
+/// replayed when the drawing context has the same display scale and color override flags.
+/// Lines with patterned decoration lines are always drawn directly by TextFrameLine::drawLLO.
+/// Lines drawn with a style override are only replayed (and never recorded) if the override
+/// just changes the text color of the whole line and the line has no decoration lines.
+class TextFrameDisplayList : public STUTextFrameDisplayList {
+public:
+  // Defined in TextFrameDisplayList.mm
+  struct RecordedLine;
+
+  /// Returns the display list of the text frame, creating an empty one if necessary. Thread-safe.
+  static const TextFrameDisplayList& get(const TextFrame&);
+
+  static void destroy(const STUTextFrameDisplayList* __nonnull);
+
+  /// Replays the commands recorded for the line, recording them first if the line has been drawn
+  /// before. Returns false without drawing anything if the line should be drawn with
+  /// TextFrameLine::drawLLO instead.
+  bool drawLLO(const TextFrameLine&, DrawingContext&) const;
+
+private:
+  static const RecordedLine* __nullable record(const TextFrameLine&, DrawingContext&);
+
+  static void destroy(const RecordedLine* __nonnull);
+
+  Int32 lineCount_;
+  /// Null for lines that haven't been drawn yet.
+  _Atomic(const RecordedLine*)* lines_;
+};
+
+} // namespace stu_label
+
+#include "UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
@@ -0,0 +1,397 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "TextFrameDisplayList.hpp"
+
+#import "STULabel/STUTextAttachment-Internal.hpp"
+
+#import "DecorationLines.hpp"
+#import "DrawingContext.hpp"
+#import "PhaseTracing.hpp"
+
+#import <stdatomic.h>
+
+#include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+namespace stu_label {
+
+struct TextFrameDisplayList::RecordedLine {
+  struct Glyphs {
+    /// Retained. Null if the style has an attachment.
+    CTFont* __nullable font;
+    const TextStyle* style;
+    /// The text matrix of the run, with the translation relative to the line origin.
+    /// (For an attachment, tx is the x-offset of the attachment.)
+    CGAffineTransform textMatrix;
+    /// A conservative estimate of the horizontal extent of the glyphs relative to the line origin.
+    /// Used for culling commands outside the clip rect.
+    Range<CGFloat> x;
+    Int32 glyphStartIndex;
+    Int32 glyphCount;
+  };
+
+  CGFloat displayScale;
+  TextFlags colorOverrideFlags;
+  /// See determineShadowDrawingMode in TextFrameLine-Drawing.mm.
+  bool drawsGlyphsShadowSeparately;
+  bool hasGlyphsShadow;
+  Int32 glyphsCommandCount;
+  Int32 underlineRectCount;
+  Int32 strikethroughRectCount;
+  const Glyphs* glyphsCommands;
+  const DecorationRect* underlineRects;
+  const DecorationRect* strikethroughRects;
+  const CGPoint* positions;
+  const CGGlyph* glyphs;
+
+  ArrayRef<const Glyphs> glyphsCommandsArray() const {
+    return {glyphsCommands, glyphsCommandCount, unchecked};
+  }
+  ArrayRef<const DecorationRect> underlineRectsArray() const {
+    return {underlineRects, underlineRectCount, unchecked};
+  }
+  ArrayRef<const DecorationRect> strikethroughRectsArray() const {
+    return {strikethroughRects, strikethroughRectCount, unchecked};
+  }
+
+  bool canBeReplayedIn(const DrawingContext& context) const {
+    return displayScale == context.displayScale().storage().displayScaleOrZero()
+        && colorOverrideFlags
+           == context.textFlagsNecessitatingDirectGlyphDrawingOfNonHighlightedText();
+  }
+};
+
+/// Marks lines that have been drawn exactly once.
+static const char drawnOnceMarker = 1;
+/// Marks lines that can't be recorded.
+static const char notRecordableMarker = 2;
+
+STU_INLINE
+const TextFrameDisplayList::RecordedLine* marker(const char& markerObject) {
+  return reinterpret_cast<const TextFrameDisplayList::RecordedLine*>(&markerObject);
+}
+
+STU_INLINE
+bool isMarker(const TextFrameDisplayList::RecordedLine* line) {
+  return line == marker(drawnOnceMarker) || line == marker(notRecordableMarker);
+}
+
+/// Returns null if the recording was cancelled or if the line can't be recorded with this context,
+/// and marker(notRecordableMarker) if the line can't be recorded at all.
+STU_NO_INLINE
+const TextFrameDisplayList::RecordedLine* __nullable
+  TextFrameDisplayList::record(const TextFrameLine& line, DrawingContext& context)
+{
+  const TextFlags lineFlags = context.effectiveLineFlags();
+  // Without a display scale, decoration lines are stroked instead of filled.
+  if ((lineFlags & (TextFlags::hasUnderline | TextFlags::hasStrikethrough))
+      && !context.displayScale())
+  {
+    return nullptr;
+  }
+  STU_TRACE_PHASE(DisplayListRecording);
+
+  const TextFrameLine::RecreatedCTLineScope ctLineScope{line};
+
+  TempVector<RecordedLine::Glyphs> commands{MaxInitialCapacity{16}};
+  TempVector<CGPoint> positions{MaxInitialCapacity{256}};
+  TempVector<CGGlyph> glyphs{MaxInitialCapacity{256}};
+  bool isRecordable = true;
+  bool drawsGlyphsShadowSeparately = false;
+  bool hasGlyphsShadow = false;
+  line.forEachStyledGlyphSpan(none,
+    [&](const StyledGlyphSpan& span, const TextStyle& style, Range<Float64> x) -> ShouldStop
+  {
+    // Partial ligatures have to be drawn with a clip rect.
+    if (span.isPartialLigature) {
+      isRecordable = false;
+      return ShouldStop{true};
+    }
+    if (const TextStyle::ShadowInfo* const shadow = style.shadowInfo()) {
+      hasGlyphsShadow = true;
+      // This mirrors the check in determineShadowDrawingMode in TextFrameLine-Drawing.mm.
+      const TextStyle::StrokeInfo* const stroke = style.strokeInfo();
+      drawsGlyphsShadowSeparately |= stroke && (stroke->doNotFill == false
+                                                || shadow->offsetX - shadow->blurRadius < 0);
+    }
+    if (style.flags() & TextFlags::hasAttachment) {
+      commands.append(RecordedLine::Glyphs{
+                        .font = nullptr, .style = &style,
+                        .textMatrix = {.a = 1, .d = 1, .tx = narrow_cast<CGFloat>(x.start)},
+                        .x = {-infinity<CGFloat>, infinity<CGFloat>},
+                        .glyphStartIndex = 0,
+                        .glyphCount = narrow_cast<Int32>(span.glyphSpan.count())});
+      return ShouldStop{context.isCancelled()};
+    }
+    const GlyphsWithPositions gwp = span.glyphSpan.getGlyphsWithPositions();
+    if (gwp.count() == 0) return {};
+    const GlyphRunRef run = span.glyphSpan.run();
+    CTFont* const font = run.font();
+    CGAffineTransform matrix = run.textMatrix();
+    matrix.tx = span.ctLineXOffset;
+    matrix.ty = 0;
+    if (NSFoundationVersionNumber <= NSFoundationVersionNumber_iOS_9_x_Max
+        && style.hasBaselineOffset())
+    {
+      matrix.ty += style.baselineOffset();
+    }
+    Range<CGFloat> commandX{-infinity<CGFloat>, infinity<CGFloat>};
+    // Strokes and shadows extend beyond the glyph bounds, so we don't cull such commands.
+    if (!(run.status() & kCTRunStatusHasNonIdentityMatrix)
+        && !style.strokeInfo() && !style.shadowInfo())
+    {
+      Range<CGFloat> positionsX = Range<CGFloat>::infinitelyEmpty();
+      for (const CGPoint& p : gwp.positions()) {
+        positionsX.start = min(positionsX.start, p.x);
+        positionsX.end = max(positionsX.end, p.x);
+      }
+      const CGRect fontBounds = CTFontGetBoundingBox(font);
+      commandX = span.ctLineXOffset
+               + Range{positionsX.start + min(fontBounds.origin.x, CGFloat(0)),
+                       positionsX.end + max(CGRectGetMaxX(fontBounds), CGFloat(0))};
+    }
+    commands.append(RecordedLine::Glyphs{
+                      .font = font, .style = &style, .textMatrix = matrix, .x = commandX,
+                      .glyphStartIndex = narrow_cast<Int32>(glyphs.count()),
+                      .glyphCount = narrow_cast<Int32>(gwp.count())});
+    glyphs.append(gwp.glyphs());
+    positions.append(gwp.positions());
+    return ShouldStop{context.isCancelled()};
+  });
+  if (!isRecordable) return marker(notRecordableMarker);
+  if (context.isCancelled()) return nullptr;
+
+  TempVector<DecorationRect> underlineRects{MaxInitialCapacity{16}};
+  TempVector<DecorationRect> strikethroughRects{MaxInitialCapacity{16}};
+  if (lineFlags & (TextFlags::hasUnderline | TextFlags::hasStrikethrough)) {
+    // The decoration lines found for a clipped context would only contain the visible parts.
+    DrawingContext::UnclippedScope unclippedScope{context};
+    if (lineFlags & TextFlags::hasUnderline) {
+      const Underlines underlines = Underlines::find(line, context);
+      if (context.isCancelled()) return nullptr;
+      if (!underlines.appendRectsLLO(underlineRects)) return marker(notRecordableMarker);
+    }
+    if (lineFlags & TextFlags::hasStrikethrough) {
+      const Strikethroughs strikethroughs = Strikethroughs::find(line, context);
+      if (context.isCancelled()) return nullptr;
+      if (!strikethroughs.appendRectsLLO(strikethroughRects)) return marker(notRecordableMarker);
+    }
+  }
+
+  static_assert(sizeof(RecordedLine)%alignof(RecordedLine::Glyphs) == 0);
+  static_assert(sizeof(RecordedLine::Glyphs)%alignof(DecorationRect) == 0);
+  static_assert(sizeof(DecorationRect)%alignof(CGPoint) == 0);
+  static_assert(sizeof(CGPoint)%alignof(CGGlyph) == 0);
+  const UInt commandsOffset = sizeof(RecordedLine);
+  const UInt underlinesOffset = commandsOffset
+                              + sign_cast(commands.count())*sizeof(RecordedLine::Glyphs);
+  const UInt strikethroughsOffset = underlinesOffset
+                                  + sign_cast(underlineRects.count())*sizeof(DecorationRect);
+  const UInt positionsOffset = strikethroughsOffset
+                             + sign_cast(strikethroughRects.count())*sizeof(DecorationRect);
+  const UInt glyphsOffset = positionsOffset + sign_cast(positions.count())*sizeof(CGPoint);
+  const UInt size = glyphsOffset + sign_cast(glyphs.count())*sizeof(CGGlyph);
+  STU_TRACE_PHASE_BYTE_SIZE(sign_cast(size));
+
+  Byte* const p = Malloc{}.allocate(sign_cast(size));
+  RecordedLine::Glyphs* const commandsArray =
+    reinterpret_cast<RecordedLine::Glyphs*>(p + commandsOffset);
+  DecorationRect* const underlinesArray = reinterpret_cast<DecorationRect*>(p + underlinesOffset);
+  DecorationRect* const strikethroughsArray =
+    reinterpret_cast<DecorationRect*>(p + strikethroughsOffset);
+  CGPoint* const positionsArray = reinterpret_cast<CGPoint*>(p + positionsOffset);
+  CGGlyph* const glyphsArray = reinterpret_cast<CGGlyph*>(p + glyphsOffset);
+  std::copy(commands.begin(), commands.end(), commandsArray);
+  std::copy(underlineRects.begin(), underlineRects.end(), underlinesArray);
+  std::copy(strikethroughRects.begin(), strikethroughRects.end(), strikethroughsArray);
+  std::copy(positions.begin(), positions.end(), positionsArray);
+  std::copy(glyphs.begin(), glyphs.end(), glyphsArray);
+  for (const RecordedLine::Glyphs& command : commands) {
+    if (command.font) {
+      CFRetain(command.font);
+    }
+  }
+
+  return new (p) RecordedLine{
+    .displayScale = context.displayScale().storage().displayScaleOrZero(),
+    .colorOverrideFlags = context.textFlagsNecessitatingDirectGlyphDrawingOfNonHighlightedText(),
+    .drawsGlyphsShadowSeparately = drawsGlyphsShadowSeparately,
+    .hasGlyphsShadow = hasGlyphsShadow,
+    .glyphsCommandCount = narrow_cast<Int32>(commands.count()),
+    .underlineRectCount = narrow_cast<Int32>(underlineRects.count()),
+    .strikethroughRectCount = narrow_cast<Int32>(strikethroughRects.count()),
+    .glyphsCommands = commandsArray,
+    .underlineRects = underlinesArray,
+    .strikethroughRects = strikethroughsArray,
+    .positions = positionsArray,
+    .glyphs = glyphsArray
+  };
+}
+
+void TextFrameDisplayList::destroy(const RecordedLine* line) {
+  for (const RecordedLine::Glyphs& command : line->glyphsCommandsArray()) {
+    if (command.font) {
+      CFRelease(command.font);
+    }
+  }
+  free(const_cast<RecordedLine*>(line));
+}
+
+void TextFrameDisplayList::destroy(const STUTextFrameDisplayList* list) {
+  const TextFrameDisplayList& self = static_cast<const TextFrameDisplayList&>(*list);
+  for (Int32 i = 0; i < self.lineCount_; ++i) {
+    const RecordedLine* const line = atomic_load_explicit(&self.lines_[i], memory_order_relaxed);
+    if (line && !isMarker(line)) {
+      destroy(line);
+    }
+  }
+  free(const_cast<STUTextFrameDisplayList*>(list));
+}
+
+const TextFrameDisplayList& TextFrameDisplayList::get(const TextFrame& textFrame) {
+  _Atomic(const STUTextFrameDisplayList*)* const frameDisplayList =
+    const_cast<_Atomic(const STUTextFrameDisplayList*)*>(&textFrame._displayList);
+  const STUTextFrameDisplayList* list = atomic_load_explicit(frameDisplayList,
+                                                             memory_order_relaxed);
+  if (STU_LIKELY(list)) {
+    list = atomic_load_explicit(frameDisplayList, memory_order_acquire);
+  } else {
+    static_assert(sizeof(TextFrameDisplayList)%alignof(_Atomic(const RecordedLine*)) == 0);
+    const UInt size = sizeof(TextFrameDisplayList)
+                    + sign_cast(textFrame.lineCount)*sizeof(_Atomic(const RecordedLine*));
+    // The zeroed memory initializes all line pointers to null.
+    Byte* const p = static_cast<Byte*>(calloc(1, size));
+    if (!p) __builtin_trap();
+    TextFrameDisplayList* const newList = new (p) TextFrameDisplayList{};
+    newList->lineCount_ = textFrame.lineCount;
+    newList->lines_ = reinterpret_cast<_Atomic(const RecordedLine*)*>(
+                        p + sizeof(TextFrameDisplayList));
+    list = newList;
+    const STUTextFrameDisplayList* expected = nullptr;
+    if (!atomic_compare_exchange_strong_explicit(frameDisplayList, &expected, list,
+                                                 memory_order_release, memory_order_acquire))
+    {
+      free(const_cast<STUTextFrameDisplayList*>(list));
+      list = expected;
+    }
+  }
+  return static_cast<const TextFrameDisplayList&>(*list);
+}
+
+/// Returns true if the style override only changes the text color of the whole line, so that the
+/// recorded commands of the line can be replayed with the overridden text color.
+static bool isTextColorOnlyOverrideOfWholeLine(const TextStyleOverride& styleOverride,
+                                               const TextFrameLine& line)
+{
+  return styleOverride.flagsMask == TextFlags{UINT16_MAX}
+      && styleOverride.flags == TextFlags{}
+      && styleOverride.textColorIndex
+      && styleOverride.overrideRange.contains(line.range());
+}
+
+/// If `overridesTextColor` is true, the text colors are overridden by the context's style override.
+static void drawGlyphsCommands(const TextFrameDisplayList::RecordedLine& line, bool drawShadow,
+                               bool overridesTextColor, DrawingContext& context)
+{
+  const CGContextRef cgContext = context.cgContext();
+  const CGPoint lineOrigin = context.lineOrigin();
+  const Range<CGFloat> clipX = context.clipRect().x;
+  for (const TextFrameDisplayList::RecordedLine::Glyphs& command : line.glyphsCommandsArray()) {
+    if (context.isCancelled()) return;
+    const TextStyle& style = *command.style;
+    if (!command.font) {
+      context.setShadow(drawShadow ? style.shadowInfo() : nullptr);
+      drawAttachment(style.attachmentInfo()->attribute, command.textMatrix.tx,
+                     style.baselineOffset(), command.glyphCount, context);
+      continue;
+    }
+    if (!clipX.overlaps(lineOrigin.x + command.x)) continue;
+    context.setShadow(drawShadow ? style.shadowInfo() : nullptr);
+    CGAffineTransform matrix = command.textMatrix;
+    matrix.tx += lineOrigin.x;
+    matrix.ty += lineOrigin.y;
+    CGContextSetTextMatrix(cgContext, matrix);
+    // This mirrors drawRunGlyphsDirectly in TextFrameLine-Drawing.mm.
+    const ColorIndex colorIndex = !overridesTextColor ? context.textColorIndex(style)
+                                : context.overriddenTextColorIndex(style);
+    context.setFillColor(colorIndex);
+    const TextStyle::StrokeInfo* const stroke = style.strokeInfo();
+    if (stroke) {
+      CGContextSetLineWidth(cgContext, stroke->strokeWidth);
+      context.setStrokeColor(stroke->colorIndex ? *stroke->colorIndex : colorIndex);
+      CGContextSetTextDrawingMode(cgContext, stroke->doNotFill ? kCGTextStroke : kCGTextFillStroke);
+    }
+    CTFontDrawGlyphs(command.font, line.glyphs + command.glyphStartIndex,
+                     line.positions + command.glyphStartIndex, sign_cast(command.glyphCount),
+                     cgContext);
+    if (stroke) {
+      CGContextSetTextDrawingMode(cgContext, kCGTextFill);
+    }
+  }
+}
+
+bool TextFrameDisplayList::drawLLO(const TextFrameLine& line, DrawingContext& context) const {
+  // The line drawing scope has already reset the style override if it doesn't affect the line.
+  const Optional<TextStyleOverride&> styleOverride = context.styleOverride();
+  if (styleOverride && !isTextColorOnlyOverrideOfWholeLine(*styleOverride, line)) return false;
+  _Atomic(const RecordedLine*)* const slot = &lines_[line.lineIndex];
+  const RecordedLine* recordedLine = atomic_load_explicit(slot, memory_order_acquire);
+  if (!recordedLine) {
+    // Lines that are only drawn once aren't worth recording.
+    const RecordedLine* expected = nullptr;
+    atomic_compare_exchange_strong_explicit(slot, &expected, marker(drawnOnceMarker),
+                                            memory_order_relaxed, memory_order_relaxed);
+    return false;
+  }
+  if (recordedLine == marker(drawnOnceMarker)) {
+    // The commands must be recorded with the line's own text styles.
+    if (styleOverride) return false;
+    const RecordedLine* const newLine = record(line, context);
+    if (!newLine) return false;
+    const RecordedLine* expected = marker(drawnOnceMarker);
+    if (atomic_compare_exchange_strong_explicit(slot, &expected, newLine,
+                                                memory_order_release, memory_order_acquire))
+    {
+      recordedLine = newLine;
+    } else {
+      if (!isMarker(newLine)) {
+        destroy(newLine);
+      }
+      recordedLine = expected;
+    }
+  }
+  if (recordedLine == marker(notRecordableMarker)
+      || !recordedLine->canBeReplayedIn(context))
+  {
+    return false;
+  }
+  // The recorded colors of decoration lines without an explicit color are the text colors.
+  if (styleOverride
+      && (recordedLine->underlineRectCount != 0 || recordedLine->strikethroughRectCount != 0))
+  {
+    return false;
+  }
+  const bool overridesTextColor = !!styleOverride;
+
+  // This mirrors TextFrameLine::drawLLO.
+  if (recordedLine->drawsGlyphsShadowSeparately) {
+    DrawingContext::ShadowOnlyDrawingScope shadowOnlyScope{context};
+    drawGlyphsCommands(*recordedLine, true, overridesTextColor, context);
+    if (context.isCancelled()) return true;
+  }
+  drawGlyphsCommands(*recordedLine,
+                     recordedLine->hasGlyphsShadow && !recordedLine->drawsGlyphsShadowSeparately,
+                     overridesTextColor, context);
+  if (context.isCancelled()) return true;
+  if (recordedLine->underlineRectCount != 0) {
+    drawDecorationRectsLLO(recordedLine->underlineRectsArray(), context);
+    if (context.isCancelled()) return true;
+  }
+  if (recordedLine->strikethroughRectCount != 0) {
+    drawDecorationRectsLLO(recordedLine->strikethroughRectsArray(), context);
+  }
+  return true;
+}
+
+} // namespace stu_label
+
+#include "UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
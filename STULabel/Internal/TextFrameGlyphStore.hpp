@@ -0,0 +1,96 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#pragma once
+
+#import "TextFrame.hpp"
+
+#import "stu/BinarySearch.hpp"
+
+#ifndef STU_USE_TEXT_FRAME_GLYPH_STORE
+  #define STU_USE_TEXT_FRAME_GLYPH_STORE 1
+#endif
+
+#include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+struct STUTextFrameGlyphStore {};
+
+namespace stu_label {
+
+/// A compact copy of the glyphs, glyph positions and fonts of all CTRuns in the lines of a text
+/// frame, stored as a structure of arrays in a single allocation owned by the text frame.
+/// Runs are identified by a key instead of their CTRun pointer, so that the store also covers the
+/// lines whose CTLine was discarded and is only recreated temporarily.
+///
+/// The store is created when the glyph data of a text frame is first needed for drawing or for
+/// measuring image bounds. Afterwards these operations iterate over the contiguous arrays instead
+/// of querying the CTRun objects again, which for runs without directly accessible glyph or
+/// position storage would require copying the data into a temporary buffer every time.
+class TextFrameGlyphStore : public STUTextFrameGlyphStore {
+public:
+  struct Run {
+    /// See `runKey`.
+    Int32 key;
+    Int32 glyphStartIndex;
+    Int32 glyphCount;
+    UInt16 fontIndex;
+  };
+
+  /// The start of the run's string range, or -1 minus the start for runs of the token CTLine.
+  /// The runs of a CTLine have disjoint string ranges, so the key identifies a run of a line
+  /// without comparing CTRun pointers.
+  STU_INLINE
+  static Int32 runKey(TextLinePart part, GlyphRunRef run) {
+    const Int32 stringStart = narrow_cast<Int32>(run.stringRange().start);
+    return part == TextLinePart::originalString ? stringStart : -1 - stringStart;
+  }
+
+  /// Returns the glyph store of the text frame, creating it if necessary. Thread-safe.
+  static const TextFrameGlyphStore& get(const TextFrame&);
+
+  static void destroy(const STUTextFrameGlyphStore* __nonnull);
+
+  /// The runs of the line's CTLine and token CTLine, sorted by key.
+  STU_INLINE
+  ArrayRef<const Run> runs(Int lineIndex) const {
+    return {runs_ + lineRunStartIndices_[lineIndex], runs_ + lineRunStartIndices_[lineIndex + 1],
+            unchecked};
+  }
+
+  /// Returns null if the run is neither a run of the line's CTLine nor of its token CTLine.
+  STU_INLINE
+  const Run* __nullable find(Int lineIndex, TextLinePart part, GlyphRunRef run) const {
+    const ArrayRef<const Run> lineRuns = runs(lineIndex);
+    const Int32 key = runKey(part, run);
+    const Int i = binarySearchFirstIndexWhere(lineRuns, [&](const Run& r) { return key <= r.key; })
+                  .indexOrArrayCount;
+    if (i == lineRuns.count()) return nullptr;
+    const Run& r = lineRuns[i];
+    if (r.key != key || r.glyphCount != run.count()) return nullptr;
+    return &r;
+  }
+
+  STU_INLINE
+  CTFont* font(const Run& run) const { return fonts_[run.fontIndex]; }
+
+  STU_INLINE
+  GlyphsWithPositions glyphsWithPositions(const Run& run, Range<Int> glyphRange) const {
+    STU_DEBUG_ASSERT(Range<Int>(0, run.glyphCount).contains(glyphRange));
+    const Int offset = run.glyphStartIndex + glyphRange.start;
+    return {none, glyphRange.count(), glyphs_ + offset, positions_ + offset};
+  }
+
+private:
+  static const TextFrameGlyphStore* create(const TextFrame&);
+
+  Int32 fontCount_;
+  const Int32* lineRunStartIndices_;
+  const Run* runs_;
+  /// Retained.
+  CTFont* const * fonts_;
+  const CGPoint* positions_;
+  const CGGlyph* glyphs_;
+};
+
+} // namespace stu_label
+
+#include "UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
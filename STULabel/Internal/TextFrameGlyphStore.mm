@@ -0,0 +1,159 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "TextFrameGlyphStore.hpp"
+
+#import <stdatomic.h>
+
+#include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+namespace stu_label {
+
+STU_NO_INLINE
+const TextFrameGlyphStore* TextFrameGlyphStore::create(const TextFrame& textFrame) {
+  const ArrayRef<const TextFrameLine> lines = textFrame.lines();
+  TempVector<Int32> lineRunStartIndices{Capacity{lines.count() + 1}};
+  TempVector<Run> runs{Capacity{lines.count()}};
+  TempVector<CTFont*> fonts{Capacity{4}};
+  // The glyph data is copied while the CTLine of the line is alive, since the CTLines of lines
+  // with `_ctLineWasDiscarded` are only recreated temporarily.
+  TempVector<CGPoint> positions{Capacity{16*lines.count()}};
+  TempVector<CGGlyph> glyphs{Capacity{16*lines.count()}};
+  for (const TextFrameLine& line : lines) {
+    const Int lineRunStartIndex = runs.count();
+    lineRunStartIndices.append(narrow_cast<Int32>(lineRunStartIndex));
+    const TextFrameLine::RecreatedCTLineScope ctLineScope{line};
+    RC<CTLine> recreatedCTLine;
+    for (const TextLinePart part : {TextLinePart::originalString, TextLinePart::truncationToken}) {
+      CTLine* const ctLine = part == TextLinePart::originalString
+                           ? line.ctLineForIteration(Out{recreatedCTLine})
+                           : line._tokenCTLine;
+      if (!ctLine) continue;
+      for (CTRun* const ctRun : glyphRuns(ctLine)) {
+        const GlyphRunRef run{ctRun};
+        CTFont* const font = run.font();
+        // A text frame usually only uses a handful of fonts.
+        Int fontIndex = 0;
+        while (fontIndex < fonts.count() && fonts[fontIndex] != font) {
+          ++fontIndex;
+        }
+        if (fontIndex == fonts.count()) {
+          fonts.append(font);
+        }
+        const Int count = run.count();
+        runs.append(Run{.key = runKey(part, run),
+                        .glyphStartIndex = narrow_cast<Int32>(glyphs.count()),
+                        .glyphCount = narrow_cast<Int32>(count),
+                        .fontIndex = narrow_cast<UInt16>(fontIndex)});
+        if (count == 0) continue;
+        // The range must not be empty, see the note on the GlyphSpan class.
+        const CFRange range{0, count};
+        CTRunGetGlyphs(ctRun, range, glyphs.append(repeat(uninitialized, count)));
+        CTRunGetPositions(ctRun, range, positions.append(repeat(uninitialized, count)));
+      }
+    }
+    std::sort(runs.begin() + lineRunStartIndex, runs.end(),
+              [](const Run& lhs, const Run& rhs) { return lhs.key < rhs.key; });
+  }
+  lineRunStartIndices.append(narrow_cast<Int32>(runs.count()));
+  const Int glyphCount = glyphs.count();
+
+  static_assert(sizeof(TextFrameGlyphStore)%alignof(Run) == 0);
+  static_assert(sizeof(Run)%alignof(CTFont*) == 0);
+  static_assert(sizeof(CTFont*)%alignof(CGPoint) == 0);
+  static_assert(sizeof(CGPoint)%alignof(Int32) == 0);
+  static_assert(sizeof(Int32)%alignof(CGGlyph) == 0);
+  const UInt runsOffset = sizeof(TextFrameGlyphStore);
+  const UInt fontsOffset = runsOffset + sign_cast(runs.count())*sizeof(Run);
+  const UInt positionsOffset = fontsOffset + sign_cast(fonts.count())*sizeof(CTFont*);
+  const UInt lineRunStartIndicesOffset = positionsOffset + sign_cast(glyphCount)*sizeof(CGPoint);
+  const UInt glyphsOffset = lineRunStartIndicesOffset
+                          + sign_cast(lineRunStartIndices.count())*sizeof(Int32);
+  const UInt size = glyphsOffset + sign_cast(glyphCount)*sizeof(CGGlyph);
+
+  Byte* const p = Malloc{}.allocate(sign_cast(size));
+  Run* const runsArray = reinterpret_cast<Run*>(p + runsOffset);
+  CTFont** const fontsArray = reinterpret_cast<CTFont**>(p + fontsOffset);
+  CGPoint* const positionsArray = reinterpret_cast<CGPoint*>(p + positionsOffset);
+  Int32* const lineRunStartIndicesArray = reinterpret_cast<Int32*>(p + lineRunStartIndicesOffset);
+  CGGlyph* const glyphsArray = reinterpret_cast<CGGlyph*>(p + glyphsOffset);
+  std::copy(runs.begin(), runs.end(), runsArray);
+  // The fonts of the runs of a recreated CTLine may not be retained by anything else.
+  for (Int i = 0; i < fonts.count(); ++i) {
+    fontsArray[i] = fonts[i];
+    CFRetain(fonts[i]);
+  }
+  std::copy(lineRunStartIndices.begin(), lineRunStartIndices.end(), lineRunStartIndicesArray);
+  std::copy(positions.begin(), positions.end(), positionsArray);
+  std::copy(glyphs.begin(), glyphs.end(), glyphsArray);
+
+  TextFrameGlyphStore* const store = new (p) TextFrameGlyphStore{};
+  store->fontCount_ = narrow_cast<Int32>(fonts.count());
+  store->lineRunStartIndices_ = lineRunStartIndicesArray;
+  store->runs_ = runsArray;
+  store->fonts_ = fontsArray;
+  store->positions_ = positionsArray;
+  store->glyphs_ = glyphsArray;
+  return store;
+}
+
+void TextFrameGlyphStore::destroy(const STUTextFrameGlyphStore* glyphStore) {
+  const TextFrameGlyphStore& self = static_cast<const TextFrameGlyphStore&>(*glyphStore);
+  for (Int32 i = 0; i < self.fontCount_; ++i) {
+    CFRelease(self.fonts_[i]);
+  }
+  free(const_cast<STUTextFrameGlyphStore*>(glyphStore));
+}
+
+const TextFrameGlyphStore& TextFrameGlyphStore::get(const TextFrame& textFrame) {
+  _Atomic(const STUTextFrameGlyphStore*)* const frameGlyphStore =
+    const_cast<_Atomic(const STUTextFrameGlyphStore*)*>(&textFrame._glyphStore);
+  const STUTextFrameGlyphStore* store = atomic_load_explicit(frameGlyphStore,
+                                                             memory_order_relaxed);
+  if (STU_LIKELY(store)) {
+    store = atomic_load_explicit(frameGlyphStore, memory_order_acquire);
+  } else {
+    store = create(textFrame);
+    const STUTextFrameGlyphStore* expected = nullptr;
+    if (!atomic_compare_exchange_strong_explicit(frameGlyphStore, &expected, store,
+                                                 memory_order_release, memory_order_acquire))
+    {
+      destroy(store);
+      store = expected;
+    }
+  }
+  return static_cast<const TextFrameGlyphStore&>(*store);
+}
+
+GlyphsWithPositions TextFrameLine::glyphsWithPositions(TextLinePart part,
+                                                       const GlyphSpan& span) const
+{
+#if STU_USE_TEXT_FRAME_GLYPH_STORE
+  const TextFrameGlyphStore& store = TextFrameGlyphStore::get(textFrame());
+  if (const TextFrameGlyphStore::Run* const run = store.find(lineIndex, part, span.run())) {
+    return store.glyphsWithPositions(*run, span.glyphRange());
+  }
+#endif
+  return span.getGlyphsWithPositions();
+}
+
+Rect<CGFloat> TextFrameLine::imageBounds(TextLinePart part, const GlyphSpan& span,
+                                         LocalGlyphBoundsCache& glyphBoundsCache) const
+{
+#if STU_USE_TEXT_FRAME_GLYPH_STORE
+  const TextFrameGlyphStore& store = TextFrameGlyphStore::get(textFrame());
+  if (const TextFrameGlyphStore::Run* const run = store.find(lineIndex, part, span.run())) {
+    if (span.isEmpty()) return {};
+    const GlyphsWithPositions gwp = store.glyphsWithPositions(*run, span.glyphRange());
+    Rect<CGFloat> bounds = glyphBoundsCache.boundingRect(store.font(*run), gwp);
+    if (span.run().status() & kCTRunStatusHasNonIdentityMatrix) {
+      bounds = CGRectApplyAffineTransform(bounds, span.run().textMatrix());
+    }
+    return bounds;
+  }
+#endif
+  return span.imageBounds(glyphBoundsCache);
+}
+
+} // namespace stu_label
+
+#include "UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
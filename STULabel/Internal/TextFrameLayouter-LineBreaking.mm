@@ -224,51 +224,21 @@ bool TextFrameLayouter::hyphenateLineInRange(TextFrameLine& line, Range<Int> str
     }
     return false;
   }
-  const Int stringLength = attributedString_.string.count();
-  const Int outerEnd = stringRange.end >= stringLength ? stringRange.end
-                     : attributedString_.string
-                       .indexOfFirstUTF16CharWhere({stringRange.end,
-                                                    min(stringRange.end + 16, stringLength)},
-                                                   isUnicodeWhitespace);
-  __block bool result = false;
-  [attributedString_.attributedString
-     enumerateAttribute:STUHyphenationLocaleIdentifierAttributeName
-                inRange:NSRange(Range{stringRange.start, outerEnd})
-                options:NSAttributedStringEnumerationReverse // We want the longest effective range.
-             usingBlock:^(__unsafe_unretained id value, NSRange nsRange, BOOL* shouldStop)
-  {
-    const auto range = Range<Int>(nsRange);
-    if (range.start >= stringRange.end) return;
-    CFString* const localeId = (__bridge CFStringRef)value;
-    if (!localeId) return;
-    if (localeId != cachedLocaleId_ && CFStringGetLength(localeId) == 0) return;
-    if (localeId == cachedLocaleId_ || (cachedLocaleId_ && CFEqual(localeId, cachedLocaleId_))) {
-      if (!cachedLocale_) return;
-    } else {
-      cachedLocaleId_ = localeId;
-      cachedLocale_ = RC<CFLocale>{CFLocaleCreate(nil, localeId), ShouldIncrementRefCount{false}};
-      if (!cachedLocale_) return;
-      if (!CFStringIsHyphenationAvailableForLocale(cachedLocale_.get())) {
-        cachedLocale_ = nullptr;
-        return;
-      }
-    }
-    for (Int i = min(stringRange.end, range.end); i > range.start + 1;) {
-      UTF32Char hyphen;
-      i = CFStringGetHyphenationLocationBeforeIndex(
-            attributedString_.string, i, range, 0, cachedLocale_.get(), &hyphen);
-      if (i <= range.start) break;
-      if (hyphen == 0x2D) { // We prefer a proper hyphen, not a hyphen-minus.
-        hyphen = hyphenCodePoint;
-      }
-      if (breakLineAt(line, i, Hyphen{hyphen}, TrailingWhitespaceStringLength{0}).success) {
-        result = true;
-        *shouldStop = true;
-        return;
-      }
+  // The hyphenation locations are computed once per paragraph and cached in the ShapedString,
+  // so that breaking the lines of a paragraph multiple times with different widths (e.g. in
+  // layoutAndScale) doesn't require repeated CFStringGetHyphenationLocationBeforeIndex calls.
+  const Int32 paraIndex = narrow_cast<Int32>(stringParasPtr_
+                                             - shapedString_.arrays().paragraphs.begin())
+                        + line.paragraphIndex;
+  const HyphenationLocations& locations = shapedString_.hyphenationLocations(
+                                            paraIndex, attributedString_,
+                                            hyphenationLocaleCache_);
+  for (const HyphenationLocation& hl : locations.locationsStrictlyInside(stringRange).reversed()) {
+    if (breakLineAt(line, hl.index, Hyphen{hl.hyphen}, TrailingWhitespaceStringLength{0}).success) {
+      return true;
     }
-  }];
-  return result;
+  }
+  return false;
 }
 
 STU_NO_INLINE
@@ -4,6 +4,8 @@
 
 #import "LineTruncation.hpp"
 #import "Once.hpp"
+#import "PhaseTracing.hpp"
+#import "TokenLineCache.hpp"
 #import "UnicodeCodePointProperties.hpp"
 
 #include "DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
@@ -176,10 +178,12 @@ void TextFrameLayouter::truncateLine(TextFrameLine& line,
                                      STUTextFrameParagraph& para,
                                      TextStyleBuffer& tokenStyleBuffer) const
 {
+  STU_TRACE_PHASE(Truncation);
   const Int32 paraTerminatorIndex = para.rangeInOriginalString.end
                                   - para.paragraphTerminatorInOriginalStringLength;
   const Int32 start = line.rangeInOriginalString.start;
   STU_DEBUG_ASSERT(stringEndIndex >= paraTerminatorIndex);
+  STU_TRACE_PHASE_COUNT(stringEndIndex - start);
   line.isFollowedByTerminatorInOriginalString = para.paragraphTerminatorInOriginalStringLength != 0;
   const Int maxEnd = attributedString_.string.indexOfFirstUTF16CharWhere(
                        Range{start, stringEndIndex}, isLineTerminator);
@@ -318,10 +322,11 @@ void TextFrameLayouter::truncateLine(TextFrameLine& line,
       tokenIsMutable = false;
       discard(tokenIsMutable); // We won't actually read this value again.
     }
-    tokenLine = CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)token);
-    STU_ASSERT(tokenLine);
+    // The same token is usually shaped for many truncated lines, so we use a global cache.
+    const TokenLineCache::Line cachedTokenLine = TokenLineCache::createLine(token);
+    tokenLine = cachedTokenLine.line;
     const Float64 previousTokenWidth = tokenWidth;
-    tokenWidth = typographicWidth(tokenLine);
+    tokenWidth = cachedTokenLine.width;
   #if STU_DEBUG
     STU_ASSERT(iterationCount != 1 || tokenWidth != previousTokenWidth);
   #else
@@ -4,6 +4,11 @@
 
 #import "STULabel/STUTextFrameOptions-Internal.hpp"
 
+#import "TokenLineCache.hpp"
+#import "UnicodeCodePointProperties.hpp"
+
+#import "stu/BinarySearch.hpp"
+
 namespace stu_label {
 
 static auto firstLineOffsetForBaselineAdjustment(const TextFrameLine& firstLine,
@@ -110,12 +115,15 @@ void TextFrameLayouter::layoutAndScale(Size<Float64> frameSize,
                              1/clamp(32, 2*max(frameSize.width, frameSize.height), 2048));
   const CGFloat accuracyPlusEps = accuracy + epsilon<CGFloat>/2;
 
+  LineBreakProfiles lineBreakProfiles;
+
   const auto estimatedScale = minTextScaleFactor + stepSize >= 1
                             ? ScaleFactorEstimate{minTextScaleFactor, 1}
                             : estimateScaleFactorNeededToFit(frameSize.height, maxLineCount,
                                                              options.fixedTruncationToken,
                                                              state.lowerBound,
-                                                             hasStepSize ? stepSize/2 : accuracy);
+                                                             hasStepSize ? stepSize/2 : accuracy,
+                                                             lineBreakProfiles);
   if (estimatedScale.value >= 1 && estimatedScale.isAccurate) return;
 
   STU_DEBUG_ASSERT(estimatedScale.value >= state.lowerBound);
@@ -246,6 +254,9 @@ void TextFrameLayouter::layoutAndScale(Size<Float64> frameSize,
     nextScale = max(state.upperBound - max(1/64.f, 2*accuracy),
                     (state.lowerBound + state.upperBound)/2);
   }
+  // Whether the last layout was done with a scale factor that was estimated from the line breaks
+  // of the previous layout.
+  bool lastScaleWasEstimated = false;
   for (;;) {
     if (hasStepSize) {
       nextScale = roundScale(nextScale);
@@ -253,10 +264,36 @@ void TextFrameLayouter::layoutAndScale(Size<Float64> frameSize,
     updateScaleInfoAndLayout(nextScale);
     if (fits()) {
       if (!updateLowerBound()) return;
-    } else {
-      if (!updateUpperBound()) return;
+      nextScale = (state.lowerBound + state.upperBound)/2;
+      if (lastScaleWasEstimated) {
+        // The estimate usually is a lower bound that is quite close to the exact value, so we
+        // first try a scale just above the new lower bound.
+        nextScale = min(nextScale, state.lowerBound + max(1/64.f, 2*accuracy));
+        lastScaleWasEstimated = false;
+      }
+      continue;
     }
+    if (!updateUpperBound()) return;
     nextScale = (state.lowerBound + state.upperBound)/2;
+    lastScaleWasEstimated = false;
+    if (state.scaleInfo.scale <= minTextScaleFactor) continue;
+    // Instead of blindly bisecting the interval, we estimate the scale factor from the
+    // current line breaks. The estimate only needs the line widths and the line break profiles
+    // recorded by the first estimate, which makes it much faster than a full layout. With an
+    // accurate estimate the search typically converges after one or two further layout calls.
+    const CGFloat scale = state.scaleInfo.scale;
+    const auto estimate = estimateScaleFactorNeededToFit(
+                            state.inverselyScaledFrameSize.height, maxLineCount,
+                            options.fixedTruncationToken, state.lowerBound/scale,
+                            (hasStepSize ? stepSize/2 : accuracy)/scale, lineBreakProfiles);
+    if (isCancelled()) return;
+    const CGFloat estimatedScale = roundDownScale(scale*estimate.value);
+    if (state.lowerBound + accuracyPlusEps <= estimatedScale
+        && estimatedScale + accuracyPlusEps <= state.upperBound)
+    {
+      nextScale = estimatedScale;
+      lastScaleWasEstimated = true;
+    }
   }
 }
 
@@ -290,11 +327,107 @@ Float64 TextFrameLayouter::estimateTailTruncationTokenWidth(const TextFrameLine&
     NSMutableAttributedString* mutableToken = [originalTruncationToken mutableCopy];
     TextFrameLayouter::addAttributesNotYetPresentInAttributedString(
                          mutableToken, NSRange{0, mutableToken.length}, attributes);
-    token = mutableToken;
+    token = [mutableToken copy];
+  }
+  const TokenLineCache::Line tokenLine = TokenLineCache::createLine(token);
+  CFRelease(tokenLine.line);
+  return tokenLine.width;
+}
+
+static bool isTrailingWhitespace(Char16 ch) {
+  return ch == ' ' || ch == '\n' || ch == '\r' || isUnicodeWhitespace(ch);
+}
+
+auto TextFrameLayouter::LineBreakProfiles::profile(const TextFrameLayouter& layouter,
+                                                   Range<Int32> stringRange)
+  -> ProfileRef
+{
+  const Int index = binarySearchFirstIndexWhere(profiles_, [&](const Profile& p) {
+                      return p.stringRange.start > stringRange.start
+                          || (p.stringRange.start == stringRange.start
+                              && p.stringRange.end >= stringRange.end);
+                    }).indexOrArrayCount;
+  if (index < profiles_.count() && profiles_[index].stringRange == stringRange) {
+    return profiles_[index].ref;
   }
-  const RC<CTLine> ctLine{CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)token),
+  ProfileRef ref{.offsetsStartIndex = narrow_cast<Int32>(startOffsets_.count()),
+                 .offsetsCount = 0};
+  const NSStringRef& string = layouter.attributedString_.string;
+  bool isUsable = !stringRange.isEmpty();
+  for (Int32 i = stringRange.start; isUsable && i < stringRange.end; ++i) {
+    // Tab stop positions depend on the head indent of the line.
+    isUsable = string[i] != '\t';
+  }
+  if (isUsable) {
+    const RC<CTLine> line{CTTypesetterCreateLineWithOffset(layouter.typesetter_, stringRange, 0),
                           ShouldIncrementRefCount{false}};
-  return CTLineGetTypographicBounds(ctLine.get(), nullptr, nullptr, nullptr);
+    const CFStringTokenizerRef tokenizer =
+      CFStringTokenizerCreate(nullptr, string, CFRange{stringRange.start, stringRange.count()},
+                              kCFStringTokenizerUnitLineBreak, nullptr);
+    Float64 offset = CTLineGetOffsetForStringIndex(line.get(), stringRange.start, nullptr);
+    startOffsets_.append(offset);
+    endOffsets_.append(offset);
+    Int32 index = stringRange.start;
+    while (isUsable && index < stringRange.end) {
+      Int32 nextIndex = stringRange.end;
+      if (CFStringTokenizerAdvanceToNextToken(tokenizer) != kCFStringTokenizerTokenNone) {
+        const CFRange token = CFStringTokenizerGetCurrentTokenRange(tokenizer);
+        nextIndex = narrow_cast<Int32>(min(token.location + token.length, CFIndex{nextIndex}));
+        if (nextIndex <= index) continue;
+      }
+      Int32 textEnd = nextIndex;
+      while (textEnd > index && isTrailingWhitespace(string[textEnd - 1])) {
+        --textEnd;
+      }
+      const Float64 endOffset = CTLineGetOffsetForStringIndex(line.get(), textEnd, nullptr);
+      const Float64 nextOffset = textEnd == nextIndex ? endOffset
+                               : CTLineGetOffsetForStringIndex(line.get(), nextIndex, nullptr);
+      isUsable = offset <= endOffset && endOffset <= nextOffset;
+      startOffsets_.append(nextOffset);
+      endOffsets_.append(endOffset);
+      offset = nextOffset;
+      index = nextIndex;
+    }
+    CFRelease(tokenizer);
+    const Int32 count = narrow_cast<Int32>(startOffsets_.count()) - ref.offsetsStartIndex;
+    if (isUsable) {
+      ref.offsetsCount = count;
+    } else {
+      startOffsets_.removeLast(count);
+      endOffsets_.removeLast(count);
+    }
+  }
+  profiles_.insert(index, Profile{.stringRange = stringRange, .ref = ref});
+  return ref;
+}
+
+Int32 TextFrameLayouter::LineBreakProfiles::lineCount(ProfileRef profile,
+                                                      Float64 initialMaxWidth,
+                                                      Float64 nonInitialMaxWidth,
+                                                      Int32 initialLinesCount,
+                                                      Int32 maxLineCount) const
+{
+  STU_DEBUG_ASSERT(profile.offsetsCount > 0);
+  const Int32 start = profile.offsetsStartIndex;
+  const Int32 end = start + profile.offsetsCount;
+  const ArrayRef<const Float64> startOffsets = startOffsets_[{start, end}];
+  const ArrayRef<const Float64> endOffsets = endOffsets_[{start, end}];
+  const Int32 last = profile.offsetsCount - 1;
+  for (Int32 n = 1, i = 0;; ++n) {
+    const Float64 maxWidth = n <= initialLinesCount ? initialMaxWidth : nonInitialMaxWidth;
+    const Float64 maxEndOffset = startOffsets[i] + maxWidth;
+    // The end offsets are monotonically increasing, so we can find the last break opportunity
+    // before which the text still fits into the line with a binary search.
+    Int32 j = i + narrow_cast<Int32>(binarySearchFirstIndexWhere(endOffsets[{i + 1, last + 1}],
+                                       [&](Float64 endOffset) { return endOffset > maxEndOffset; }
+                                     ).indexOrArrayCount);
+    if (j == i) {
+      j = i + 1;
+    }
+    if (j == last) return n;
+    if (n + 1 == maxLineCount) return maxLineCount;
+    i = j;
+  }
 }
 
 struct ScalingPara {
@@ -310,12 +443,14 @@ struct ScalingPara {
   const CGFloat initialExtraHeadIndent;
   const CGFloat initialExtraTailIndent;
   const Float64 maxWidthMinusCommonIndent;
+  const TextFrameLayouter::LineBreakProfiles::ProfileRef lineBreakProfile;
 
   /// This function currently does not account for hyphenation opportunities. Implementing that
   /// currently doesn't seem worth the effort (as long as CTTypesetter has no built-in support
   /// for hyphenation).
   void bisectInverseScaleInterval(bool lineCountIsLowerBound, Float64 inverseScale,
-                                  CTTypesetter* const typesetter, const NSStringRef& string)
+                                  CTTypesetter* const typesetter, const NSStringRef& string,
+                                  const TextFrameLayouter::LineBreakProfiles& lineBreakProfiles)
   {
     if (lineCountIsLowerBound) {
       minLineCount = lineCount;
@@ -358,6 +493,12 @@ struct ScalingPara {
         nonInitialMaxWidth += extraTailIndent;
       }
     }
+    if (lineBreakProfile.offsetsCount > 0) {
+      lineCount = lineBreakProfiles.lineCount(lineBreakProfile, initialMaxWidth,
+                                              nonInitialMaxWidth, initialLinesCount,
+                                              maxLineCount);
+      return;
+    }
     for (Int32 n = 1, index = stringRange.start, endIndex;; ++n, index = endIndex) {
       const Float64 maxWidth = n <= initialLinesCount ? initialMaxWidth : nonInitialMaxWidth;
       const Float64 headIndent = n <= initialLinesCount ? initialHeadIndent : nonInitialHeadIndent;
@@ -386,7 +527,8 @@ namespace stu_label {
 auto TextFrameLayouter::estimateScaleFactorNeededToFit(Float64 frameHeight, Int32 maxLineCount,
                                                        NSAttributedString* __unsafe_unretained
                                                          truncationToken,
-                                                       Float64 minScale, Float64 accuracy) const
+                                                       Float64 minScale, Float64 accuracy,
+                                                       LineBreakProfiles& lineBreakProfiles) const
 -> ScaleFactorEstimate
 {
   ArrayRef<const TextFrameLine> lines = lines_;
@@ -584,8 +726,9 @@ auto TextFrameLayouter::estimateScaleFactorNeededToFit(Float64 frameHeight, Int3
       initialExtraHeadIndent = max(0.f, -initialExtraHeadIndent);
       initialExtraTailIndent = max(0.f, -initialExtraTailIndent);
     }
-    paras.append(ScalingPara{.stringRange = {firstLine.rangeInOriginalString.start,
-                                             lastLine.rangeInOriginalString.end},
+    const Range<Int32> stringRange{firstLine.rangeInOriginalString.start,
+                                   lastLine.rangeInOriginalString.end};
+    paras.append(ScalingPara{.stringRange = stringRange,
                              .maxLineCount = n,
                              .lineCount = n,
                              .originalLineCount = n,
@@ -594,7 +737,8 @@ auto TextFrameLayouter::estimateScaleFactorNeededToFit(Float64 frameHeight, Int3
                              .commonHeadIndent = commonHeadIndent,
                              .initialExtraHeadIndent = initialExtraHeadIndent,
                              .initialExtraTailIndent = initialExtraTailIndent,
-                             .maxWidthMinusCommonIndent = maxWidthMinusCommonIndent});
+                             .maxWidthMinusCommonIndent = maxWidthMinusCommonIndent,
+                             .lineBreakProfile = lineBreakProfiles.profile(*this, stringRange)});
     if (isCancelled()) break;
   }
   paras.trimFreeCapacity();
@@ -614,7 +758,7 @@ auto TextFrameLayouter::estimateScaleFactorNeededToFit(Float64 frameHeight, Int3
     remainingParaIndices.removeWhere([&](Int32 i) -> bool {
       ScalingPara& para = paras[i];
       para.bisectInverseScaleInterval(isLowerBound, inverseScale,
-                                      typesetter_, attributedString_.string);
+                                      typesetter_, attributedString_.string, lineBreakProfiles);
       const Int32 lineCountDiff = para.originalLineCount - para.lineCount;
       const Float64 heighDiff = lineCountDiff*para.lineHeight;
       if (para.minLineCount != para.maxLineCount) {
@@ -623,7 +767,7 @@ auto TextFrameLayouter::estimateScaleFactorNeededToFit(Float64 frameHeight, Int3
         return false;
       } else {
         lineCount -= lineCountDiff;
-        height -= lineCountDiff;
+        height -= heighDiff;
         return true;
       }
     });
@@ -14,9 +14,13 @@ struct TextFrameOptions;
 
 class TextFrameLayouter {
 public:
+  /// @param sharedFontInfoCache
+  ///  An optional cache that is used instead of a layouter-owned one, so that consecutive layouts
+  ///  on the same thread can share the cached font info. Must outlive the layouter.
   TextFrameLayouter(const ShapedString&, Range<Int32> stringRange,
                     STUDefaultTextAlignment defaultTextAlignment,
-                    const STUCancellationFlag* cancellationFlag);
+                    const STUCancellationFlag* cancellationFlag,
+                    LocalFontInfoCache* __nullable sharedFontInfoCache = nullptr);
 
   ~TextFrameLayouter();
 
@@ -40,6 +44,21 @@ public:
   void layoutAndScale(Size<Float64> frameSize, const Optional<DisplayScale>& displayScale,
                       const TextFrameOptions& options);
 
+  /// Makes subsequent `layout` calls position the first line relative to the specified last line
+  /// of the preceding text (e.g. the last line of the previous text frame in a
+  /// `STUTextFrameSequence`), exactly as the line would be positioned in a layout of the combined
+  /// text, instead of positioning it like the first line of a text frame.
+  ///
+  /// The line's `originY` must be the unrounded baseline position relative to the origin of this
+  /// layouter's text frame and its `paragraphIndex` must be -1.
+  ///
+  /// @pre The string range starts with the paragraph following the line's paragraph. The layout
+  ///      must not be scaled. The line must outlive all `layout` calls.
+  void setPrecedingLine(const STUTextFrameLine* __nullable line) {
+    STU_PRECONDITION(!line || (line->paragraphIndex == -1 && stringRange_.start > 0));
+    precedingLine_ = line;
+  }
+
   void layout(Size<Float64> inverselyScaledFrameSize, ScaleInfo scaleInfo,
               Int maxLineCount, const TextFrameOptions& options);
 
@@ -49,6 +68,11 @@ public:
 
   STUTextLayoutMode layoutMode() const { return layoutMode_; }
 
+  /// The value of the `usesCompactLineStorage` option passed to the last `layout` call.
+  bool usesCompactLineStorage() const { return usesCompactLineStorage_; }
+
+  CTTypesetter* typesetter() const { return typesetter_; }
+
   struct ScaleFactorAndNeedsRealignment {
     Float64 scaleFactor;
     bool needsRealignment;
@@ -63,6 +87,55 @@ public:
     bool isAccurate;
   };
 
+  /// The line break opportunities of paragraphs together with the typographic offsets of the
+  /// text before and after each opportunity.
+  ///
+  /// A profile is recorded once per paragraph string range. Afterwards the line count of the
+  /// paragraph for any line width can be estimated with a greedy line breaking over the recorded
+  /// offsets, without any further CTTypesetter calls. layoutAndScale passes the same instance to
+  /// all estimateScaleFactorNeededToFit calls, so that the profiles are reused for all candidate
+  /// scale factors.
+  class LineBreakProfiles {
+  public:
+    struct ProfileRef {
+      Int32 offsetsStartIndex;
+      /// 0 if the profile can't be used for estimating the line breaks.
+      Int32 offsetsCount;
+    };
+
+    /// Returns the profile for the string range, recording it if necessary.
+    ///
+    /// The profile can't be used if the string range contains tabs or if the recorded offsets
+    /// aren't monotonic, e.g. because of right-to-left text.
+    ProfileRef profile(const TextFrameLayouter&, Range<Int32> stringRange);
+
+    /// Returns the estimated line count of the paragraph, or maxLineCount if the line count is
+    /// greater than or equal to maxLineCount.
+    ///
+    /// Like CTTypesetter the estimate lets trailing whitespace hang into the margin. If the text up
+    /// to the next break opportunity doesn't fit into a line, the estimate doesn't break the text
+    /// within the word, as CTTypesetter would, so the returned value may be too low in that case.
+    ///
+    /// @pre profile.offsetsCount > 0
+    Int32 lineCount(ProfileRef profile, Float64 initialMaxWidth, Float64 nonInitialMaxWidth,
+                    Int32 initialLinesCount, Int32 maxLineCount) const;
+
+  private:
+    struct Profile {
+      Range<Int32> stringRange;
+      ProfileRef ref;
+    };
+
+    /// Sorted by stringRange.start, then by stringRange.end.
+    Vector<Profile> profiles_;
+    /// The offset of each break opportunity (including the start and end of the paragraph)
+    /// relative to the start of the paragraph's line.
+    Vector<Float64> startOffsets_;
+    /// The offset of the end of the text before each break opportunity, excluding any trailing
+    /// whitespace.
+    Vector<Float64> endOffsets_;
+  };
+
   /// Usually returns an exact value or a lower bound that is quite close to the exact value.
   /// Paragraphs with varying line heights affect the accuracy negatively.
   /// Hyphenation opportunities are currently ignored, so the estimate can be farther off if the
@@ -71,7 +144,8 @@ public:
   /// @param accuracy The desired absolute accuracy of the returned estimate.
   ScaleFactorEstimate estimateScaleFactorNeededToFit(Float64 frameHeight, Int32 maxLineCount,
                                                      NSAttributedString* attributedString,
-                                                     Float64 minScale, Float64 accuracy) const;
+                                                     Float64 minScale, Float64 accuracy,
+                                                     LineBreakProfiles& lineBreakProfiles) const;
 
   bool needToJustifyLines() const { return needToJustifyLines_; }
 
@@ -267,6 +341,7 @@ private:
   void restoreLayoutFrom(SavedLayout&&);
 
   struct InitData {
+    const ShapedString& shapedString;
     const STUCancellationFlag& cancellationFlag;
     CTTypesetter* const typesetter;
     TempStringBuffer tempStringBuffer;
@@ -280,10 +355,12 @@ private:
     ArrayRef<const ColorRef> stringColorInfos;
     ArrayRef<const TextStyleBuffer::ColorHashBucket> stringColorHashBuckets;
     bool stringRangeIsFullString;
+    LocalFontInfoCache* __nullable sharedFontInfoCache;
 
     static InitData create(const ShapedString&, Range<Int32> stringRange,
                            STUDefaultTextAlignment defaultTextAlignment,
-                           Optional<const STUCancellationFlag&> cancellationFlag);
+                           Optional<const STUCancellationFlag&> cancellationFlag,
+                           LocalFontInfoCache* __nullable sharedFontInfoCache);
   };
   explicit TextFrameLayouter(InitData init);
 
@@ -294,6 +371,7 @@ private:
   }
 
   const TempStringBuffer tempStringBuffer_;
+  const ShapedString& shapedString_;
   const STUCancellationFlag& cancellationFlag_;
   CTTypesetter* const typesetter_;
   const NSAttributedStringRef attributedString_;
@@ -308,23 +386,24 @@ private:
   Size<Float64> inverselyScaledFrameSize_{};
   const bool stringRangeIsFullString_;
   STUTextLayoutMode layoutMode_{};
+  bool usesCompactLineStorage_{};
   bool needToJustifyLines_{};
   bool mayExceedMaxWidth_{};
   bool ownsCTLinesAndParagraphTruncationTokens_{true};
   UInt32 layoutCallCount_{};
+  const STUTextFrameLine* precedingLine_{};
   Int32 clippedStringRangeEnd_{};
   Float32 minimalSpacingBelowLastLine_{};
   Int clippedParagraphCount_{};
   const TextStyle* clippedOriginalStringTerminatorStyle_;
-  /// A cached CFLocale instance for hyphenation purposes.
-  RC<CFLocale> cachedLocale_;
-  CFString* cachedLocaleId_{};
+  HyphenationLocaleCache hyphenationLocaleCache_;
   Float64 lineMaxWidth_;
   Float64 lineHeadIndent_;
   Float64 hyphenationFactor_;
   STULastHyphenationLocationInRangeFinder __nullable __unsafe_unretained
     lastHyphenationLocationInRangeFinder_;
-  LocalFontInfoCache localFontInfoCache_;
+  LocalFontInfoCache ownLocalFontInfoCache_;
+  LocalFontInfoCache& localFontInfoCache_;
   TextStyleBuffer tokenStyleBuffer_;
   TempVector<FontMetrics> tokenFontMetrics_;
 };
@@ -63,13 +63,15 @@ static STUParagraphAlignment paragraphAlignment(NSTextAlignment alignment,
 TextFrameLayouter::TextFrameLayouter(const ShapedString& shapedString,
                                      Range<Int32> stringRange,
                                      STUDefaultTextAlignment defaultTextAlignment,
-                                     const STUCancellationFlag* cancellationFlag)
+                                     const STUCancellationFlag* cancellationFlag,
+                                     LocalFontInfoCache* sharedFontInfoCache)
 : TextFrameLayouter{InitData::create(shapedString, stringRange, defaultTextAlignment,
-                                     cancellationFlag)} {}
+                                     cancellationFlag, sharedFontInfoCache)} {}
 
 auto TextFrameLayouter::InitData::create(const ShapedString& shapedString, Range<Int32> stringRange,
                                          const STUDefaultTextAlignment defaultTextAlignment,
-                                         Optional<const STUCancellationFlag&> cancellationFlag)
+                                         Optional<const STUCancellationFlag&> cancellationFlag,
+                                         LocalFontInfoCache* sharedFontInfoCache)
   -> InitData
 {
   const ShapedString::ArraysRef sas = shapedString.arrays();
@@ -159,7 +161,8 @@ auto TextFrameLayouter::InitData::create(const ShapedString& shapedString, Range
   TempStringBuffer tempStringBuffer{paras.allocator()};
   NSAttributedStringRef attributedString{shapedString.attributedString, Ref{tempStringBuffer}};
 
-  return {.cancellationFlag = *(cancellationFlag ?: &CancellationFlag::neverCancelledFlag),
+  return {.shapedString = shapedString,
+          .cancellationFlag = *(cancellationFlag ?: &CancellationFlag::neverCancelledFlag),
           .typesetter = shapedString.typesetter.get(),
           .tempStringBuffer = std::move(tempStringBuffer),
           .attributedString = attributedString,
@@ -171,11 +174,13 @@ auto TextFrameLayouter::InitData::create(const ShapedString& shapedString, Range
           .stringFontMetrics = sas.fontMetrics,
           .stringColorInfos = sas.colors,
           .stringColorHashBuckets = sas.colorHashBuckets,
-          .stringRangeIsFullString = isFullString};
+          .stringRangeIsFullString = isFullString,
+          .sharedFontInfoCache = sharedFontInfoCache};
 }
 
 TextFrameLayouter::TextFrameLayouter(InitData init)
 : tempStringBuffer_{std::move(init.tempStringBuffer)},
+  shapedString_{init.shapedString},
   cancellationFlag_{init.cancellationFlag},
   typesetter_{init.typesetter},
   attributedString_{init.attributedString},
@@ -190,6 +195,8 @@ TextFrameLayouter::TextFrameLayouter(InitData init)
   clippedStringRangeEnd_{stringRange_.end},
   clippedParagraphCount_{paras_.count()},
   clippedOriginalStringTerminatorStyle_{init.stringStyles.terminatorStyle},
+  localFontInfoCache_{init.sharedFontInfoCache ? *init.sharedFontInfoCache
+                                               : ownLocalFontInfoCache_},
   tokenStyleBuffer_{Ref{localFontInfoCache_}, paras_.allocator(),
                     pair(init.stringColorInfos, init.stringColorHashBuckets)},
   tokenFontMetrics_{paras_.allocator()}
@@ -405,18 +412,21 @@ Float32 extraSpacingBeforeFirstAndAfterLastLineInParagraphDueToMinBaselineDistan
                               line, minBaselineDistance);
 }
 
+/// @param precedingLine The line preceding the first line, if any (see setPrecedingLine).
 static
 Float64 calculateBaselineOfLineFromPreviousLine(const STUTextFrameLine* __nonnull const line,
                                                 const ShapedString::Paragraph* __nonnull const para,
-                                                const TextFrameLayouter::ScaleInfo& scaleInfo)
+                                                const TextFrameLayouter::ScaleInfo& scaleInfo,
+                                                const STUTextFrameLine* __nullable precedingLine)
 {
   STU_DEBUG_ASSERT(line->_initStep == 4);
+  const STUTextFrameLine* const previousLine = line->lineIndex != 0 ? &line[-1] : precedingLine;
   if (line->isFirstLineInParagraph) {
     STUFirstLineOffsetType firstLineOffsetType;
     Float64 firstLineOffset;
     Float64 y;
     Float32 minBaselineDistance;
-    if (line->lineIndex == 0) {
+    if (!previousLine) {
       firstLineOffsetType = scaleInfo.firstParagraphFirstLineOffsetType;
       firstLineOffset = scaleInfo.firstParagraphFirstLineOffset*scaleInfo.inverseScale;
       // We ignore any paddingTop for the first paragraph.
@@ -425,7 +435,7 @@ Float64 calculateBaselineOfLineFromPreviousLine(const STUTextFrameLine* __nonnul
     } else {
       firstLineOffsetType = para->firstLineOffsetType;
       firstLineOffset = para->firstLineOffset;
-      const STUTextFrameLine& line1 = line[-1];
+      const STUTextFrameLine& line1 = *previousLine;
       const Int32 d = line1.paragraphIndex - line->paragraphIndex;
       STU_DEBUG_ASSERT(d < 0);
       // d can be less than -1 if the line follows a truncation scope spanning multiple paragraphs.
@@ -452,11 +462,12 @@ Float64 calculateBaselineOfLineFromPreviousLine(const STUTextFrameLine* __nonnul
         offset += extraSpacingBeforeFirstAndAfterLastLineInParagraphDueToMinBaselineDistance(
                     *line, para->minBaselineDistance);
       }
-      if (line->lineIndex == 0) {
+      if (!previousLine) {
         firstLineOffset += offset;
         break;
       }
-      return max(y, max(y + offset, line[-1].originY + minBaselineDistance) + firstLineOffset);
+      return max(y, max(y + offset, previousLine->originY + minBaselineDistance)
+                    + firstLineOffset);
     }
     case STUOffsetOfFirstBaselineFromTop:
       break;
@@ -473,8 +484,9 @@ Float64 calculateBaselineOfLineFromPreviousLine(const STUTextFrameLine* __nonnul
     y += max(0, firstLineOffset);
     return y;
   }
-  return line[-1].originY + max(line[-1]._heightBelowBaseline + line->_heightAboveBaseline,
-                                para->minBaselineDistance);
+  return previousLine->originY + max(previousLine->_heightBelowBaseline
+                                     + line->_heightAboveBaseline,
+                                     para->minBaselineDistance);
 }
 
 /// @pre scaleInfo == none if spara isn't the first paragraph.
@@ -628,6 +640,7 @@ void TextFrameLayouter::layout(const Size<Float64> inverselyScaledFrameSize,
   const Float64 frameHeightPlusEpsilon = frameHeight + 1/1024.;
   scaleInfo_ = scaleInfo;
   layoutMode_ = options.textLayoutMode;
+  usesCompactLineStorage_ = options.usesCompactLineStorage;
   if (STU_UNLIKELY(paras_.isEmpty())) return;
   if (!lines_.isEmpty()) {
     STU_ASSERT(ownsCTLinesAndParagraphTruncationTokens_);
@@ -659,8 +672,11 @@ void TextFrameLayouter::layout(const Size<Float64> inverselyScaledFrameSize,
   Int32 stringIndex = stringRange_.start;
   bool clipped = false;
   bool isLastLineInFrame = false;
-  Float64 minYOfSpacingBelowBaseline = minDistanceFromParagraphTopToSpacingBelowFirstBaseline(
-                                         layoutMode_, *spara, scaleInfo_);
+  Float64 minYOfSpacingBelowBaseline =
+    !precedingLine_
+    ? minDistanceFromParagraphTopToSpacingBelowFirstBaseline(layoutMode_, *spara, scaleInfo_)
+    : minYOfSpacingBelowFirstBaselineInNewParagraph(layoutMode_, *precedingLine_, spara[-1],
+                                                    *spara);
 NewTruncationScope:;
   const Int truncationScopeStartLineIndex = lines_.count();
   Optional<const TruncationScope&> truncationScope =
@@ -779,7 +795,8 @@ NewParagraph:;
     style = initializeTypographicMetricsOfLine(*line);
 
     line->init_step5(TextFrameLine::InitStep5Params{
-      .origin = {originX, calculateBaselineOfLineFromPreviousLine(line, spara, scaleInfo)}
+      .origin = {originX, calculateBaselineOfLineFromPreviousLine(line, spara, scaleInfo,
+                                                              precedingLine_)}
     });
     STU_DEBUG_ASSERT(minYOfSpacingBelowBaseline
                      <= line->originY + line->_heightBelowBaselineWithoutSpacing + 1/1024.0);
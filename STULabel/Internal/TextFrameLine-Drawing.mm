@@ -11,8 +11,10 @@
 
 namespace stu_label {
 
-static void drawRunGlyphsDirectly(GlyphSpan span, const TextStyle& style, DrawingContext& context) {
-  const GlyphsWithPositions gwp = span.getGlyphsWithPositions();
+static void drawRunGlyphsDirectly(const TextFrameLine& line, TextLinePart part, GlyphSpan span,
+                                  const TextStyle& style, DrawingContext& context)
+{
+  const GlyphsWithPositions gwp = line.glyphsWithPositions(part, span);
   if (gwp.count() == 0) return;
   const FontRef font = span.run().font();
   const ColorIndex colorIndex = context.textColorIndex(style);
@@ -33,8 +35,8 @@ static void drawRunGlyphsDirectly(GlyphSpan span, const TextStyle& style, Drawin
 }
 
 
-static void drawRunGlyphs(GlyphSpan glyphSpan, const TextStyle& style,
-                          CGFloat ctLineXOffset, DrawingContext& context)
+static void drawRunGlyphs(const TextFrameLine& line, TextLinePart part, GlyphSpan glyphSpan,
+                          const TextStyle& style, CGFloat ctLineXOffset, DrawingContext& context)
 {
   CGAffineTransform matrix = glyphSpan.run().textMatrix();
   matrix.tx = context.lineOrigin().x + ctLineXOffset;
@@ -49,7 +51,7 @@ static void drawRunGlyphs(GlyphSpan glyphSpan, const TextStyle& style,
     glyphSpan.draw(context.cgContext());
     context.currentCGContextColorsMayHaveChanged();
   } else {
-    drawRunGlyphsDirectly(glyphSpan, style, context);
+    drawRunGlyphsDirectly(line, part, glyphSpan, style, context);
   }
 }
 
@@ -71,7 +73,8 @@ static void drawGlyphs(const TextFrameLine& line, bool drawShadow, DrawingContex
       const auto oldColorIndices = context.currentColorIndices();
       if (STU_UNLIKELY(span.isPartialLigature)) {
         if (shadow) {
-          Rect<CGFloat> r = span.glyphSpan.imageBounds(context.glyphBoundsCache());
+          Rect<CGFloat> r = line.imageBounds(span.part, span.glyphSpan,
+                                             context.glyphBoundsCache());
           r.x += span.ctLineXOffset;
           r += context.lineOrigin();
           if (context.displayScale()) {
@@ -90,7 +93,7 @@ static void drawGlyphs(const TextFrameLine& line, bool drawShadow, DrawingContex
         CGContextSaveGState(context.cgContext());
         CGContextClipToRect(context.cgContext(), clipRect);
       }
-      drawRunGlyphs(span.glyphSpan, style, span.ctLineXOffset, context);
+      drawRunGlyphs(line, span.part, span.glyphSpan, style, span.ctLineXOffset, context);
       if (STU_UNLIKELY(span.isPartialLigature)) {
         CGContextRestoreGState(context.cgContext());
         if (shadow) {
@@ -137,7 +140,7 @@ static void drawGlyphs(const TextFrameLine& line, bool drawShadow, DrawingContex
       style = tokenStyle;
     }
     context.setShadow(drawShadow ? style->shadowInfo() : nil);
-    drawRunGlyphs(glyphSpan, *style, ctLineXOffset.value, context);
+    drawRunGlyphs(line, part, glyphSpan, *style, ctLineXOffset.value, context);
     return ShouldStop{context.isCancelled()};
   });
 }
@@ -14,7 +14,8 @@ ShouldStop TextFrameLine::forEachCTLineSegment(
              FunctionRef<ShouldStop(TextLinePart, CTLineXOffset, CTLine&, Optional<GlyphSpan>)> body)
   const
 {
-  CTLine* const ctLine = _ctLine;
+  RC<CTLine> recreatedCTLine;
+  CTLine* const ctLine = ctLineForIteration(Out{recreatedCTLine});
   NSArrayRef<CTRun*> runs;
   const bool shouldIterNonTokenRunsIndividually{(nonTokenTextFlags() | everyRunFlag) & mask.flags};
   if (ctLine) {
@@ -168,7 +169,8 @@ ShouldStop TextFrameLine::forEachStyledGlyphSpan(
                           para.rangeOfTruncationTokenInTruncatedString().start,
                        .line = this,
                        .paragraph = &para};
-  CTLine* const ctLine = _ctLine;
+  RC<CTLine> recreatedCTLine;
+  CTLine* const ctLine = ctLineForIteration(Out{recreatedCTLine});
   NSArrayRef<CTRun*> runs;
   const TextStyle* style;
   Float64 x;
@@ -177,11 +177,11 @@ Rect<CGFloat> calculateLineGlyphPathBoundsLLO(const TextFrameLine& line,
 {
   Rect<CGFloat> bounds = Rect<CGFloat>::infinitelyEmpty();
   line.forEachCTLineSegment(FlagsRequiringIndividualRunIteration{detail::everyRunFlag},
-    [&](TextLinePart part __unused, CTLineXOffset ctLineXOffset, CTLine& ctLine __unused,
+    [&](TextLinePart part, CTLineXOffset ctLineXOffset, CTLine& ctLine __unused,
         Optional<GlyphSpan> glyphSpan) -> ShouldStop
   {
     const GlyphSpan span = *glyphSpan;
-    Rect<CGFloat> r = span.imageBounds(glyphBoundsCache);
+    Rect<CGFloat> r = line.imageBounds(part, span, glyphBoundsCache);
     if (!r.isEmpty()) {
       r.x += ctLineXOffset.value;
       bounds = bounds.convexHull(r);
@@ -454,6 +454,7 @@ static Rect<Float64> calculateLineImageBoundsUsingExistingGlyphBounds(
 }
 
 Rect<CGFloat> TextFrameLine::calculateImageBoundsLLO(const ImageBoundsContext& context) const {
+  const RecreatedCTLineScope ctLineScope{*this};
   const Range<TextFrameCompactIndex> lineRange = this->range();
   const Optional<TextStyleOverride&> styleOverride = context.styleOverride;
   const bool fullLine = !styleOverride || styleOverride->drawnRange.contains(lineRange);
@@ -0,0 +1,67 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#pragma once
+
+#import "GlyphSpan.hpp"
+
+#import "stu/FunctionRef.hpp"
+
+namespace stu_label {
+
+/// @brief A global cache for the CTLines of the short attributed strings that are shaped over and
+///        over again during layout, i.e. truncation tokens and inserted hyphens.
+///
+/// An entry is identified by an immutable attributed string, which is compared with
+/// @c -[NSAttributedString isEqualToAttributedString:], and an optional font and integer value that
+/// capture the parameters of the line creation that aren't represented by the attributed string.
+/// Since the token attributes are derived from the attributes at the truncation point, the same
+/// token line can usually be reused for all truncated lines with the same style.
+///
+/// The cached lines are immutable and shared between threads and text frames.
+///
+/// The cache is cleared when it grows too large, when the app enters the background and when the
+/// app receives a memory warning.
+class TokenLineCache {
+public:
+  struct Key {
+    NSAttributedString* __unsafe_unretained __nonnull attributedString;
+    /// Compared with CFEqual.
+    CTFont* __nullable font;
+    UInt32 value;
+  };
+
+  struct Line {
+    /// Owned by the caller.
+    CTLine* __nonnull line;
+    /// typographicWidth(line)
+    Float64 width;
+  };
+
+  /// Returns the line created by @c CTLineCreateWithAttributedString for the attributed string,
+  /// taking it from the global cache if possible.
+  ///
+  /// @pre The attributed string must be immutable.
+  ///
+  /// Thread-safe.
+  static Line createLine(NSAttributedString* __nonnull attributedString);
+
+  /// Returns the line for the key, taking it from the global cache if possible. On a cache miss the
+  /// line is created with the specified function (without holding a lock), which must return a
+  /// line owned by the caller.
+  ///
+  /// @pre The key's attributed string must be immutable.
+  ///
+  /// Thread-safe.
+  static Line createLine(const Key& key,
+                         FunctionRef<CTLine* __nonnull(const Key& key)> create);
+
+  /// Thread-safe.
+  static void clearGlobalCache();
+
+#if STU_DEBUG
+  /// For testing purposes.
+  static Int globalCacheHitCount();
+#endif
+};
+
+} // namespace stu_label
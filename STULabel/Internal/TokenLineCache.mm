@@ -0,0 +1,178 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "TokenLineCache.hpp"
+
+#import "STULabel/stu_mutex.h"
+
+#import "Hash.hpp"
+#import "HashTable.hpp"
+
+#import "stu/Vector.hpp"
+
+namespace stu_label {
+
+struct TokenLineCacheEntry {
+  /// Retained.
+  CFAttributedString* attributedString;
+  /// Retained.
+  CTFont* font;
+  UInt32 value;
+  HashCode<UInt> hashCode;
+  /// Retained.
+  CTLine* line;
+  Float64 width;
+};
+
+struct GlobalTokenLineCache {
+  static constexpr Int maxEntryCount = 256;
+
+  Vector<TokenLineCacheEntry> entries;
+  HashSet<UInt16, Malloc> indices{uninitialized};
+#if STU_DEBUG
+  Int hitCount{};
+#endif
+
+  STU_NO_INLINE
+  void clear() {
+    for (auto& entry : entries.reversed()) {
+      CFRelease(entry.line);
+      if (entry.font) {
+        CFRelease(entry.font);
+      }
+      CFRelease(entry.attributedString);
+    }
+    entries.removeAll();
+    indices.removeAll();
+  }
+};
+
+stu_mutex tokenLineCacheMutex = STU_MUTEX_INIT;
+bool tokenLineCacheIsInitialized = false;
+alignas(GlobalTokenLineCache)
+Byte tokenLineCacheStorage[sizeof(GlobalTokenLineCache)];
+
+/// @pre tokenLineCacheMutex must be locked by the current thread.
+static GlobalTokenLineCache& tokenLineCache() {
+  if (STU_UNLIKELY(!tokenLineCacheIsInitialized)) {
+    tokenLineCacheIsInitialized = true;
+    GlobalTokenLineCache& cache = *new (tokenLineCacheStorage) GlobalTokenLineCache{};
+    cache.indices.initializeWithBucketCount(64);
+    cache.entries.ensureFreeCapacity(16);
+
+    NSNotificationCenter* const notificationCenter = NSNotificationCenter.defaultCenter;
+    NSOperationQueue* const mainQueue = NSOperationQueue.mainQueue;
+    const auto clearCacheBlock = ^(NSNotification*) {
+      TokenLineCache::clearGlobalCache();
+    };
+    [notificationCenter addObserverForName:UIApplicationDidEnterBackgroundNotification
+                                    object:nil queue:mainQueue usingBlock:clearCacheBlock];
+    [notificationCenter addObserverForName:UIApplicationDidReceiveMemoryWarningNotification
+                                    object:nil queue:mainQueue usingBlock:clearCacheBlock];
+  }
+  return reinterpret_cast<GlobalTokenLineCache&>(tokenLineCacheStorage);
+}
+
+void TokenLineCache::clearGlobalCache() {
+  stu_mutex_lock(&tokenLineCacheMutex);
+  if (tokenLineCacheIsInitialized) {
+    reinterpret_cast<GlobalTokenLineCache&>(tokenLineCacheStorage).clear();
+  }
+  stu_mutex_unlock(&tokenLineCacheMutex);
+}
+
+#if STU_DEBUG
+Int TokenLineCache::globalCacheHitCount() {
+  stu_mutex_lock(&tokenLineCacheMutex);
+  const Int count = tokenLineCache().hitCount;
+  stu_mutex_unlock(&tokenLineCacheMutex);
+  return count;
+}
+#endif
+
+static HashCode<UInt> hashKey(const TokenLineCache::Key& key) {
+  NSAttributedString* const string = key.attributedString;
+  // -[NSAttributedString hash] only hashes the string, so we additionally hash the font
+  // attribute, which usually distinguishes tokens with the same text but a different style.
+  const UInt64 fontHash = string.length == 0 ? 0
+                        : [[string attribute:NSFontAttributeName atIndex:0 effectiveRange:nil]
+                             hash];
+  return narrow_cast<HashCode<UInt>>(hash(UInt64{string.hash}, fontHash,
+                                          UInt64{key.font ? CFHash(key.font) : 0},
+                                          UInt64{key.value}));
+}
+
+TokenLineCache::Line TokenLineCache::createLine(NSAttributedString* __nonnull attributedString) {
+  return createLine(Key{attributedString, nullptr, 0}, [](const Key& key) -> CTLine* {
+                      return CTLineCreateWithAttributedString(
+                               (__bridge CFAttributedStringRef)key.attributedString);
+                    });
+}
+
+TokenLineCache::Line TokenLineCache::createLine(const Key& key,
+                                                FunctionRef<CTLine*(const Key& key)> create)
+{
+  const HashCode<UInt> hashCode = hashKey(key);
+  const auto isEqualKey = [&](const GlobalTokenLineCache& cache, const UInt16 index) -> bool {
+    const TokenLineCacheEntry& entry = cache.entries[index];
+    if (hashCode != entry.hashCode || key.value != entry.value) return false;
+    if (key.font != entry.font && !(key.font && entry.font && CFEqual(key.font, entry.font))) {
+      return false;
+    }
+    NSAttributedString* const string = (__bridge NSAttributedString*)entry.attributedString;
+    return key.attributedString == string
+        || [key.attributedString isEqualToAttributedString:string];
+  };
+  {
+    stu_mutex_lock(&tokenLineCacheMutex);
+    GlobalTokenLineCache& cache = tokenLineCache();
+    if (const auto optIndex = cache.indices.find(hashCode, [&](const UInt16 index) {
+                                                   return isEqualKey(cache, index);
+                                                 }))
+    {
+      const TokenLineCacheEntry& entry = cache.entries[*optIndex];
+      const Line result = {.line = entry.line, .width = entry.width};
+      CFRetain(result.line);
+    #if STU_DEBUG
+      cache.hitCount += 1;
+    #endif
+      stu_mutex_unlock(&tokenLineCacheMutex);
+      return result;
+    }
+    stu_mutex_unlock(&tokenLineCacheMutex);
+  }
+
+  CTLine* const line = create(key);
+  STU_ASSERT(line);
+  const Line result = {.line = line, .width = typographicWidth(line)};
+
+  CFAttributedString* const attributedString =
+    (__bridge_retained CFAttributedString*)[key.attributedString copy];
+  if (key.font) {
+    CFRetain(key.font);
+  }
+  CFRetain(result.line);
+  stu_mutex_lock(&tokenLineCacheMutex);
+  GlobalTokenLineCache& cache = tokenLineCache();
+  if (STU_UNLIKELY(cache.entries.count() == GlobalTokenLineCache::maxEntryCount)) {
+    cache.clear();
+  }
+  const UInt16 index = narrow_cast<UInt16>(cache.entries.count());
+  const bool inserted = cache.indices.insert(hashCode, index, [&](const UInt16 index) {
+                                               return isEqualKey(cache, index);
+                                             }).inserted;
+  if (inserted) {
+    cache.entries.append(TokenLineCacheEntry{attributedString, key.font, key.value, hashCode,
+                                             result.line, result.width});
+  }
+  stu_mutex_unlock(&tokenLineCacheMutex);
+  if (!inserted) {
+    CFRelease(result.line);
+    if (key.font) {
+      CFRelease(key.font);
+    }
+    CFRelease(attributedString);
+  }
+  return result;
+}
+
+} // namespace stu_label
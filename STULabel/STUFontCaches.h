@@ -0,0 +1,55 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "STUDefines.h"
+
+#import <Foundation/Foundation.h>
+
+STU_EXTERN_C_BEGIN
+
+// STULabel keeps two global caches shared by all threads: a cache for the metrics of the fonts
+// used in laid out text and a cache for the glyph bounds of the used font faces. The memory
+// footprint of each cache is limited by a byte budget. When a cache exceeds its budget, the least
+// recently used fonts (or font faces) are evicted until the footprint has dropped to 3/4 of the
+// budget. A font face whose glyph bounds cache is in use by a running layout or rendering task is
+// never evicted.
+//
+// When the app receives a memory warning or enters the background, the caches are trimmed to a
+// low watermark of 1/4 of their budget (instead of being emptied).
+//
+// The default budgets are 256 KiB for the font metrics cache and 4 MiB for the glyph bounds cache.
+// They can also be changed at compile time with the preprocessor macros
+// STU_FONT_INFO_CACHE_BYTE_BUDGET and STU_GLYPH_BOUNDS_CACHE_BYTE_BUDGET.
+
+typedef struct STUFontCacheStatistics {
+  /// The number of fonts in the font metrics cache.
+  size_t fontInfoCount;
+  /// The memory footprint of the font metrics cache in bytes (not including the font objects).
+  size_t fontInfoByteSize;
+  /// The number of fonts evicted from the font metrics cache so far.
+  size_t fontInfoEvictionCount;
+  /// The number of font faces in the glyph bounds cache.
+  size_t glyphBoundsFontFaceCount;
+  /// The memory footprint of the glyph bounds cache in bytes.
+  size_t glyphBoundsByteSize;
+  /// The number of font faces evicted from the glyph bounds cache so far.
+  size_t glyphBoundsEvictionCount;
+  /// The number of font metrics lookups that were answered by the small per-layout (or
+  /// per-drawing) cache in front of the font metrics cache. The counts of a local cache are only
+  /// added to the totals when the layout or drawing operation is finished.
+  uint64_t localFontInfoCacheHitCount;
+  /// The number of font metrics lookups that missed the per-layout (or per-drawing) cache and
+  /// had to access the global font metrics cache.
+  uint64_t localFontInfoCacheMissCount;
+} STUFontCacheStatistics;
+
+/// Sets the byte budgets of the global font metrics and glyph bounds caches. If a cache currently
+/// exceeds its new budget, the least recently used entries are immediately evicted.
+/// Thread-safe.
+void stu_setFontCacheByteBudgets(size_t fontInfoCacheBudget, size_t glyphBoundsCacheBudget);
+
+/// Returns the current footprints and the eviction counts of the global font caches and the
+/// lookup counts of the local font metrics caches. The statistics are also available in release
+/// builds. Thread-safe.
+STUFontCacheStatistics stu_fontCacheStatistics(void);
+
+STU_EXTERN_C_END
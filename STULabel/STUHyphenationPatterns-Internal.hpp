@@ -0,0 +1,14 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "STUHyphenationPatterns.h"
+
+#import "Internal/Hyphenation.hpp"
+
+namespace stu_label {
+
+const HyphenationPatterns& hyphenationPatterns(STUHyphenationPatterns* __nonnull);
+
+/// Returns the patterns registered for the locale identifier, or nil.
+STUHyphenationPatterns* __nullable registeredHyphenationPatterns(CFString* __nonnull localeId);
+
+} // namespace stu_label
@@ -0,0 +1,88 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "STUDefines.h"
+
+#import <Foundation/Foundation.h>
+
+STU_ASSUME_NONNULL_AND_STRONG_BEGIN
+
+/// An immutable set of TeX hyphenation patterns for Frank Liang's hyphenation algorithm, compiled
+/// into a compact trie encoding.
+///
+/// By default STULabel determines the hyphenation locations for text with a
+/// @c STUHyphenationLocaleIdentifierAttributeName attribute with
+/// @c CFStringGetHyphenationLocationBeforeIndex. If patterns are registered for the locale
+/// identifier with @c registerPatterns:forLocaleIdentifier:, the patterns are used instead, which
+/// is usually considerably faster and also works for locales that Core Foundation has no
+/// hyphenation dictionary for.
+///
+/// The compiled data returned by @c compiledData can be stored in a file (e.g. at build time) and
+/// later be loaded with @c initWithContentsOfCompiledFile:, which memory-maps the file if possible.
+///
+/// This class is thread-safe.
+STU_EXPORT
+@interface STUHyphenationPatterns : NSObject
+
+/// Compiles the patterns and hyphenation exceptions.
+///
+/// @param patterns
+///  The whitespace-separated patterns in the format of the TeX @c \\patterns command, e.g.
+///  @c "1ba .ach4 4b1b". A @c % character starts a comment that extends to the end of the line.
+/// @param exceptions
+///  The whitespace-separated words in the format of the TeX @c \\hyphenation command, with hyphens
+///  marking the only permitted hyphenation locations, e.g. @c "ta-ble project". An exception is
+///  encoded as a pattern with the value 9 at the hyphenation locations and 8 at all other
+///  locations, so it takes precedence over all regular patterns with values less than 8.
+/// @param leftHyphenMin The minimum number of UTF-16 code units before a hyphenation location.
+/// @param rightHyphenMin The minimum number of UTF-16 code units after a hyphenation location.
+///
+/// Patterns and exceptions are lowercased with the root locale before they are compiled. The
+/// characters are matched as UTF-16 code units.
+///
+/// @returns Null if a pattern or exception is malformed.
+- (nullable instancetype)initWithPatterns:(NSString *)patterns
+                               exceptions:(nullable NSString *)exceptions
+                            leftHyphenMin:(NSInteger)leftHyphenMin
+                           rightHyphenMin:(NSInteger)rightHyphenMin;
+
+/// Initializes the instance with data returned by the @c compiledData property.
+///
+/// The data is validated, but not copied (unless it is not 4-byte aligned).
+///
+/// @returns Null if the data is not valid compiled pattern data.
+- (nullable instancetype)initWithCompiledData:(NSData *)data;
+
+/// Loads the compiled data from the file, memory-mapping it if possible.
+///
+/// @returns Null if the file can't be read or doesn't contain valid compiled pattern data.
+- (nullable instancetype)initWithContentsOfCompiledFile:(NSURL *)fileURL;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/// The compiled binary representation of the patterns.
+@property (readonly) NSData *compiledData;
+
+@property (readonly) NSInteger leftHyphenMin;
+@property (readonly) NSInteger rightHyphenMin;
+
+/// Returns the UTF-16 indices in the specified word where the patterns permit a hyphen.
+///
+/// The word is lowercased with the root locale before the patterns are applied.
+- (NSIndexSet *)hyphenationLocationsInWord:(NSString *)word;
+
+/// Registers the patterns for the specified locale identifier, or unregisters any patterns for the
+/// locale identifier if @c patterns is null.
+///
+/// Locale identifiers are compared after canonicalization, i.e. "en_US" and "en-US" are treated
+/// as equal. The registration only affects hyphenation locations that haven't yet been
+/// computed, i.e. an existing @c STUShapedString instance may continue to use the previously
+/// registered patterns.
++ (void)registerPatterns:(nullable STUHyphenationPatterns *)patterns
+     forLocaleIdentifier:(NSString *)localeIdentifier;
+
++ (nullable STUHyphenationPatterns *)registeredPatternsForLocaleIdentifier:
+                                       (NSString *)localeIdentifier;
+
+@end
+
+STU_ASSUME_NONNULL_AND_STRONG_END
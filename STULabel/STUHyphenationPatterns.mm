@@ -0,0 +1,132 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "STUHyphenationPatterns-Internal.hpp"
+
+#import "stu_mutex.h"
+
+#include "Internal/DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+using namespace stu;
+using namespace stu_label;
+
+@implementation STUHyphenationPatterns {
+  NSData* _compiledData;
+@package
+  HyphenationPatterns _patterns;
+}
+
+- (instancetype)init {
+  [self doesNotRecognizeSelector:_cmd];
+  __builtin_trap();
+}
+
+- (nullable instancetype)initWithPatterns:(NSString*)patterns
+                               exceptions:(nullable NSString*)exceptions
+                            leftHyphenMin:(NSInteger)leftHyphenMin
+                           rightHyphenMin:(NSInteger)rightHyphenMin
+{
+  STU_CHECK(patterns != nil);
+  NSData* const data = HyphenationPatterns::compile(patterns, exceptions,
+                                                    leftHyphenMin, rightHyphenMin);
+  if (!data) return nil;
+  return [self initWithCompiledData:data];
+}
+
+- (nullable instancetype)initWithCompiledData:(NSData*)data {
+  STU_CHECK(data != nil);
+  data = [data copy];
+  if (reinterpret_cast<UInt>(data.bytes)%alignof(UInt32) != 0) {
+    data = [[NSData alloc] initWithBytes:data.bytes length:data.length];
+  }
+  const Optional<HyphenationPatterns> patterns = HyphenationPatterns::create(
+                                                   {static_cast<const Byte*>(data.bytes),
+                                                    sign_cast(data.length)});
+  if (!patterns) return nil;
+  _compiledData = data;
+  _patterns = *patterns;
+  return self;
+}
+
+- (nullable instancetype)initWithContentsOfCompiledFile:(NSURL*)fileURL {
+  NSData* const data = [NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedIfSafe
+                                               error:nil];
+  if (!data) return nil;
+  return [self initWithCompiledData:data];
+}
+
+- (NSData*)compiledData {
+  return _compiledData;
+}
+
+- (NSInteger)leftHyphenMin {
+  return _patterns.leftHyphenMin();
+}
+
+- (NSInteger)rightHyphenMin {
+  return _patterns.rightHyphenMin();
+}
+
+- (NSIndexSet*)hyphenationLocationsInWord:(NSString*)word {
+  STU_CHECK(word != nil);
+  const NSStringRef string{word};
+  TempArray<Char16> chars{uninitialized, Count{string.count()}};
+  string.copyUTF16Chars({0, string.count()}, chars);
+  TempVector<Int32> offsets;
+  _patterns.findHyphenationLocations(chars, nullptr, offsets);
+  NSMutableIndexSet* const indexSet = [[NSMutableIndexSet alloc] init];
+  for (const Int32 offset : offsets) {
+    [indexSet addIndex:sign_cast(offset)];
+  }
+  return indexSet;
+}
+
+static stu_mutex registryMutex = STU_MUTEX_INIT;
+static NSMutableDictionary<NSString*, STUHyphenationPatterns*>* registry;
+/// Allows registeredHyphenationPatterns to skip the locking and the canonicalization when no
+/// patterns are registered, which is the common case.
+static std::atomic<bool> registryIsEmpty{true};
+
+static NSString* canonicalLocaleIdentifier(CFString* localeId) {
+  return (__bridge_transfer NSString*)CFLocaleCreateCanonicalLocaleIdentifierFromString(nil,
+                                                                                        localeId);
+}
+
++ (void)registerPatterns:(nullable STUHyphenationPatterns*)patterns
+     forLocaleIdentifier:(NSString*)localeIdentifier
+{
+  STU_CHECK(localeIdentifier != nil);
+  NSString* const key = canonicalLocaleIdentifier((__bridge CFStringRef)localeIdentifier);
+  stu_mutex_lock(&registryMutex);
+  if (!registry) {
+    registry = [[NSMutableDictionary alloc] init];
+  }
+  registry[key] = patterns;
+  registryIsEmpty.store(registry.count == 0, std::memory_order_release);
+  stu_mutex_unlock(&registryMutex);
+}
+
++ (nullable STUHyphenationPatterns*)registeredPatternsForLocaleIdentifier:
+                                      (NSString*)localeIdentifier
+{
+  STU_CHECK(localeIdentifier != nil);
+  return registeredHyphenationPatterns((__bridge CFStringRef)localeIdentifier);
+}
+
+@end
+
+namespace stu_label {
+
+const HyphenationPatterns& hyphenationPatterns(STUHyphenationPatterns* patterns) {
+  return patterns->_patterns;
+}
+
+STUHyphenationPatterns* registeredHyphenationPatterns(CFString* localeId) {
+  if (registryIsEmpty.load(std::memory_order_acquire)) return nil;
+  NSString* const key = canonicalLocaleIdentifier(localeId);
+  stu_mutex_lock(&registryMutex);
+  STUHyphenationPatterns* const patterns = registry[key];
+  stu_mutex_unlock(&registryMutex);
+  return patterns;
+}
+
+} // namespace stu_label
@@ -14,6 +14,12 @@
 
 @property (readonly, nullable) CALayer* stu_contentSublayer;
 
+#if STU_DEBUG
+/// The number of times the layer's image was updated after a highlight change by redrawing only
+/// the lines whose highlighting changed. For testing. Only available in debug builds.
+@property (readonly) NSUInteger stu_imageHighlightUpdateCount;
+#endif
+
 @end
 
 namespace stu_label {
@@ -111,6 +111,7 @@ class LabelLayer : public LabelPropertiesCRTPBase<LabelLayer> {
   bool contentsIsNotNil_ : 1;
   bool isRegisteredAsLayerThatMayHaveImage_ : 1;
   bool imageMayHaveBeenPurged_ : 1;
+  bool imageCanBeUpdatedForHighlightChange_ : 1;
 
   LabelLayer* previousLayerThatHasImage_;
   LabelLayer* nextLayerThatHasImage_;
@@ -160,6 +161,17 @@ class LabelLayer : public LabelPropertiesCRTPBase<LabelLayer> {
   STUTextLinkArrayWithTextFrameOrigin* links_;
 
   PurgeableImage image_;
+  /// The text frame, drawing options and render info that image_ was drawn with, if image_ was
+  /// drawn synchronously and may be updated after a highlight change by redrawing only the lines
+  /// whose highlighting changed.
+  STUTextFrame* imageTextFrame_;
+  STUTextFrameDrawingOptions* imageDrawingOptions_;
+  LabelTextFrameRenderInfo imageRenderInfo_;
+#if STU_DEBUG
+  /// The number of times image_ was updated after a highlight change instead of being redrawn.
+  /// Only used by tests.
+  UInt imageHighlightUpdateCount_{0};
+#endif
 
   friend const CGSize& ::STULabelLayerGetSize(const STULabelLayer*);
 
@@ -878,14 +890,14 @@ public:
       if (hasContent_ && displaysAsynchronously_) {
         prefersSynchronousDrawingForNextDisplay_ = true;
       }
-      invalidateImage();
+      invalidateImageHighlighting();
     }
   }
 
   void setHighlightStyle(STUTextHighlightStyle* __unsafe_unretained highlightStyle) {
     if (params_.setHighlightStyle(highlightStyle)) {
       if (!isInvalidated_ && params_.isHighlighted()) {
-        invalidateImage();
+        invalidateImageHighlighting();
       }
     }
   }
@@ -893,7 +905,7 @@ public:
   void setHighlightRange(NSRange range, STUTextRangeType rangeType) {
     if (params_.setHighlightRange(range, rangeType)) {
       if (!isInvalidated_ && params_.isHighlighted()) {
-        invalidateImage();
+        invalidateImageHighlighting();
       }
     }
   }
@@ -933,6 +945,7 @@ public:
     params_.releasesTextFrameAfterRenderingWasExplicitlySet = true;
     if (releasesTextFrameAfterRendering && textFrame_ && !isInvalidated_ && hasContent_) {
       textFrame_ = nil;
+      clearImageUpdateInfo();
     }
   }
 
@@ -1250,11 +1263,31 @@ private:
     } else if (renderInfo.mode != LabelRenderMode::tiledSublayer) {
       bool needToReleaseImage = false;
       if (!image && textFrame_) {
-        image_ = createLabelTextFrameImage(textFrame_, renderInfo, params_, nullptr);
+        PurgeableImage updatedImage;
+        if (imageCanBeUpdatedForHighlightChange(renderInfo)) {
+          updatedImage = updateLabelTextFrameImageHighlighting(image_, textFrame_, renderInfo,
+                                                               params_, imageDrawingOptions_);
+        }
+        if (updatedImage) {
+          image_ = std::move(updatedImage);
+        #if STU_DEBUG
+          ++imageHighlightUpdateCount_;
+        #endif
+        } else {
+          image_ = createLabelTextFrameImage(textFrame_, renderInfo, params_, nullptr);
+        }
         imageMayHaveBeenPurged_ = false;
         image = image_.createCGImage().toRawPointer();
         needToReleaseImage = true;
         registerAsLabelLayerThatHasImage();
+        if (!params_.drawingBlock && !params_.releasesTextFrameAfterRendering) {
+          imageCanBeUpdatedForHighlightChange_ = true;
+          imageTextFrame_ = textFrame_;
+          imageDrawingOptions_ = params_.frozenDrawingOptions().unretained;
+          imageRenderInfo_ = renderInfo;
+        } else {
+          clearImageUpdateInfo();
+        }
       }
       STU_DEBUG_ASSERT(image != nullptr);
       if (renderInfo.mode == LabelRenderMode::image) {
@@ -1274,6 +1307,26 @@ private:
     }
   }
 
+  bool imageCanBeUpdatedForHighlightChange(const LabelTextFrameRenderInfo& renderInfo) const {
+    return imageCanBeUpdatedForHighlightChange_
+        && imageTextFrame_ == textFrame_
+        && image_
+        && !params_.drawingBlock
+        && CGRectEqualToRect(renderInfo.bounds, imageRenderInfo_.bounds)
+        && renderInfo.mode == imageRenderInfo_.mode
+        && renderInfo.imageFormat == imageRenderInfo_.imageFormat
+        && renderInfo.shouldDrawBackgroundColor == imageRenderInfo_.shouldDrawBackgroundColor
+        && renderInfo.isOpaque == imageRenderInfo_.isOpaque
+        && image_.sizeInPixels() == SizeInPixels<UInt32>{renderInfo.bounds.size,
+                                                         params_.displayScale()};
+  }
+
+  void clearImageUpdateInfo() {
+    imageCanBeUpdatedForHighlightChange_ = false;
+    imageTextFrame_ = nil;
+    imageDrawingOptions_ = nil;
+  }
+
   void setHasBackgroundColor(bool hasBackgroundColor) {
     if (layerHasBackgroundColor_ == hasBackgroundColor) return;
     layerHasBackgroundColor_ = hasBackgroundColor;
@@ -1341,12 +1394,14 @@ private:
       }
       image_ = PurgeableImage();
       imageMayHaveBeenPurged_ = false;
+      clearImageUpdateInfo();
       deregisterAsLabelLayerThatHasImage();
       break;
     case LabelRenderMode::imageInSublayer:
       contentLayer_.contents = nil;
       image_ = PurgeableImage();
       imageMayHaveBeenPurged_ = false;
+      clearImageUpdateInfo();
       deregisterAsLabelLayerThatHasImage();
       break;
     case LabelRenderMode::tiledSublayer:
@@ -1465,6 +1520,10 @@ public:
     return renderMode_ >= LabelRenderMode::imageInSublayer ? contentLayer_ : nil;
   }
 
+#if STU_DEBUG
+  UInt imageHighlightUpdateCount() const { return imageHighlightUpdateCount_; }
+#endif
+
 private:
   /// MARK: - Render task
 
@@ -1493,6 +1552,14 @@ private:
   /// function.
   STU_INLINE
   void invalidateImage() {
+    imageCanBeUpdatedForHighlightChange_ = false;
+    if (isInvalidated_) return;
+    invalidateImage_slowPath();
+  }
+  /// Like invalidateImage(), except that the next synchronous display may update the current image
+  /// by only redrawing the lines whose highlighting changed.
+  STU_INLINE
+  void invalidateImageHighlighting() {
     if (isInvalidated_) return;
     invalidateImage_slowPath();
   }
@@ -1530,6 +1597,7 @@ private:
     if (!preserveTextFrames) {
       links_ = nil;
       textFrame_ = nil;
+      clearImageUpdateInfo();
       textFrameInfo_.isValid = false;
       textFrameInfoIsValidForCurrentSize_ = false;
       measuringTextFrame_ = nil;
@@ -1824,6 +1892,7 @@ void LabelRenderTask::assignResultTo(LabelLayer& label) {
   if (image_) {
     cgImage = image_.createCGImage();
     label.imageMayHaveBeenPurged_ = false;
+    label.clearImageUpdateInfo();
     if (type() != Type::prerender) {
       label.image_ = std::move(image_);
     } else {
@@ -1945,6 +2014,12 @@ Unretained<STUTextFrameOptions* __nonnull> stu_label::defaultLabelTextFrameOptio
   return impl.contentSublayer();
 }
 
+#if STU_DEBUG
+- (NSUInteger)stu_imageHighlightUpdateCount {
+  return impl.imageHighlightUpdateCount();
+}
+#endif
+
 /// MARK: - Overridden methods
 
 - (instancetype)init {
@@ -0,0 +1,102 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "STUDefines.h"
+
+#import <Foundation/Foundation.h>
+
+STU_EXTERN_C_BEGIN
+
+// Phase tracing is only compiled into the library if the library is built with the preprocessor
+// macro STU_PHASE_TRACING defined as 1. Otherwise the functions declared in this header have no
+// effect and stu_phaseTracingIsAvailable() returns false.
+
+typedef NS_ENUM(uint8_t, STUTracePhase) {
+  /// The creation of a @c STUShapedString.
+  /// @c count is the paragraph count and @c byteSize the size of the shaped string data.
+  STUTracePhaseTextShaping = 0,
+  /// The calculation of the (possibly scaled) layout of a text frame.
+  /// @c count is the number of layout iterations, which can be greater than 1 if the text was
+  /// scaled down to fit the frame size.
+  STUTracePhaseLayout = 1,
+  /// The truncation of a single line. @c count is the UTF-16 length of the line's string range
+  /// before the truncation.
+  STUTracePhaseTruncation = 2,
+  /// The justification of the lines in a text frame. @c count is the line count.
+  STUTracePhaseJustification = 3,
+  /// The calculation of the image bounds of a text frame for label rendering.
+  /// @c count is the line count.
+  STUTracePhaseImageBounds = 4,
+  /// The drawing of the text frame bitmap of a label. @c byteSize is the size of the bitmap.
+  STUTracePhaseDrawing = 5,
+  /// The creation of a @c STUTextFrame from a finished layout. @c count is the line count and
+  /// @c byteSize the size of the text frame data.
+  STUTracePhaseTextFrameCreation = 6,
+  /// The recreation of the Core Text line object of a text frame line that was created with the
+  /// @c STUTextFrameOptions.usesCompactLineStorage option. @c count is the UTF-16 length of the
+  /// line's string range.
+  STUTracePhaseLineRecreation = 7,
+  /// A call of @c -[STUTextFrame rectsForRange:frameOrigin:displayScale:].
+  /// @c count is 1 if the result was taken from the text frame's cache of recently returned
+  /// rect arrays and 0 otherwise, so that the average count is the cache hit rate.
+  STUTracePhaseTextRects = 8,
+  /// A call of @c -[STUTextRectArray createPathWithEdgeInsets:...].
+  /// @c count is 1 if the path was taken from the rect array's path cache and 0 otherwise.
+  STUTracePhaseTextRectsPath = 9,
+  /// The recording of the drawing commands of a text frame line for the frame's display list,
+  /// which happens when the line is drawn for the second time. @c byteSize is the size of the
+  /// recorded commands.
+  STUTracePhaseDisplayListRecording = 10,
+  /// The memory-mapping and validation of the persistent font cache file, which happens at most
+  /// once per launch and after every update of the file. @c count is the number of cached fonts
+  /// and @c byteSize the size of the file.
+  STUTracePhasePersistentFontCacheLoading = 11
+};
+
+typedef struct STUTraceEvent {
+  /// The start time in nanoseconds, measured with the @c mach_absolute_time clock.
+  uint64_t startTime;
+  /// The duration in nanoseconds.
+  uint64_t duration;
+  /// An ID that identifies the label render task the phase ran in, or 0 if the phase didn't run
+  /// as part of a label render task.
+  uint64_t renderTaskID;
+  int64_t count;
+  int64_t byteSize;
+  /// The mach thread ID of the thread that ran the phase.
+  uint32_t threadID;
+  STUTracePhase phase;
+} STUTraceEvent;
+
+typedef void (^ STUTraceEventHandler)(const STUTraceEvent * __nonnull event);
+
+bool stu_phaseTracingIsAvailable(void);
+
+/// Sets a handler that is called for every trace event. The handler is called synchronously on the
+/// thread that ran the phase, which may be any thread, and should return quickly.
+/// Thread-safe.
+void stu_setTraceEventHandler(STUTraceEventHandler __nullable handler);
+
+/// Sets the capacity of the global ring buffer that records the most recent trace events.
+/// A capacity of 0, which is the default, disables the ring buffer. Any events in the buffer are
+/// discarded.
+/// Thread-safe.
+void stu_setTraceRingBufferCapacity(size_t capacity);
+
+/// Moves up to @c capacity events from the ring buffer into the @c events array, oldest first.
+/// Returns the number of events copied.
+/// Thread-safe.
+size_t stu_takeTraceEvents(STUTraceEvent * __nonnull events, size_t capacity);
+
+/// Enables or disables the emission of os_signpost intervals for every traced phase, with the
+/// subsystem "STULabel", the category "Phases" and the signpost name "Phase". The begin message
+/// contains the phase name and the end message the phase's count, byte size and render task ID.
+/// Has no effect before iOS 12.
+/// Thread-safe.
+void stu_setTraceSignpostsEnabled(bool enabled);
+
+/// Returns the events encoded as a JSON array in the Chrome trace event format, which can be
+/// opened in chrome://tracing or https://ui.perfetto.dev for offline analysis.
+NSData * __nonnull stu_chromeTraceJSONForTraceEvents(const STUTraceEvent * __nullable events,
+                                                      size_t count);
+
+STU_EXTERN_C_END
@@ -9,6 +9,10 @@ STU_ASSUME_NONNULL_AND_STRONG_BEGIN
 
 /// The value for this key must be an NSString with a locale identifier (in the format recognized
 /// by @c NSLocale).
+///
+/// The hyphenation locations are determined with the @c STUHyphenationPatterns registered for the
+/// locale identifier, or, if no patterns are registered, with
+/// @c CFStringGetHyphenationLocationBeforeIndex.
 NS_SWIFT_NAME(stuHyphenationLocaleIdentifier)
 extern const NSAttributedStringKey STUHyphenationLocaleIdentifierAttributeName;
 
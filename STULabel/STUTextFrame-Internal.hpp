@@ -33,6 +33,12 @@ STUTextFrame * __nullable
                                           const STUCancellationFlag * __nullable)
     NS_RETURNS_RETAINED;
 
+STUTextFrame * __nullable
+  STUTextFrameCreateWithSerializedData(__nullable Class cls,
+                                       NSData * __nonnull serializedData,
+                                       STUShapedString * __nonnull shapedString)
+    NS_RETURNS_RETAINED;
+
 STU_INLINE
 STUTextFrameRange STUTextFrameGetRange(const STUTextFrame* frame) {
   return {STUTextFrameIndexZero, STUTextFrameDataGetEndIndex(frame->data)};
@@ -41,6 +47,21 @@ STUTextFrameRange STUTextFrameGetRange(const STUTextFrame* frame) {
 
 namespace stu_label {
 
+/// Like `STUTextFrameCreateWithShapedStringRange`, except that the first line is positioned
+/// relative to `precedingLine` if it is non-null (see `TextFrameLayouter::setPrecedingLine`), and
+/// that a copy of the last line with the unrounded baseline position is assigned to `outLastLine`
+/// if the frame isn't empty.
+STUTextFrame* __nullable
+  createSTUTextFrameFollowingLine(__nullable Class cls,
+                                  STUShapedString* __nonnull shapedString,
+                                  NSRange stringRange,
+                                  CGSize, CGFloat displayScale,
+                                  STUTextFrameOptions* __nullable,
+                                  const STUCancellationFlag* __nullable,
+                                  const STUTextFrameLine* __nullable precedingLine,
+                                  Optional<STUTextFrameLine&> outLastLine)
+    NS_RETURNS_RETAINED;
+
 struct ContextBaseCTM_d : Parameter<ContextBaseCTM_d, CGFloat> { using Parameter::Parameter; };
 struct PixelAlignBaselines : Parameter<PixelAlignBaselines> { using Parameter::Parameter; };
 
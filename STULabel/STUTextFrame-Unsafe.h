@@ -22,6 +22,12 @@ STU_EXTERN_C_BEGIN
 @end
 
 typedef struct STUTextBackgroundSegment STUTextBackgroundSegment;
+typedef struct STUTextFrameHitTestIndex STUTextFrameHitTestIndex;
+typedef struct STUTextFrameLineIndexTable STUTextFrameLineIndexTable;
+typedef struct STUTextFrameRectsCache STUTextFrameRectsCache;
+typedef struct STUTextFrameImageBoundsCache STUTextFrameImageBoundsCache;
+typedef struct STUTextFrameGlyphStore STUTextFrameGlyphStore;
+typedef struct STUTextFrameDisplayList STUTextFrameDisplayList;
 
 /// @note All functions accepting a pointer to a @c STUTextFrameData instance assume that the
 ///       instance is owned by a @c STUTextFrame. Never pass a pointer to a copied or manually
@@ -88,8 +94,17 @@ typedef struct STUTextFrameData {
   size_t _dataSize;
   /// The attributed string of the @c STUShapedString from which this text frame was created.
   NSAttributedString * __unsafe_unretained __nullable originalAttributedString;
+  /// The typesetter used for recreating the `_ctLine` of lines with `_ctLineWasDiscarded` set.
+  /// Only non-null if the text frame was created with the @c usesCompactLineStorage option.
+  __nullable CTTypesetterRef _typesetter;
   _Atomic(CFAttributedStringRef) _truncatedAttributedString;
   _Atomic(const STUTextBackgroundSegment *) _backgroundSegments;
+  _Atomic(const STUTextFrameHitTestIndex *) _hitTestIndex;
+  _Atomic(const STUTextFrameLineIndexTable *) _lineIndexTable;
+  _Atomic(STUTextFrameRectsCache *) _rectsCache;
+  _Atomic(STUTextFrameImageBoundsCache *) _imageBoundsCache;
+  _Atomic(const STUTextFrameGlyphStore *) _glyphStore;
+  _Atomic(const STUTextFrameDisplayList *) _displayList;
 } STUTextFrameData;
 
 static STU_INLINE NS_REFINED_FOR_SWIFT
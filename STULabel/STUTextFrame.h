@@ -129,6 +129,88 @@ STU_EXPORT
   NS_SWIFT_NAME(init(_:stringRange:size:displayScaleOrZero:options:cancellationFlag:))
   NS_DESIGNATED_INITIALIZER;
 
+/// Initializes the text frame from data previously returned by the @c serializedData method of a
+/// text frame that was created from an equal shaped string.
+///
+/// The serialized format is only meant for caching layouts, e.g. on disk between app launches.
+/// It is specific to the build of this library that created it.
+///
+/// @returns
+///  Nil if the data is not a valid serialized text frame for the specified shaped string, e.g.
+///  because it was created by a different version of this library or for a different string.
+- (nullable instancetype)initWithSerializedData:(NSData *)serializedData
+                                   shapedString:(STUShapedString *)shapedString
+  NS_SWIFT_NAME(init(serializedData:shapedString:))
+  NS_DESIGNATED_INITIALIZER;
+
+/// Lays out each of the specified shaped strings with the same display scale and options.
+///
+/// This is equivalent to, but more efficient than, initializing the text frames individually,
+/// because the temporary memory and the cached font information are shared between the layouts.
+///
+/// @param stringRanges
+///  Either null or a C array with @c shapedStrings.count string ranges. If this argument is null,
+///  the full strings are laid out.
+/// @param sizes
+///  A C array with @c shapedStrings.count frame sizes.
+/// @param concurrently
+///  Indicates whether the layout work should be distributed over multiple worker threads.
+/// @returns
+///  An array with one text frame for each shaped string, in the same order, or nil if the layout
+///  was cancelled.
++ (nullable NSArray<STUTextFrame *> *)
+    textFramesWithShapedStrings:(NSArray<STUShapedString *> *)shapedStrings
+                   stringRanges:(nullable const NSRange *)stringRanges
+                          sizes:(const CGSize *)sizes
+                   displayScale:(CGFloat)displayScale
+                        options:(nullable STUTextFrameOptions *)options
+                   concurrently:(bool)concurrently
+               cancellationFlag:(nullable const STUCancellationFlag *)cancellationFlag
+  NS_SWIFT_NAME(textFrames(_:stringRanges:sizes:displayScaleOrZero:options:concurrently:
+                           cancellationFlag:));
+
+/// Like @c textFramesWithShapedStrings, except that only the layout info for each string is
+/// calculated, with a zero frame origin and the specified display scale. This avoids the
+/// allocation of the @c STUTextFrame instances.
+///
+/// @param outLayoutInfos
+///  A C array with space for @c shapedStrings.count elements.
+/// @returns
+///  False if the layout was cancelled, in which case the contents of @c outLayoutInfos are
+///  unspecified, otherwise true.
++ (bool)getLayoutInfos:(STUTextFrameLayoutInfo *)outLayoutInfos
+      forShapedStrings:(NSArray<STUShapedString *> *)shapedStrings
+          stringRanges:(nullable const NSRange *)stringRanges
+                 sizes:(const CGSize *)sizes
+          displayScale:(CGFloat)displayScale
+               options:(nullable STUTextFrameOptions *)options
+          concurrently:(bool)concurrently
+      cancellationFlag:(nullable const STUCancellationFlag *)cancellationFlag
+  NS_SWIFT_NAME(getLayoutInfos(_:for:stringRanges:sizes:displayScaleOrZero:options:concurrently:
+                               cancellationFlag:));
+
+/// Asynchronously loads the bounds of the glyphs for the printable ASCII and Latin-1 characters of
+/// the specified fonts into the global glyph bounds cache of the library.
+///
+/// Glyph bounds are normally loaded on demand, e.g. when a text frame is first drawn or when its
+/// image bounds are first calculated. Calling this method at app start with the fonts the app
+/// uses most moves this work to a background thread (with the utility QoS class).
++ (void)preloadGlyphBoundsForFonts:(NSArray<UIFont *> *)fonts
+  NS_SWIFT_NAME(preloadGlyphBounds(for:));
+
+/// Returns the layout of the text frame in a compact serialized form that can be stored and later
+/// be passed together with an equal shaped string to @c initWithSerializedData:shapedString:,
+/// which is much faster than laying out the string again.
+///
+/// Loading a serialized text frame doesn't restore the CTLine objects of the lines, which are
+/// instead recreated when they are first needed, as with the
+/// @c STUTextFrameOptions.usesCompactLineStorage option.
+///
+/// @returns
+///  Nil if the text frame can't be serialized. Currently this is the case for text frames without
+///  lines, truncated text frames, frames with hyphenated lines and frames with justified lines.
+- (nullable NSData *)serializedData;
+
 /// The attributed string of the @c STUShapedString from which the text frame was created.
 @property (readonly) NSAttributedString *originalAttributedString;
 
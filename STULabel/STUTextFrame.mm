@@ -16,9 +16,14 @@
 #import "Internal/TextFrameLayouter.hpp"
 
 #import "Internal/InputClamping.hpp"
+#import "Internal/PhaseTracing.hpp"
 #import "Internal/STUPlaceholderObjects.h"
 #import "Internal/TextLineSpan.hpp"
 
+#import "stu_mutex.h"
+
+#import <stdatomic.h>
+
 #include "Internal/DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
 
 using namespace stu;
@@ -39,6 +44,248 @@ NSRange STUTextFrameRangeGetRangeInTruncatedString(STUTextFrameRange range) {
 STU_EXPORT
 const bool __STULabelWasBuiltWithAddressSanitizer = STU_USE_ADDRESS_SANITIZER;
 
+/// A small cache of the rect arrays most recently returned by
+/// -[STUTextFrame rectsForRange:frameOrigin:displayScale:], since e.g. a press on a link can lead
+/// to many requests for the rects of the same range.
+struct STUTextFrameRectsCache {
+  static constexpr Int capacity = 4;
+
+  struct Entry {
+    STUTextFrameRange range;
+    CGPoint frameOrigin;
+    CGFloat displayScale;
+    /// Retained. Null if the entry is unused.
+    CFTypeRef __nullable rects;
+  };
+
+  stu_mutex mutex;
+  Int nextEntryIndex;
+  Entry entries[capacity];
+};
+
+namespace stu_label {
+
+static Class textFrameClass;
+static STUTextFrameOptions* defaultTextFrameOptions;
+
+static void initializeTextFrameClassAndDefaultOptions() {
+  static dispatch_once_t once;
+  dispatch_once_f(&once, nullptr, [](void*){
+    textFrameClass = STUTextFrame.class;
+    defaultTextFrameOptions = [[STUTextFrameOptions alloc] init];
+  });
+}
+
+/// Lays out the text and returns false if the layout was cancelled.
+STU_INLINE
+bool layoutAndJustify(TextFrameLayouter& layouter, CGSize frameSize, CGFloat displayScale,
+                      const TextFrameOptions& options)
+{
+  if (layouter.isCancelled()) return false;
+  {
+    STU_TRACE_PHASE(Layout);
+    layouter.layoutAndScale(frameSize, DisplayScale::create(displayScale), options);
+    STU_TRACE_PHASE_COUNT(layouter.layoutCallCount());
+  }
+  if (layouter.isCancelled()) return false;
+  if (layouter.needToJustifyLines()) {
+    STU_TRACE_PHASE(Justification);
+    STU_TRACE_PHASE_COUNT(layouter.lines().count());
+    layouter.justifyLinesWhereNecessary();
+    if (layouter.isCancelled()) return false;
+  }
+  return true;
+}
+
+STUTextFrame* __nonnull createSTUTextFrame(__nonnull Class cls, TextFrameLayouter&& layouter)
+  NS_RETURNS_RETAINED
+{
+  STU_TRACE_PHASE(TextFrameCreation);
+  STU_TRACE_PHASE_COUNT(layouter.lines().count());
+  const UInt instanceSize = roundUpToMultipleOf<alignof(TextFrame)>(class_getInstanceSize(cls));
+  const auto oso = TextFrame::objectSizeAndThisOffset(layouter);
+  STU_TRACE_PHASE_BYTE_SIZE(sign_cast(instanceSize + oso.size));
+  Byte* const p = static_cast<Byte*>(malloc(instanceSize + oso.size));
+  memset(p, 0, instanceSize);
+  STUTextFrame* const instance = stu_constructClassInstance(cls, p);
+  STU_DEBUG_ASSERT([instance isKindOfClass:textFrameClass]);
+  const_cast<STUTextFrameData*&>(instance->data) =
+    new (p + instanceSize + oso.offset) TextFrame(std::move(layouter), oso.size - oso.offset);
+  return instance;
+}
+
+static STUTextFrameRectsCache& rectsCache(const TextFrame& tf) {
+  _Atomic(STUTextFrameRectsCache*)* const frameRectsCache =
+    const_cast<_Atomic(STUTextFrameRectsCache*)*>(&tf._rectsCache);
+  STUTextFrameRectsCache* cache = atomic_load_explicit(frameRectsCache, memory_order_relaxed);
+  if (STU_LIKELY(cache)) {
+    cache = atomic_load_explicit(frameRectsCache, memory_order_acquire);
+  } else {
+    cache = static_cast<STUTextFrameRectsCache*>(calloc(1, sizeof(STUTextFrameRectsCache)));
+    cache->mutex = STU_MUTEX_INIT;
+    STUTextFrameRectsCache* expected = nullptr;
+    if (!atomic_compare_exchange_strong_explicit(frameRectsCache, &expected, cache,
+                                                 memory_order_release, memory_order_acquire))
+    {
+      stu_mutex_destroy(&cache->mutex);
+      free(cache);
+      cache = expected;
+    }
+  }
+  return *cache;
+}
+
+static void destroyRectsCache(const TextFrame& tf) {
+  STUTextFrameRectsCache* const cache = atomic_load_explicit(&tf._rectsCache,
+                                                             memory_order_relaxed);
+  if (!cache) return;
+  for (const STUTextFrameRectsCache::Entry& entry : cache->entries) {
+    if (entry.rects) {
+      CFRelease(entry.rects);
+    }
+  }
+  stu_mutex_destroy(&cache->mutex);
+  free(cache);
+}
+
+static STUTextRectArray* __nullable cachedRects(STUTextFrameRectsCache& cache,
+                                                STUTextFrameRange range, CGPoint frameOrigin,
+                                                CGFloat displayScale)
+{
+  CFTypeRef rects = nullptr;
+  stu_mutex_lock(&cache.mutex);
+  for (const STUTextFrameRectsCache::Entry& entry : cache.entries) {
+    if (entry.rects && entry.range == range && entry.frameOrigin == frameOrigin
+        && entry.displayScale == displayScale)
+    {
+      rects = CFRetain(entry.rects);
+      break;
+    }
+  }
+  stu_mutex_unlock(&cache.mutex);
+  return (__bridge_transfer STUTextRectArray*)rects;
+}
+
+static void addCachedRects(STUTextFrameRectsCache& cache, STUTextFrameRange range,
+                           CGPoint frameOrigin, CGFloat displayScale,
+                           STUTextRectArray* __unsafe_unretained rects)
+{
+  CFTypeRef const retainedRects = (__bridge_retained CFTypeRef)rects;
+  stu_mutex_lock(&cache.mutex);
+  STUTextFrameRectsCache::Entry& entry = cache.entries[cache.nextEntryIndex];
+  CFTypeRef const oldRects = entry.rects;
+  entry = {.range = range, .frameOrigin = frameOrigin, .displayScale = displayScale,
+           .rects = retainedRects};
+  cache.nextEntryIndex = (cache.nextEntryIndex + 1)%STUTextFrameRectsCache::capacity;
+  stu_mutex_unlock(&cache.mutex);
+  if (oldRects) {
+    CFRelease(oldRects); // Released outside the lock.
+  }
+}
+
+static STUTextFrameLayoutInfo layoutInfo(const TextFrame& tf, CGPoint frameOrigin,
+                                         CGFloat displayScale)
+{
+  Float64 firstBaseline = frameOrigin.y + tf.firstBaseline;
+  Float64 lastBaseline = frameOrigin.y + tf.lastBaseline;
+  if (const Optional<DisplayScale> scale = DisplayScale::create(displayScale)) {
+    firstBaseline = ceilToScale(firstBaseline, *scale);
+    lastBaseline = ceilToScale(lastBaseline, *scale);
+  }
+  return {
+    .lineCount = tf.lineCount,
+    .flags = tf.flags,
+    .layoutMode = tf.layoutMode,
+    .consistentAlignment = tf.consistentAlignment,
+    .minX = frameOrigin.x + tf.minX,
+    .maxX = frameOrigin.x + tf.maxX,
+    .firstBaseline = firstBaseline,
+    .lastBaseline = lastBaseline,
+    .firstLineHeight = tf.firstLineHeight,
+    .firstLineHeightAboveBaseline = tf.firstLineHeightAboveBaseline,
+    .lastLineHeight = tf.lastLineHeight,
+    .lastLineHeightBelowBaseline = tf.lastLineHeightBelowBaseline,
+    .lastLineHeightBelowBaselineWithoutSpacing = tf.lastLineHeightBelowBaselineWithoutSpacing,
+    .lastLineHeightBelowBaselineWithMinimalSpacing =
+       tf.lastLineHeightBelowBaselineWithMinimalSpacing,
+    .size = tf.size,
+    .textScaleFactor = tf.textScaleFactor
+  };
+}
+
+/// Constructs the TextFrame in temporary memory from the thread-local allocator, so that no
+/// STUTextFrame instance needs to be allocated when only the layout info is needed.
+STUTextFrameLayoutInfo layoutInfoOfTemporaryTextFrame(TextFrameLayouter&& layouter) {
+  const auto oso = TextFrame::objectSizeAndThisOffset(layouter);
+  TempArray<Byte> buffer{uninitialized, Count{oso.size}};
+  const TextFrame* const tf = new (buffer.begin() + oso.offset)
+                                  TextFrame(std::move(layouter), oso.size - oso.offset);
+  const STUTextFrameLayoutInfo info = layoutInfo(*tf, CGPoint{}, tf->displayScale);
+  tf->~TextFrame();
+  return info;
+}
+
+/// The shared state of a batch layout.
+struct BatchLayoutParams {
+  CFArrayRef shapedStrings;
+  const NSRange* __nullable stringRanges;
+  const CGSize* sizes;
+  CGFloat displayScale;
+  const TextFrameOptions& options;
+  const STUCancellationFlag* __nullable cancellationFlag;
+};
+
+/// Lays out the items in the specified index range on the current thread.
+/// All layouts share a single thread-local arena allocator and a single LocalFontInfoCache.
+static void layoutBatchItems(const BatchLayoutParams& params, Range<Int> indexRange,
+                             FunctionRef<void(Int index, TextFrameLayouter&&)> output)
+{
+  ThreadLocalArenaAllocator::InitialBuffer<4096> buffer;
+  ThreadLocalArenaAllocator alloc{Ref{buffer}};
+  LocalFontInfoCache fontInfoCache;
+  for (Int i = indexRange.start; i < indexRange.end; ++i) {
+    STUShapedString* __unsafe_unretained const stuShapedString =
+      (__bridge STUShapedString*)CFArrayGetValueAtIndex(params.shapedStrings, i);
+    const ShapedString& shapedString = *stuShapedString->shapedString;
+    NSRange stringRange;
+    if (params.stringRanges) {
+      stringRange = params.stringRanges[i];
+      STU_CHECK_MSG(stringRange.location <= sign_cast(shapedString.stringLength)
+                    && stringRange.length <= sign_cast(shapedString.stringLength)
+                                             - stringRange.location,
+                    "Invalid string range.");
+    } else {
+      stringRange = NSRange{0, sign_cast(shapedString.stringLength)};
+    }
+    TextFrameLayouter layouter{shapedString, Range<Int32>(stringRange),
+                               params.options.defaultTextAlignment, params.cancellationFlag,
+                               &fontInfoCache};
+    if (!layoutAndJustify(layouter, params.sizes[i], params.displayScale, params.options)) return;
+    output(i, std::move(layouter));
+  }
+}
+
+/// Returns false if the layout was cancelled.
+static bool layoutBatch(const BatchLayoutParams& params, Int count, bool concurrently,
+                        FunctionRef<void(Int index, TextFrameLayouter&&)> output)
+{
+  // Small chunks keep the load balanced, while still amortizing the per-thread setup costs.
+  const Int chunkSize = 8;
+  if (!concurrently || count <= chunkSize) {
+    layoutBatchItems(params, Range{0, count}, output);
+  } else {
+    const Int chunkCount = (count + (chunkSize - 1))/chunkSize;
+    const dispatch_queue_t queue = dispatch_get_global_queue(qos_class_self(), 0);
+    dispatch_apply(sign_cast(chunkCount), queue, ^(UInt chunkIndex) {
+      const Int start = sign_cast(chunkIndex)*chunkSize;
+      layoutBatchItems(params, Range{start, min(start + chunkSize, count)}, output);
+    });
+  }
+  return !(params.cancellationFlag && STUCancellationFlagGetValue(params.cancellationFlag));
+}
+
+} // namespace stu_label
+
 @implementation STUTextFrame
 
 STU_NO_INLINE
@@ -102,6 +349,29 @@ Unretained<STUTextFrame* __nonnull> stu_label::emptySTUTextFrame() {
                                                      displayScale, options, cancellationFlag);
 }
 
+- (nullable instancetype)initWithSerializedData:(nonnull NSData*)serializedData
+                                   shapedString:(nonnull STUShapedString*)shapedString
+{
+  return (id)STUTextFrameCreateWithSerializedData(self.class, serializedData, shapedString);
+}
+
+STUTextFrame* __nullable
+  STUTextFrameCreateWithSerializedData(__nullable Class cls,
+                                       NSData* NS_VALID_UNTIL_END_OF_SCOPE __nonnull serializedData,
+                                       STUShapedString* NS_VALID_UNTIL_END_OF_SCOPE __nonnull
+                                         shapedString)
+  NS_RETURNS_RETAINED
+{
+  initializeTextFrameClassAndDefaultOptions();
+  if (!cls) {
+    STU_ANALYZER_ASSUME(textFrameClass != nil);
+    cls = textFrameClass;
+  }
+  return createSTUTextFrame(cls, *shapedString->shapedString,
+                            ArrayRef{static_cast<const Byte*>(serializedData.bytes),
+                                     sign_cast(serializedData.length)});
+}
+
 STUTextFrame* __nonnull
   STUTextFrameCreateWithShapedString(__nullable Class cls,
                                      STUShapedString* __unsafe_unretained __nonnull shapedString,
@@ -125,6 +395,24 @@ STUTextFrame* __nullable
     STUTextFrameOptions* NS_VALID_UNTIL_END_OF_SCOPE __nullable options,
     const STUCancellationFlag* __nullable cancellationFlag)
   NS_RETURNS_RETAINED
+{
+  return stu_label::createSTUTextFrameFollowingLine(cls, stuShapedString, stringRange, frameSize,
+                                                    displayScale, options, cancellationFlag,
+                                                    nullptr, none);
+}
+
+STUTextFrame* __nullable
+  stu_label::createSTUTextFrameFollowingLine(
+    __nullable Class cls,
+    STUShapedString* NS_VALID_UNTIL_END_OF_SCOPE stuShapedString,
+    NSRange stringRange,
+    CGSize frameSize,
+    CGFloat displayScale,
+    STUTextFrameOptions* NS_VALID_UNTIL_END_OF_SCOPE __nullable options,
+    const STUCancellationFlag* __nullable cancellationFlag,
+    const STUTextFrameLine* __nullable precedingLine,
+    Optional<STUTextFrameLine&> outLastLine)
+  NS_RETURNS_RETAINED
 {
   if (STU_UNLIKELY(!stuShapedString)) return nil;
   const ShapedString& shapedString = *stuShapedString->shapedString;
@@ -133,20 +421,14 @@ STUTextFrame* __nullable
                                          - stringRange.location,
                 "Invalid string range.");
 
-  static Class textFrameClass;
-  static STUTextFrameOptions* defaultOptions;
-  static dispatch_once_t once;
-  dispatch_once_f(&once, nullptr, [](void*){
-    textFrameClass = STUTextFrame.class;
-    defaultOptions = [[STUTextFrameOptions alloc] init];
-  });
+  initializeTextFrameClassAndDefaultOptions();
   if (!cls) {
     STU_ANALYZER_ASSUME(textFrameClass != nil);
     cls = textFrameClass;
   }
   if (!options) {
-    STU_ANALYZER_ASSUME(defaultOptions != nil);
-    options = defaultOptions;
+    STU_ANALYZER_ASSUME(defaultTextFrameOptions != nil);
+    options = defaultTextFrameOptions;
   }
 
   ThreadLocalArenaAllocator::InitialBuffer<4096> buffer;
@@ -154,31 +436,106 @@ STUTextFrame* __nullable
 
   TextFrameLayouter layouter{shapedString, Range<Int32>(stringRange),
                              options->_options.defaultTextAlignment, cancellationFlag};
-  if (layouter.isCancelled()) return nil;
-  layouter.layoutAndScale(frameSize, DisplayScale::create(displayScale), options->_options);
-  if (layouter.isCancelled()) return nil;
-  if (layouter.needToJustifyLines()) {
-    layouter.justifyLinesWhereNecessary();
-    if (layouter.isCancelled()) return nil;
+  layouter.setPrecedingLine(precedingLine);
+  if (!layoutAndJustify(layouter, frameSize, displayScale, options->_options)) return nil;
+  if (outLastLine && !layouter.lines().isEmpty()) {
+    // The lines in the text frame have rounded baselines, so we copy the layouter's line.
+    *outLastLine = layouter.lines()[$ - 1];
   }
+  return createSTUTextFrame(cls, std::move(layouter));
+}
 
-  const UInt instanceSize = roundUpToMultipleOf<alignof(TextFrame)>(class_getInstanceSize(cls));
-  const auto oso = TextFrame::objectSizeAndThisOffset(layouter);
-  Byte* const p = static_cast<Byte*>(malloc(instanceSize + oso.size));
-  memset(p, 0, instanceSize);
-  STUTextFrame* const instance = stu_constructClassInstance(cls, p);
-  STU_DEBUG_ASSERT([instance isKindOfClass:textFrameClass]);
-  const_cast<STUTextFrameData*&>(instance->data) =
-    new (p + instanceSize + oso.offset) TextFrame(std::move(layouter), oso.size - oso.offset);
-  return instance;
++ (nullable NSArray<STUTextFrame*>*)
+    textFramesWithShapedStrings:(NSArray<STUShapedString*>*)shapedStrings
+                   stringRanges:(nullable const NSRange*)stringRanges
+                          sizes:(const CGSize*)sizes
+                   displayScale:(CGFloat)displayScale
+                        options:(nullable STUTextFrameOptions*)options
+                   concurrently:(bool)concurrently
+               cancellationFlag:(nullable const STUCancellationFlag*)cancellationFlag
+{
+  initializeTextFrameClassAndDefaultOptions();
+  NSArray* const strings = [shapedStrings copy];
+  const Int count = sign_cast(strings.count);
+  STU_CHECK(count == 0 || sizes != nullptr);
+  if (!options) {
+    options = defaultTextFrameOptions;
+  }
+  Class const cls = self;
+  // Each frame is stored at the index of its string, so the workers don't need to synchronize.
+  const void** const frames = static_cast<const void**>(calloc(sign_cast(max(count, 1)),
+                                                               sizeof(void*)));
+  const bool success = layoutBatch(
+    {.shapedStrings = (__bridge CFArrayRef)strings, .stringRanges = stringRanges, .sizes = sizes,
+     .displayScale = displayScale, .options = options->_options,
+     .cancellationFlag = cancellationFlag},
+    count, concurrently,
+    [&](Int index, TextFrameLayouter&& layouter) {
+      frames[index] = (__bridge_retained CFTypeRef)createSTUTextFrame(cls, std::move(layouter));
+    });
+  NSArray* result = nil;
+  if (success) {
+    result = (__bridge_transfer NSArray*)CFArrayCreate(nullptr, frames, count,
+                                                       &kCFTypeArrayCallBacks);
+  }
+  for (Int i = 0; i < count; ++i) {
+    if (frames[i]) {
+      CFRelease(frames[i]);
+    }
+  }
+  free(frames);
+  return result;
+}
+
++ (bool)getLayoutInfos:(STUTextFrameLayoutInfo*)outLayoutInfos
+      forShapedStrings:(NSArray<STUShapedString*>*)shapedStrings
+          stringRanges:(nullable const NSRange*)stringRanges
+                 sizes:(const CGSize*)sizes
+          displayScale:(CGFloat)displayScale
+               options:(nullable STUTextFrameOptions*)options
+          concurrently:(bool)concurrently
+      cancellationFlag:(nullable const STUCancellationFlag*)cancellationFlag
+{
+  initializeTextFrameClassAndDefaultOptions();
+  NSArray* const strings = [shapedStrings copy];
+  const Int count = sign_cast(strings.count);
+  STU_CHECK(count == 0 || (sizes != nullptr && outLayoutInfos != nullptr));
+  if (!options) {
+    options = defaultTextFrameOptions;
+  }
+  return layoutBatch(
+           {.shapedStrings = (__bridge CFArrayRef)strings, .stringRanges = stringRanges,
+            .sizes = sizes, .displayScale = displayScale, .options = options->_options,
+            .cancellationFlag = cancellationFlag},
+           count, concurrently,
+           [&](Int index, TextFrameLayouter&& layouter) {
+             outLayoutInfos[index] = layoutInfoOfTemporaryTextFrame(std::move(layouter));
+           });
+}
+
++ (void)preloadGlyphBoundsForFonts:(NSArray<UIFont*>*)fonts {
+  NSArray<UIFont*>* const fontsCopy = [fonts copy];
+  dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+    ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
+    ThreadLocalArenaAllocator alloc{Ref{buffer}};
+    for (UIFont* const font in fontsCopy) {
+      FontFaceGlyphBoundsCache::preloadLatin1GlyphBounds((__bridge CTFont*)font);
+    }
+  });
 }
 
 - (void)dealloc {
   if (const STUTextFrameData* const frame = data) {
+    // The rects cache contains Objective-C objects, so we destroy it here instead of in ~TextFrame.
+    destroyRectsCache(down_cast<const TextFrame&>(*frame));
     down_cast<const TextFrame&>(*frame).~TextFrame();
   }
 }
 
+- (nullable NSData*)serializedData {
+  return textFrameRef(self).serializedData();
+}
+
 - (NSAttributedString*)originalAttributedString {
   return data->originalAttributedString;
 }
@@ -193,32 +550,7 @@ STUTextFrame* __nullable
 - (STUTextFrameLayoutInfo)layoutInfoForFrameOrigin:(CGPoint)frameOrigin
                                       displayScale:(CGFloat)displayScale
 {
-  const TextFrame& tf = textFrameRef(self);
-  Float64 firstBaseline = frameOrigin.y + tf.firstBaseline;
-  Float64 lastBaseline = frameOrigin.y + tf.lastBaseline;
-  if (const Optional<DisplayScale> scale = DisplayScale::create(displayScale)) {
-    firstBaseline = ceilToScale(firstBaseline, *scale);
-    lastBaseline = ceilToScale(lastBaseline, *scale);
-  }
-  return {
-    .lineCount = tf.lineCount,
-    .flags = tf.flags,
-    .layoutMode = tf.layoutMode,
-    .consistentAlignment = tf.consistentAlignment,
-    .minX = frameOrigin.x + tf.minX,
-    .maxX = frameOrigin.x + tf.maxX,
-    .firstBaseline = firstBaseline,
-    .lastBaseline = lastBaseline,
-    .firstLineHeight = tf.firstLineHeight,
-    .firstLineHeightAboveBaseline = tf.firstLineHeightAboveBaseline,
-    .lastLineHeight = tf.lastLineHeight,
-    .lastLineHeightBelowBaseline = tf.lastLineHeightBelowBaseline,
-    .lastLineHeightBelowBaselineWithoutSpacing = tf.lastLineHeightBelowBaselineWithoutSpacing,
-    .lastLineHeightBelowBaselineWithMinimalSpacing =
-       tf.lastLineHeightBelowBaselineWithMinimalSpacing,
-    .size = tf.size,
-    .textScaleFactor = tf.textScaleFactor
-  };
+  return layoutInfo(textFrameRef(self), frameOrigin, displayScale);
 }
 
 - (CGFloat)displayScale {
@@ -340,15 +672,23 @@ STUTextFrame* __nullable
                                frameOrigin:(CGPoint)frameOrigin
                               displayScale:(CGFloat)displayScale
 {
+  STU_TRACE_PHASE(TextRects);
+  const TextFrame& tf = textFrameRef(self);
+  STUTextFrameRectsCache& cache = rectsCache(tf);
+  if (STUTextRectArray* const array = cachedRects(cache, range, frameOrigin, displayScale)) {
+    STU_TRACE_PHASE_COUNT(1);
+    return array;
+  }
+
   ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
   ThreadLocalArenaAllocator alloc{Ref{buffer}};
 
-  const TextFrame& tf = textFrameRef(self);
   const TempArray<TextLineSpan> spans = tf.lineSpans(range);
   const TextFrameScaleAndDisplayScale scaleFactors{tf, displayScale};
   STUTextRectArray* const array = STUTextRectArrayCreate(nil, spans, tf.lines(),
                                                          TextFrameOrigin{frameOrigin},
                                                          scaleFactors);
+  addCachedRects(cache, range, frameOrigin, displayScale, array);
   return array;
 }
 
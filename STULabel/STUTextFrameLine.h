@@ -113,6 +113,11 @@ typedef struct NS_REFINED_FOR_SWIFT STUTextFrameLine {
 
   bool isTruncatedAsRightToLeftLine : 1;
 
+  /// Indicates that `_ctLine` was released after layout because the text frame was created with
+  /// the @c usesCompactLineStorage option. The line can be recreated with the text frame's
+  /// `_typesetter`.
+  bool _ctLineWasDiscarded : 1;
+
   /// The unscaled typographic width of the line, not including any trailing whitespace or
   /// paragraph indent.
   float width;
@@ -146,8 +151,8 @@ typedef struct NS_REFINED_FOR_SWIFT STUTextFrameLine {
   /// offsets and minimum baseline distances, excluding any line spacing.
   float _heightBelowBaselineWithoutSpacing;
 
-  ptrdiff_t _textStylesOffset;
-  ptrdiff_t _tokenStylesOffset;
+  int32_t _textStylesOffset;
+  int32_t _tokenStylesOffset;
 
   // Core Text has no public API for concatenating `CTLine` instances or for inserting a `CTRun`
   // into an existing `CTLine`, except `CTLineCreateTruncatedLine`, which isn't flexible enough for
@@ -167,6 +172,7 @@ typedef struct NS_REFINED_FOR_SWIFT STUTextFrameLine {
   // context and the paragraph styling may not be fully preserved.)
 
   /// The CTLine holding the text from the original string.
+  /// Is null if `_ctLineWasDiscarded`.
   __nullable CTLineRef _ctLine;
   /// The CTLine of the truncation token or the inserted hyphen.
   __nullable CTLineRef _tokenCTLine;
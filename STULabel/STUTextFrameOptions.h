@@ -174,6 +174,19 @@ STU_EXPORT
 @property (readonly, nullable) STULastHyphenationLocationInRangeFinder
                                  lastHyphenationLocationInRangeFinder;
 
+/// Indicates whether the text frame should release the Core Text line objects of lines that
+/// don't contain a truncation token or an inserted hyphen and aren't justified, and recreate
+/// temporary instances from the shaped string's typesetter whenever the glyphs of such a line are
+/// needed, e.g. for drawing, hit testing or calculating image bounds.
+///
+/// This substantially reduces the memory footprint of text frames that are kept alive for a long
+/// time without being drawn often, e.g. the text frames of the cells in a long scrolling feed,
+/// at the cost of slower drawing. The text frame retains the typesetter instead, which is shared
+/// with the @c STUShapedString and any other text frame created from it with this option.
+///
+/// Default value: false
+@property (readonly) bool usesCompactLineStorage;
+
 @end
 
 /// Equality for @c STUTextFrameOptionsBuilder instances is defined as pointer equality.
@@ -227,6 +240,19 @@ STU_EXPORT
 @property (nonatomic, nullable) STULastHyphenationLocationInRangeFinder
                                   lastHyphenationLocationInRangeFinder;
 
+/// Indicates whether the text frame should release the Core Text line objects of lines that
+/// don't contain a truncation token or an inserted hyphen and aren't justified, and recreate
+/// temporary instances from the shaped string's typesetter whenever the glyphs of such a line are
+/// needed, e.g. for drawing, hit testing or calculating image bounds.
+///
+/// This substantially reduces the memory footprint of text frames that are kept alive for a long
+/// time without being drawn often, e.g. the text frames of the cells in a long scrolling feed,
+/// at the cost of slower drawing. The text frame retains the typesetter instead, which is shared
+/// with the @c STUShapedString and any other text frame created from it with this option.
+///
+/// Default value: false
+@property (nonatomic) bool usesCompactLineStorage;
+
 @end
 
 STU_ASSUME_NONNULL_AND_STRONG_END
@@ -21,7 +21,8 @@ using namespace stu_label;
   f(CGFloat, minimumTextScaleFactor) \
   f(CGFloat, textScaleFactorStepSize) \
   f(STUBaselineAdjustment, textScalingBaselineAdjustment) \
-  f(__nullable STULastHyphenationLocationInRangeFinder, lastHyphenationLocationInRangeFinder)
+  f(__nullable STULastHyphenationLocationInRangeFinder, lastHyphenationLocationInRangeFinder) \
+  f(bool, usesCompactLineStorage)
 
 #define DEFINE_FIELD(Type, name) Type _##name;
 
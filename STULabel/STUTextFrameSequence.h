@@ -0,0 +1,86 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "STUTextFrame.h"
+
+STU_EXTERN_C_BEGIN
+STU_ASSUME_NONNULL_AND_STRONG_BEGIN
+
+/// An incrementally calculated text layout of a shaped string for a fixed frame width, stored as a
+/// vertical sequence of @c STUTextFrame instances that each contain one or more complete
+/// paragraphs.
+///
+/// A @c STUTextFrame always contains the full layout of its text, which for very long texts can
+/// take considerably longer to calculate than the display of the first screenful of text. A
+/// @c STUTextFrameSequence instead only lays out the text up to the Y-coordinate passed to
+/// @c layoutUpToY:cancellationFlag:, so that the layout can follow e.g. the visible or prerender
+/// rect of a scroll view. For the text that hasn't been laid out yet the sequence provides a
+/// height estimate that is refined as the layout proceeds.
+///
+/// Hit testing, range rects and drawing work as usual with the text frames in the sequence, using
+/// the frame origins returned by @c originOfFrameAtIndex:.
+///
+/// The first line in each text frame is positioned relative to the last line of the previous text
+/// frame, so that the line positions are the same as in a single text frame for the whole text.
+///
+/// @note The @c maximumNumberOfLines option is ignored and the text frames are never truncated.
+///
+/// This class is not thread-safe.
+STU_EXPORT
+@interface STUTextFrameSequence : NSObject
+
+/// Initializes the sequence and lays out the first text frame.
+- (instancetype)initWithShapedString:(STUShapedString *)shapedString
+                               width:(CGFloat)width
+                        displayScale:(CGFloat)displayScale
+                             options:(nullable STUTextFrameOptions *)options
+  NS_SWIFT_NAME(init(_:width:displayScaleOrZero:options:))
+  NS_DESIGNATED_INITIALIZER;
+
+@property (readonly) STUShapedString *shapedString;
+
+@property (readonly) CGFloat width;
+
+/// The number of text frames that have been laid out so far.
+@property (readonly) NSInteger frameCount;
+
+/// @pre 0 <= index < frameCount
+- (STUTextFrame *)frameAtIndex:(NSInteger)index;
+
+/// The origin of the text frame in the coordinate system of the sequence.
+/// @pre 0 <= index < frameCount
+- (CGPoint)originOfFrameAtIndex:(NSInteger)index;
+
+/// The index range of the laid out text frames whose vertical extent intersects the interval
+/// @c [minY, maxY].
+- (NSRange)rangeOfFramesIntersectingVerticalRangeFromY:(CGFloat)minY toY:(CGFloat)maxY
+  NS_SWIFT_NAME(rangeOfFramesIntersecting(minY:maxY:));
+
+/// The UTF-16 length of the string prefix that has been laid out so far.
+@property (readonly) NSUInteger laidOutStringLength;
+
+/// Indicates whether the full string has been laid out.
+@property (readonly) bool isComplete;
+
+/// The height of the text frames that have been laid out so far.
+@property (readonly) CGFloat laidOutHeight;
+
+/// The laid out height plus an estimate for the height of the text that hasn't been laid out yet.
+/// The estimate assumes that the remaining text has the same average height per UTF-16 code unit
+/// as the laid out text. If @c isComplete is true, this value equals @c laidOutHeight.
+@property (readonly) CGFloat estimatedHeight;
+
+/// Lays out further text frames until the laid out height exceeds @c y or the full string has been
+/// laid out.
+///
+/// @returns False if the layout was cancelled, otherwise true. Text frames that were completed
+///          before the cancellation remain in the sequence.
+- (bool)layoutUpToY:(CGFloat)y
+   cancellationFlag:(nullable const STUCancellationFlag *)cancellationFlag
+  NS_SWIFT_NAME(layout(upToY:cancellationFlag:));
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+STU_ASSUME_NONNULL_AND_STRONG_END
+STU_EXTERN_C_END
@@ -0,0 +1,176 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "STUTextFrameSequence.h"
+
+#import "STUShapedString-Internal.hpp"
+#import "STUTextFrame-Internal.hpp"
+
+#import "Internal/DisplayScaleRounding.hpp"
+#import "Internal/InputClamping.hpp"
+#import "Internal/ShapedString.hpp"
+
+#import "stu/BinarySearch.hpp"
+
+#include "Internal/DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+using namespace stu;
+using namespace stu_label;
+
+/// Paragraphs are combined into one text frame until the frame's string length reaches this value,
+/// so that a sequence for a text with many short paragraphs doesn't consist of tiny frames.
+static const Int32 minFrameStringLength = 2048;
+
+@implementation STUTextFrameSequence {
+  STUShapedString* _shapedString;
+  STUTextFrameOptions* _options;
+  CGFloat _width;
+  CGFloat _displayScale;
+  NSMutableArray<STUTextFrame*>* _frames;
+  Vector<CGFloat> _frameOriginYs;
+  Int32 _paragraphIndex;
+  Int32 _laidOutStringLength;
+  CGFloat _laidOutHeight;
+  bool _hasLastLine;
+  /// The last line of the last frame, with the unrounded baseline position relative to the
+  /// frame's origin.
+  STUTextFrameLine _lastLine;
+  Float64 _lastLineBaselineY;
+}
+
+- (instancetype)init {
+  [self doesNotRecognizeSelector:_cmd];
+  __builtin_trap();
+}
+
+- (instancetype)initWithShapedString:(STUShapedString*)shapedString
+                               width:(CGFloat)width
+                        displayScale:(CGFloat)displayScale
+                             options:(nullable STUTextFrameOptions*)options
+{
+  STU_CHECK(shapedString != nil);
+  if (options && options.maximumNumberOfLines != 0) {
+    options = [options copyWithUpdates:^(STUTextFrameOptionsBuilder* builder) {
+                builder.maximumNumberOfLines = 0;
+              }];
+  }
+  _shapedString = shapedString;
+  _options = options;
+  _width = clampNonNegativeFloatInput(width);
+  _displayScale = DisplayScale::create(displayScale) ? displayScale : 0;
+  _frames = [[NSMutableArray alloc] init];
+  [self layoutUpToY:0 cancellationFlag:nullptr];
+  return self;
+}
+
+- (STUShapedString*)shapedString {
+  return _shapedString;
+}
+
+- (CGFloat)width {
+  return _width;
+}
+
+- (NSInteger)frameCount {
+  return _frameOriginYs.count();
+}
+
+- (STUTextFrame*)frameAtIndex:(NSInteger)index {
+  STU_CHECK_MSG(0 <= index && index < _frameOriginYs.count(), "Frame index out of bounds.");
+  return _frames[sign_cast(index)];
+}
+
+- (CGPoint)originOfFrameAtIndex:(NSInteger)index {
+  STU_CHECK_MSG(0 <= index && index < _frameOriginYs.count(), "Frame index out of bounds.");
+  return CGPoint{0, _frameOriginYs[index]};
+}
+
+- (NSRange)rangeOfFramesIntersectingVerticalRangeFromY:(CGFloat)minY toY:(CGFloat)maxY {
+  const ArrayRef<const CGFloat> originYs = _frameOriginYs;
+  if (!(minY <= maxY) || originYs.isEmpty() || maxY < 0 || minY > _laidOutHeight) {
+    return NSRange{};
+  }
+  // The frames are stacked without gaps, so frame i extends from originYs[i] to originYs[i + 1].
+  const Int start = max(Int{0}, binarySearchFirstIndexWhere(originYs, [&](CGFloat y) {
+                                                         return y > minY;
+                                                       }).indexOrArrayCount - 1);
+  const Int end = binarySearchFirstIndexWhere(originYs, [&](CGFloat y) {
+                    return y > maxY;
+                  }).indexOrArrayCount;
+  return NSRange{sign_cast(start), sign_cast(end - start)};
+}
+
+- (NSUInteger)laidOutStringLength {
+  return sign_cast(_laidOutStringLength);
+}
+
+- (bool)isComplete {
+  return _laidOutStringLength == _shapedString->shapedString->stringLength;
+}
+
+- (CGFloat)laidOutHeight {
+  return _laidOutHeight;
+}
+
+- (CGFloat)estimatedHeight {
+  const Int32 stringLength = _shapedString->shapedString->stringLength;
+  if (_laidOutStringLength == stringLength || _laidOutStringLength == 0) return _laidOutHeight;
+  return _laidOutHeight
+       + (_laidOutHeight/_laidOutStringLength)*(stringLength - _laidOutStringLength);
+}
+
+- (bool)layoutUpToY:(CGFloat)y
+   cancellationFlag:(nullable const STUCancellationFlag*)cancellationFlag
+{
+  const ShapedString& shapedString = *_shapedString->shapedString;
+  const ArrayRef<const ShapedString::Paragraph> paras = shapedString.arrays().paragraphs;
+  const Optional<DisplayScale> displayScale = DisplayScale::create(_displayScale);
+  while (_paragraphIndex < paras.count()
+         && (_frameOriginYs.isEmpty() || _laidOutHeight <= y))
+  {
+    const Int32 start = paras[_paragraphIndex].stringRange.start;
+    Int32 endIndex = _paragraphIndex;
+    do ++endIndex;
+    while (endIndex < paras.count()
+           && paras[endIndex - 1].stringRange.end - start < minFrameStringLength);
+    const Int32 end = paras[endIndex - 1].stringRange.end;
+    const NSRange stringRange{sign_cast(start), sign_cast(end - start)};
+    const CGFloat originY = _laidOutHeight;
+    // We position the first line of the frame relative to the last line of the previous frame,
+    // so that the line spacing is exactly the same as in a single text frame for the whole text.
+    STUTextFrameLine precedingLine;
+    if (_hasLastLine) {
+      precedingLine = _lastLine;
+      precedingLine.originY = _lastLineBaselineY - originY;
+      precedingLine.paragraphIndex = -1;
+    }
+    STUTextFrameLine lastLine;
+    STUTextFrame* const frame = createSTUTextFrameFollowingLine(
+                                  nil, _shapedString, stringRange, CGSize{_width, CGFLOAT_MAX},
+                                  _displayScale, _options, cancellationFlag,
+                                  _hasLastLine ? &precedingLine : nullptr, lastLine);
+    if (!frame) return false;
+    const STUTextFrameLayoutInfo info = [frame layoutInfoForFrameOrigin:CGPoint{}];
+    CGFloat height = 0;
+    _hasLastLine = info.lineCount > 0;
+    if (_hasLastLine) {
+      _lastLine = lastLine;
+      _lastLineBaselineY = originY + lastLine.originY;
+      height = narrow_cast<CGFloat>(info.lastBaseline + info.lastLineHeightBelowBaseline);
+      if (displayScale) {
+        // Since the frame origins are multiples of the pixel size, this doesn't change the
+        // (rounded) baseline positions relative to a single text frame for the whole text.
+        height = ceilToScale(height, *displayScale);
+      }
+    }
+    [_frames addObject:frame];
+    _frameOriginYs.append(originY);
+    _laidOutHeight = originY + height;
+    _laidOutStringLength = end;
+    _paragraphIndex = endIndex;
+  }
+  return true;
+}
+
+@end
+
+#include "Internal/UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
@@ -0,0 +1,44 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "STUTextFrameSequence.h"
+#import "STUImageUtils.h"
+#import "STUTextFrameDrawingOptions.h"
+
+#import <UIKit/UIKit.h>
+
+STU_ASSUME_NONNULL_AND_STRONG_BEGIN
+
+/// A view that displays a long text with a @c STUTextFrameSequence and a tiled content layer.
+///
+/// The view creates a text frame sequence for its width and display scale and only lays out the
+/// text frames that are needed to draw the currently visible or prerendered tiles. The tiles are
+/// drawn and prerendered asynchronously, so that scrolling through a long text doesn't require the
+/// full text layout up front.
+///
+/// The intrinsic content height is the @c estimatedHeight of the sequence, which is refined as the
+/// layout proceeds. Typically you'd put the view into a @c UIScrollView and constrain its width.
+///
+/// The text frame options' @c maximumNumberOfLines property is ignored.
+STU_EXPORT
+@interface STUTextFrameSequenceView : UIView
+
+@property (nonatomic, nullable) STUShapedString *shapedString;
+
+@property (nonatomic, nullable) STUTextFrameOptions *textFrameOptions;
+
+@property (nonatomic, nullable) STUTextFrameDrawingOptions *drawingOptions;
+
+/// Default value: @c STUPredefinedCGImageFormatRGB
+@property (nonatomic) STUPredefinedCGImageFormat imageFormat;
+
+/// Calls the block with the text frame sequence for the view's current width and display scale,
+/// or with null if the view has no shaped string.
+///
+/// The sequence is shared with the tile drawing code, which may run on a background thread. The
+/// block is called while holding a lock that synchronizes the accesses to the sequence, so the
+/// block must not retain the sequence or access it after it returns.
+- (void)accessTextFrameSequence:(void (^ NS_NOESCAPE)(STUTextFrameSequence * __nullable))block;
+
+@end
+
+STU_ASSUME_NONNULL_AND_STRONG_END
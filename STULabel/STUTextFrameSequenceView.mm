@@ -0,0 +1,234 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "STUTextFrameSequenceView.h"
+
+#import "STUTextFrame-Internal.hpp"
+
+#import "stu_mutex.h"
+
+#import "Internal/InputClamping.hpp"
+#import "Internal/STULabelTiledLayer.h"
+
+#import "stu/Vector.hpp"
+
+#include "Internal/DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
+
+using namespace stu;
+using namespace stu_label;
+
+/// The state shared between the view and the tile drawing block, which may be called on a
+/// background thread.
+@interface STUTextFrameSequenceViewContent : NSObject
+@end
+@implementation STUTextFrameSequenceViewContent {
+@package
+  __weak STUTextFrameSequenceView* _view;
+  STUTextFrameDrawingOptions* _drawingOptions;
+  stu_mutex _mutex;
+  // The following fields are guarded by _mutex.
+  STUTextFrameSequence* _sequence;
+  CGFloat _estimatedHeight;
+}
+
+- (instancetype)initWithView:(STUTextFrameSequenceView*)view
+                    sequence:(nullable STUTextFrameSequence*)sequence
+              drawingOptions:(nullable STUTextFrameDrawingOptions*)drawingOptions
+{
+  _view = view;
+  _drawingOptions = drawingOptions;
+  stu_mutex_init(&_mutex);
+  _sequence = sequence;
+  _estimatedHeight = sequence ? sequence.estimatedHeight : 0;
+  return self;
+}
+
+- (void)dealloc {
+  stu_mutex_destroy(&_mutex);
+}
+
+- (CGFloat)estimatedHeight {
+  stu_mutex_lock(&_mutex);
+  const CGFloat height = _estimatedHeight;
+  stu_mutex_unlock(&_mutex);
+  return height;
+}
+
+- (void)drawRect:(CGRect)rect inContext:(CGContext*)context
+ cancellationFlag:(const STUCancellationFlag* __nullable)cancellationFlag
+{
+  NSMutableArray<STUTextFrame*>* const frames = [[NSMutableArray alloc] init];
+  Vector<CGFloat> originYs;
+  bool estimatedHeightChanged = false;
+  stu_mutex_lock(&_mutex);
+  if (STUTextFrameSequence* const sequence = _sequence) {
+    // We only hold the lock while laying out the text, since the text frames are immutable.
+    const CGFloat maxY = CGRectGetMaxY(rect);
+    [sequence layoutUpToY:maxY cancellationFlag:cancellationFlag];
+    const NSRange range = [sequence rangeOfFramesIntersectingVerticalRangeFromY:rect.origin.y
+                                                                            toY:maxY];
+    for (NSUInteger i = range.location; i < NSMaxRange(range); ++i) {
+      [frames addObject:[sequence frameAtIndex:sign_cast(i)]];
+      originYs.append([sequence originOfFrameAtIndex:sign_cast(i)].y);
+    }
+    const CGFloat estimatedHeight = sequence.estimatedHeight;
+    estimatedHeightChanged = estimatedHeight != _estimatedHeight;
+    _estimatedHeight = estimatedHeight;
+  }
+  stu_mutex_unlock(&_mutex);
+  if (estimatedHeightChanged) {
+    dispatch_async(dispatch_get_main_queue(), ^{
+      [self->_view invalidateIntrinsicContentSize];
+    });
+  }
+  STUTextFrameDrawingOptions* const drawingOptions = _drawingOptions;
+  Int i = 0;
+  for (STUTextFrame* frame in frames) {
+    if (cancellationFlag && STUCancellationFlagGetValue(cancellationFlag)) break;
+    drawTextFrame(frame, STUTextFrameGetRange(frame), CGPoint{0, originYs[i]}, context,
+                  ContextBaseCTM_d{1}, PixelAlignBaselines{true}, drawingOptions,
+                  cancellationFlag);
+    ++i;
+  }
+}
+
+@end
+
+@implementation STUTextFrameSequenceView {
+  STUShapedString* _shapedString;
+  STUTextFrameOptions* _textFrameOptions;
+  STUTextFrameDrawingOptions* _drawingOptions;
+  STUTextFrameSequenceViewContent* _content;
+  CGFloat _contentWidth;
+  CGFloat _contentDisplayScale;
+  bool _needsNewContent;
+}
+
++ (Class)layerClass {
+  return STULabelTiledLayer.class;
+}
+
+static void initCommon(STUTextFrameSequenceView* self) {
+  self.opaque = false;
+  self->_needsNewContent = true;
+  [self setNeedsLayout];
+}
+
+- (instancetype)initWithFrame:(CGRect)frame {
+  if ((self = [super initWithFrame:frame])) {
+    initCommon(self);
+  }
+  return self;
+}
+
+- (nullable instancetype)initWithCoder:(NSCoder*)decoder {
+  if ((self = [super initWithCoder:decoder])) {
+    initCommon(self);
+  }
+  return self;
+}
+
+// We override layerWillDraw with an empty method in order to prevent the default implementation
+// from setting the contentsFormat of the layer, which would reset the tiled layer's image format.
+- (void)layerWillDraw:(CALayer* __unused)layer {}
+
+- (STULabelTiledLayer*)tiledLayer {
+  return static_cast<STULabelTiledLayer*>(self.layer);
+}
+
+- (void)setNeedsNewContent {
+  _needsNewContent = true;
+  [self setNeedsLayout];
+}
+
+- (nullable STUShapedString*)shapedString {
+  return _shapedString;
+}
+- (void)setShapedString:(nullable STUShapedString*)shapedString {
+  if (_shapedString == shapedString) return;
+  _shapedString = shapedString;
+  [self setNeedsNewContent];
+}
+
+- (nullable STUTextFrameOptions*)textFrameOptions {
+  return _textFrameOptions;
+}
+- (void)setTextFrameOptions:(nullable STUTextFrameOptions*)textFrameOptions {
+  if (_textFrameOptions == textFrameOptions) return;
+  _textFrameOptions = textFrameOptions;
+  [self setNeedsNewContent];
+}
+
+- (nullable STUTextFrameDrawingOptions*)drawingOptions {
+  return _drawingOptions;
+}
+- (void)setDrawingOptions:(nullable STUTextFrameDrawingOptions*)drawingOptions {
+  if (_drawingOptions == drawingOptions) return;
+  // The drawing options are mutable and may be accessed on a background thread.
+  _drawingOptions = [drawingOptions copy];
+  [self setNeedsNewContent];
+}
+
+- (STUPredefinedCGImageFormat)imageFormat {
+  return self.tiledLayer.imageFormat;
+}
+- (void)setImageFormat:(STUPredefinedCGImageFormat)imageFormat {
+  self.tiledLayer.imageFormat = imageFormat;
+}
+
+- (void)setContentScaleFactor:(CGFloat)contentScaleFactor {
+  [super setContentScaleFactor:contentScaleFactor];
+  [self setNeedsLayout];
+}
+
+- (void)layoutSubviews {
+  [super layoutSubviews];
+  const CGFloat width = self.bounds.size.width;
+  const CGFloat displayScale = clampDisplayScaleInput(self.contentScaleFactor);
+  if (!_needsNewContent && width == _contentWidth && displayScale == _contentDisplayScale) return;
+  _needsNewContent = false;
+  _contentWidth = width;
+  _contentDisplayScale = displayScale;
+  STUTextFrameSequence* const sequence =
+    !_shapedString ? nil
+    : [[STUTextFrameSequence alloc] initWithShapedString:_shapedString width:width
+                                            displayScale:displayScale options:_textFrameOptions];
+  STUTextFrameSequenceViewContent* const content =
+    [[STUTextFrameSequenceViewContent alloc] initWithView:self sequence:sequence
+                                           drawingOptions:_drawingOptions];
+  _content = content;
+  self.tiledLayer.drawingBlock = !sequence ? nil
+                               : ^(CGContext* context, CGRect rect,
+                                   const STUCancellationFlag* cancellationFlag)
+                                 {
+                                   [content drawRect:rect inContext:context
+                                    cancellationFlag:cancellationFlag];
+                                 };
+  [self invalidateIntrinsicContentSize];
+}
+
+- (CGSize)intrinsicContentSize {
+  const CGFloat height = _content ? [_content estimatedHeight] : 0;
+  return CGSize{UIViewNoIntrinsicMetric, height};
+}
+
+- (void)accessTextFrameSequence:(void (^ NS_NOESCAPE)(STUTextFrameSequence* __nullable))block {
+  [self layoutIfNeeded];
+  STUTextFrameSequenceViewContent* const content = _content;
+  if (!content) {
+    block(nil);
+    return;
+  }
+  stu_mutex_lock(&content->_mutex);
+  block(content->_sequence);
+  const CGFloat estimatedHeight = content->_sequence.estimatedHeight;
+  const bool estimatedHeightChanged = estimatedHeight != content->_estimatedHeight;
+  content->_estimatedHeight = estimatedHeight;
+  stu_mutex_unlock(&content->_mutex);
+  if (estimatedHeightChanged) {
+    [self invalidateIntrinsicContentSize];
+  }
+}
+
+@end
+
+#include "Internal/UndefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
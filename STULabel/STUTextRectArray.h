@@ -85,6 +85,9 @@ STU_EXPORT
 /// @param transform
 ///  A pointer to an affine transformation matrix, or null if no transformation is needed.
 ///  If non-null, this transformation is applied to the path before it is returned.
+///
+/// @note The array caches the path created for the first combination of parameters, so repeated
+///       calls with these parameters may return the same (immutable) path object.
 -   (CGPathRef)createPathWithEdgeInsets:(UIEdgeInsets)edgeInsets
                            cornerRadius:(CGFloat)cornerRadius
 extendTextLinesToCommonHorizontalBounds:(bool)extendTextLinesToCommonHorizontalBounds
@@ -6,8 +6,11 @@
 
 #import "Internal/InputClamping.hpp"
 #import "Internal/Once.hpp"
+#import "Internal/PhaseTracing.hpp"
 #import "Internal/TextLineSpansPath.hpp"
 
+#import <stdatomic.h>
+
 #include "Internal/DefineUIntOnCatalystToWorkAroundGlobalNamespacePollution.h"
 
 using namespace stu;
@@ -81,8 +84,35 @@ struct STUTextRectArrayData {
 };
 
 
+/// The path created by the first createPathWithEdgeInsets call for an array, together with the
+/// call's parameters. Links and highlighted ranges are typically redrawn with the same style
+/// parameters, so caching a single path suffices.
+struct CachedTextRectsPath {
+  UIEdgeInsets edgeInsets;
+  CGFloat cornerRadius;
+  bool extendTextLinesToCommonHorizontalBounds;
+  bool fillTextLineGaps;
+  bool hasTransform;
+  CGAffineTransform transform;
+  CGPathRef path;
+
+  bool matches(UIEdgeInsets edgeInsets, CGFloat cornerRadius,
+               bool extendTextLinesToCommonHorizontalBounds, bool fillTextLineGaps,
+               const CGAffineTransform* __nullable transform) const
+  {
+    return UIEdgeInsetsEqualToEdgeInsets(this->edgeInsets, edgeInsets)
+        && this->cornerRadius == cornerRadius
+        && this->extendTextLinesToCommonHorizontalBounds
+           == extendTextLinesToCommonHorizontalBounds
+        && this->fillTextLineGaps == fillTextLineGaps
+        && this->hasTransform == (transform != nullptr)
+        && (!transform || CGAffineTransformEqualToTransform(this->transform, *transform));
+  }
+};
+
 @implementation STUTextRectArray {
   UInt taggedPointer_; // TODO: debug viewer
+  _Atomic(CachedTextRectsPath*) cachedPath_;
 }
 
 struct DataOrOtherArray {
@@ -122,6 +152,10 @@ struct DataOrOtherArray {
   if (d.otherArray) {
     decrementRefCount(d.otherArray);
   }
+  if (CachedTextRectsPath* const cp = atomic_load_explicit(&cachedPath_, memory_order_relaxed)) {
+    CGPathRelease(cp->path);
+    free(cp);
+  }
 }
 
 - (nonnull id)copyWithZone:(nullable NSZone* __unused)zone {
@@ -406,16 +440,45 @@ extendTextLinesToCommonHorizontalBounds:(bool)extendLinesToCommonBounds
 {
   const DataOrOtherArray d{self};
   if (d.data) {
+    STU_TRACE_PHASE(TextRectsPath);
     const STUTextRectArrayData& data = *d.data;
-    ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
-    ThreadLocalArenaAllocator alloc{Ref{buffer}};
     cornerRadius = clampNonNegativeFloatInput(cornerRadius);
     edgeInsets = clampEdgeInsetsInput(edgeInsets);
+    const CachedTextRectsPath* const cp = atomic_load_explicit(&cachedPath_,
+                                                               memory_order_acquire);
+    if (cp && cp->matches(edgeInsets, cornerRadius, extendLinesToCommonBounds, fillTextLineGaps,
+                          transform))
+    {
+      STU_TRACE_PHASE_COUNT(1);
+      return CGPathRetain(cp->path);
+    }
+    ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
+    ThreadLocalArenaAllocator alloc{Ref{buffer}};
     CGMutablePathRef path = CGPathCreateMutable();
     addLineSpansPath(*path, data.spans(), data.textLineVerticalPositions(),
                      ShouldFillTextLineGaps{fillTextLineGaps},
                      ShouldExtendTextLinesToCommonHorizontalBounds{extendLinesToCommonBounds},
                      edgeInsets, CornerRadius{cornerRadius}, nil, transform);
+    if (!cp) {
+      CachedTextRectsPath* const newCP =
+        static_cast<CachedTextRectsPath*>(malloc(sizeof(CachedTextRectsPath)));
+      *newCP = CachedTextRectsPath{
+                 .edgeInsets = edgeInsets,
+                 .cornerRadius = cornerRadius,
+                 .extendTextLinesToCommonHorizontalBounds = extendLinesToCommonBounds,
+                 .fillTextLineGaps = fillTextLineGaps,
+                 .hasTransform = transform != nullptr,
+                 .transform = transform ? *transform : CGAffineTransformIdentity,
+                 // The caller may mutate the returned path, so we cache a copy.
+                 .path = CGPathCreateCopy(path)};
+      CachedTextRectsPath* expected = nullptr;
+      if (!atomic_compare_exchange_strong_explicit(&cachedPath_, &expected, newCP,
+                                                   memory_order_release, memory_order_relaxed))
+      {
+        CGPathRelease(newCP->path);
+        free(newCP);
+      }
+    }
     return path;
   }
   STU_ANALYZER_ASSUME(d.otherArray != nil);
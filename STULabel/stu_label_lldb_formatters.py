@@ -938,8 +938,8 @@ def __lldb_init_module(dbg, dict):
     ' "stu_label::FontFaceGlyphBoundsCache::FontFace"')
 
   dbg.HandleCommand(
-    'type summary add -w stu_label --summary-string "\'${var.fontFace}\' CachePool"'
-    ' "stu_label::FontFaceGlyphBoundsCache::Pool"')
+    'type summary add -w stu_label --summary-string "\'${var.fontFace_}\' GlyphBoundsCache"'
+    ' "stu_label::FontFaceGlyphBoundsCache"')
 
   dbg.HandleCommand(
     'type summary add -w stu_label -F stu_label_lldb_formatters.CTRun_SummaryFormatter'
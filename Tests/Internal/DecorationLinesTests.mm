@@ -0,0 +1,181 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "TestUtils.h"
+
+#import "DecorationLines.hpp"
+
+#import "STULabel/STUTextFrame.h"
+
+using namespace stu_label;
+
+@interface DecorationLinesTests : XCTestCase
+@end
+@implementation DecorationLinesTests
+
+- (void)setUp {
+  [super setUp];
+  self.continueAfterFailure = false;
+}
+
+static DecorationLine decorationLine(Range<CGFloat> x, NSUnderlineStyle style) {
+  return DecorationLine{.fullLineXStart = x.start, .style = style};
+}
+
+static bool hasSegments(const DecorationLineSegments& segments,
+                        ArrayRef<const Range<CGFloat>> xs, ArrayRef<const Int> lineIndices)
+{
+  if (segments.xs.count() != xs.count() || segments.lineIndices.count() != lineIndices.count()) {
+    return false;
+  }
+  for (Int i = 0; i < xs.count(); ++i) {
+    if (segments.xs[i] != xs[i] || segments.lineIndices[i] != lineIndices[i]) return false;
+  }
+  return true;
+}
+
+- (void)testSubtractGaps {
+  ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
+  ThreadLocalArenaAllocator alloc{Ref{buffer}};
+
+  const Range<CGFloat> lineXs[] = {{0, 10}, {10, 20}, {30, 40}};
+  const DecorationLine lines[] = {decorationLine(lineXs[0], NSUnderlineStyleSingle),
+                                  decorationLine(lineXs[1], NSUnderlineStyleDouble),
+                                  decorationLine(lineXs[2], NSUnderlineStyleSingle)};
+  const Range<CGFloat> gaps[] = {{-5, -1}, {2, 3}, {9, 12}, {18, 25}, {26, 28}, {35, 45}};
+  {
+    const auto segments = DecorationLineSegments::subtractGaps(lineXs, lines, gaps,
+                                                               OnlyDoubleLines{false});
+    const Range<CGFloat> xs[] = {{0, 2}, {3, 9}, {12, 18}, {30, 35}};
+    const Int lineIndices[] = {0, 0, 1, 2};
+    XCTAssert(hasSegments(segments, xs, lineIndices));
+  }
+  {
+    const auto segments = DecorationLineSegments::subtractGaps(lineXs, lines, gaps,
+                                                               OnlyDoubleLines{true});
+    const Range<CGFloat> xs[] = {{12, 18}};
+    const Int lineIndices[] = {1};
+    XCTAssert(hasSegments(segments, xs, lineIndices));
+  }
+  {
+    const auto segments = DecorationLineSegments::subtractGaps(lineXs, lines, {},
+                                                               OnlyDoubleLines{false});
+    const Range<CGFloat> xs[] = {{0, 10}, {10, 20}, {30, 40}};
+    const Int lineIndices[] = {0, 1, 2};
+    XCTAssert(hasSegments(segments, xs, lineIndices));
+  }
+}
+
+static DecorationLine underline(Range<CGFloat> x, ColorIndex colorIndex,
+                                bool isContinuation, bool hasContinuation)
+{
+  return DecorationLine{.fullLineXStart = x.start, .offsetLLO = -2, .thickness = 1,
+                        .style = NSUnderlineStyleSingle, .colorIndex = colorIndex,
+                        .hasUnderlineContinuation = hasContinuation,
+                        .isUnderlineContinuation = isContinuation};
+}
+
+- (void)testRemoveLinePartsNotIntersectingClipRectAndMergeIdenticallyStyledAdjacentUnderlines {
+  ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
+  ThreadLocalArenaAllocator alloc{Ref{buffer}};
+
+  const ColorIndex c0{ColorIndex::fixedColorCount};
+  const ColorIndex c1{ColorIndex::fixedColorCount + 1};
+  const Range<CGFloat> lineXs[] = {{0, 10}, {10, 20}, {20, 30}, {30, 40}, {50, 60}, {60, 70}};
+  const DecorationLine lines[] = {underline(lineXs[0], c0, false, true),
+                                  underline(lineXs[1], c0, true, true),
+                                  underline(lineXs[2], c1, true, true),
+                                  underline(lineXs[3], c1, true, false),
+                                  underline(lineXs[4], c0, false, true),
+                                  underline(lineXs[5], c0, true, false)};
+  const Rect<CGFloat> boundsLLO = {Range<CGFloat>{0, 70}, Range<CGFloat>{-2.5, -1.5}};
+  const auto clipAndMerge = [&](Rect<CGFloat> clipRect,
+                                ArrayRef<const Range<CGFloat>> expectedXs)
+  {
+    TempVector<Range<CGFloat>> xs;
+    TempVector<DecorationLine> ls;
+    xs.append(lineXs);
+    ls.append(lines);
+    removeLinePartsNotIntersectingClipRectAndMergeIdenticallyStyledAdjacentUnderlines(
+      xs, ls, boundsLLO, clipRect);
+    XCTAssertEqual(xs.count(), expectedXs.count());
+    XCTAssertEqual(ls.count(), expectedXs.count());
+    for (Int i = 0; i < min(xs.count(), expectedXs.count()); ++i) {
+      XCTAssert(xs[i] == expectedXs[i]);
+    }
+    if (!ls.isEmpty()) {
+      XCTAssertFalse(ls[0].isUnderlineContinuation);
+      XCTAssertFalse(ls[$ - 1].hasUnderlineContinuation);
+    }
+  };
+  {
+    // All lines are visible.
+    const Range<CGFloat> xs[] = {{0, 20}, {20, 40}, {50, 70}};
+    clipAndMerge(Rect<CGFloat>{Range<CGFloat>{-10, 100}, Range<CGFloat>{-10, 10}}, xs);
+  }
+  {
+    // The first two and the last line parts are clipped.
+    const Range<CGFloat> xs[] = {{20, 40}, {50, 60}};
+    clipAndMerge(Rect<CGFloat>{Range<CGFloat>{25, 55}, Range<CGFloat>{-10, 10}}, xs);
+  }
+  {
+    // A line part in the middle is clipped.
+    const Range<CGFloat> xs[] = {{0, 20}, {20, 30}};
+    clipAndMerge(Rect<CGFloat>{Range<CGFloat>{5, 25}, Range<CGFloat>{-10, 10}}, xs);
+  }
+  {
+    // The lines aren't visible at all.
+    clipAndMerge(Rect<CGFloat>{Range<CGFloat>{0, 70}, Range<CGFloat>{0, 10}}, {});
+  }
+}
+
+/// Reports the per-line time of drawing text lines with dense underlines, e.g. lines in a table
+/// with many links, relative to drawing the same lines without underlines.
+- (void)testPerLineUnderlineDrawingBenchmark {
+  NSMutableString* const text = [[NSMutableString alloc] init];
+  const int lineCount = 100;
+  for (int i = 0; i < lineCount; ++i) {
+    [text appendString:@"jump quickly | gypsy jig | happy puppy | jolly typography | "
+                        "spying jays | glassy quay\n"];
+  }
+  UIFont* const font = [UIFont fontWithName:@"HelveticaNeue" size:14];
+  NSMutableAttributedString* const underlined = [[NSMutableAttributedString alloc]
+                                                   initWithString:text
+                                                       attributes:@{NSFontAttributeName: font}];
+  NSAttributedString* const plain = [underlined copy];
+  NSArray<UIColor*>* const colors = @[UIColor.blueColor, UIColor.purpleColor];
+  __block int linkIndex = 0;
+  [text enumerateSubstringsInRange:NSRange{0, text.length} options:NSStringEnumerationByWords
+                        usingBlock:^(NSString* __unused word, NSRange range, NSRange __unused r,
+                                     BOOL* __unused stop)
+  {
+    [underlined addAttributes:@{NSUnderlineStyleAttributeName: @(NSUnderlineStyleSingle),
+                                NSForegroundColorAttributeName: colors[linkIndex++ % 2]}
+                        range:range];
+  }];
+
+  const CGSize size = {600, 2000};
+  const auto measure = [&](NSAttributedString* string) -> CFTimeInterval {
+    STUTextFrame* const frame = [[STUTextFrame alloc]
+                                   initWithShapedString:[[STUShapedString alloc]
+                                                           initWithAttributedString:string]
+                                                   size:size displayScale:2 options:nil];
+    XCTAssertEqual([frame layoutInfoForFrameOrigin:CGPointZero].lineCount, lineCount);
+    UIGraphicsBeginImageContextWithOptions(size, false, 2);
+    CFTimeInterval minTime = INFINITY;
+    for (int i = 0; i < 5; ++i) {
+      const CFTimeInterval t0 = CACurrentMediaTime();
+      [frame drawAtPoint:CGPointZero];
+      minTime = fmin(minTime, CACurrentMediaTime() - t0);
+    }
+    UIGraphicsEndImageContext();
+    return minTime;
+  };
+  const CFTimeInterval plainTime = measure(plain);
+  const CFTimeInterval underlinedTime = measure(underlined);
+  NSLog(@"Drawing %d lines with %d underlines each: %.1f µs per line (%.1f µs per line without "
+         "underlines, i.e. %.1f µs per line for the underlines)",
+        lineCount, linkIndex/lineCount, underlinedTime*1e6/lineCount, plainTime*1e6/lineCount,
+        (underlinedTime - plainTime)*1e6/lineCount);
+}
+
+@end
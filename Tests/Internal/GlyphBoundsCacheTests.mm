@@ -6,6 +6,8 @@
 
 #import "GlyphSpan.hpp"
 
+#import "STULabel/STUFontCaches.h"
+
 #import <random>
 
 using namespace stu_label;
@@ -318,6 +320,81 @@ using FontFace = FontFaceGlyphBoundsCache::FontFace;
 
 #endif
 
+- (void)testConcurrentBoundingRectLookups {
+  FontFaceGlyphBoundsCache::clearGlobalCache();
+
+  UIFont* const font = [UIFont fontWithName:@"HelveticaNeue" size:17];
+  const CGFloat fontSize = font.pointSize;
+  const Int glyphCount = CTFontGetGlyphCount((__bridge CTFont*)font);
+  const Int threadCount = 8;
+  FontFaceGlyphBoundsCache* caches[threadCount] = {};
+  FontFaceGlyphBoundsCache** const cachesPointer = caches;
+  _Atomic(Int) mismatchCount = 0;
+  _Atomic(Int)* const mismatchCountPointer = &mismatchCount;
+
+  dispatch_apply(sign_cast(threadCount), dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0),
+                 ^(size_t t)
+  {
+    ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
+    ThreadLocalArenaAllocator alloc{Ref{buffer}};
+    FontFaceGlyphBoundsCache::UniquePtr cache;
+    FontFaceGlyphBoundsCache::exchange(InOut(cache), font, FontFace{font, fontSize});
+    cachesPointer[t] = cache.get();
+    // Every thread looks up all glyphs, starting at a different offset.
+    for (Int i = 0; i < glyphCount; ++i) {
+      const CGGlyph glyph = static_cast<CGGlyph>((i + sign_cast(t)*(glyphCount/threadCount))
+                                                 % glyphCount);
+      const CGPoint position = CGPointZero;
+      const stu_label::Rect<CGFloat> r1 = cache->boundingRect(fontSize, ArrayRef{&glyph, 1},
+                                                              &position);
+      stu_label::Rect<CGFloat> r2 = CTFontGetBoundingRectsForGlyphs((__bridge CTFontRef)font,
+                                                                   kCTFontOrientationHorizontal,
+                                                                   &glyph, nullptr, 1);
+      if (r2.isEmpty()) {
+        r2 = stu_label::Rect<CGFloat>{};
+      }
+      const CGFloat eps = 4*epsilon<CGFloat>*max(r2.width(), r2.height(), CGFloat(1));
+      if (!(abs(r1.x.start - r2.x.start) <= eps && abs(r1.x.end - r2.x.end) <= eps
+            && abs(r1.y.start - r2.y.start) <= eps && abs(r1.y.end - r2.y.end) <= eps))
+      {
+        atomic_fetch_add_explicit(mismatchCountPointer, 1, memory_order_relaxed);
+      }
+    }
+  });
+
+  XCTAssertEqual(atomic_load(&mismatchCount), 0);
+  // All threads share a single cache for the font face.
+  for (const auto cache : caches) {
+    XCTAssert(cache != nullptr && cache == caches[0]);
+  }
+  FontFaceGlyphBoundsCache::UniquePtr cache;
+  FontFaceGlyphBoundsCache::exchange(InOut(cache), font, FontFace{font, fontSize});
+  XCTAssert(cache.get() == caches[0]);
+  XCTAssert(cache->usesIntBounds());
+}
+
+- (void)testPreloadLatin1GlyphBounds {
+  ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
+  ThreadLocalArenaAllocator alloc{Ref{buffer}};
+
+  FontFaceGlyphBoundsCache::clearGlobalCache();
+  UIFont* const font = [UIFont fontWithName:@"HelveticaNeue" size:17];
+  UIFont* const largerFont = [font fontWithSize:51];
+  FontFaceGlyphBoundsCache::preloadLatin1GlyphBounds(largerFont);
+
+  const UniChar characters[] = {'A', 'g', '~', 0xC4, 0xDF, 0xFF};
+  CGGlyph glyphs[arrayLength(characters)];
+  XCTAssert(CTFontGetGlyphsForCharacters((__bridge CTFont*)font, characters, glyphs,
+                                         arrayLength(characters)));
+  const CGPoint positions[arrayLength(characters)] = {{0, 0}, {10, 0}, {20, 1}, {30, -1},
+                                                      {40, 0.5}, {50, -0.5}};
+  FontFaceGlyphBoundsCache::UniquePtr cache;
+  FontFaceGlyphBoundsCache::exchange(InOut(cache), font, FontFace{font, font.pointSize});
+  [self checkBoundingRectWithFont:font glyphs:glyphs positions:positions cache:*cache
+                 maxRelativeError:0];
+  XCTAssert(cache->usesIntBounds());
+}
+
 - (void)testLocalGlyphBoundsCache {
   ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
   ThreadLocalArenaAllocator alloc{Ref{buffer}};
@@ -351,5 +428,132 @@ using FontFace = FontFaceGlyphBoundsCache::FontFace;
   }
 }
 
-@end
+- (void)testLocalFontInfoCache {
+  constexpr Int n = LocalFontInfoCache::entryCount;
+  NSMutableArray<UIFont*>* const fonts = [[NSMutableArray alloc] init];
+  for (Int i = 0; i <= n; ++i) {
+    [fonts addObject:[UIFont fontWithName:@"HelveticaNeue" size:10 + i]];
+  }
+  LocalFontInfoCache cache;
+  for (int k = 0; k < 3; ++k) {
+    for (Int i = 0; i < n; ++i) {
+      const CachedFontInfo& info = cache[(__bridge CTFont*)fonts[i]];
+      XCTAssertEqual(info.metrics.ascent(), CachedFontInfo::get(fonts[i]).metrics.ascent());
+    }
+  }
+  XCTAssertEqual(cache.lookupCount(), 3*n);
+  XCTAssertEqual(cache.globalLookupCount(), n);
+  // Accessing the least recently used entry moves it to the front.
+  XCTAssertEqual(&cache[(__bridge CTFont*)fonts[0]], &cache[(__bridge CTFont*)fonts[0]]);
+  XCTAssertEqual(cache.globalLookupCount(), n);
+  // This evicts fonts[1].
+  discard(cache[(__bridge CTFont*)fonts[n]]);
+  XCTAssertEqual(cache.globalLookupCount(), n + 1);
+  discard(cache[(__bridge CTFont*)fonts[0]]);
+  XCTAssertEqual(cache.globalLookupCount(), n + 1);
+  discard(cache[(__bridge CTFont*)fonts[1]]);
+  XCTAssertEqual(cache.globalLookupCount(), n + 2);
+}
+
+- (void)testLocalFontInfoCacheStatistics {
+  UIFont* const font1 = [UIFont fontWithName:@"HelveticaNeue" size:10];
+  UIFont* const font2 = [UIFont fontWithName:@"HelveticaNeue" size:11];
+  const STUFontCacheStatistics stats0 = stu_fontCacheStatistics();
+  {
+    LocalFontInfoCache cache;
+    discard(cache[(__bridge CTFont*)font1]);
+    discard(cache[(__bridge CTFont*)font1]);
+    discard(cache[(__bridge CTFont*)font2]);
+    discard(cache[(__bridge CTFont*)font1]);
+  }
+  const STUFontCacheStatistics stats1 = stu_fontCacheStatistics();
+  // Other tests may run concurrently, so we only check lower bounds.
+  XCTAssertGreaterThanOrEqual(stats1.localFontInfoCacheHitCount - stats0.localFontInfoCacheHitCount,
+                              2u);
+  XCTAssertGreaterThanOrEqual(stats1.localFontInfoCacheMissCount
+                              - stats0.localFontInfoCacheMissCount, 2u);
+}
+
+- (void)testGlyphBoundsCacheByteBudget {
+  ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
+  ThreadLocalArenaAllocator alloc{Ref{buffer}};
+
+  stu_setFontCacheByteBudgets(SIZE_MAX, SIZE_MAX);
+  FontFaceGlyphBoundsCache::clearGlobalCache();
+  NSArray<UIFont*>* const fonts = @[[UIFont fontWithName:@"HelveticaNeue" size:17],
+                                    [UIFont fontWithName:@"Thonburi" size:17],
+                                    [UIFont fontWithName:@"Helvetica" size:17]];
+  const auto useFont = [](UIFont* font) {
+    LocalGlyphBoundsCache localCache;
+    discard(localCache.glyphBoundsCache(font).boundingRect(CGGlyph{1}, CGPointZero));
+  };
+  const STUFontCacheStatistics stats0 = stu_fontCacheStatistics();
+  for (UIFont* const font in fonts) {
+    useFont(font);
+  }
+  const STUFontCacheStatistics stats1 = stu_fontCacheStatistics();
+  XCTAssertEqual(stats1.glyphBoundsFontFaceCount, stats0.glyphBoundsFontFaceCount + 3);
+  XCTAssertGreaterThan(stats1.glyphBoundsByteSize, stats0.glyphBoundsByteSize);
+  XCTAssertEqual(stats1.glyphBoundsEvictionCount, stats0.glyphBoundsEvictionCount);
+
+  // Lowering the budget evicts the least recently used font face.
+  const size_t budget = stats1.glyphBoundsByteSize - 1;
+  stu_setFontCacheByteBudgets(SIZE_MAX, budget);
+  const STUFontCacheStatistics stats2 = stu_fontCacheStatistics();
+  XCTAssertEqual(stats2.glyphBoundsFontFaceCount, stats1.glyphBoundsFontFaceCount - 1);
+  XCTAssertEqual(stats2.glyphBoundsEvictionCount, stats1.glyphBoundsEvictionCount + 1);
+  XCTAssertLessThanOrEqual(stats2.glyphBoundsByteSize, budget);
+  // The other two font faces are still cached.
+  useFont(fonts[1]);
+  useFont(fonts[2]);
+  XCTAssertEqual(stu_fontCacheStatistics().glyphBoundsFontFaceCount,
+                 stats2.glyphBoundsFontFaceCount);
+
+  // A memory warning trims the cache to the low watermark instead of clearing it.
+  stu_setFontCacheByteBudgets(SIZE_MAX, 4*stats2.glyphBoundsByteSize);
+  trimGlobalFontCachesToLowWatermarks();
+  const STUFontCacheStatistics stats3 = stu_fontCacheStatistics();
+  XCTAssertEqual(stats3.glyphBoundsFontFaceCount, stats2.glyphBoundsFontFaceCount);
+  stu_setFontCacheByteBudgets(SIZE_MAX, 4*stats0.glyphBoundsByteSize);
+  trimGlobalFontCachesToLowWatermarks();
+  const STUFontCacheStatistics stats4 = stu_fontCacheStatistics();
+  XCTAssertLessThanOrEqual(stats4.glyphBoundsByteSize, stats0.glyphBoundsByteSize);
+  XCTAssertEqual(stats4.glyphBoundsFontFaceCount, stats0.glyphBoundsFontFaceCount);
+
+  // The default budgets.
+  stu_setFontCacheByteBudgets(256*1024, 4*1024*1024);
+}
+
+- (void)testFontInfoCacheByteBudget {
+  stu_setFontCacheByteBudgets(SIZE_MAX, SIZE_MAX);
+  for (int i = 0; i < 64; ++i) {
+    discard(CachedFontInfo::get([UIFont fontWithName:@"HelveticaNeue" size:8 + i/4.f]));
+  }
+  const STUFontCacheStatistics stats1 = stu_fontCacheStatistics();
+  XCTAssertGreaterThanOrEqual(stats1.fontInfoCount, 64u);
+
+  const size_t budget = stats1.fontInfoByteSize/2;
+  stu_setFontCacheByteBudgets(budget, SIZE_MAX);
+  const STUFontCacheStatistics stats2 = stu_fontCacheStatistics();
+  XCTAssertLessThanOrEqual(stats2.fontInfoByteSize, budget);
+  XCTAssertGreaterThan(stats2.fontInfoCount, 0u);
+  XCTAssertLessThan(stats2.fontInfoCount, stats1.fontInfoCount);
+  XCTAssertEqual(stats2.fontInfoEvictionCount,
+                 stats1.fontInfoEvictionCount + (stats1.fontInfoCount - stats2.fontInfoCount));
+
+  // Further insertions keep the footprint within the budget.
+  for (int i = 64; i < 128; ++i) {
+    discard(CachedFontInfo::get([UIFont fontWithName:@"HelveticaNeue" size:8 + i/4.f]));
+    XCTAssertLessThanOrEqual(stu_fontCacheStatistics().fontInfoByteSize, budget);
+  }
+  XCTAssertGreaterThan(stu_fontCacheStatistics().fontInfoEvictionCount,
+                       stats2.fontInfoEvictionCount);
+
+  trimGlobalFontCachesToLowWatermarks();
+  XCTAssertLessThanOrEqual(stu_fontCacheStatistics().fontInfoByteSize, budget/4);
 
+  // The default budgets.
+  stu_setFontCacheByteBudgets(256*1024, 4*1024*1024);
+}
+
+@end
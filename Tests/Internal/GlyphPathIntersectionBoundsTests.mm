@@ -0,0 +1,79 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "TestUtils.h"
+
+#import "GlyphPathIntersectionBounds.hpp"
+
+using namespace stu_label;
+
+@interface GlyphPathIntersectionBoundsTests : XCTestCase
+@end
+@implementation GlyphPathIntersectionBoundsTests
+
+- (void)setUp {
+  [super setUp];
+  self.continueAfterFailure = false;
+}
+
+- (void)checkInterval:(Range<CGFloat>)r1 isApproximatelyEqualTo:(Range<CGFloat>)r2
+             accuracy:(CGFloat)accuracy
+{
+  XCTAssertEqual(r1.isEmpty(), r2.isEmpty());
+  if (r1.isEmpty()) return;
+  XCTAssertEqualWithAccuracy(r1.start, r2.start, accuracy);
+  XCTAssertEqualWithAccuracy(r1.end, r2.end, accuracy);
+}
+
+- (void)checkGlyphsOfString:(NSString*)string font:(UIFont*)font
+                 lowerLineY:(Range<CGFloat>)lowerLineY upperLineY:(Range<CGFloat>)upperLineY
+{
+  CTFont* const ctFont = (__bridge CTFont*)font;
+  const Int n = string.length;
+  CGGlyph glyphs[n];
+  unichar characters[n];
+  [string getCharacters:characters range:NSRange{0, sign_cast(n)}];
+  XCTAssert(CTFontGetGlyphsForCharacters(ctFont, characters, glyphs, n));
+
+  const CGFloat maxError = 0.25f;
+  const GlyphPathIntersectionBounds bounds{ctFont};
+  XCTAssert(bounds.isCacheable());
+  for (const CGGlyph glyph : ArrayRef{glyphs, n}) {
+    const CGPathRef path = CTFontCreatePathForGlyph(ctFont, glyph, nullptr);
+    XCTAssert(path);
+    const LowerAndUpperInterval expected = findXBoundsOfPathIntersectionWithHorizontalLines(
+                                             path, lowerLineY, upperLineY, maxError);
+    CFRelease(path);
+    const LowerAndUpperInterval xis = bounds.find(glyph, lowerLineY, upperLineY, maxError);
+    // The cached bounds are computed for the quantized lines.
+    [self checkInterval:xis.lower isApproximatelyEqualTo:expected.lower accuracy:2*maxError];
+    [self checkInterval:xis.upper isApproximatelyEqualTo:expected.upper accuracy:2*maxError];
+    const LowerAndUpperInterval cachedXIs = bounds.find(glyph, lowerLineY, upperLineY, maxError);
+    XCTAssert(cachedXIs.lower == xis.lower);
+    XCTAssert(cachedXIs.upper == xis.upper);
+  }
+}
+
+- (void)testGlyphPathIntersectionBounds {
+  NSString* const string = @"gjpqyQ";
+  for (const CGFloat fontSize : {12.f, 17.f, 23.5f, 64.f}) {
+    UIFont* const font = [UIFont fontWithName:@"HelveticaNeue" size:fontSize];
+    const CGFloat y = -fontSize/8;
+    const CGFloat d = fontSize/32;
+    [self checkGlyphsOfString:string font:font
+                   lowerLineY:Range{y - d, y} upperLineY:Range{y - d, y}];
+    [self checkGlyphsOfString:string font:font
+                   lowerLineY:Range{y - 3*d, y - 2*d} upperLineY:Range{y - d, y}];
+  }
+  GlyphPathIntersectionBounds::clearGlobalCache();
+  [self checkGlyphsOfString:string font:[UIFont fontWithName:@"HelveticaNeue" size:17]
+                 lowerLineY:Range{-2.5, -1.5} upperLineY:Range{-2.5, -1.5}];
+}
+
+- (void)testFontWithNonIdentityMatrixIsNotCacheable {
+  const CGAffineTransform matrix = CGAffineTransformMake(1, 0, 0.2, 1, 0, 0);
+  const RC<CTFont> font{CTFontCreateWithName((__bridge CFStringRef)@"HelveticaNeue", 17, &matrix),
+                        ShouldIncrementRefCount{false}};
+  XCTAssertFalse(GlyphPathIntersectionBounds{font.get()}.isCacheable());
+}
+
+@end
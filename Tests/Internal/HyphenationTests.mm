@@ -0,0 +1,262 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "TestUtils.h"
+
+#import "STULabel/STUHyphenationPatterns.h"
+#import "STULabel/STUTextAttributes.h"
+
+#import "Hyphenation.hpp"
+
+using namespace stu_label;
+
+static NSArray<NSNumber*>* hyphenationIndices(STUHyphenationPatterns* patterns, NSString* word) {
+  NSMutableArray<NSNumber*>* const indices = [[NSMutableArray alloc] init];
+  [[patterns hyphenationLocationsInWord:word]
+     enumerateIndexesUsingBlock:^(NSUInteger index, BOOL* __unused stop) {
+       [indices addObject:@(index)];
+     }];
+  return indices;
+}
+
+static NSArray<NSNumber*>* hyphenationIndices(NSAttributedString* string) {
+  HyphenationLocaleCache localeCache;
+  const HyphenationLocations& locations = HyphenationLocations::create(
+                                            NSAttributedStringRef{string},
+                                            Range<Int>(NSRange{0, string.length}),
+                                            localeCache);
+  NSMutableArray<NSNumber*>* const indices = [[NSMutableArray alloc] init];
+  for (const HyphenationLocation& location : locations.locations()) {
+    [indices addObject:@(location.index)];
+  }
+  HyphenationLocations::destroy(locations);
+  return indices;
+}
+
+/// The patterns from the example in Frank Liang's thesis "Word Hy-phen-a-tion by Com-put-er".
+static NSString* const liangExamplePatterns = @"hy3ph he2n hena4 hen5at 1na n2at 1tio 2io o2n";
+
+@interface HyphenationTests : XCTestCase
+@end
+@implementation HyphenationTests
+
+- (void)setUp {
+  [super setUp];
+  self.continueAfterFailure = false;
+}
+
+- (void)testPatterns {
+  STUHyphenationPatterns* const patterns = [[STUHyphenationPatterns alloc]
+                                              initWithPatterns:liangExamplePatterns
+                                                    exceptions:nil
+                                                 leftHyphenMin:2 rightHyphenMin:3];
+  XCTAssertNotNil(patterns);
+  XCTAssertEqual(patterns.leftHyphenMin, 2);
+  XCTAssertEqual(patterns.rightHyphenMin, 3);
+  XCTAssertEqualObjects(hyphenationIndices(patterns, @"hyphenation"), (@[@2, @6]));
+  XCTAssertEqualObjects(hyphenationIndices(patterns, @"Hyphenation"), (@[@2, @6]));
+  XCTAssertEqualObjects(hyphenationIndices(patterns, @"HYPHENATION"), (@[@2, @6]));
+  XCTAssertEqualObjects(hyphenationIndices(patterns, @"hyphen"), (@[@2]));
+  XCTAssertEqualObjects(hyphenationIndices(patterns, @"dog"), (@[]));
+  XCTAssertEqualObjects(hyphenationIndices(patterns, @""), (@[]));
+
+  // leftHyphenMin and rightHyphenMin.
+  STUHyphenationPatterns* const patterns2 = [[STUHyphenationPatterns alloc]
+                                               initWithPatterns:liangExamplePatterns
+                                                     exceptions:nil
+                                                  leftHyphenMin:3 rightHyphenMin:6];
+  XCTAssertEqualObjects(hyphenationIndices(patterns2, @"hyphenation"), (@[]));
+  STUHyphenationPatterns* const patterns3 = [[STUHyphenationPatterns alloc]
+                                               initWithPatterns:liangExamplePatterns
+                                                     exceptions:nil
+                                                  leftHyphenMin:2 rightHyphenMin:5];
+  XCTAssertEqualObjects(hyphenationIndices(patterns3, @"hyphenation"), (@[@2, @6]));
+
+  // Comments, duplicates and surrounding whitespace.
+  STUHyphenationPatterns* const patterns4 = [[STUHyphenationPatterns alloc]
+                                               initWithPatterns:
+                                                 [NSString stringWithFormat:
+                                                   @"%% comment 1a\n %@\n\thy3ph %% 1y\r\n",
+                                                   liangExamplePatterns]
+                                                     exceptions:nil
+                                                  leftHyphenMin:2 rightHyphenMin:3];
+  XCTAssertEqualObjects(patterns4.compiledData, patterns.compiledData);
+
+  XCTAssertNil([[STUHyphenationPatterns alloc] initWithPatterns:@"a12b" exceptions:nil
+                                                  leftHyphenMin:1 rightHyphenMin:1]);
+  XCTAssertNil([[STUHyphenationPatterns alloc] initWithPatterns:@"a1b 3" exceptions:nil
+                                                  leftHyphenMin:1 rightHyphenMin:1]);
+}
+
+- (void)testExceptions {
+  STUHyphenationPatterns* const patterns = [[STUHyphenationPatterns alloc]
+                                              initWithPatterns:liangExamplePatterns
+                                                    exceptions:@"hyphen-ation ta-ble"
+                                                 leftHyphenMin:2 rightHyphenMin:2];
+  XCTAssertNotNil(patterns);
+  XCTAssertEqualObjects(hyphenationIndices(patterns, @"hyphenation"), (@[@6]));
+  XCTAssertEqualObjects(hyphenationIndices(patterns, @"Table"), (@[@2]));
+  // An exception only applies to the full word.
+  XCTAssertEqualObjects(hyphenationIndices(patterns, @"tables"), (@[]));
+  XCTAssertEqualObjects(hyphenationIndices(patterns, @"hyphen"), (@[@2]));
+
+  XCTAssertNil([[STUHyphenationPatterns alloc] initWithPatterns:@"" exceptions:@"-ab"
+                                                  leftHyphenMin:1 rightHyphenMin:1]);
+  XCTAssertNil([[STUHyphenationPatterns alloc] initWithPatterns:@"" exceptions:@"ab-"
+                                                  leftHyphenMin:1 rightHyphenMin:1]);
+  XCTAssertNil([[STUHyphenationPatterns alloc] initWithPatterns:@"" exceptions:@"a--b"
+                                                  leftHyphenMin:1 rightHyphenMin:1]);
+}
+
+- (void)testCompiledData {
+  STUHyphenationPatterns* const patterns = [[STUHyphenationPatterns alloc]
+                                              initWithPatterns:liangExamplePatterns
+                                                    exceptions:@"ta-ble"
+                                                 leftHyphenMin:2 rightHyphenMin:3];
+  NSData* const data = patterns.compiledData;
+
+  STUHyphenationPatterns* const patterns2 = [[STUHyphenationPatterns alloc]
+                                               initWithCompiledData:data];
+  XCTAssertNotNil(patterns2);
+  XCTAssertEqualObjects(patterns2.compiledData, data);
+  XCTAssertEqual(patterns2.leftHyphenMin, 2);
+  XCTAssertEqual(patterns2.rightHyphenMin, 3);
+  XCTAssertEqualObjects(hyphenationIndices(patterns2, @"hyphenation"), (@[@2, @6]));
+  XCTAssertEqualObjects(hyphenationIndices(patterns2, @"table"), (@[@2]));
+
+  // Unaligned data is copied.
+  NSMutableData* const buffer = [[NSMutableData alloc] initWithLength:data.length + 1];
+  Byte* const unalignedBytes = static_cast<Byte*>(buffer.mutableBytes) + 1;
+  memcpy(unalignedBytes, data.bytes, data.length);
+  STUHyphenationPatterns* const patterns3 = [[STUHyphenationPatterns alloc]
+                                               initWithCompiledData:
+                                                 [NSData dataWithBytesNoCopy:unalignedBytes
+                                                                      length:data.length
+                                                                freeWhenDone:false]];
+  XCTAssertNotNil(patterns3);
+  XCTAssertEqualObjects(patterns3.compiledData, data);
+
+  NSURL* const url = [[NSURL fileURLWithPath:NSTemporaryDirectory()]
+                        URLByAppendingPathComponent:@"STUHyphenationPatternsTest.bin"];
+  XCTAssert([data writeToURL:url atomically:true]);
+  STUHyphenationPatterns* const patterns4 = [[STUHyphenationPatterns alloc]
+                                               initWithContentsOfCompiledFile:url];
+  XCTAssertNotNil(patterns4);
+  XCTAssertEqualObjects(hyphenationIndices(patterns4, @"hyphenation"), (@[@2, @6]));
+  [NSFileManager.defaultManager removeItemAtURL:url error:nil];
+
+  // Truncated or corrupted data is rejected.
+  XCTAssertNil([[STUHyphenationPatterns alloc]
+                  initWithCompiledData:[data subdataWithRange:NSRange{0, data.length - 1}]]);
+  XCTAssertNil([[STUHyphenationPatterns alloc] initWithCompiledData:[NSData data]]);
+  for (NSUInteger i = 0; i < data.length; ++i) {
+    NSMutableData* const corruptedData = [data mutableCopy];
+    static_cast<Byte*>(corruptedData.mutableBytes)[i] ^= 0xff;
+    STUHyphenationPatterns* const corruptedPatterns = [[STUHyphenationPatterns alloc]
+                                                         initWithCompiledData:corruptedData];
+    if (corruptedPatterns) {
+      // A corruption that passes the validation must not lead to out-of-bounds accesses.
+      hyphenationIndices(corruptedPatterns, @"hyphenation");
+    }
+  }
+}
+
+- (void)testRegisteredPatterns {
+  // Core Foundation has no hyphenation support for Klingon.
+  NSString* const localeId = @"tlh";
+  NSAttributedString* const string = [[NSAttributedString alloc]
+                                        initWithString:@"Hyphenation, hyphenation."
+                                            attributes:@{STUHyphenationLocaleIdentifierAttributeName:
+                                                           localeId}];
+  XCTAssertEqualObjects(hyphenationIndices(string), (@[]));
+
+  STUHyphenationPatterns* const patterns = [[STUHyphenationPatterns alloc]
+                                              initWithPatterns:liangExamplePatterns
+                                                    exceptions:nil
+                                                 leftHyphenMin:2 rightHyphenMin:3];
+  [STUHyphenationPatterns registerPatterns:patterns forLocaleIdentifier:localeId];
+  XCTAssertEqual([STUHyphenationPatterns registeredPatternsForLocaleIdentifier:localeId],
+                 patterns);
+  XCTAssertEqualObjects(hyphenationIndices(string), (@[@2, @6, @15, @19]));
+
+  [STUHyphenationPatterns registerPatterns:nil forLocaleIdentifier:localeId];
+  XCTAssertNil([STUHyphenationPatterns registeredPatternsForLocaleIdentifier:localeId]);
+  XCTAssertEqualObjects(hyphenationIndices(string), (@[]));
+}
+
+/// Compares the pattern-based hyphenation with the Core Foundation implementation, using
+/// exceptions generated from the Core Foundation hyphenation locations of the words in the text,
+/// so that both implementations must return the same locations.
+- (void)testPatternHyphenationPerformance {
+  NSString* const localeId = @"en_US";
+  NSString* const paragraph =
+    @"all human beings are born free and equal in dignity and rights they are endowed with "
+     "reason and conscience and should act towards one another in a spirit of brotherhood "
+     "everyone is entitled to all the rights and freedoms set forth in this declaration without "
+     "distinction of any kind such as race colour sex language religion political or other "
+     "opinion national or social origin property birth or other status furthermore no "
+     "distinction shall be made on the basis of the political jurisdictional or international "
+     "status of the country or territory to which a person belongs whether it be independent "
+     "trust nonselfgoverning or under any other limitation of sovereignty\n";
+  NSMutableString* const text = [[NSMutableString alloc] init];
+  const int paragraphCount = 200;
+  for (int i = 0; i < paragraphCount; ++i) {
+    [text appendString:paragraph];
+  }
+  NSAttributedString* const string = [[NSAttributedString alloc]
+                                        initWithString:text
+                                            attributes:@{STUHyphenationLocaleIdentifierAttributeName:
+                                                           localeId}];
+  NSAttributedString* const paragraphString = [string attributedSubstringFromRange:
+                                                        NSRange{0, paragraph.length}];
+
+  NSMutableSet<NSString*>* const words = [[NSMutableSet alloc] init];
+  for (NSString* word in [paragraph componentsSeparatedByCharactersInSet:
+                                      NSCharacterSet.whitespaceAndNewlineCharacterSet])
+  {
+    if (word.length == 0) continue;
+    NSMutableString* const exception = [word mutableCopy];
+    NSArray<NSNumber*>* const indices = hyphenationIndices(
+                                          [[NSAttributedString alloc]
+                                             initWithString:word
+                                                 attributes:
+                                                   @{STUHyphenationLocaleIdentifierAttributeName:
+                                                       localeId}]);
+    for (NSNumber* index in indices.reverseObjectEnumerator) {
+      [exception insertString:@"-" atIndex:index.unsignedIntegerValue];
+    }
+    [words addObject:exception];
+  }
+  STUHyphenationPatterns* const patterns = [[STUHyphenationPatterns alloc]
+                                              initWithPatterns:@""
+                                                    exceptions:[words.allObjects
+                                                                  componentsJoinedByString:@" "]
+                                                 leftHyphenMin:1 rightHyphenMin:1];
+  XCTAssertNotNil(patterns);
+
+  const auto measure = [&]() -> CFTimeInterval {
+    CFTimeInterval minTime = INFINITY;
+    for (int i = 0; i < 5; ++i) {
+      const CFTimeInterval t0 = CACurrentMediaTime();
+      hyphenationIndices(string);
+      minTime = fmin(minTime, CACurrentMediaTime() - t0);
+    }
+    return minTime;
+  };
+
+  NSArray<NSNumber*>* const cfIndices = hyphenationIndices(paragraphString);
+  XCTAssert(cfIndices.count > 0);
+  const CFTimeInterval cfTime = measure();
+
+  [STUHyphenationPatterns registerPatterns:patterns forLocaleIdentifier:localeId];
+  NSArray<NSNumber*>* const patternIndices = hyphenationIndices(paragraphString);
+  const CFTimeInterval patternTime = measure();
+  [STUHyphenationPatterns registerPatterns:nil forLocaleIdentifier:localeId];
+
+  XCTAssertEqualObjects(patternIndices, cfIndices);
+  NSLog(@"Hyphenation of %d paragraphs: CFStringGetHyphenationLocationBeforeIndex: %.2f ms "
+         "(%.0f paragraphs/s), STUHyphenationPatterns: %.2f ms (%.0f paragraphs/s)",
+        paragraphCount, cfTime*1000, paragraphCount/cfTime,
+        patternTime*1000, paragraphCount/patternTime);
+}
+
+@end
@@ -0,0 +1,142 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "TestUtils.h"
+
+#import "Kerning.hpp"
+#import "ThreadLocalAllocator.hpp"
+
+using namespace stu_label;
+
+#if STU_TRUNCATION_TOKEN_KERNING
+
+@interface KerningTests : XCTestCase
+@end
+@implementation KerningTests
+
+- (void)setUp {
+  [super setUp];
+  self.continueAfterFailure = false;
+}
+
+- (void)testKerningAdjustmentCache {
+  ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
+  ThreadLocalArenaAllocator alloc{Ref{buffer}};
+  clearKerningAdjustmentCache();
+
+  UIFont* const font = [UIFont fontWithName:@"HelveticaNeue" size:17];
+  NSAttributedString* const string0 = [[NSAttributedString alloc]
+                                         initWithString:@"A"
+                                             attributes:@{NSFontAttributeName: font}];
+  NSAttributedString* const string1 = [[NSAttributedString alloc]
+                                         initWithString:@"V"
+                                             attributes:@{NSFontAttributeName: font}];
+  CTLine* const line0 = CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)string0);
+  CTLine* const line1 = CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)string1);
+  const NSAttributedStringRef ref0{string0};
+  const NSAttributedStringRef ref1{string1};
+  const auto glyph0 = GlyphForKerningPurposes::find(glyphRuns(line0)[0], ref0, rightmostGlyph);
+  const auto glyph1 = GlyphForKerningPurposes::find(glyphRuns(line1)[0], ref1, leftmostGlyph);
+  XCTAssert(glyph0.glyph && glyph1.glyph);
+
+  const Optional<Float64> adjustment = kerningAdjustment(glyph0, ref0.string,
+                                                         glyph1, ref1.string);
+  XCTAssert(adjustment != none);
+  // Helvetica Neue has a negative kerning value for the pair "AV".
+  XCTAssertLessThan(*adjustment, 0);
+  const KerningAdjustmentCacheStatistics stats0 = kerningAdjustmentCacheStatistics();
+  XCTAssertEqual(stats0.entryCount, 1);
+
+  const Optional<Float64> adjustment2 = kerningAdjustment(glyph0, ref0.string,
+                                                          glyph1, ref1.string);
+  XCTAssert(adjustment2 != none);
+  XCTAssertEqual(*adjustment2, *adjustment);
+  const KerningAdjustmentCacheStatistics stats1 = kerningAdjustmentCacheStatistics();
+  XCTAssertEqual(stats1.entryCount, 1);
+  XCTAssertEqual(stats1.hitCount, stats0.hitCount + 1);
+  XCTAssertEqual(stats1.missCount, stats0.missCount);
+
+  // Equal attribute dictionaries that aren't identical map to the same entry.
+  NSAttributedString* const string0b = [[NSAttributedString alloc]
+                                          initWithString:@"A"
+                                              attributes:[NSDictionary dictionaryWithDictionary:
+                                                            @{NSFontAttributeName: font}]];
+  CTLine* const line0b = CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)string0b);
+  const NSAttributedStringRef ref0b{string0b};
+  const auto glyph0b = GlyphForKerningPurposes::find(glyphRuns(line0b)[0], ref0b, rightmostGlyph);
+  const Optional<Float64> adjustment3 = kerningAdjustment(glyph0b, ref0b.string,
+                                                          glyph1, ref1.string);
+  XCTAssert(adjustment3 != none);
+  XCTAssertEqual(*adjustment3, *adjustment);
+  const KerningAdjustmentCacheStatistics stats1b = kerningAdjustmentCacheStatistics();
+  XCTAssertEqual(stats1b.entryCount, 1);
+  XCTAssertEqual(stats1b.hitCount, stats1.hitCount + 1);
+  XCTAssertEqual(stats1b.missCount, stats1.missCount);
+  CFRelease(line0b);
+
+  // The reversed pair has a different key.
+  discard(kerningAdjustment(glyph1, ref1.string, glyph0, ref0.string));
+  const KerningAdjustmentCacheStatistics stats2 = kerningAdjustmentCacheStatistics();
+  XCTAssertEqual(stats2.entryCount, 2);
+  XCTAssertEqual(stats2.missCount, stats1b.missCount + 1);
+
+  clearKerningAdjustmentCache();
+  XCTAssertEqual(kerningAdjustmentCacheStatistics().entryCount, 0);
+
+  CFRelease(line1);
+  CFRelease(line0);
+}
+
+- (void)testKerningAdjustmentCacheWithSeveralEqualKeysExceptAttributes {
+  ThreadLocalArenaAllocator::InitialBuffer<2048> buffer;
+  ThreadLocalArenaAllocator alloc{Ref{buffer}};
+  clearKerningAdjustmentCache();
+
+  UIFont* const font = [UIFont fontWithName:@"HelveticaNeue" size:17];
+  const auto attributes = [&](UIColor* color) -> NSDictionary* {
+    return [NSDictionary dictionaryWithDictionary:@{NSFontAttributeName: font,
+                                                    NSForegroundColorAttributeName: color}];
+  };
+  NSAttributedString* const string1 = [[NSAttributedString alloc]
+                                         initWithString:@"V"
+                                             attributes:@{NSFontAttributeName: font}];
+  CTLine* const line1 = CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)string1);
+  const NSAttributedStringRef ref1{string1};
+  const auto glyph1 = GlyphForKerningPurposes::find(glyphRuns(line1)[0], ref1, leftmostGlyph);
+
+  const auto adjustment = [&](NSDictionary* attributes0) -> Optional<Float64> {
+    NSAttributedString* const string0 = [[NSAttributedString alloc] initWithString:@"A"
+                                                                        attributes:attributes0];
+    CTLine* const line0 = CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)string0);
+    const NSAttributedStringRef ref0{string0};
+    const auto glyph0 = GlyphForKerningPurposes::find(glyphRuns(line0)[0], ref0, rightmostGlyph);
+    const Optional<Float64> result = kerningAdjustment(glyph0, ref0.string, glyph1, ref1.string);
+    CFRelease(line0);
+    return result;
+  };
+
+  const Optional<Float64> redAdjustment = adjustment(attributes(UIColor.redColor));
+  const Optional<Float64> blueAdjustment = adjustment(attributes(UIColor.blueColor));
+  XCTAssert(redAdjustment != none && blueAdjustment != none);
+  const KerningAdjustmentCacheStatistics stats0 = kerningAdjustmentCacheStatistics();
+  XCTAssertEqual(stats0.entryCount, 2);
+
+  // Both entries only differ from the key in the identity of the attribute dictionaries, and the
+  // lookup must find the equal one even if it isn't the first such entry.
+  for (UIColor* color in @[UIColor.blueColor, UIColor.redColor]) {
+    const Optional<Float64> adjustment2 = adjustment(attributes(color));
+    XCTAssert(adjustment2 != none);
+    XCTAssertEqual(*adjustment2,
+                   [color isEqual:UIColor.redColor] ? *redAdjustment : *blueAdjustment);
+  }
+  const KerningAdjustmentCacheStatistics stats1 = kerningAdjustmentCacheStatistics();
+  XCTAssertEqual(stats1.entryCount, 2);
+  XCTAssertEqual(stats1.hitCount, stats0.hitCount + 2);
+  XCTAssertEqual(stats1.missCount, stats0.missCount);
+
+  clearKerningAdjustmentCache();
+  CFRelease(line1);
+}
+
+@end
+
+#endif // STU_TRUNCATION_TOKEN_KERNING
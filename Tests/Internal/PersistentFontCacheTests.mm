@@ -0,0 +1,120 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "TestUtils.h"
+
+#import "PersistentFontCache.hpp"
+
+using namespace stu_label;
+
+static PersistentFontCache::GlyphBoundsPage testPage(UInt32 index, Int16 value) {
+  PersistentFontCache::GlyphBoundsPage page;
+  page.index = index;
+  page.reserved = 0;
+  for (Int i = 0; i < FontFaceGlyphBoundsCache::pageSize; ++i) {
+    const Int16 x = narrow_cast<Int16>(value + i);
+    page.intBounds[i] = bit_cast<UInt64>(Rect<Int16>{Range{x, narrow_cast<Int16>(x + 1)},
+                                                     Range{x, narrow_cast<Int16>(x + 2)}});
+  }
+  return page;
+}
+
+static bool operator==(const PersistentFontCache::GlyphBoundsPage& lhs,
+                       const PersistentFontCache::GlyphBoundsPage& rhs)
+{
+  return memcmp(&lhs, &rhs, sizeof(lhs)) == 0;
+}
+
+@interface PersistentFontCacheTests : XCTestCase
+@end
+@implementation PersistentFontCacheTests {
+  NSString* _path;
+}
+
+- (void)setUp {
+  [super setUp];
+  self.continueAfterFailure = false;
+  _path = [NSTemporaryDirectory() stringByAppendingPathComponent:
+             [NSString stringWithFormat:@"PersistentFontCacheTests-%@", NSUUID.UUID.UUIDString]];
+}
+
+- (void)tearDown {
+  [NSFileManager.defaultManager removeItemAtPath:_path error:nil];
+  [super tearDown];
+}
+
+- (void)testWriteAndFind {
+  UIFont* const font = [UIFont fontWithName:@"HelveticaNeue" size:17];
+  UIFont* const largerFont = [font fontWithSize:18];
+  UIFont* const boldFont = [UIFont fontWithName:@"HelveticaNeue-Bold" size:17];
+  const char* const path = _path.fileSystemRepresentation;
+
+  const PersistentFontCache emptyCache{path};
+  XCTAssert(emptyCache.isEmpty());
+  XCTAssert(!emptyCache.findFontInfo(font));
+
+  Vector<PersistentFontCache::GlyphBoundsPage> pages;
+  pages.append(testPage(0, 1));
+  pages.append(testPage(2, 100));
+  const PersistentFontCache::FontInfoEntry fontInfos[] = {
+    {RC<CTFont>{(__bridge CTFont*)font}, CachedFontInfo::get(font)}
+  };
+  const PersistentFontCache::GlyphBoundsEntry glyphBounds[] = {
+    {RC<CTFont>{(__bridge CTFont*)font}, 0, std::move(pages)}
+  };
+  XCTAssert(emptyCache.writeFile(path, fontInfos, glyphBounds));
+
+  const PersistentFontCache cache{path};
+  XCTAssertFalse(cache.isEmpty());
+  const Optional<CachedFontInfo> info = cache.findFontInfo(font);
+  XCTAssert(info);
+  XCTAssertEqual(info->metrics.ascent(), CachedFontInfo::get(font).metrics.ascent());
+  XCTAssertEqual(info->underlineThickness, CachedFontInfo::get(font).underlineThickness);
+  // The font size is part of the font info key.
+  XCTAssert(!cache.findFontInfo(largerFont));
+  XCTAssert(!cache.findFontInfo(boldFont));
+
+  // The glyph bounds are stored independently of the font size.
+  for (UIFont* const f in @[font, largerFont]) {
+    const ArrayRef<const PersistentFontCache::GlyphBoundsPage> foundPages =
+      cache.findGlyphBounds(f, 0);
+    XCTAssertEqual(foundPages.count(), 2);
+    XCTAssert(foundPages[0] == testPage(0, 1));
+    XCTAssert(foundPages[1] == testPage(2, 100));
+  }
+  XCTAssert(cache.findGlyphBounds(font, 17).isEmpty());
+  XCTAssert(cache.findGlyphBounds(boldFont, 0).isEmpty());
+
+  // Writing new entries preserves the old ones.
+  const PersistentFontCache::FontInfoEntry boldFontInfos[] = {
+    {RC<CTFont>{(__bridge CTFont*)boldFont}, CachedFontInfo::get(boldFont)}
+  };
+  XCTAssert(cache.writeFile(path, boldFontInfos, {}));
+  const PersistentFontCache updatedCache{path};
+  XCTAssert(updatedCache.findFontInfo(font));
+  XCTAssert(updatedCache.findFontInfo(boldFont));
+  XCTAssertEqual(updatedCache.findGlyphBounds(font, 0).count(), 2);
+  // The old mapping stays valid after the file was replaced.
+  XCTAssert(cache.findFontInfo(font));
+  XCTAssert(!cache.findFontInfo(boldFont));
+}
+
+- (void)testInvalidFileIsIgnored {
+  UIFont* const font = [UIFont fontWithName:@"HelveticaNeue" size:17];
+  const char* const path = _path.fileSystemRepresentation;
+  const PersistentFontCache::FontInfoEntry fontInfos[] = {
+    {RC<CTFont>{(__bridge CTFont*)font}, CachedFontInfo::get(font)}
+  };
+  XCTAssert(PersistentFontCache{path}.writeFile(path, fontInfos, {}));
+  XCTAssert(PersistentFontCache{path}.findFontInfo(font));
+
+  NSMutableData* const data = [NSMutableData dataWithContentsOfFile:_path];
+  // Truncated file.
+  [[data subdataWithRange:NSRange{0, data.length - 1}] writeToFile:_path atomically:false];
+  XCTAssert(PersistentFontCache{path}.isEmpty());
+  // Corrupted magic number.
+  static_cast<Byte*>(data.mutableBytes)[0] ^= 1;
+  [data writeToFile:_path atomically:false];
+  XCTAssert(PersistentFontCache{path}.isEmpty());
+}
+
+@end
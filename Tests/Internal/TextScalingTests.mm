@@ -0,0 +1,97 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "TestUtils.h"
+
+#import "STULabel/STUShapedString-Internal.hpp"
+#import "STULabel/STUTextFrameOptions-Internal.hpp"
+
+#import "TextFrameLayouter.hpp"
+
+using namespace stu_label;
+
+@interface TextScalingTests : XCTestCase
+@end
+@implementation TextScalingTests
+
+struct ScalingTestCase {
+  NSString* text;
+  CGFloat fontSize;
+  CGSize frameSize;
+  Int32 maxLineCount;
+};
+
+static STUShapedString* shapedString(NSString* text, CGFloat fontSize) {
+  UIFont* const font = [UIFont fontWithName:@"HelveticaNeue" size:fontSize];
+  return [[STUShapedString alloc]
+            initWithAttributedString:[[NSAttributedString alloc]
+                                        initWithString:text
+                                            attributes:@{NSFontAttributeName: font}]
+            defaultBaseWritingDirection:STUWritingDirectionLeftToRight];
+}
+
+static STUTextFrameOptions* scalingOptions(Int32 maxLineCount, CGFloat minScale,
+                                           CGFloat stepSize)
+{
+  return [[STUTextFrameOptions alloc] initWithBlock:^(STUTextFrameOptionsBuilder* builder) {
+           builder.maximumNumberOfLines = maxLineCount;
+           builder.minimumTextScaleFactor = minScale;
+           builder.textScaleFactorStepSize = stepSize;
+         }];
+}
+
+static ArrayRef<const ScalingTestCase> scalingTestCases() {
+  static const ScalingTestCase cases[] = {
+    {@"Breaking: Heavy rain and strong winds expected across the region this weekend",
+     40, {320, 90}, 2},
+    {@"Breaking: Heavy rain and strong winds expected across the region this weekend",
+     40, {320, 200}, 0},
+    {@"The quick brown fox jumps over the lazy dog.\nPack my box with five dozen liquor jugs.\n"
+      "How vexingly quick daft zebras jump!",
+     30, {250, 180}, 0},
+    {@"Sphinx of black quartz, judge my vow. The five boxing wizards jump quickly. "
+      "Jackdaws love my big sphinx of quartz.",
+     24, {200, 120}, 4},
+    {@"Supercalifragilisticexpialidocious antidisestablishmentarianism",
+     36, {180, 100}, 3}
+  };
+  return cases;
+}
+
+/// Reports the number of layout iterations and the wall time of the scale factor search, which
+/// estimates candidate scales from line break profiles that are recorded once per paragraph.
+- (void)testScaleFactorSearchLayoutCallCount {
+  const CGFloat minScale = 0.1;
+  const CGFloat stepSize = 1/128.0;
+  // A plain bisection of [minScale, 1] with this step size needs 7 layouts, plus the initial
+  // layout and the two layouts around the initial estimate.
+  const UInt32 maxLayoutCallCount = 12;
+  for (const ScalingTestCase& tc : scalingTestCases()) {
+    STUShapedString* const string = shapedString(tc.text, tc.fontSize);
+    STUTextFrameOptions* const options = scalingOptions(tc.maxLineCount, minScale, stepSize);
+    ThreadLocalArenaAllocator::InitialBuffer<4096> buffer;
+    ThreadLocalArenaAllocator alloc{Ref{buffer}};
+    TextFrameLayouter layouter{*string->shapedString,
+                               Range<Int32>{0, narrow_cast<Int32>(tc.text.length)},
+                               STUDefaultTextAlignmentLeft, nullptr};
+    const CFTimeInterval t0 = CACurrentMediaTime();
+    layouter.layoutAndScale(Size<Float64>{tc.frameSize}, none, options->_options);
+    const CFTimeInterval t1 = CACurrentMediaTime();
+    const CGFloat scale = layouter.scaleInfo().scale;
+    NSLog(@"Scale factor search: scale %.4f, %u layout calls, %.3f ms, text: \"%@\"",
+          scale, layouter.layoutCallCount(), (t1 - t0)*1000, tc.text);
+    XCTAssertLessThan(scale, 1);
+    XCTAssertGreaterThanOrEqual(scale, minScale);
+    XCTAssertLessThanOrEqual(layouter.layoutCallCount(), maxLayoutCallCount);
+
+    // STUTextFrame uses the same search and the text must fit with the found scale factor.
+    STUTextFrame* const frame = [[STUTextFrame alloc] initWithShapedString:string
+                                                                      size:tc.frameSize
+                                                              displayScale:0
+                                                                   options:options];
+    const STUTextFrameLayoutInfo info = [frame layoutInfoForFrameOrigin:CGPointZero];
+    XCTAssertEqual(info.textScaleFactor, scale);
+    XCTAssertFalse(info.flags & STUTextFrameIsTruncated);
+  }
+}
+
+@end
@@ -0,0 +1,104 @@
+// Copyright 2018 Stephan Tolksdorf
+
+#import "TestUtils.h"
+
+#import "TokenLineCache.hpp"
+
+using namespace stu_label;
+
+@interface TokenLineCacheTests : XCTestCase
+@end
+@implementation TokenLineCacheTests
+
+- (void)setUp {
+  [super setUp];
+  self.continueAfterFailure = false;
+}
+
+- (void)testCreateLine {
+  TokenLineCache::clearGlobalCache();
+  UIFont* const font = [UIFont fontWithName:@"HelveticaNeue" size:17];
+  NSAttributedString* const token = [[NSAttributedString alloc]
+                                       initWithString:@"…"
+                                           attributes:@{NSFontAttributeName: font}];
+  const TokenLineCache::Line line1 = TokenLineCache::createLine(token);
+  XCTAssertEqual(line1.width, CTLineGetTypographicBounds(line1.line, nullptr, nullptr, nullptr));
+  XCTAssertGreaterThan(line1.width, 0);
+
+  // An equal token with a different identity is mapped to the same line.
+  NSAttributedString* const equalToken = [[NSAttributedString alloc]
+                                            initWithString:@"…"
+                                                attributes:@{NSFontAttributeName: font}];
+  const TokenLineCache::Line line2 = TokenLineCache::createLine(equalToken);
+  XCTAssertEqual(line2.line, line1.line);
+  XCTAssertEqual(line2.width, line1.width);
+
+  // Tokens with different attributes are mapped to different lines.
+  NSAttributedString* const largerToken = [[NSAttributedString alloc]
+                                             initWithString:@"…"
+                                                 attributes:@{NSFontAttributeName:
+                                                                [font fontWithSize:34]}];
+  const TokenLineCache::Line line3 = TokenLineCache::createLine(largerToken);
+  XCTAssertNotEqual(line3.line, line1.line);
+  XCTAssertGreaterThan(line3.width, line1.width);
+
+  NSAttributedString* const coloredToken = [[NSAttributedString alloc]
+                                              initWithString:@"…"
+                                                  attributes:@{NSFontAttributeName: font,
+                                                               NSForegroundColorAttributeName:
+                                                                 UIColor.redColor}];
+  const TokenLineCache::Line line4 = TokenLineCache::createLine(coloredToken);
+  XCTAssertNotEqual(line4.line, line1.line);
+
+  CFRelease(line4.line);
+  CFRelease(line3.line);
+  CFRelease(line2.line);
+  CFRelease(line1.line);
+}
+
+- (void)testCreateLineWithKey {
+  TokenLineCache::clearGlobalCache();
+  UIFont* const font = [UIFont fontWithName:@"HelveticaNeue" size:17];
+  NSAttributedString* const string = [[NSAttributedString alloc]
+                                        initWithString:@"a‐"
+                                            attributes:@{NSFontAttributeName: font}];
+  Int createCount = 0;
+  const auto createLine = [&](const TokenLineCache::Key& key) -> CTLine* {
+    ++createCount;
+    return CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)key.attributedString);
+  };
+  const TokenLineCache::Key key = {string, (__bridge CTFont*)font, 1};
+  const TokenLineCache::Line line1 = TokenLineCache::createLine(key, createLine);
+  const TokenLineCache::Line line2 = TokenLineCache::createLine(key, createLine);
+  XCTAssertEqual(createCount, 1);
+  XCTAssertEqual(line2.line, line1.line);
+
+  // The font and the value are part of the key.
+  const TokenLineCache::Key keyWithDifferentValue = {string, (__bridge CTFont*)font, 2};
+  const TokenLineCache::Line line3 = TokenLineCache::createLine(keyWithDifferentValue, createLine);
+  XCTAssertEqual(createCount, 2);
+  const TokenLineCache::Key keyWithoutFont = {string, nullptr, 1};
+  const TokenLineCache::Line line4 = TokenLineCache::createLine(keyWithoutFont, createLine);
+  XCTAssertEqual(createCount, 3);
+  XCTAssertNotEqual(line4.line, line1.line);
+
+#if STU_DEBUG
+  const Int hitCount = TokenLineCache::globalCacheHitCount();
+  CFRelease(TokenLineCache::createLine(keyWithoutFont, createLine).line);
+  XCTAssertEqual(TokenLineCache::globalCacheHitCount(), hitCount + 1);
+#endif
+
+  // Clearing the cache doesn't invalidate the returned lines.
+  TokenLineCache::clearGlobalCache();
+  XCTAssertEqual(CTLineGetGlyphCount(line1.line), 2);
+  const TokenLineCache::Line line5 = TokenLineCache::createLine(key, createLine);
+  XCTAssertEqual(createCount, 4);
+
+  CFRelease(line5.line);
+  CFRelease(line4.line);
+  CFRelease(line3.line);
+  CFRelease(line2.line);
+  CFRelease(line1.line);
+}
+
+@end
@@ -75,4 +75,37 @@ class SwiftWrapperTests: XCTestCase {
     XCTAssertEqual(line.descent, CGFloat(Float32(-font.descender)))
     XCTAssertEqual(line.leading, expectedLeading)
   }
+
+  func testTextRectsCaching() {
+    let tf = STUTextFrame(STUShapedString(NSAttributedString("Test test", [.font: font])),
+                          size: CGSize(width: 100, height: 100),
+                          displayScale: 0)
+    let range = tf.indices
+    let rects = tf.rects(for: range, frameOrigin: .zero)
+    XCTAssert(tf.rects(for: range, frameOrigin: .zero) === rects)
+    let shiftedRects = tf.rects(for: range, frameOrigin: CGPoint(x: 1, y: 2))
+    XCTAssert(shiftedRects !== rects)
+    XCTAssertEqual(shiftedRects.bounds, rects.bounds.offsetBy(dx: 1, dy: 2))
+    XCTAssert(tf.rects(for: range, frameOrigin: .zero) === rects)
+
+    let path1 = rects.createPath(withEdgeInsets: .zero, cornerRadius: 2,
+                                 extendTextLinesToCommonHorizontalBounds: true,
+                                 fillTextLineGaps: true, transform: nil)
+    let path2 = rects.createPath(withEdgeInsets: .zero, cornerRadius: 2,
+                                 extendTextLinesToCommonHorizontalBounds: true,
+                                 fillTextLineGaps: true, transform: nil)
+    let path3 = rects.createPath(withEdgeInsets: .zero, cornerRadius: 2,
+                                 extendTextLinesToCommonHorizontalBounds: true,
+                                 fillTextLineGaps: true, transform: nil)
+    let path4 = rects.createPath(withEdgeInsets: .zero, cornerRadius: 3,
+                                 extendTextLinesToCommonHorizontalBounds: true,
+                                 fillTextLineGaps: true, transform: nil)
+    // The first call returns a new path and caches a copy of it. Later calls with the same
+    // parameters must return the cached path object, not just an equal path.
+    XCTAssertEqual(path1, path2)
+    XCTAssert(path1 !== path2)
+    XCTAssert(path2 === path3)
+    XCTAssert(path4 !== path2)
+    XCTAssertNotEqual(path4, path2)
+  }
 }
@@ -4,6 +4,20 @@ import STULabelSwift
 
 import XCTest
 
+/// Draws the text frame at the origin of an opaque white image with the specified size.
+private func image(_ frame: STUTextFrame, size: CGSize, displayScale: CGFloat,
+                   options: STUTextFrame.DrawingOptions? = nil) -> UIImage
+{
+  let cgImage = stu_createCGImage(size: size, scale: displayScale,
+                                  backgroundColor: UIColor.white.cgColor,
+                                  STUCGImageFormat(.rgb, [.withoutAlphaChannel]),
+                                  { context in
+                                    frame.draw(in: context, contextBaseCTM_d: 1,
+                                               pixelAlignBaselines: true, options: options)
+                                  })!
+  return UIImage(cgImage: cgImage, scale: displayScale, orientation: .up)
+}
+
 class TextFrameDrawingTests: SnapshotTestCase {
   let displayScale: CGFloat = 2
 
@@ -157,4 +171,215 @@ class TextFrameDrawingTests: SnapshotTestCase {
 
     self.checkSnapshotImage(pdfImage, referenceImage: referencePDFImage)
   }
+
+  func testCompactLineStorage() {
+    let font = UIFont(name: "HelveticaNeue", size: 18)!
+    let paraStyle = NSMutableParagraphStyle()
+    paraStyle.firstLineHeadIndent = 10
+    paraStyle.headIndent = 5
+    let attributedString = NSAttributedString("Apple Banana\tCherry Durian Elderberry Fig",
+                                              [.font: font, .paragraphStyle: paraStyle,
+                                               .underlineStyle: NSUnderlineStyle.single.rawValue])
+    let shapedString = STUShapedString(attributedString)
+    let size = CGSize(width: 120, height: 1000)
+    let frame = STUTextFrame(shapedString, size: size, displayScale: displayScale, options: nil)
+    let compactFrame = STUTextFrame(shapedString, size: size, displayScale: displayScale,
+                                    options: STUTextFrameOptions { (b) in
+                                               b.usesCompactLineStorage = true
+                                             })
+    XCTAssertGreaterThan(frame.lines.count, 1)
+    XCTAssertEqual(compactFrame.lines.count, frame.lines.count)
+    for (line, compactLine) in zip(frame.lines, compactFrame.lines) {
+      XCTAssertNotNil(line._ctLine)
+      XCTAssertNil(compactLine._ctLine)
+      XCTAssertEqual(compactLine.rangeInOriginalString, line.rangeInOriginalString)
+      XCTAssertEqual(compactLine.typographicBounds, line.typographicBounds)
+    }
+    XCTAssertEqual(compactFrame.imageBounds(frameOrigin: .zero),
+                   frame.imageBounds(frameOrigin: .zero))
+    // Hit-testing a compact frame uses the glyph offset index of the recreated lines.
+    for line in frame.lines {
+      for x in stride(from: frame.layoutBounds.minX, to: frame.layoutBounds.maxX, by: 3) {
+        let point = CGPoint(x: x, y: line.baselineOrigin.y)
+        let range = frame.rangeOfGraphemeCluster(closestTo: point,
+                                                 ignoringTrailingWhitespace: true,
+                                                 frameOrigin: .zero)
+        let compactRange = compactFrame.rangeOfGraphemeCluster(closestTo: point,
+                                                               ignoringTrailingWhitespace: true,
+                                                               frameOrigin: .zero)
+        XCTAssertEqual(compactRange.bounds, range.bounds)
+        XCTAssertEqual(compactRange.isLigatureFraction, range.isLigatureFraction)
+      }
+    }
+
+    let imageSize = CGSize(width: ceil(frame.layoutBounds.maxX + 2),
+                           height: ceil(frame.layoutBounds.maxY + 2))
+    self.checkSnapshotImage(image(compactFrame, size: imageSize, displayScale: displayScale),
+                            referenceImage: image(frame, size: imageSize,
+                                                  displayScale: displayScale))
+  }
+
+  func testSerializedTextFrame() {
+    let font = UIFont(name: "HelveticaNeue", size: 18)!
+    let attributedString = NSAttributedString("Apple Banana Cherry\nDurian Elderberry Fig",
+                                              [.font: font,
+                                               .foregroundColor: UIColor.blue,
+                                               .underlineStyle: NSUnderlineStyle.single.rawValue])
+    let shapedString = STUShapedString(attributedString)
+    let size = CGSize(width: 120, height: 1000)
+    let frame = STUTextFrame(shapedString, size: size, displayScale: displayScale, options: nil)
+    let data = frame.serializedData()!
+    let loadedFrame = STUTextFrame(serializedData: data, shapedString: shapedString)!
+    XCTAssert(type(of: loadedFrame) == STUTextFrame.self)
+    weak var weakLoadedFrame: STUTextFrame?
+    autoreleasepool {
+      let frame = STUTextFrame(serializedData: data, shapedString: shapedString)!
+      weakLoadedFrame = frame
+      XCTAssertNotNil(weakLoadedFrame)
+    }
+    XCTAssertNil(weakLoadedFrame)
+    XCTAssertEqual(loadedFrame.lines.count, frame.lines.count)
+    for (line, loadedLine) in zip(frame.lines, loadedFrame.lines) {
+      XCTAssertNil(loadedLine._ctLine)
+      XCTAssertEqual(loadedLine.rangeInOriginalString, line.rangeInOriginalString)
+      XCTAssertEqual(loadedLine.typographicBounds, line.typographicBounds)
+    }
+    XCTAssertEqual(loadedFrame.layoutBounds, frame.layoutBounds)
+    XCTAssertEqual(loadedFrame.imageBounds(frameOrigin: .zero),
+                   frame.imageBounds(frameOrigin: .zero))
+    XCTAssertEqual(loadedFrame.serializedData(), data)
+
+    let imageSize = CGSize(width: ceil(frame.layoutBounds.maxX + 2),
+                           height: ceil(frame.layoutBounds.maxY + 2))
+    self.checkSnapshotImage(image(loadedFrame, size: imageSize, displayScale: displayScale),
+                            referenceImage: image(frame, size: imageSize,
+                                                  displayScale: displayScale))
+
+    let otherShapedString = STUShapedString(NSAttributedString("Apple Banana Cherry\nDurian",
+                                                               [.font: font]))
+    XCTAssertNil(STUTextFrame(serializedData: data, shapedString: otherShapedString))
+    // The same text with different attributes.
+    let largerFontShapedString = STUShapedString(
+      NSAttributedString(attributedString.string,
+                         [.font: font.withSize(19),
+                          .foregroundColor: UIColor.blue,
+                          .underlineStyle: NSUnderlineStyle.single.rawValue]))
+    XCTAssertNil(STUTextFrame(serializedData: data, shapedString: largerFontShapedString))
+    let paragraphStyle = NSMutableParagraphStyle()
+    paragraphStyle.paragraphSpacing = 10
+    let paragraphSpacingShapedString = STUShapedString(
+      NSAttributedString(attributedString.string,
+                         [.font: font,
+                          .foregroundColor: UIColor.blue,
+                          .underlineStyle: NSUnderlineStyle.single.rawValue,
+                          .paragraphStyle: paragraphStyle]))
+    XCTAssertNil(STUTextFrame(serializedData: data, shapedString: paragraphSpacingShapedString))
+    let minimumBaselineDistanceShapedString = STUShapedString(
+      NSAttributedString(attributedString.string,
+                         [.font: font,
+                          .foregroundColor: UIColor.blue,
+                          .underlineStyle: NSUnderlineStyle.single.rawValue,
+                          .stuParagraphStyle: STUParagraphStyle { b in
+                                                b.minimumBaselineDistance = 30
+                                              }]))
+    XCTAssertNil(STUTextFrame(serializedData: data,
+                              shapedString: minimumBaselineDistanceShapedString))
+
+    // Fonts that only differ in their font features.
+    let digitsString = "0123 1111"
+    let systemFont = UIFont.systemFont(ofSize: 18)
+    let digitsFrame = STUTextFrame(STUShapedString(NSAttributedString(digitsString,
+                                                                      [.font: systemFont])),
+                                   size: size, displayScale: displayScale, options: nil)
+    let monospacedDigitsShapedString = STUShapedString(
+      NSAttributedString(digitsString, [.font: UIFont.monospacedDigitSystemFont(ofSize: 18,
+                                                                                weight: .regular)]))
+    XCTAssertNil(STUTextFrame(serializedData: digitsFrame.serializedData()!,
+                              shapedString: monospacedDigitsShapedString))
+    // An equal string with a different identity.
+    XCTAssertNotNil(STUTextFrame(serializedData: data,
+                                 shapedString: STUShapedString(
+                                   NSAttributedString(attributedString: attributedString))))
+    XCTAssertNil(STUTextFrame(serializedData: data.subdata(in: 0..<(data.count - 1)),
+                              shapedString: shapedString))
+
+    let truncatedFrame = STUTextFrame(shapedString, size: size, displayScale: displayScale,
+                                      options: STUTextFrameOptions { (b) in
+                                                 b.maximumNumberOfLines = 1
+                                               })
+    XCTAssertNil(truncatedFrame.serializedData())
+  }
+
+  func testDisplayListReplay() {
+    let font = UIFont(name: "HelveticaNeue", size: 18)!
+    let shadow = NSShadow()
+    shadow.shadowOffset = CGSize(width: 1, height: 2)
+    shadow.shadowBlurRadius = 2
+    shadow.shadowColor = UIColor.gray
+    let string = NSMutableAttributedString("Apple Banana Cherry\nDurian ",
+                                           [.font: font, .foregroundColor: UIColor.blue])
+    string.append(NSAttributedString("Elderberry", [.font: font,
+                                                    .link: URL(string: "https://example.com")!]))
+    string.append(NSAttributedString(" Fig\nGrape", [.font: font,
+                                                      .underlineStyle: 1]))
+    string.append(NSAttributedString(" Honeydew", [.font: font,
+                                                   .underlineStyle: NSUnderlineStyle.double.rawValue,
+                                                   .strikethroughStyle: 1]))
+    string.append(NSAttributedString("\nJackfruit", [.font: font, .shadow: shadow,
+                                                     .underlineStyle: 1]))
+    let shapedString = STUShapedString(string)
+    let size = CGSize(width: 200, height: 1000)
+    let frame = STUTextFrame(shapedString, size: size, displayScale: displayScale, options: nil)
+
+    let imageSize = CGSize(width: ceil(frame.layoutBounds.maxX + 4),
+                           height: ceil(frame.layoutBounds.maxY + 4))
+    // A line is only recorded when it is drawn for the second time, so the first image of a frame
+    // is always drawn directly.
+    func directlyDrawnImage(_ options: STUTextFrame.DrawingOptions?) -> UIImage {
+      return image(STUTextFrame(shapedString, size: size, displayScale: displayScale,
+                                options: nil),
+                   size: imageSize, displayScale: displayScale, options: options)
+    }
+
+    let firstImage = image(frame, size: imageSize, displayScale: displayScale)
+    // Records the lines.
+    self.checkSnapshotImage(image(frame, size: imageSize, displayScale: displayScale),
+                            referenceImage: firstImage)
+    // Replays the lines.
+    self.checkSnapshotImage(image(frame, size: imageSize, displayScale: displayScale),
+                            referenceImage: firstImage)
+
+    let options = STUTextFrame.DrawingOptions()
+    options.overrideTextColor = UIColor.red
+    options.overrideLinkColor = UIColor.green
+    // The lines were recorded without override colors, so they are drawn directly here.
+    self.checkSnapshotImage(image(frame, size: imageSize, displayScale: displayScale,
+                                  options: options),
+                            referenceImage: directlyDrawnImage(options))
+
+    // Lines without decoration lines are replayed with the text color of a highlight style that
+    // only changes the text color.
+    let highlightOptions = STUTextFrame.DrawingOptions()
+    highlightOptions.highlightStyle = STUTextHighlightStyle { b in b.textColor = UIColor.orange }
+    highlightOptions.setHighlightRange(NSRange(0..<string.length),
+                                       type: .rangeInOriginalString)
+    self.checkSnapshotImage(image(frame, size: imageSize, displayScale: displayScale,
+                                  options: highlightOptions),
+                            referenceImage: directlyDrawnImage(highlightOptions))
+
+    // Lines of a frame with compact line storage are recorded too.
+    let compactFrame = STUTextFrame(shapedString, size: size, displayScale: displayScale,
+                                    options: STUTextFrameOptions { (b) in
+                                               b.usesCompactLineStorage = true
+                                             })
+    for line in compactFrame.lines {
+      XCTAssertNil(line._ctLine)
+    }
+    for _ in 0..<2 {
+      _ = image(compactFrame, size: imageSize, displayScale: displayScale, options: options)
+    }
+    self.checkSnapshotImage(image(compactFrame, size: imageSize, displayScale: displayScale,
+                                  options: options),
+                            referenceImage: directlyDrawnImage(options))
+  }
 }
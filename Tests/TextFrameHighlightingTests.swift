@@ -173,4 +173,50 @@ class TextFrameHighlightingTests: SnapshotTestCase {
                                   (f.range(forRangeInOriginalString: NSRange(5...6)), hs)),
                             suffix: "_2-6-drawn_5-6-red")
   }
+
+  func testLabelLayerHighlightRangeChange() {
+    let hs = STUTextHighlightStyle { b in b.setUnderlineStyle(.single, color: nil)
+                                          b.textColor = .red }
+    func labelLayer(highlightRange: NSRange) -> STULabelLayer {
+      let layer = STULabelLayer()
+      let selector = Selector(("stu_setAlwaysUsesContentSublayer:"))
+      let method = layer.method(for: selector)
+      let f = unsafeBitCast(method, to: (@convention(c) (NSObject, Selector, Bool) -> Void).self)
+      f(layer, selector, true)
+      layer.contentsScale = displayScale
+      layer.releasesTextFrameAfterRendering = false
+      layer.font = font
+      layer.text = "Lorem ipsum dolor sit amet,\nconsectetur adipiscing elit,\nsed do eiusmod tempor"
+      layer.highlightStyle = hs
+      layer.setHighlightRange(highlightRange, type: .rangeInOriginalString)
+      layer.isHighlighted = true
+      layer.bounds = CGRect(origin: .zero,
+                            size: layer.sizeThatFits(CGSize(width: 1000, height: 1000)))
+      return layer
+    }
+    func contentImage(_ layer: STULabelLayer) -> UIImage {
+      layer.displayIfNeeded()
+      return UIImage(cgImage: layer.sublayers![0].contents as! CGImage)
+    }
+
+    // The counter only exists in debug builds of the library.
+    func imageHighlightUpdateCount(_ layer: STULabelLayer) -> UInt? {
+      let selector = Selector(("stu_imageHighlightUpdateCount"))
+      guard layer.responds(to: selector) else { return nil }
+      let method = layer.method(for: selector)
+      let f = unsafeBitCast(method, to: (@convention(c) (NSObject, Selector) -> UInt).self)
+      return f(layer, selector)
+    }
+
+    let layer = labelLayer(highlightRange: NSRange(0..<5))
+    _ = contentImage(layer)
+    XCTAssert(imageHighlightUpdateCount(layer) ?? 0 == 0)
+    // Only the first and the last line need to be redrawn.
+    layer.setHighlightRange(NSRange(62..<65), type: .rangeInOriginalString)
+    let image = contentImage(layer)
+    XCTAssert(imageHighlightUpdateCount(layer) ?? 1 == 1)
+    self.checkSnapshotImage(image,
+                            referenceImage: contentImage(labelLayer(highlightRange:
+                                                                      NSRange(62..<65))))
+  }
 }
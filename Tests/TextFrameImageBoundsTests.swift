@@ -138,5 +138,31 @@ class TextFrameImageBoundsTests: SnapshotTestCase {
     self.checkSnapshotImage(self.image(tf, nil, options), suffix: "_LL_differently_stroked")
   }
 
+  func testCachedImageBoundsOfFrameWithManyLines() {
+    let font = UIFont(name: "HelveticaNeue", size: 17)!
+    let string = NSAttributedString(Array(repeating: "Lorem ipsum dolor", count: 200)
+                                      .joined(separator: "\n"),
+                                    [.font: font, .underlineStyle: NSUnderlineStyle.single.rawValue])
+    let shapedString = STUShapedString(string, defaultBaseWritingDirection: .leftToRight)
+    let size = CGSize(width: 1000, height: 10000)
+    let frame = STUTextFrame(shapedString, size: size, displayScale: 2)
+    XCTAssertEqual(frame.lines.count, 200)
+
+    let bounds = frame.imageBounds(frameOrigin: .zero, displayScale: 2)
+    XCTAssertEqual(frame.imageBounds(frameOrigin: .zero, displayScale: 2), bounds)
+    XCTAssertEqual(frame.imageBounds(frameOrigin: CGPoint(x: 1, y: 2), displayScale: 2),
+                   bounds.offsetBy(dx: 1, dy: 2))
+
+    let options = STUTextFrame.DrawingOptions()
+    options.highlightRange = STUTextRange(range: NSRange(18..<35), type: .rangeInOriginalString)
+    options.highlightStyle = STUTextHighlightStyle { b in
+                               b.setUnderlineStyle(.thick, color: UIColor.blue)
+                             }
+    let uncachedFrame = STUTextFrame(shapedString, size: size, displayScale: 2)
+    XCTAssertEqual(frame.imageBounds(frameOrigin: .zero, displayScale: 2, options: options),
+                   uncachedFrame.imageBounds(frameOrigin: .zero, displayScale: 2,
+                                             options: options))
+  }
+
   // TODO
 }
@@ -353,4 +353,198 @@ class TextFrameLayoutInfoTests : XCTestCase {
     })()
   }
 
+  func testBatchLayout() {
+    let font = UIFont(name: "HelveticaNeue", size: 16)!
+    let options = STUTextFrameOptions { (b) in b.maximumNumberOfLines = 2
+                                              b.minimumTextScaleFactor = 0.5 }
+    let n = 50
+    let strings = (0..<n).map { i -> STUShapedString in
+                    let text = String(repeating: "Test \(i) ", count: i%7 + 1)
+                    return STUShapedString(NSAttributedString(text, [.font: font]))
+                  }
+    let sizes = (0..<n).map { i in CGSize(width: 50 + CGFloat(i%5)*20, height: 100) }
+    let ranges = (0..<n).map { i in NSRange(0..<(i%3 == 0 ? strings[i].attributedString.length
+                                                          : 4)) }
+    for concurrently in [false, true] {
+      let frames = STUTextFrame.textFrames(strings, stringRanges: ranges, sizes: sizes,
+                                           displayScaleOrZero: 2, options: options,
+                                           concurrently: concurrently, cancellationFlag: nil)!
+      var infos = [STUTextFrame.LayoutInfo](repeating: STUTextFrame.LayoutInfo(), count: n)
+      XCTAssert(STUTextFrame.getLayoutInfos(&infos, for: strings, stringRanges: ranges,
+                                            sizes: sizes, displayScaleOrZero: 2, options: options,
+                                            concurrently: concurrently, cancellationFlag: nil))
+      XCTAssertEqual(frames.count, n)
+      for i in 0..<n {
+        let tf = STUTextFrame(strings[i], stringRange: ranges[i], size: sizes[i],
+                              displayScaleOrZero: 2, options: options, cancellationFlag: nil)!
+        let info = tf.layoutInfo(frameOrigin: .zero)
+        for other in [frames[i].layoutInfo(frameOrigin: .zero), infos[i]] {
+          XCTAssertEqual(info.lineCount, other.lineCount)
+          XCTAssertEqual(info.flags, other.flags)
+          XCTAssertEqual(info.textScaleFactor, other.textScaleFactor)
+          XCTAssertEqual(info.size, other.size)
+          XCTAssertEqual(info.minX, other.minX)
+          XCTAssertEqual(info.maxX, other.maxX)
+          XCTAssertEqual(info.firstBaseline, other.firstBaseline)
+          XCTAssertEqual(info.lastBaseline, other.lastBaseline)
+          XCTAssertEqual(info.lastLineHeightBelowBaseline, other.lastLineHeightBelowBaseline)
+        }
+        XCTAssertEqual(tf.rangeInOriginalString, frames[i].rangeInOriginalString)
+      }
+    }
+  }
+
+  func testTextFrameSequence() {
+    let font = UIFont(name: "HelveticaNeue", size: 16)!
+    let text = (0..<200).map { i in String(repeating: "Paragraph \(i) ", count: i%11 + 1) }
+                        .joined(separator: "\n")
+    let shapedString = STUShapedString(NSAttributedString(text, [.font: font]))
+    let length = shapedString.attributedString.length
+    let sequence = STUTextFrameSequence(shapedString, width: 200, displayScaleOrZero: 2,
+                                        options: nil)
+    XCTAssertEqual(sequence.frameCount, 1)
+    XCTAssertFalse(sequence.isComplete)
+    XCTAssert(sequence.laidOutStringLength < length)
+    XCTAssert(sequence.estimatedHeight > sequence.laidOutHeight)
+
+    XCTAssert(sequence.layout(upToY: 1000, cancellationFlag: nil))
+    XCTAssert(sequence.laidOutHeight > 1000 || sequence.isComplete)
+    XCTAssert(sequence.layout(upToY: .infinity, cancellationFlag: nil))
+    XCTAssert(sequence.isComplete)
+    XCTAssertEqual(sequence.laidOutStringLength, UInt(length))
+    XCTAssertEqual(sequence.estimatedHeight, sequence.laidOutHeight)
+
+    var stringIndex = 0
+    var lineCount = 0
+    for i in 0..<sequence.frameCount {
+      let frame = sequence.frame(at: i)
+      XCTAssertEqual(frame.rangeInOriginalString.location, stringIndex)
+      stringIndex = NSMaxRange(frame.rangeInOriginalString)
+      let origin = sequence.originOfFrame(at: i)
+      let info = frame.layoutInfo(frameOrigin: origin)
+      XCTAssert(info.firstBaseline > Double(origin.y))
+      if i + 1 < sequence.frameCount {
+        XCTAssert(info.lastBaseline < Double(sequence.originOfFrame(at: i + 1).y))
+      }
+      XCTAssertEqual(sequence.rangeOfFramesIntersecting(minY: CGFloat(info.firstBaseline),
+                                                        maxY: CGFloat(info.firstBaseline)),
+                     NSRange(i..<i + 1))
+      lineCount += Int(info.lineCount)
+    }
+    XCTAssertEqual(stringIndex, length)
+
+    let fullFrame = STUTextFrame(shapedString, stringRange: NSRange(0..<length),
+                                 size: CGSize(width: 200, height: 1e6), displayScaleOrZero: 2,
+                                 options: nil, cancellationFlag: nil)!
+    XCTAssertEqual(lineCount, Int(fullFrame.layoutInfo(frameOrigin: .zero).lineCount))
+
+    // The line positions are the same as in a single text frame for the whole text, including
+    // the paragraph spacing and line height adjustments across frame boundaries.
+    let style = NSMutableParagraphStyle()
+    style.paragraphSpacing = 10
+    style.paragraphSpacingBefore = 5
+    style.lineHeightMultiple = 1.3
+    style.minimumLineHeight = 23
+    let spacedString = STUShapedString(NSAttributedString(text, [.font: font,
+                                                                 .paragraphStyle: style]))
+    for displayScale: CGFloat in [0, 2, 3] {
+      let spacedSequence = STUTextFrameSequence(spacedString, width: 200,
+                                                displayScaleOrZero: displayScale, options: nil)
+      XCTAssert(spacedSequence.layout(upToY: .infinity, cancellationFlag: nil))
+      XCTAssert(spacedSequence.frameCount > 1)
+      let spacedFullFrame = STUTextFrame(spacedString, stringRange: NSRange(0..<length),
+                                         size: CGSize(width: 200, height: 1e6),
+                                         displayScaleOrZero: displayScale, options: nil,
+                                         cancellationFlag: nil)!
+      let fullLines = spacedFullFrame.lines
+      var lineIndex = 0
+      for i in 0..<spacedSequence.frameCount {
+        let origin = spacedSequence.originOfFrame(at: i)
+        for line in spacedSequence.frame(at: i).lines {
+          let fullLine = fullLines[lineIndex]
+          XCTAssertEqual(line.rangeInOriginalString, fullLine.rangeInOriginalString)
+          XCTAssertEqual(origin.y + line.baselineOrigin.y, fullLine.baselineOrigin.y,
+                         accuracy: displayScale == 0 ? 1e-6 : 0)
+          lineIndex += 1
+        }
+      }
+      XCTAssertEqual(lineIndex, fullLines.count)
+      let lastFrameIndex = spacedSequence.frameCount - 1
+      let lastInfo = spacedSequence.frame(at: lastFrameIndex)
+                                   .layoutInfo(frameOrigin: spacedSequence.originOfFrame(
+                                                              at: lastFrameIndex))
+      XCTAssertEqual(lastInfo.lastBaseline,
+                     spacedFullFrame.layoutInfo(frameOrigin: .zero).lastBaseline,
+                     accuracy: displayScale == 0 ? 1e-6 : 0)
+    }
+  }
+
+  func testTextFrameSequenceView() {
+    let font = UIFont(name: "HelveticaNeue", size: 16)!
+    let text = (0..<200).map { i in String(repeating: "Paragraph \(i) ", count: i%11 + 1) }
+                        .joined(separator: "\n")
+    let shapedString = STUShapedString(NSAttributedString(text, [.font: font]))
+    let view = STUTextFrameSequenceView(frame: CGRect(x: 0, y: 0, width: 200, height: 100))
+    view.contentScaleFactor = 2
+    view.accessTextFrameSequence { XCTAssertNil($0) }
+    XCTAssertEqual(view.intrinsicContentSize.height, 0)
+
+    view.shapedString = shapedString
+    var estimatedHeight: CGFloat = 0
+    view.accessTextFrameSequence { sequence in
+      XCTAssertEqual(sequence!.width, 200)
+      XCTAssertFalse(sequence!.isComplete)
+      estimatedHeight = sequence!.estimatedHeight
+    }
+    XCTAssertEqual(view.intrinsicContentSize.height, estimatedHeight)
+
+    view.accessTextFrameSequence { sequence in
+      XCTAssert(sequence!.layout(upToY: .infinity, cancellationFlag: nil))
+      estimatedHeight = sequence!.estimatedHeight
+    }
+    XCTAssertEqual(view.intrinsicContentSize.height, estimatedHeight)
+
+    // A new width requires a new sequence.
+    view.bounds.size.width = 300
+    view.accessTextFrameSequence { sequence in
+      XCTAssertEqual(sequence!.width, 300)
+      XCTAssertEqual(sequence!.frameCount, 1)
+    }
+  }
+
+  func testIndexConversionInFramesWithManyLines() {
+    let font = UIFont(name: "HelveticaNeue", size: 18)!
+    var string = ""
+    for i in 0..<400 {
+      string += String(repeating: "x", count: (i*7)%23) + (i%3 == 0 ? " yy\n" : "\n")
+    }
+    let shapedString = STUShapedString(NSAttributedString(string, [.font: font]))
+    let frame = STUTextFrame(shapedString, size: CGSize(width: 1000, height: 1e6),
+                             displayScale: 2, options: nil)
+    let truncatedFrame = STUTextFrame(shapedString, size: CGSize(width: 1000, height: 1e6),
+                                      displayScale: 2,
+                                      options: STUTextFrameOptions { (b) in
+                                                 b.maximumNumberOfLines = 300
+                                                 b.lastLineTruncationMode = .middle
+                                               })
+    XCTAssertGreaterThanOrEqual(frame.lines.count, 400)
+    XCTAssertEqual(truncatedFrame.lines.count, 300)
+    for line in frame.lines {
+      let range = line.rangeInOriginalString
+      for i in range.location..<NSMaxRange(range) {
+        XCTAssertEqual(frame.index(forUTF16IndexInOriginalString: i, indexInTruncationToken: 0)
+                            .lineIndex,
+                       line.lineIndex)
+      }
+    }
+    for f in [frame, truncatedFrame] {
+      for line in f.lines {
+        let range = line.rangeInTruncatedString
+        for i in range.location..<NSMaxRange(range) where i > 0 {
+          XCTAssertEqual(f.index(forUTF16IndexInTruncatedString: i).lineIndex, line.lineIndex)
+        }
+      }
+    }
+  }
+
 }
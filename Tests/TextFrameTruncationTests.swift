@@ -87,6 +87,64 @@ class TruncationTests: SnapshotTestCase {
     XCTAssertEqual(lines[0].rangeInTruncatedString, NSRange(0..<5))
   }
 
+  func testLongSingleLineTruncation() {
+    // The truncation point lies far inside a long run, which exercises the binary search over the
+    // advance sums of the run.
+    let url = "https://www.example.com/documentation/text-layout/truncation?language=swift&platform=ios"
+    let prefix = String(url.prefix(40))
+    let suffix = String(url.suffix(30))
+    let tokenWidth = typographicWidth("…")
+
+    let fe = textFrame(url, width: typographicWidth(prefix) + tokenWidth + 0.001, maxLineCount: 1)
+    XCTAssertEqual(fe.truncatedAttributedString.string, prefix + "…")
+
+    let fs = textFrame(url, width: tokenWidth + typographicWidth(suffix) + 0.001, maxLineCount: 1,
+                       lastLineTruncationMode: .start)
+    XCTAssertEqual(fs.truncatedAttributedString.string, "…" + suffix)
+
+    let width: CGFloat = 200
+    let fm = textFrame(url, width: width, maxLineCount: 1, lastLineTruncationMode: .middle)
+    let parts = fm.truncatedAttributedString.string.components(separatedBy: "…")
+    XCTAssertEqual(parts.count, 2)
+    XCTAssert(url.hasPrefix(parts[0]))
+    XCTAssert(url.hasSuffix(parts[1]))
+    XCTAssertLessThanOrEqual(fm.layoutBounds.size.width, width)
+  }
+
+  func testTruncatedAttributedStringAttributes() {
+    let string = NSMutableAttributedString()
+    string.append(NSAttributedString("Test", [.font: font, .foregroundColor: UIColor.red]))
+    string.append(NSAttributedString("ing", [.font: font, .foregroundColor: UIColor.blue]))
+    let token = NSAttributedString("…", [.font: font, .foregroundColor: UIColor.green])
+    let width = typographicWidth("Te") + typographicWidth("…") + typographicWidth("ng")
+    let f = textFrame(string, width: width + 0.001, maxLineCount: 1,
+                      lastLineTruncationMode: .middle, truncationToken: token)
+    let expected = NSMutableAttributedString()
+    expected.append(NSAttributedString("Te", [.font: font, .foregroundColor: UIColor.red]))
+    expected.append(token)
+    expected.append(NSAttributedString("ng", [.font: font, .foregroundColor: UIColor.blue]))
+
+    let ts = f.truncatedAttributedString
+    XCTAssertEqual(ts, expected)
+    XCTAssertEqual(ts.string, "Te…ng")
+    XCTAssertEqual(ts.copy() as! NSAttributedString, expected)
+    // Archives must not reference the private truncated string classes.
+    XCTAssert(ts.classForCoder == NSAttributedString.self)
+    let archive = NSKeyedArchiver.archivedData(withRootObject: ts)
+    XCTAssertEqual(NSKeyedUnarchiver.unarchiveObject(with: archive) as? NSAttributedString,
+                   expected)
+    var range = NSRange()
+    XCTAssertEqual(ts.attribute(.foregroundColor, at: 1, effectiveRange: &range) as? UIColor,
+                   UIColor.red)
+    XCTAssertEqual(range, NSRange(0..<2))
+    XCTAssertEqual(ts.attribute(.foregroundColor, at: 2, effectiveRange: &range) as? UIColor,
+                   UIColor.green)
+    XCTAssertEqual(range, NSRange(2..<3))
+    XCTAssertEqual(ts.attribute(.foregroundColor, at: 3, effectiveRange: &range) as? UIColor,
+                   UIColor.blue)
+    XCTAssertEqual(range, NSRange(3..<5))
+  }
+
   func testSingleCharacterTokenFontSelection() {
     let font = UIFont(name: "HoeflerText-Regular", size: 17)!
     let width = typographicWidth("XX", font: font)